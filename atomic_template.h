@@ -0,0 +1,215 @@
+/*
+ *  Atomic operations on guest memory
+ *
+ * Generate the helpers used by TCG for the tcg_gen_atomic_* operations.
+ *
+ * Included from cputlb.c and user-exec.c, with SHIFT set to the log2 of
+ * the access size and ATOMIC_BE to the guest byte order of the access.
+ * The includer provides:
+ *   atomic_mmu_lookup  the host address of the access, or NULL when the
+ *                      host cannot do it atomically;
+ *   atomic_slow_ld/st  the accesses done in that case instead.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define DATA_SIZE (1 << SHIFT)
+
+#if DATA_SIZE == 8
+#define SUFFIX q
+#define DATA_TYPE  uint64_t
+#define SDATA_TYPE  int64_t
+#define ABI_TYPE  uint64_t
+#define BSWAP bswap64
+#elif DATA_SIZE == 4
+#define SUFFIX l
+#define DATA_TYPE  uint32_t
+#define SDATA_TYPE  int32_t
+#define ABI_TYPE  uint32_t
+#define BSWAP bswap32
+#elif DATA_SIZE == 2
+#define SUFFIX w
+#define DATA_TYPE  uint16_t
+#define SDATA_TYPE  int16_t
+#define ABI_TYPE  uint32_t
+#define BSWAP bswap16
+#elif DATA_SIZE == 1
+#define SUFFIX b
+#define DATA_TYPE  uint8_t
+#define SDATA_TYPE  int8_t
+#define ABI_TYPE  uint32_t
+#define BSWAP
+#else
+#error unsupported data size
+#endif
+
+/* the byte accesses have a single version, the others one per order */
+#if DATA_SIZE == 1
+#define END
+#elif ATOMIC_BE
+#define END _be
+#else
+#define END _le
+#endif
+
+/* convert between the guest value and the host memory */
+#if DATA_SIZE == 1 || ATOMIC_BE == defined(HOST_WORDS_BIGENDIAN)
+#define MEMV(x) (x)
+#else
+#define MEMV(x) BSWAP(x)
+#endif
+
+#define ATOMIC_NAME(X) \
+    HELPER(glue(glue(glue(atomic_, X), SUFFIX), END))
+
+/* The accesses to MMIO, pages with watchpoints, or unaligned addresses go
+   through the slow path, and so do all the 64-bit ones of the hosts without
+   64-bit atomics.  The slow path is not atomic by itself: in system mode,
+   atomic_mmu_lookup only returns NULL once the other vCPUs are stopped.  */
+#if DATA_SIZE == 8 && !defined(CONFIG_ATOMIC64)
+#define ATOMIC_MMU_LOOKUP \
+    ((DATA_TYPE *)atomic_mmu_lookup(env, addr, oi, DATA_SIZE, retaddr), \
+     (DATA_TYPE *)NULL)
+#define HOST_ATOMIC(OP, ...) (abort(), (DATA_TYPE)0)
+#else
+#define ATOMIC_MMU_LOOKUP \
+    ((DATA_TYPE *)atomic_mmu_lookup(env, addr, oi, DATA_SIZE, retaddr))
+#define HOST_ATOMIC(OP, ...) glue(atomic_, OP)(__VA_ARGS__)
+#endif
+#define ATOMIC_SLOW_LD \
+    ((DATA_TYPE)atomic_slow_ld(env, addr, oi, DATA_SIZE, ATOMIC_BE, retaddr))
+#define ATOMIC_SLOW_ST(val) \
+    atomic_slow_st(env, addr, val, oi, DATA_SIZE, ATOMIC_BE, retaddr)
+
+ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
+                              ABI_TYPE cmpv, ABI_TYPE newv, uint32_t oi)
+{
+    uintptr_t retaddr = GETRA();
+    DATA_TYPE *haddr = ATOMIC_MMU_LOOKUP;
+    DATA_TYPE old;
+
+    if (likely(haddr)) {
+        old = HOST_ATOMIC(cmpxchg__nocheck, haddr, MEMV((DATA_TYPE)cmpv),
+                          MEMV((DATA_TYPE)newv));
+        return MEMV(old);
+    }
+    old = ATOMIC_SLOW_LD;
+    if (old == (DATA_TYPE)cmpv) {
+        ATOMIC_SLOW_ST(newv);
+    }
+    return old;
+}
+
+ABI_TYPE ATOMIC_NAME(xchg)(CPUArchState *env, target_ulong addr,
+                           ABI_TYPE val, uint32_t oi)
+{
+    uintptr_t retaddr = GETRA();
+    DATA_TYPE *haddr = ATOMIC_MMU_LOOKUP;
+    DATA_TYPE old;
+
+    if (likely(haddr)) {
+        old = HOST_ATOMIC(xchg__nocheck, haddr, MEMV((DATA_TYPE)val));
+        return MEMV(old);
+    }
+    old = ATOMIC_SLOW_LD;
+    ATOMIC_SLOW_ST(val);
+    return old;
+}
+
+/* The bitwise operations do not depend on the byte order */
+#define GEN_ATOMIC_BITWISE(NAME, OP)                                    \
+ABI_TYPE ATOMIC_NAME(NAME)(CPUArchState *env, target_ulong addr,        \
+                           ABI_TYPE val, uint32_t oi)                   \
+{                                                                       \
+    uintptr_t retaddr = GETRA();                                        \
+    DATA_TYPE *haddr = ATOMIC_MMU_LOOKUP;                               \
+    DATA_TYPE old;                                                      \
+                                                                        \
+    if (likely(haddr)) {                                                \
+        old = HOST_ATOMIC(NAME, haddr, MEMV((DATA_TYPE)val));           \
+        return MEMV(old);                                               \
+    }                                                                   \
+    old = ATOMIC_SLOW_LD;                                               \
+    ATOMIC_SLOW_ST(old OP (DATA_TYPE)val);                              \
+    return old;                                                         \
+}
+
+GEN_ATOMIC_BITWISE(fetch_and, &)
+GEN_ATOMIC_BITWISE(fetch_or, |)
+GEN_ATOMIC_BITWISE(fetch_xor, ^)
+
+#undef GEN_ATOMIC_BITWISE
+
+/* The arithmetic ones retry a compare-and-swap of the computed value */
+#define GEN_ATOMIC_ARITH(NAME, OP)                                      \
+ABI_TYPE ATOMIC_NAME(NAME)(CPUArchState *env, target_ulong addr,        \
+                           ABI_TYPE val, uint32_t oi)                   \
+{                                                                       \
+    uintptr_t retaddr = GETRA();                                        \
+    DATA_TYPE *haddr = ATOMIC_MMU_LOOKUP;                               \
+    DATA_TYPE old, cmp, mem;                                            \
+                                                                        \
+    if (likely(haddr)) {                                                \
+        mem = *(volatile DATA_TYPE *)haddr;                             \
+        do {                                                            \
+            cmp = mem;                                                  \
+            old = MEMV(cmp);                                            \
+            mem = HOST_ATOMIC(cmpxchg__nocheck, haddr, cmp,             \
+                              MEMV((DATA_TYPE)OP(old, val)));           \
+        } while (mem != cmp);                                           \
+        return old;                                                     \
+    }                                                                   \
+    old = ATOMIC_SLOW_LD;                                               \
+    ATOMIC_SLOW_ST(OP(old, val));                                       \
+    return old;                                                         \
+}
+
+#define ATOMIC_ADD(a, b)  ((DATA_TYPE)((a) + (b)))
+#define ATOMIC_SMIN(a, b) \
+    ((SDATA_TYPE)(a) < (SDATA_TYPE)(b) ? (DATA_TYPE)(a) : (DATA_TYPE)(b))
+#define ATOMIC_SMAX(a, b) \
+    ((SDATA_TYPE)(a) > (SDATA_TYPE)(b) ? (DATA_TYPE)(a) : (DATA_TYPE)(b))
+#define ATOMIC_UMIN(a, b) \
+    ((DATA_TYPE)(a) < (DATA_TYPE)(b) ? (DATA_TYPE)(a) : (DATA_TYPE)(b))
+#define ATOMIC_UMAX(a, b) \
+    ((DATA_TYPE)(a) > (DATA_TYPE)(b) ? (DATA_TYPE)(a) : (DATA_TYPE)(b))
+
+GEN_ATOMIC_ARITH(fetch_add, ATOMIC_ADD)
+GEN_ATOMIC_ARITH(fetch_smin, ATOMIC_SMIN)
+GEN_ATOMIC_ARITH(fetch_smax, ATOMIC_SMAX)
+GEN_ATOMIC_ARITH(fetch_umin, ATOMIC_UMIN)
+GEN_ATOMIC_ARITH(fetch_umax, ATOMIC_UMAX)
+
+#undef GEN_ATOMIC_ARITH
+#undef ATOMIC_ADD
+#undef ATOMIC_SMIN
+#undef ATOMIC_SMAX
+#undef ATOMIC_UMIN
+#undef ATOMIC_UMAX
+
+#undef ATOMIC_MMU_LOOKUP
+#undef HOST_ATOMIC
+#undef ATOMIC_SLOW_LD
+#undef ATOMIC_SLOW_ST
+#undef ATOMIC_NAME
+#undef MEMV
+#undef END
+#undef ATOMIC_BE
+#undef SHIFT
+#undef DATA_SIZE
+#undef SUFFIX
+#undef DATA_TYPE
+#undef SDATA_TYPE
+#undef ABI_TYPE
+#undef BSWAP
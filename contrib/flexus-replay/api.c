@@ -0,0 +1,704 @@
+/*
+ * The QEMU side of the Flexus API, answered from the recorded trace
+ *
+ * A trace only holds memory accesses: the registers, the memory contents
+ * and the timing interface are not available and return neutral values.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "flexus-replay.h"
+
+ReplayState replay;
+
+/* Table 0 holds the generic callbacks, table i + 1 those of cpu i */
+typedef QEMU_callback_container_t *ReplayCallbackTable[QEMU_callback_event_count];
+
+static ReplayCallbackTable *replay_callbacks;
+static uint64_t replay_next_callback_id;
+
+void replay_state_init(int num_cpus, int sockets, int cores, int threads)
+{
+    int i;
+
+    replay.num_cpus = num_cpus;
+    replay.num_sockets = sockets;
+    replay.num_cores = cores;
+    replay.num_threads = threads;
+    replay.cpus = g_new0(ReplayCPU, num_cpus);
+    replay.cpu_objs = g_new0(conf_object_t, num_cpus);
+    replay.cpu_enabled = g_new(bool, num_cpus);
+    for (i = 0; i < num_cpus; i++) {
+        replay.cpus[i].index = i;
+        replay.cpus[i].space.name = (char *)"cpu-memory";
+        replay.cpus[i].space.object = &replay.cpus[i];
+        replay.cpus[i].space.type = QEMU_AddressSpace;
+        replay.cpu_objs[i].name = g_strdup_printf("cpu%d", i);
+        replay.cpu_objs[i].object = &replay.cpus[i];
+        replay.cpu_objs[i].type = QEMU_CPUState;
+        replay.cpu_enabled[i] = true;
+        memset(replay.cpus[i].coalesce_lines, 0xff,
+               sizeof(replay.cpus[i].coalesce_lines));
+    }
+    replay.dma_spaces[0].name = (char *)"device";
+    replay.dma_spaces[0].type = QEMU_AddressSpace;
+    replay.dma_spaces[1].name = (char *)"pci-device";
+    replay.dma_spaces[1].type = QEMU_AddressSpace;
+    replay.filter_kinds = QEMU_FILTER_ALL;
+    replay.simulating = true;
+
+    replay_callbacks = g_new0(ReplayCallbackTable, num_cpus + 1);
+}
+
+static ReplayCPU *replay_cpu(conf_object_t *cpu)
+{
+    return cpu->object;
+}
+
+/*
+ * Callbacks
+ */
+
+int QEMU_insert_callback(int cpu_id, QEMU_callback_event_t event, void *obj,
+                         void *fun)
+{
+    QEMU_callback_container_t *container, **tail;
+
+    if (cpu_id < QEMUFLEX_GENERIC_CALLBACK || cpu_id >= replay.num_cpus
+        || event >= QEMU_callback_event_count) {
+        return -1;
+    }
+    container = g_new0(QEMU_callback_container_t, 1);
+    container->id = replay_next_callback_id++;
+    container->obj = obj;
+    container->callback = fun;
+    /* in insertion order, as in QEMU */
+    tail = &replay_callbacks[cpu_id + 1][event];
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = container;
+    return container->id;
+}
+
+void QEMU_delete_callback(int cpu_id, QEMU_callback_event_t event,
+                          uint64_t callback_id)
+{
+    QEMU_callback_container_t *container, **prev;
+
+    if (cpu_id < QEMUFLEX_GENERIC_CALLBACK || cpu_id >= replay.num_cpus
+        || event >= QEMU_callback_event_count) {
+        return;
+    }
+    for (prev = &replay_callbacks[cpu_id + 1][event]; *prev;
+         prev = &(*prev)->next) {
+        container = *prev;
+        if (container->id == callback_id) {
+            *prev = container->next;
+            g_free(container);
+            return;
+        }
+    }
+}
+
+bool replay_has_callbacks(int cpu_id, QEMU_callback_event_t event)
+{
+    return replay_callbacks[cpu_id + 1][event] != NULL
+        || replay_callbacks[0][event] != NULL;
+}
+
+static void replay_call(const QEMU_callback_container_t *cb,
+                        QEMU_callback_event_t event,
+                        QEMU_callback_args_t *args)
+{
+    void *obj = cb->obj;
+
+    switch (event) {
+    case QEMU_config_ready:
+        /* never called with their object */
+        ((cb_func_void)cb->callback)();
+        break;
+    case QEMU_periodic_event:
+        if (obj) {
+            ((cb_func_noc_t2)cb->callback)(obj, args->noc->class_data,
+                                           args->noc->obj);
+        } else {
+            ((cb_func_noc_t)cb->callback)(args->noc->class_data,
+                                          args->noc->obj);
+        }
+        break;
+    case QEMU_cpu_mem_trans:
+    case QEMU_dma_mem_trans:
+        if (obj) {
+            ((cb_func_ncm_t2)cb->callback)(obj, args->ncm->space,
+                                           args->ncm->trans);
+        } else {
+            ((cb_func_ncm_t)cb->callback)(args->ncm->space, args->ncm->trans);
+        }
+        break;
+    case QEMU_cpu_mem_trans_batch:
+        if (obj) {
+            ((cb_func_nib_t2)cb->callback)(obj, args->nib->cpu_id,
+                                           args->nib->records,
+                                           args->nib->count);
+        } else {
+            ((cb_func_nib_t)cb->callback)(args->nib->cpu_id,
+                                          args->nib->records,
+                                          args->nib->count);
+        }
+        break;
+    default:
+        /* the other events do not happen in a replay */
+        break;
+    }
+}
+
+void replay_execute_callbacks(int cpu_id, QEMU_callback_event_t event,
+                              QEMU_callback_args_t *event_data)
+{
+    const QEMU_callback_container_t *cb;
+
+    if (cpu_id != QEMUFLEX_GENERIC_CALLBACK) {
+        for (cb = replay_callbacks[cpu_id + 1][event]; cb; cb = cb->next) {
+            replay_call(cb, event, event_data);
+        }
+    }
+    for (cb = replay_callbacks[0][event]; cb; cb = cb->next) {
+        replay_call(cb, event, event_data);
+    }
+}
+
+/*
+ * Batched trace
+ */
+
+void QEMU_trace_set_batch_size(int records)
+{
+    int i;
+
+    if (records < 0) {
+        records = 0;
+    }
+    for (i = 0; i < replay.num_cpus; i++) {
+        replay_batch_flush(i);
+        g_free(replay.cpus[i].batch);
+        replay.cpus[i].batch = records > 0
+            ? g_new(QEMU_mem_trace_record_t, records) : NULL;
+    }
+    replay.batch_size = records;
+}
+
+void replay_batch_flush(int cpu_id)
+{
+    ReplayCPU *cpu = &replay.cpus[cpu_id];
+    QEMU_callback_args_t event_data;
+    QEMU_nib nib;
+
+    if (cpu->batch_count == 0) {
+        return;
+    }
+    nib.cpu_id = cpu_id;
+    nib.records = cpu->batch;
+    nib.count = cpu->batch_count;
+    event_data.nib = &nib;
+    /* a callback flushing again must not see the same records */
+    cpu->batch_count = 0;
+    replay_execute_callbacks(cpu_id, QEMU_cpu_mem_trans_batch, &event_data);
+}
+
+void QEMU_trace_flush(int cpu_id)
+{
+    int i;
+
+    if (cpu_id >= 0) {
+        if (cpu_id < replay.num_cpus) {
+            replay_batch_flush(cpu_id);
+        }
+        return;
+    }
+    for (i = 0; i < replay.num_cpus; i++) {
+        replay_batch_flush(i);
+    }
+}
+
+void QEMU_trace_set_parallel(int enable)
+{
+    /* the batches are delivered in order on the replay thread */
+}
+
+/*
+ * Instrumentation filter
+ */
+
+/* the accesses dropped to a way of the coalescing leave it, as count
+ * record to deliver before the access rec */
+static void replay_filter_flush(ReplayCPU *cpu, int is_store, int way,
+                                const QEMU_trace_file_record_t *rec,
+                                QEMU_trace_file_record_t *count)
+{
+    *count = *rec;
+    count->logical_address = cpu->coalesce_vlines[is_store][way];
+    count->target_address = count->logical_address;
+    count->physical_address = cpu->coalesce_lines[is_store][way];
+    count->size = 0;
+    count->repeat = cpu->coalesce_folded[is_store][way];
+    count->flags = rec->flags & QEMU_TRACE_USER;
+    cpu->coalesce_vlines[is_store][way] =
+        rec->logical_address & replay.line_mask;
+    cpu->coalesce_folded[is_store][way] = 0;
+}
+
+/* as QEMU_filter_coalesce, for the data accesses of the cpu. The count
+ * records of the trace are passed on as they are. */
+static bool replay_filter_coalesce(ReplayCPU *cpu,
+                                   const QEMU_trace_file_record_t *rec,
+                                   QEMU_trace_file_record_t *count)
+{
+    uint64_t line = rec->physical_address & replay.line_mask;
+    int is_store = rec->type == QEMU_Trans_Store;
+    int i;
+
+    if (replay.line_mask == 0 || (rec->flags & QEMU_TRACE_IO)
+        || (rec->type != QEMU_Trans_Load && rec->type != QEMU_Trans_Store)
+        || rec->size == 0
+        || ((rec->physical_address + rec->size - 1) & replay.line_mask)
+           != line) {
+        return false;
+    }
+    for (i = 0; i < REPLAY_COALESCE_WAYS; i++) {
+        if (cpu->coalesce_lines[is_store][i] != line) {
+            continue;
+        }
+        if (replay.window != 0
+            && cpu->coalesce_folded[is_store][i] >= replay.window) {
+            replay_filter_flush(cpu, is_store, i, rec, count);
+            return false;
+        }
+        cpu->coalesce_folded[is_store][i]++;
+        cpu->coalesced++;
+        return true;
+    }
+    i = cpu->coalesce_next[is_store];
+    replay_filter_flush(cpu, is_store, i, rec, count);
+    cpu->coalesce_lines[is_store][i] = line;
+    cpu->coalesce_next[is_store] = (i + 1) % REPLAY_COALESCE_WAYS;
+    return false;
+}
+
+static void replay_filter_coalesce_reset(void)
+{
+    int i;
+
+    for (i = 0; i < replay.num_cpus; i++) {
+        memset(replay.cpus[i].coalesce_lines, 0xff,
+               sizeof(replay.cpus[i].coalesce_lines));
+        memset(replay.cpus[i].coalesce_folded, 0,
+               sizeof(replay.cpus[i].coalesce_folded));
+        replay.cpus[i].coalesce_next[0] = 0;
+        replay.cpus[i].coalesce_next[1] = 0;
+    }
+}
+
+bool replay_filter_keep(int cpu_id, const QEMU_trace_file_record_t *rec,
+                        QEMU_trace_file_record_t *count)
+{
+    int space, i;
+    bool in_range;
+
+    count->repeat = 0;
+
+    if (!replay.cpu_enabled[cpu_id]) {
+        return false;
+    }
+    if (!(replay.filter_kinds & ((rec->flags & QEMU_TRACE_USER)
+                                 ? QEMU_FILTER_USER : QEMU_FILTER_KERNEL))
+        || !(replay.filter_kinds & ((rec->flags & QEMU_TRACE_IO)
+                                    ? QEMU_FILTER_IO : QEMU_FILTER_RAM))) {
+        return false;
+    }
+    for (space = QEMU_FILTER_VIRTUAL; space <= QEMU_FILTER_PHYSICAL; space++) {
+        uint64_t address = space == QEMU_FILTER_VIRTUAL
+                           ? rec->logical_address : rec->physical_address;
+
+        if (replay.num_ranges[space] == 0) {
+            continue;
+        }
+        in_range = false;
+        for (i = 0; i < replay.num_ranges[space] && !in_range; i++) {
+            in_range = address >= replay.ranges[space][i].start
+                       && address < replay.ranges[space][i].end;
+        }
+        if (!in_range) {
+            return false;
+        }
+    }
+    return !replay_filter_coalesce(&replay.cpus[cpu_id], rec, count);
+}
+
+void QEMU_filter_set_cpu(int cpu_id, int enable)
+{
+    if (cpu_id >= 0 && cpu_id < replay.num_cpus) {
+        replay.cpu_enabled[cpu_id] = enable != 0;
+    }
+    replay_filter_coalesce_reset();
+}
+
+void QEMU_filter_set_kinds(int kinds)
+{
+    replay.filter_kinds = kinds & QEMU_FILTER_ALL;
+    replay_filter_coalesce_reset();
+}
+
+int QEMU_filter_add_range(int space, uint64_t start, uint64_t end)
+{
+    if (space != QEMU_FILTER_VIRTUAL && space != QEMU_FILTER_PHYSICAL) {
+        return -1;
+    }
+    if (replay.num_ranges[space] == REPLAY_FILTER_RANGES) {
+        return -1;
+    }
+    replay.ranges[space][replay.num_ranges[space]].start = start;
+    replay.ranges[space][replay.num_ranges[space]].end = end;
+    replay.num_ranges[space]++;
+    return 0;
+}
+
+void QEMU_filter_clear_ranges(void)
+{
+    replay.num_ranges[QEMU_FILTER_VIRTUAL] = 0;
+    replay.num_ranges[QEMU_FILTER_PHYSICAL] = 0;
+}
+
+int QEMU_filter_set_coalescing(int line_size, int window)
+{
+    if (line_size < 0 || (line_size & (line_size - 1)) != 0 || window < 0) {
+        return -1;
+    }
+    replay.line_mask = line_size ? ~(uint64_t)(line_size - 1) : 0;
+    replay.window = window;
+    replay_filter_coalesce_reset();
+    return 0;
+}
+
+uint64_t QEMU_filter_get_coalesced(int cpu_id)
+{
+    uint64_t total = 0;
+    int i;
+
+    if (cpu_id >= 0) {
+        return cpu_id < replay.num_cpus ? replay.cpus[cpu_id].coalesced : 0;
+    }
+    for (i = 0; i < replay.num_cpus; i++) {
+        total += replay.cpus[i].coalesced;
+    }
+    return total;
+}
+
+int QEMU_sampling_configure(uint64_t period, uint64_t warm, uint64_t measure,
+                            int cpu_id)
+{
+    /* the trace has already been sampled when it was recorded */
+    return period == 0 ? 0 : -1;
+}
+
+/*
+ * Simulation control
+ */
+
+int QEMU_is_in_simulation(void)
+{
+    return replay.simulating;
+}
+
+void QEMU_toggle_simulation(int enable)
+{
+    /* the replay ends when the simulator leaves the simulation */
+    if (!enable) {
+        replay.simulating = false;
+    }
+}
+
+void QEMU_break_simulation(const char *msg)
+{
+    printf("Stopping the replay because of break_simulation\n");
+    printf("With exit message: %s\n", msg);
+    replay.simulating = false;
+}
+
+void QEMU_checkpoint_request(void)
+{
+}
+
+void QEMU_cpu_set_quantum(const int *val)
+{
+}
+
+void QEMU_flush_all_caches(void)
+{
+}
+
+/*
+ * Processors
+ */
+
+int QEMU_get_num_cpus(void)
+{
+    return replay.num_cpus;
+}
+
+int QEMU_get_num_sockets(void)
+{
+    return replay.num_sockets;
+}
+
+int QEMU_get_num_cores(void)
+{
+    return replay.num_cores;
+}
+
+int QEMU_get_num_threads_per_core(void)
+{
+    return replay.num_threads;
+}
+
+int QEMU_cpu_get_socket_id(conf_object_t *cpu)
+{
+    return replay_cpu(cpu)->index / (replay.num_cores * replay.num_threads);
+}
+
+int QEMU_cpu_get_core_id(conf_object_t *cpu)
+{
+    return (replay_cpu(cpu)->index / replay.num_threads) % replay.num_cores;
+}
+
+int QEMU_cpu_get_thread_id(conf_object_t *cpu)
+{
+    return replay_cpu(cpu)->index % replay.num_threads;
+}
+
+conf_object_t *QEMU_get_cpu_by_index(int index)
+{
+    if (index < 0 || index >= replay.num_cpus) {
+        return NULL;
+    }
+    return &replay.cpu_objs[index];
+}
+
+conf_object_t *QEMU_get_all_processors(int *numCPUs)
+{
+    *numCPUs = replay.num_cpus;
+    return replay.cpu_objs;
+}
+
+void cpu_pop_indexes(int *indexes)
+{
+    int i;
+
+    for (i = 0; i < replay.num_cpus; i++) {
+        indexes[i] = i;
+    }
+}
+
+int QEMU_get_processor_number(conf_object_t *cpu)
+{
+    return replay_cpu(cpu)->index;
+}
+
+int cpu_proc_num(void *cs)
+{
+    return ((ReplayCPU *)cs)->index;
+}
+
+conf_object_t *QEMU_get_object(const char *name)
+{
+    int i;
+
+    for (i = 0; i < replay.num_cpus; i++) {
+        if (strcmp(replay.cpu_objs[i].name, name) == 0) {
+            return &replay.cpu_objs[i];
+        }
+    }
+    return NULL;
+}
+
+uint64_t QEMU_step_count(conf_object_t *cpu)
+{
+    return replay_cpu(cpu)->instructions;
+}
+
+uint64_t QEMU_get_instruction_count(int cpu_number)
+{
+    if (cpu_number < 0 || cpu_number >= replay.num_cpus) {
+        return 0;
+    }
+    return replay.cpus[cpu_number].instructions;
+}
+
+int QEMU_set_tick_frequency(conf_object_t *cpu, double tick_freq)
+{
+    return 42;
+}
+
+double QEMU_get_tick_frequency(conf_object_t *cpu)
+{
+    return 3.14;
+}
+
+/*
+ * Processor state: only the pc and the translations are in the trace
+ */
+
+uint64_t cpu_get_program_counter(void *cs)
+{
+    return ((ReplayCPU *)cs)->pc;
+}
+
+uint64_t QEMU_get_program_counter(conf_object_t *cpu)
+{
+    return replay_cpu(cpu)->pc;
+}
+
+static physical_address_t replay_translate(ReplayCPU *cpu, bool fetch,
+                                           logical_address_t va)
+{
+    uint64_t page = va & REPLAY_PAGE_MASK;
+
+    if (page == (fetch ? cpu->fetch_page : cpu->data_page)) {
+        return va + (fetch ? cpu->fetch_offset : cpu->data_offset);
+    }
+    if (page == (fetch ? cpu->data_page : cpu->fetch_page)) {
+        return va + (fetch ? cpu->data_offset : cpu->fetch_offset);
+    }
+    return (physical_address_t)-1;
+}
+
+physical_address_t mmu_logical_to_physical(void *cs, logical_address_t va)
+{
+    return replay_translate(cs, false, va);
+}
+
+physical_address_t QEMU_logical_to_physical(conf_object_t *cpu,
+                                            data_or_instr_t fetch,
+                                            logical_address_t va)
+{
+    return replay_translate(replay_cpu(cpu), fetch == QEMU_DI_Instruction, va);
+}
+
+void cpu_read_register(void *env_ptr, int reg_index, unsigned *reg_size,
+                       void *data_out)
+{
+    *reg_size = 0;
+}
+
+void QEMU_read_register(conf_object_t *cpu, int reg_index, unsigned *reg_size,
+                        void *data_out)
+{
+    *reg_size = 0;
+}
+
+uint64_t QEMU_read_register_by_type(conf_object_t *cpu, int reg_index,
+                                    int reg_type)
+{
+    return 0;
+}
+
+int QEMU_read_arch_state(conf_object_t *cpu, QEMU_arch_state_t *state)
+{
+    return -1;
+}
+
+int QEMU_read_arch_state_dirty(conf_object_t *cpu, QEMU_arch_state_t *state,
+                               uint64_t *dirty)
+{
+    return -1;
+}
+
+int QEMU_clear_exception(void)
+{
+    return 0;
+}
+
+int QEMU_get_pending_exception(void)
+{
+    return -1;
+}
+
+/*
+ * Memory: its contents are not in the trace
+ */
+
+conf_object_t *QEMU_get_phys_memory(conf_object_t *cpu)
+{
+    return &replay_cpu(cpu)->space;
+}
+
+conf_object_t *QEMU_get_phys_mem(conf_object_t *cpu)
+{
+    return &replay_cpu(cpu)->space;
+}
+
+void *cpu_get_address_space_flexus(void *cs)
+{
+    return &((ReplayCPU *)cs)->space;
+}
+
+uint64_t QEMU_read_phys_memory(conf_object_t *cpu, physical_address_t pa,
+                               int bytes)
+{
+    return 0;
+}
+
+void *QEMU_map_phys_memory(physical_address_t pa, uint64_t *len)
+{
+    return NULL;
+}
+
+conf_object_t *QEMU_get_ethernet(void)
+{
+    return NULL;
+}
+
+int QEMU_mem_op_is_data(generic_transaction_t *mop)
+{
+    return mop->type == QEMU_Trans_Store || mop->type == QEMU_Trans_Load;
+}
+
+int QEMU_mem_op_is_write(generic_transaction_t *mop)
+{
+    return mop->type == QEMU_Trans_Store;
+}
+
+int QEMU_mem_op_is_read(generic_transaction_t *mop)
+{
+    return mop->type == QEMU_Trans_Load;
+}
+
+/*
+ * Timing: a trace cannot be executed
+ */
+
+instruction_error_t QEMU_instruction_handle_interrupt(conf_object_t *cpu,
+                                                      pseudo_exceptions_t pendingInterrupt)
+{
+    return QEMU_IE_OK;
+}
+
+int QEMU_advance(void)
+{
+    return -1;
+}
+
+int QEMU_cpu_exec_proc(conf_object_t *cpu)
+{
+    return -1;
+}
+
+int QEMU_cpu_execute(conf_object_t *cpu, uint64_t count, uint64_t *executed)
+{
+    *executed = 0;
+    return -1;
+}
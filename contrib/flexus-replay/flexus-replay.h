@@ -0,0 +1,114 @@
+/*
+ * Replay of the traces recorded by -flexus-trace-record into a Flexus
+ * simulator, without a guest
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#ifndef FLEXUS_REPLAY_H
+#define FLEXUS_REPLAY_H
+
+#include "libqemuflex/flexus_proxy.h"
+#include "libqemuflex/trace_format.h"
+
+/* A periodic event is delivered every that many replayed instructions */
+#define REPLAY_PERIODIC_EVENT_DELAY 1000
+
+/* The traces do not tell the page size of the guest, translations are
+ * reused within 4 KiB pages */
+#define REPLAY_PAGE_MASK (~(uint64_t)0xfff)
+
+/* Ranges per address space of the instrumentation filter, as in QEMU */
+#define REPLAY_FILTER_RANGES 8
+
+/* Recent lines of the coalescing per cpu and type of access, as in QEMU */
+#define REPLAY_COALESCE_WAYS 4
+
+/* State of a cpu, rebuilt from its records */
+typedef struct ReplayCPU {
+    int index;
+    /* address space of the transactions of the cpu */
+    conf_object_t space;
+    uint64_t instructions;
+    uint64_t pc;
+    /* last translations of a fetch and of a data access */
+    uint64_t fetch_page;
+    uint64_t fetch_offset;
+    uint64_t data_page;
+    uint64_t data_offset;
+    /* records not handed to the batch callbacks yet */
+    QEMU_mem_trace_record_t *batch;
+    uint32_t batch_count;
+    /* recent lines of the loads [0] and stores [1] passed on by the
+     * coalescing, -1 for none, their virtual addresses and the accesses
+     * dropped since */
+    uint64_t coalesce_lines[2][REPLAY_COALESCE_WAYS];
+    uint64_t coalesce_vlines[2][REPLAY_COALESCE_WAYS];
+    uint32_t coalesce_folded[2][REPLAY_COALESCE_WAYS];
+    int coalesce_next[2];
+    uint64_t coalesced;
+} ReplayCPU;
+
+typedef struct ReplayFilterRange {
+    uint64_t start;
+    uint64_t end;
+} ReplayFilterRange;
+
+typedef struct ReplayState {
+    int num_cpus;
+    int num_sockets;
+    int num_cores;
+    int num_threads;
+    ReplayCPU *cpus;
+    /* the cpus as handed to the simulator, object points to their ReplayCPU */
+    conf_object_t *cpu_objs;
+    /* initiators of the device accesses: devices and PCI devices */
+    conf_object_t dma_spaces[2];
+
+    /* cleared when the simulator leaves simulation or breaks it */
+    bool simulating;
+    /* stop after that many instructions of all the cpus, 0 for no limit */
+    uint64_t max_instructions;
+    uint64_t instructions;
+    /* records per batch set by the simulator, 0 when not batched */
+    uint32_t batch_size;
+
+    /* instrumentation filter set by the simulator */
+    bool *cpu_enabled;
+    int filter_kinds;
+    int num_ranges[2];
+    ReplayFilterRange ranges[2][REPLAY_FILTER_RANGES];
+    /* coalescing of the data accesses, line_mask is 0 when disabled */
+    uint64_t line_mask;
+    uint32_t window;
+} ReplayState;
+
+extern ReplayState replay;
+
+/* api.c */
+void replay_state_init(int num_cpus, int sockets, int cores, int threads);
+bool replay_has_callbacks(int cpu_id, QEMU_callback_event_t event);
+/* run the callbacks of the cpu and then the generic ones, or only the
+ * generic ones for QEMUFLEX_GENERIC_CALLBACK */
+void replay_execute_callbacks(int cpu_id, QEMU_callback_event_t event,
+                              QEMU_callback_args_t *event_data);
+/* whether the filter of the simulator keeps a record of the cpu, a count
+ * record to deliver before it is left in count if its repeat is not 0 */
+bool replay_filter_keep(int cpu_id, const QEMU_trace_file_record_t *rec,
+                        QEMU_trace_file_record_t *count);
+/* hand the pending records of the cpu to the batch callbacks */
+void replay_batch_flush(int cpu_id);
+
+/* replay.c */
+typedef struct ReplayTrace ReplayTrace;
+
+ReplayTrace *replay_trace_open(const char *path);
+void replay_trace_close(ReplayTrace *trace);
+int replay_trace_num_cpus(const ReplayTrace *trace);
+/* deliver the records to the simulator, in batch order, until the end of
+ * the trace or of the simulation; returns -1 if the trace is corrupted */
+int replay_trace_run(ReplayTrace *trace, uint64_t *records);
+
+#endif /* FLEXUS_REPLAY_H */
@@ -0,0 +1,148 @@
+/*
+ * Replay of the traces recorded by -flexus-trace-record into a Flexus
+ * simulator, without a guest
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/timer.h"
+
+#include "flexus-replay.h"
+
+typedef struct FlexusReplayArgs {
+    const char *simulator;
+    const char *trace;
+    uint64_t max_instructions;
+    int sockets;
+    int cores;
+    int threads;
+} FlexusReplayArgs;
+
+/* show flexus_replay_usage and exit with given error code */
+static void
+flexus_replay_usage(const char *name, int code)
+{
+    fprintf(stderr, "%s [opts] <trace>\n", name);
+    fprintf(stderr, "  -h: show this help\n");
+    fprintf(stderr, "  -s <simulator>: path of the simulator library to "
+                    "load\n");
+    fprintf(stderr, "  -n <instructions>: stop after that many instructions "
+                    "of all the cpus\n");
+    fprintf(stderr, "  -t <sockets>:<cores>:<threads>: topology of the "
+                    "cpus,\n"
+                    "     one socket of single threaded cores by default\n");
+    exit(code);
+}
+
+/* parse the program arguments, exit on error */
+static void
+flexus_replay_parse_args(FlexusReplayArgs *args, int argc, char *argv[])
+{
+    int c;
+
+    while ((c = getopt(argc, argv, "hs:n:t:")) != -1) {
+        switch (c) {
+        case 'h':
+            flexus_replay_usage(argv[0], 0);
+            break;
+
+        case 's':
+            args->simulator = optarg;
+            break;
+
+        case 'n':
+            if (qemu_strtoull(optarg, NULL, 0, &args->max_instructions) < 0) {
+                fprintf(stderr, "cannot parse instructions\n");
+                flexus_replay_usage(argv[0], 1);
+            }
+            break;
+
+        case 't':
+            if (sscanf(optarg, "%d:%d:%d", &args->sockets, &args->cores,
+                       &args->threads) != 3
+                || args->sockets <= 0 || args->cores <= 0
+                || args->threads <= 0) {
+                fprintf(stderr, "cannot parse topology\n");
+                flexus_replay_usage(argv[0], 1);
+            }
+            break;
+
+        default:
+            flexus_replay_usage(argv[0], 1);
+            break;
+        }
+    }
+    if (optind != argc - 1 || args->simulator == NULL) {
+        flexus_replay_usage(argv[0], 1);
+    }
+    args->trace = argv[optind];
+}
+
+int
+main(int argc, char *argv[])
+{
+    FlexusReplayArgs args = { 0 };
+    QFLEX_API_Interface_Hooks_t hooks;
+    QEMU_callback_args_t event_data;
+    simulator_obj_t *simulator;
+    ReplayTrace *trace;
+    uint64_t records = 0;
+    int64_t start, ns;
+    int num_cpus, ret;
+
+    flexus_replay_parse_args(&args, argc, argv);
+
+    trace = replay_trace_open(args.trace);
+    if (trace == NULL) {
+        return 1;
+    }
+    num_cpus = replay_trace_num_cpus(trace);
+    if (args.sockets == 0) {
+        args.sockets = 1;
+        args.cores = num_cpus;
+        args.threads = 1;
+    }
+    if (args.sockets * args.cores * args.threads != num_cpus) {
+        fprintf(stderr, "the topology does not have the %d cpus of the "
+                "trace\n", num_cpus);
+        replay_trace_close(trace);
+        return 1;
+    }
+    replay_state_init(num_cpus, args.sockets, args.cores, args.threads);
+    replay.max_instructions = args.max_instructions;
+
+    simulator = simulator_load(args.simulator);
+    if (simulator == NULL) {
+        replay_trace_close(trace);
+        return 1;
+    }
+    QFLEX_API_get_interface_hooks(&hooks);
+    if (simulator_init != NULL) {
+        simulator_init(&hooks);
+    }
+    event_data.noc = NULL;
+    replay_execute_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_config_ready,
+                             &event_data);
+    if (simulator_prepare != NULL) {
+        simulator_prepare();
+    }
+
+    start = get_clock();
+    ret = replay_trace_run(trace, &records);
+    ns = get_clock() - start;
+
+    printf("replayed %" PRIu64 " records, %" PRIu64 " instructions in "
+           "%.3f s (%.2f M records/s)\n", records, replay.instructions,
+           ns / 1e9, ns > 0 ? records * 1e3 / ns : 0);
+
+    if (simulator_deinit != NULL) {
+        simulator_deinit();
+    }
+    simulator_unload(simulator);
+    replay_trace_close(trace);
+    return ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,389 @@
+/*
+ * Reading and merging the streams of a recorded trace
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+#include <zlib.h>
+
+#include "flexus-replay.h"
+
+/* The blocks of a cpu or of the devices, in file order */
+typedef struct ReplayStream {
+    /* cpu of the stream, -1 for the devices */
+    int cpu;
+    /* offsets of the block headers in the file */
+    size_t *blocks;
+    int num_blocks;
+    int next_block;
+    /* records of the current block, decompressed in raw if needed */
+    uint8_t *raw;
+    const uint8_t *pos;
+    const uint8_t *end;
+    QEMU_trace_codec_t codec;
+    /* next record of the stream, at sequence number codec.seq */
+    QEMU_trace_file_record_t rec;
+    bool pending;
+} ReplayStream;
+
+struct ReplayTrace {
+    const uint8_t *data;
+    size_t size;
+    QEMU_trace_file_header_t header;
+    /* the cpus, then the devices */
+    int num_streams;
+    ReplayStream *streams;
+};
+
+/* Index the blocks of every stream. A trace cut short by a crash of QEMU
+ * is replayed up to its last complete block. */
+static int replay_trace_index(ReplayTrace *trace)
+{
+    size_t offset = QEMU_TRACE_FILE_HEADER_SIZE;
+    QEMU_trace_block_header_t header;
+
+    while (offset + QEMU_TRACE_BLOCK_HEADER_SIZE <= trace->size) {
+        ReplayStream *stream;
+
+        QEMU_trace_unpack_block_header(trace->data + offset, &header);
+        if (header.stored_size > trace->size - offset
+                                 - QEMU_TRACE_BLOCK_HEADER_SIZE) {
+            fprintf(stderr, "warning: the trace is truncated, %zu bytes "
+                    "ignored\n", trace->size - offset);
+            break;
+        }
+        if (header.stream == QEMU_TRACE_STREAM_DMA) {
+            stream = &trace->streams[trace->num_streams - 1];
+        } else if (header.stream < trace->header.num_cpus) {
+            stream = &trace->streams[header.stream];
+        } else {
+            fprintf(stderr, "invalid stream %u at offset %zu\n",
+                    header.stream, offset);
+            return -1;
+        }
+        if (header.raw_size > trace->header.block_size) {
+            fprintf(stderr, "invalid block size %u at offset %zu\n",
+                    header.raw_size, offset);
+            return -1;
+        }
+        stream->blocks = g_renew(size_t, stream->blocks,
+                                 stream->num_blocks + 1);
+        stream->blocks[stream->num_blocks++] = offset;
+        offset += QEMU_TRACE_BLOCK_HEADER_SIZE + header.stored_size;
+    }
+    return 0;
+}
+
+ReplayTrace *replay_trace_open(const char *path)
+{
+    ReplayTrace *trace;
+    struct stat st;
+    void *data;
+    int fd, i;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size < QEMU_TRACE_FILE_HEADER_SIZE) {
+        fprintf(stderr, "%s is not a trace\n", path);
+        close(fd);
+        return NULL;
+    }
+    /* the page cache is shared by all the replays of the same trace */
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "cannot map %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    trace = g_new0(ReplayTrace, 1);
+    trace->data = data;
+    trace->size = st.st_size;
+    if (!QEMU_trace_unpack_file_header(trace->data, &trace->header)
+        || trace->header.num_cpus == 0) {
+        fprintf(stderr, "%s is not a trace of a supported version\n", path);
+        replay_trace_close(trace);
+        return NULL;
+    }
+
+    trace->num_streams = trace->header.num_cpus + 1;
+    trace->streams = g_new0(ReplayStream, trace->num_streams);
+    for (i = 0; i < trace->num_streams; i++) {
+        trace->streams[i].cpu = i < trace->header.num_cpus ? i : -1;
+        trace->streams[i].raw = g_malloc(trace->header.block_size);
+    }
+    if (replay_trace_index(trace) < 0) {
+        replay_trace_close(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+void replay_trace_close(ReplayTrace *trace)
+{
+    int i;
+
+    for (i = 0; trace->streams && i < trace->num_streams; i++) {
+        g_free(trace->streams[i].blocks);
+        g_free(trace->streams[i].raw);
+    }
+    g_free(trace->streams);
+    munmap((void *)trace->data, trace->size);
+    g_free(trace);
+}
+
+int replay_trace_num_cpus(const ReplayTrace *trace)
+{
+    return trace->header.num_cpus;
+}
+
+static int replay_stream_load(ReplayTrace *trace, ReplayStream *stream)
+{
+    size_t offset = stream->blocks[stream->next_block++];
+    const uint8_t *p = trace->data + offset + QEMU_TRACE_BLOCK_HEADER_SIZE;
+    QEMU_trace_block_header_t header;
+    uLongf size;
+
+    QEMU_trace_unpack_block_header(trace->data + offset, &header);
+    if (header.flags & QEMU_TRACE_BLOCK_RAW) {
+        if (header.stored_size != header.raw_size) {
+            goto corrupted;
+        }
+        stream->pos = p;
+    } else {
+        size = header.raw_size;
+        if (uncompress(stream->raw, &size, p, header.stored_size) != Z_OK
+            || size != header.raw_size) {
+            goto corrupted;
+        }
+        stream->pos = stream->raw;
+    }
+    stream->end = stream->pos + header.raw_size;
+    QEMU_trace_codec_reset(&stream->codec, header.seq);
+    return 0;
+
+corrupted:
+    fprintf(stderr, "corrupted block at offset %zu\n", offset);
+    return -1;
+}
+
+/* Decode the next record of the stream, skipping the sequence records.
+ * Returns 0 at the end of the stream. */
+static int replay_stream_next(ReplayTrace *trace, ReplayStream *stream)
+{
+    const uint8_t *p;
+
+    stream->pending = false;
+    for (;;) {
+        if (stream->pos == stream->end) {
+            if (stream->next_block == stream->num_blocks) {
+                return 0;
+            }
+            if (replay_stream_load(trace, stream) < 0) {
+                return -1;
+            }
+            continue;
+        }
+        p = QEMU_trace_decode(&stream->codec, stream->pos, stream->end,
+                              &stream->rec);
+        if (p == NULL) {
+            fprintf(stderr, "truncated record in a block of stream %d\n",
+                    stream->cpu);
+            return -1;
+        }
+        stream->pos = p;
+        if (stream->rec.type != QEMU_TRACE_KIND_SEQ) {
+            stream->pending = true;
+            return 1;
+        }
+    }
+}
+
+static void replay_cpu_deliver(ReplayCPU *cpu, const QEMU_trace_file_record_t *rec)
+{
+    static memory_transaction_t trans;
+    conf_object_t *space = &cpu->space;
+    QEMU_callback_args_t event_data;
+    QEMU_ncm args;
+    QEMU_mem_trace_record_t *batch;
+
+    if (replay.batch_size > 0) {
+        if (!replay_has_callbacks(cpu->index, QEMU_cpu_mem_trans_batch)) {
+            return;
+        }
+        batch = &cpu->batch[cpu->batch_count++];
+        batch->pc = rec->pc;
+        batch->logical_address = rec->logical_address;
+        batch->physical_address = rec->physical_address;
+        batch->target_address = rec->target_address;
+        batch->size = rec->size;
+        batch->repeat = rec->repeat;
+        batch->type = rec->type;
+        batch->branch_type = rec->branch_type;
+        batch->flags = rec->flags;
+        batch->pad = 0;
+        batch->insn = NULL;
+        if (cpu->batch_count == replay.batch_size) {
+            replay_batch_flush(cpu->index);
+        }
+        return;
+    }
+
+    if (!replay_has_callbacks(cpu->index, QEMU_cpu_mem_trans)) {
+        return;
+    }
+    trans.s.cpu_state = cpu;
+    trans.s.ini_ptr = space;
+    trans.s.pc = rec->pc;
+    trans.s.logical_address = rec->logical_address;
+    trans.s.physical_address = rec->physical_address;
+    trans.s.size = rec->size;
+    trans.s.repeat = rec->repeat;
+    trans.s.type = rec->type;
+    trans.s.branch_type = rec->branch_type;
+    trans.s.annul = !!(rec->flags & QEMU_TRACE_ANNUL);
+    trans.s.atomic = !!(rec->flags & QEMU_TRACE_ATOMIC);
+    trans.io = !!(rec->flags & QEMU_TRACE_IO);
+    trans.arm_specific.user = !!(rec->flags & QEMU_TRACE_USER);
+
+    args.space = space;
+    args.trans = &trans;
+    event_data.ncm = &args;
+    replay_execute_callbacks(cpu->index, QEMU_cpu_mem_trans, &event_data);
+}
+
+static void replay_cpu_record(ReplayCPU *cpu, const QEMU_trace_file_record_t *rec)
+{
+    QEMU_trace_file_record_t count;
+
+    if (!replay_filter_keep(cpu->index, rec, &count)) {
+        return;
+    }
+    if (count.repeat != 0) {
+        replay_cpu_deliver(cpu, &count);
+    }
+    replay_cpu_deliver(cpu, rec);
+}
+
+static void replay_dma_record(const QEMU_trace_file_record_t *rec)
+{
+    static memory_transaction_t trans;
+    QEMU_callback_args_t event_data;
+    QEMU_ncm args;
+
+    if (!replay_has_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans)) {
+        return;
+    }
+    trans.s.ini_ptr = &replay.dma_spaces[rec->pci];
+    trans.s.ini_type = rec->pci ? QEMU_Initiator_PCI_Device
+                                : QEMU_Initiator_Device;
+    trans.s.physical_address = rec->physical_address;
+    trans.s.size = rec->size;
+    trans.s.type = rec->type;
+
+    args.space = trans.s.ini_ptr;
+    args.trans = &trans;
+    event_data.ncm = &args;
+    replay_execute_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans,
+                             &event_data);
+}
+
+/* Update the state of the cpu the simulator can read back, and count the
+ * instructions like QEMU does */
+static void replay_cpu_advance(ReplayCPU *cpu, const QEMU_trace_file_record_t *rec)
+{
+    /* the physical address of a fetch is the one of its target */
+    uint64_t page = rec->target_address & REPLAY_PAGE_MASK;
+    QEMU_noc args;
+    QEMU_callback_args_t event_data;
+
+    cpu->pc = rec->pc;
+    if (rec->type != QEMU_TRACE_FETCH) {
+        cpu->data_page = page;
+        cpu->data_offset = rec->physical_address - rec->target_address;
+        return;
+    }
+    cpu->fetch_page = page;
+    cpu->fetch_offset = rec->physical_address - rec->target_address;
+    cpu->instructions++;
+    replay.instructions++;
+
+    if (replay.instructions % REPLAY_PERIODIC_EVENT_DELAY == 0) {
+        args.class_data = NULL;
+        args.obj = NULL;
+        event_data.noc = &args;
+        replay_execute_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_periodic_event,
+                                 &event_data);
+    }
+    if (replay.max_instructions != 0
+        && replay.instructions >= replay.max_instructions) {
+        replay.simulating = false;
+    }
+}
+
+/* Deliver the records of the stream up to the next batch */
+static int replay_stream_deliver(ReplayTrace *trace, ReplayStream *stream,
+                                 uint64_t *records)
+{
+    uint64_t seq = stream->codec.seq;
+    int ret = 1;
+
+    while (ret > 0 && stream->codec.seq == seq && replay.simulating) {
+        if (stream->cpu < 0) {
+            replay_dma_record(&stream->rec);
+        } else {
+            ReplayCPU *cpu = &replay.cpus[stream->cpu];
+
+            replay_cpu_advance(cpu, &stream->rec);
+            replay_cpu_record(cpu, &stream->rec);
+        }
+        (*records)++;
+        ret = replay_stream_next(trace, stream);
+    }
+    return ret < 0 ? -1 : 0;
+}
+
+int replay_trace_run(ReplayTrace *trace, uint64_t *records)
+{
+    ReplayStream *next;
+    int i;
+
+    for (i = 0; i < trace->num_streams; i++) {
+        if (replay_stream_next(trace, &trace->streams[i]) < 0) {
+            return -1;
+        }
+    }
+
+    while (replay.simulating) {
+        /* the device records of a sequence number come before the batch of
+         * the cpus with the same number, the devices are the last stream */
+        next = NULL;
+        for (i = trace->num_streams - 1; i >= 0; i--) {
+            ReplayStream *stream = &trace->streams[i];
+
+            if (stream->pending
+                && (next == NULL || stream->codec.seq < next->codec.seq)) {
+                next = stream;
+            }
+        }
+        if (next == NULL) {
+            break;
+        }
+        if (replay_stream_deliver(trace, next, records) < 0) {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < replay.num_cpus; i++) {
+        replay_batch_flush(i);
+    }
+    return 0;
+}
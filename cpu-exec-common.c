@@ -24,6 +24,7 @@
 
 bool exit_request;
 CPUState *tcg_current_cpu;
+sig_atomic_t quantum_value;
 
 /* exit the current TB from a signal handler. The host registers are
    restored in a state compatible with the CPU emulator
@@ -26,12 +26,18 @@
 #include "qemu/timer.h"
 #include "exec/address-spaces.h"
 #include "qemu/rcu.h"
+#include "qemu/main-loop.h"
 #include "exec/tb-hash.h"
 #include "exec/log.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
 #include "hw/i386/apic.h"
 #endif
 #include "sysemu/replay.h"
+#ifdef CONFIG_FLEXUS
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "libqemuflex/api.h"
+#endif
 
 /* -icount align implementation. */
 
@@ -204,68 +210,187 @@ static void cpu_exec_nocache(CPUState *cpu, int max_cycles,
     if (max_cycles > CF_COUNT_MASK)
         max_cycles = CF_COUNT_MASK;
 
+    tb_lock();
     tb = tb_gen_code(cpu, orig_tb->pc, orig_tb->cs_base, orig_tb->flags,
                      max_cycles | CF_NOCACHE
                          | (ignore_icount ? CF_IGNORE_ICOUNT : 0));
     tb->orig_tb = tcg_ctx.tb_ctx.tb_invalidated_flag ? NULL : orig_tb;
+    tb_unlock();
     cpu->current_tb = tb;
     /* execute the generated code */
     trace_exec_tb_nocache(tb, tb->pc);
     cpu_tb_exec(cpu, tb);
     cpu->current_tb = NULL;
+    tb_lock();
     tb_phys_invalidate(tb, -1);
     tb_free(tb);
+    tb_unlock();
 }
 
+struct tb_desc {
+    target_ulong pc;
+    target_ulong cs_base;
+    CPUArchState *env;
+    tb_page_addr_t phys_page1;
+    uint64_t flags;
+    uint32_t step_cflags;
+};
+
+static bool tb_cmp(const void *p, const void *d)
+{
+    const TranslationBlock *tb = p;
+    const struct tb_desc *desc = d;
+
+    if (tb->pc == desc->pc &&
+        tb->page_addr[0] == desc->phys_page1 &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags &&
+        (desc->step_cflags ? (tb->cflags & (CF_STEP | CF_COUNT_MASK))
+                                 == desc->step_cflags
+                           : !(tb->cflags & CF_STEP))) {
+        /* check next page if needed */
+        if (tb->page_addr[1] == -1) {
+            return true;
+        } else {
+            tb_page_addr_t phys_page2;
+            target_ulong virt_page2;
+
+            virt_page2 = (desc->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+            phys_page2 = get_page_addr_code(desc->env, virt_page2);
+            if (tb->page_addr[1] == phys_page2) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* Look up the TB of pc.  step_cflags is zero for the TBs the CPU runs
+   normally, or CF_STEP and the instruction count of a step TB.  Called in
+   the RCU read-side critical section of cpu_exec, which tb_cmp may leave
+   with a longjmp.  */
 static TranslationBlock *tb_find_physical(CPUState *cpu,
                                           target_ulong pc,
                                           target_ulong cs_base,
-                                          uint64_t flags)
+                                          uint64_t flags,
+                                          uint32_t step_cflags)
 {
-    CPUArchState *env = (CPUArchState *)cpu->env_ptr;
-    TranslationBlock *tb, **ptb1;
-    unsigned int h;
-    tb_page_addr_t phys_pc, phys_page1;
-    target_ulong virt_page2;
+    tb_page_addr_t phys_pc;
+    struct tb_desc desc;
+    uint32_t h;
 
     tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
 
+    desc.env = (CPUArchState *)cpu->env_ptr;
+    desc.cs_base = cs_base;
+    desc.flags = flags;
+    desc.pc = pc;
+    desc.step_cflags = step_cflags;
+
     /* find translated block using physical mappings */
-    phys_pc = get_page_addr_code(env, pc);
-    phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    for(;;) {
-        tb = *ptb1;
+    phys_pc = get_page_addr_code(desc.env, pc);
+    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    h = tb_hash_func(phys_pc, pc, flags, cs_base);
+    return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
+}
+
+/* Execute the first max_cycles instructions of orig_tb.  Unlike
+   cpu_exec_nocache the shortened TB is kept, tagged with CF_STEP and its
+   count, so that stepping the same code again does not translate it.  It
+   is never chained to nor entered in tb_jmp_cache.  */
+static void cpu_exec_step(CPUState *cpu, int max_cycles,
+                          TranslationBlock *orig_tb)
+{
+    TranslationBlock *tb;
+    uint32_t cflags;
+
+    if (max_cycles > CF_COUNT_MASK)
+        max_cycles = CF_COUNT_MASK;
+    cflags = max_cycles | CF_STEP;
+
+    tb_lock();
+    tb = tb_find_physical(cpu, orig_tb->pc, orig_tb->cs_base, orig_tb->flags,
+                          cflags);
+    if (!tb) {
+        tb = tb_gen_code(cpu, orig_tb->pc, orig_tb->cs_base, orig_tb->flags,
+                         cflags);
+    }
+    tb_unlock();
+    cpu->current_tb = tb;
+    /* execute the generated code */
+    trace_exec_tb(tb, tb->pc);
+    cpu_tb_exec(cpu, tb);
+    cpu->current_tb = NULL;
+}
+
+#if !defined(CONFIG_USER_ONLY)
+/* Execute the next instruction of the CPU alone, for an atomic operation
+   of -tcg-threads multi that the host cannot do atomically and that raised
+   EXCP_ATOMIC.  The caller holds the BQL and started an exclusive section,
+   so the slow path of the operation is atomic.  An exception raised by the
+   instruction is left pending for the next cpu_exec.  */
+void cpu_exec_step_atomic(CPUState *cpu)
+{
+    CPUClass *cc = CPU_GET_CLASS(cpu);
+    CPUArchState *env = cpu->env_ptr;
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    current_cpu = cpu;
+    rcu_read_lock();
+    cc->cpu_exec_enter(cpu);
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+        tb_lock();
+        tb = tb_find_physical(cpu, pc, cs_base, flags, 1 | CF_STEP);
         if (!tb) {
-            return NULL;
+            tb = tb_gen_code(cpu, pc, cs_base, flags, 1 | CF_STEP);
         }
-        if (tb->pc == pc &&
-            tb->page_addr[0] == phys_page1 &&
-            tb->cs_base == cs_base &&
-            tb->flags == flags) {
-            /* check next page if needed */
-            if (tb->page_addr[1] != -1) {
-                tb_page_addr_t phys_page2;
-
-                virt_page2 = (pc & TARGET_PAGE_MASK) +
-                    TARGET_PAGE_SIZE;
-                phys_page2 = get_page_addr_code(env, virt_page2);
-                if (tb->page_addr[1] == phys_page2) {
-                    break;
-                }
-            } else {
-                break;
-            }
-        }
-        ptb1 = &tb->phys_hash_next;
+        tb_unlock();
+        cpu->exclusive_step = true;
+        cpu->current_tb = tb;
+        trace_exec_tb(tb, tb->pc);
+        cpu_tb_exec(cpu, tb);
+    } else {
+        /* reload the locals clobbered by the longjmp, as in cpu_exec */
+        cpu = current_cpu;
+        cc = CPU_GET_CLASS(cpu);
+        cpu->can_do_io = 1;
+        tb_lock_reset();
     }
+    cpu->current_tb = NULL;
+    cpu->exclusive_step = false;
+    cc->cpu_exec_exit(cpu);
+    rcu_read_unlock();
+    current_cpu = NULL;
+}
+#endif
 
-    /* Move the TB to the head of the list */
-    *ptb1 = tb->phys_hash_next;
-    tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
-    return tb;
+/* The TB that just exited did not fit in the budget of the CPU.  Execute
+ * the instructions left in it, so that the CPU stops on the exact
+ * instruction count, then raise the instruction event or leave the
+ * execution loop at the end of the quantum.
+ */
+static void cpu_handle_quantum_expired(CPUState *cpu, TranslationBlock *tb)
+{
+    uint64_t executed;
+
+    if (cpu->quantum_budget > 0) {
+        cpu_exec_step(cpu, cpu->quantum_budget, tb);
+    }
+    executed = cpu_executed_instructions(cpu);
+    if (executed >= cpu->instr_event) {
+        cpu->instr_event = UINT64_MAX;
+#ifdef CONFIG_FLEXUS
+        QEMU_sampling_instr_event(cpu->cpu_index);
+#endif
+    }
+    if (executed >= cpu->quantum_end) {
+        cpu->hasReachedInstrLimit = true;
+        cpu_loop_exit(cpu);
+    }
+    cpu_budget_update(cpu);
 }
 
 static TranslationBlock *tb_find_slow(CPUState *cpu,
@@ -275,30 +400,26 @@ static TranslationBlock *tb_find_slow(CPUState *cpu,
 {
     TranslationBlock *tb;
 
-    tb = tb_find_physical(cpu, pc, cs_base, flags);
+    /* the lookup runs under RCU only */
+    tb = tb_find_physical(cpu, pc, cs_base, flags, 0);
     if (tb) {
         goto found;
     }
 
-#ifdef CONFIG_USER_ONLY
-    /* mmap_lock is needed by tb_gen_code, and mmap_lock must be
-     * taken outside tb_lock.  Since we're momentarily dropping
-     * tb_lock, there's a chance that our desired tb has been
-     * translated.
+    /* mmap_lock is needed by tb_gen_code in user mode, and must be
+     * taken outside tb_lock.  Another thread may have translated the
+     * block since the lookup, look it up again under the locks.
      */
-    tb_unlock();
+#ifdef CONFIG_USER_ONLY
     mmap_lock();
+#endif
     tb_lock();
-    tb = tb_find_physical(cpu, pc, cs_base, flags);
-    if (tb) {
-        mmap_unlock();
-        goto found;
+    tb = tb_find_physical(cpu, pc, cs_base, flags, 0);
+    if (!tb) {
+        /* if no translated code available, then translate it now */
+        tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
     }
-#endif
-
-    /* if no translated code available, then translate it now */
-    tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
-
+    tb_unlock();
 #ifdef CONFIG_USER_ONLY
     mmap_unlock();
 #endif
@@ -321,8 +442,10 @@ static inline TranslationBlock *tb_find_fast(CPUState *cpu)
        is executed. */
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
     tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    /* another thread may have invalidated the TB after its entries in
+       tb_jmp_cache were cleared */
     if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
-                 tb->flags != flags)) {
+                 tb->flags != flags || tb->page_addr[0] == -1)) {
         tb = tb_find_slow(cpu, pc, cs_base, flags);
     }
     return tb;
@@ -342,6 +465,23 @@ static void cpu_handle_debug_exception(CPUState *cpu)
     cc->debug_excp_handler(cpu);
 }
 
+/* With -tcg-threads multi the vCPUs run guest code without the BQL, the
+   delivery of interrupts and exceptions still takes it.  A longjmp out of
+   the delivery releases it in cpu_exec.  */
+static inline void cpu_exec_lock_iothread(void)
+{
+    if (qemu_tcg_mttcg_enabled()) {
+        qemu_mutex_lock_iothread();
+    }
+}
+
+static inline void cpu_exec_unlock_iothread(void)
+{
+    if (qemu_tcg_mttcg_enabled()) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 /* main execution loop */
 
 int cpu_exec(CPUState *cpu)
@@ -378,7 +518,9 @@ int cpu_exec(CPUState *cpu)
     atomic_mb_set(&tcg_current_cpu, cpu);
     rcu_read_lock();
 
-    if (unlikely(atomic_mb_read(&exit_request))) {
+    /* each vCPU thread is kicked through its own exit_request with
+       -tcg-threads multi */
+    if (!qemu_tcg_mttcg_enabled() && unlikely(atomic_mb_read(&exit_request))) {
         cpu->exit_request = 1;
     }
 
@@ -393,8 +535,9 @@ int cpu_exec(CPUState *cpu)
 
     /* prepare setjmp context for exception handling */
     for(;;) {
-        if(cpu->hasReachedInstrLimit){
+        if (cpu->hasReachedInstrLimit) {
             cpu->nr_quantumHits++;
+            ret = EXCP_INTERRUPT;
             break;
         }
         if (sigsetjmp(cpu->jmp_env, 0) == 0) {
@@ -421,7 +564,10 @@ int cpu_exec(CPUState *cpu)
                     break;
 #else
                     if (replay_exception()) {
+                        cpu->exception_taken = cpu->exception_index;
+                        cpu_exec_lock_iothread();
                         cc->do_interrupt(cpu);
+                        cpu_exec_unlock_iothread();
                         cpu->exception_index = -1;
                     } else if (!replay_has_interrupt()) {
                         /* give a chance to iothread in replay mode */
@@ -440,11 +586,9 @@ int cpu_exec(CPUState *cpu)
 
             next_tb = 0; /* force lookup of first TB */
             for(;;) {
-                if(cpu->hasReachedInstrLimit){
-                    break;
-                }
                 interrupt_request = cpu->interrupt_request;
                 if (unlikely(interrupt_request)) {
+                    cpu_exec_lock_iothread();
                     if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
                         /* Mask out external interrupts for this step. */
                         interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -486,6 +630,7 @@ int cpu_exec(CPUState *cpu)
                     else {
                         replay_interrupt();
                         if (cc->cpu_exec_interrupt(cpu, interrupt_request)) {
+                            cpu->exception_taken = cpu->exception_index;
                             next_tb = 0;
                         }
                     }
@@ -497,6 +642,7 @@ int cpu_exec(CPUState *cpu)
                            the program flow was changed */
                         next_tb = 0;
                     }
+                    cpu_exec_unlock_iothread();
                 }
                 if (unlikely(cpu->exit_request
                              || replay_has_interrupt())) {
@@ -504,7 +650,6 @@ int cpu_exec(CPUState *cpu)
                     cpu->exception_index = EXCP_INTERRUPT;
                     cpu_loop_exit(cpu);
                 }
-                tb_lock();
                 tb = tb_find_fast(cpu);
                 /* Note: we do it here to avoid a gcc bug on Mac OS X when
                    doing it in tb_find_slow */
@@ -517,13 +662,20 @@ int cpu_exec(CPUState *cpu)
                 }
                 /* see if we can patch the calling TB. When the TB
                    spans two pages, we cannot safely do a direct
-                   jump. */
+                   jump.  Neither TB may have been invalidated by
+                   another thread since it was looked up. */
                 if (next_tb != 0 && tb->page_addr[1] == -1
                     && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                    TranslationBlock *last_tb;
+
+                    last_tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+                    tb_lock();
+                    if (last_tb->page_addr[0] != -1
+                        && tb->page_addr[0] != -1) {
+                        tb_add_jump(last_tb, next_tb & TB_EXIT_MASK, tb);
+                    }
+                    tb_unlock();
                 }
-                tb_unlock();
                 if (likely(!cpu->exit_request)) {
                     trace_exec_tb(tb, tb->pc);
                     /* execute the generated code */
@@ -543,12 +695,23 @@ int cpu_exec(CPUState *cpu)
                          * or cpu->interrupt_request.
                          */
                         smp_rmb();
+                        tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
                         next_tb = 0;
+                        if ((tb->cflags & CF_QUANTUM)
+                            && cpu->quantum_budget < tb->icount) {
+                            cpu_handle_quantum_expired(cpu, tb);
+                        }
                         break;
                     case TB_EXIT_ICOUNT_EXPIRED:
                     {
                         /* Instruction counter expired.  */
                         int insns_left = cpu->icount_decr.u32;
+                        /* The block was already charged to the quantum
+                         * but did not run.  */
+                        tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+                        if (tb->cflags & CF_QUANTUM) {
+                            cpu->quantum_budget += tb->icount;
+                        }
                         if (cpu->icount_extra && insns_left >= 0) {
                             /* Refill decrementer and continue execution.  */
                             cpu->icount_extra += insns_left;
@@ -558,7 +721,6 @@ int cpu_exec(CPUState *cpu)
                         } else {
                             if (insns_left > 0) {
                                 /* Execute remaining instructions.  */
-                                tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
                                 cpu_exec_nocache(cpu, insns_left, tb, false);
                                 align_clocks(&sc, cpu);
                             }
@@ -601,6 +763,9 @@ int cpu_exec(CPUState *cpu)
 #endif /* buggy compiler */
             cpu->can_do_io = 1;
             tb_lock_reset();
+            if (qemu_tcg_mttcg_enabled() && qemu_mutex_iothread_locked()) {
+                qemu_mutex_unlock_iothread();
+            }
         }
     } /* for(;;) */
 
@@ -36,6 +36,7 @@
 #include "qmp-commands.h"
 
 #include "qemu/thread.h"
+#include "exec/exec-all.h"
 #include "sysemu/cpus.h"
 #include "sysemu/qtest.h"
 #include "qemu/main-loop.h"
@@ -906,6 +907,30 @@ static QemuCond qemu_cpu_cond;
 static QemuCond qemu_pause_cond;
 static QemuCond qemu_work_cond;
 
+/* Exclusive sections of the vCPU threads with -tcg-threads multi, during
+ * which no vCPU executes guest code.  All protected by the BQL: a vCPU is
+ * running from tcg_cpu_exec_start to tcg_cpu_exec_end, and pending_cpus
+ * counts the running vCPUs a section still waits for, plus one for the
+ * thread that started it.
+ */
+static int pending_cpus;
+/* a running vCPU left, signaled to the thread starting a section */
+static QemuCond qemu_exclusive_cond;
+/* the section ended */
+static QemuCond qemu_exclusive_resume;
+
+/* Work queued by async_safe_run, run in an exclusive section */
+struct qemu_safe_work_item {
+    void (*func)(void *data);
+    void *data;
+    QSIMPLEQ_ENTRY(qemu_safe_work_item) next;
+};
+
+static QemuMutex qemu_safe_work_mutex;
+static QSIMPLEQ_HEAD(, qemu_safe_work_item) qemu_safe_work =
+    QSIMPLEQ_HEAD_INITIALIZER(qemu_safe_work);
+static int safe_work_pending;
+
 void qemu_init_cpu_loop(void)
 {
     qemu_init_sigbus();
@@ -913,7 +938,10 @@ void qemu_init_cpu_loop(void)
     qemu_cond_init(&qemu_pause_cond);
     qemu_cond_init(&qemu_work_cond);
     qemu_cond_init(&qemu_io_proceeded_cond);
+    qemu_cond_init(&qemu_exclusive_cond);
+    qemu_cond_init(&qemu_exclusive_resume);
     qemu_mutex_init(&qemu_global_mutex);
+    qemu_mutex_init(&qemu_safe_work_mutex);
 
     qemu_thread_get_self(&io_thread);
 }
@@ -979,6 +1007,92 @@ void async_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data)
     qemu_cpu_kick(cpu);
 }
 
+void async_safe_run(void (*func)(void *data), void *data)
+{
+    struct qemu_safe_work_item *wi;
+    CPUState *cpu;
+
+    wi = g_new(struct qemu_safe_work_item, 1);
+    wi->func = func;
+    wi->data = data;
+
+    qemu_mutex_lock(&qemu_safe_work_mutex);
+    QSIMPLEQ_INSERT_TAIL(&qemu_safe_work, wi, next);
+    atomic_mb_set(&safe_work_pending, 1);
+    qemu_mutex_unlock(&qemu_safe_work_mutex);
+
+    CPU_FOREACH(cpu) {
+        qemu_cpu_kick(cpu);
+    }
+}
+
+/* Wait until the other vCPUs left the execution loop, the caller must not
+ * be running.  Called with the BQL held, which is released while waiting.
+ */
+static void start_exclusive(void)
+{
+    CPUState *other;
+
+    while (pending_cpus) {
+        qemu_cond_wait(&qemu_exclusive_resume, &qemu_global_mutex);
+    }
+    pending_cpus = 1;
+    CPU_FOREACH(other) {
+        if (other->running) {
+            pending_cpus++;
+            qemu_cpu_kick(other);
+        }
+    }
+    while (pending_cpus > 1) {
+        qemu_cond_wait(&qemu_exclusive_cond, &qemu_global_mutex);
+    }
+}
+
+static void end_exclusive(void)
+{
+    pending_cpus = 0;
+    qemu_cond_broadcast(&qemu_exclusive_resume);
+}
+
+static void tcg_cpu_exec_start(CPUState *cpu)
+{
+    cpu->running = true;
+}
+
+static void tcg_cpu_exec_end(CPUState *cpu)
+{
+    cpu->running = false;
+    if (pending_cpus > 1) {
+        pending_cpus--;
+        if (pending_cpus == 1) {
+            qemu_cond_signal(&qemu_exclusive_cond);
+        }
+    }
+}
+
+static void flush_safe_work(void)
+{
+    struct qemu_safe_work_item *wi;
+
+    if (!atomic_mb_read(&safe_work_pending)) {
+        return;
+    }
+
+    start_exclusive();
+    qemu_mutex_lock(&qemu_safe_work_mutex);
+    while (!QSIMPLEQ_EMPTY(&qemu_safe_work)) {
+        wi = QSIMPLEQ_FIRST(&qemu_safe_work);
+        QSIMPLEQ_REMOVE_HEAD(&qemu_safe_work, next);
+        qemu_mutex_unlock(&qemu_safe_work_mutex);
+        wi->func(wi->data);
+        g_free(wi);
+        qemu_mutex_lock(&qemu_safe_work_mutex);
+    }
+    atomic_mb_set(&safe_work_pending, 0);
+    qemu_mutex_unlock(&qemu_safe_work_mutex);
+    end_exclusive();
+}
+
 static void flush_queued_work(CPUState *cpu)
 {
     struct qemu_work_item *wi;
@@ -1031,8 +1145,23 @@ static void qemu_tcg_wait_io_event(CPUState *cpu)
     CPU_FOREACH(cpu) {
         qemu_wait_io_event_common(cpu);
     }
+    flush_safe_work();
 }
 
+static void qemu_tcg_mttcg_wait_io_event(CPUState *cpu)
+{
+    while (cpu_thread_is_idle(cpu) && !atomic_mb_read(&safe_work_pending)) {
+        qemu_cond_wait(cpu->halt_cond, &qemu_global_mutex);
+    }
+
+    qemu_wait_io_event_common(cpu);
+    flush_safe_work();
+
+    /* another vCPU may have started an exclusive section meanwhile */
+    while (pending_cpus) {
+        qemu_cond_wait(&qemu_exclusive_resume, &qemu_global_mutex);
+    }
+}
 
 static void qemu_kvm_wait_io_event(CPUState *cpu)
 {
@@ -1128,6 +1257,23 @@ static void *qemu_dummy_cpu_thread_fn(void *arg)
 }
 
 static void tcg_exec_all(void);
+static int tcg_cpu_exec(CPUState *cpu);
+
+static void qemu_tcg_init_cpu_state(CPUState *cpu)
+{
+    cpu->thread_id = qemu_get_thread_id();
+    cpu->created = true;
+    cpu->can_do_io = 1;
+    cpu->hasReachedInstrLimit = false;
+    cpu->nr_total_instr = 0;
+    cpu_quantum_refill(cpu);
+    cpu->nr_quantumHits = 0;
+    cpu->nr_exp[0] = 0;
+    cpu->nr_exp[1] = 0;
+    cpu->nr_exp[2] = 0;
+    cpu->nr_exp[3] = 0;
+    cpu->nr_exp[4] = 0;
+}
 
 static void *qemu_tcg_cpu_thread_fn(void *arg)
 {    
@@ -1138,20 +1284,7 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     qemu_thread_get_self(cpu->thread);
 
     CPU_FOREACH(cpu) {
-        cpu->thread_id = qemu_get_thread_id();
-        cpu->created = true;
-        cpu->can_do_io = 1;
-        cpu->nr_instr = 0;
-        cpu->hasReachedInstrLimit = false;
-        cpu->nr_total_instr = 0;
-        cpu->nr_quantumHits = 0;
-        cpu->nr_exp[0] = 0;
-        cpu->nr_exp[1] = 0;
-        cpu->nr_exp[2] = 0;
-        cpu->nr_exp[3] = 0;
-        cpu->nr_exp[4] = 0;
-
-
+        qemu_tcg_init_cpu_state(cpu);
     }
     qemu_cond_signal(&qemu_cpu_cond);
 
@@ -1194,6 +1327,56 @@ static void *qemu_tcg_cpu_thread_fn(void *arg)
     return NULL;
 }
 
+/* With -tcg-threads multi, each vCPU runs in its own thread and only
+ * releases the BQL while executing guest code.  The quantum still bounds
+ * how long a vCPU runs between two visits to the main loop, but the vCPUs
+ * are not interleaved anymore.
+ */
+static void *qemu_tcg_mttcg_cpu_thread_fn(void *arg)
+{
+    CPUState *cpu = arg;
+    int r;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock_iothread();
+    qemu_thread_get_self(cpu->thread);
+    qemu_tcg_init_cpu_state(cpu);
+    current_cpu = cpu;
+    qemu_cond_signal(&qemu_cpu_cond);
+
+    while (1) {
+        qemu_tcg_mttcg_wait_io_event(cpu);
+        if (!cpu_can_run(cpu)) {
+            continue;
+        }
+
+        tcg_cpu_exec_start(cpu);
+        qemu_mutex_unlock_iothread();
+        r = tcg_cpu_exec(cpu);
+        qemu_mutex_lock_iothread();
+        tcg_cpu_exec_end(cpu);
+
+        if (r == EXCP_ATOMIC) {
+            start_exclusive();
+            cpu_exec_step_atomic(cpu);
+            end_exclusive();
+        } else if (r == EXCP_DEBUG) {
+            cpu_handle_guest_debug(cpu);
+        } else if (!cpu->hasReachedInstrLimit
+                   && r >= EXCP_INTERRUPT && r <= EXCP_YIELD) {
+            cpu->nr_exp[r - EXCP_INTERRUPT]++;
+        }
+        if (quantum_value <= 0 || cpu->hasReachedInstrLimit
+            || r == EXCP_HLT || r == EXCP_HALTED || r == EXCP_YIELD) {
+            cpu->hasReachedInstrLimit = false;
+            cpu_quantum_refill(cpu);
+        }
+    }
+
+    return NULL;
+}
+
 static void qemu_cpu_kick_thread(CPUState *cpu)
 {
 #ifndef _WIN32
@@ -1229,7 +1412,9 @@ static void qemu_cpu_kick_no_halt(void)
 void qemu_cpu_kick(CPUState *cpu)
 {
     qemu_cond_broadcast(cpu->halt_cond);
-    if (tcg_enabled()) {
+    if (tcg_enabled() && qemu_tcg_mttcg_enabled()) {
+        cpu_exit(cpu);
+    } else if (tcg_enabled()) {
         qemu_cpu_kick_no_halt();
     } else {
         qemu_cpu_kick_thread(cpu);
@@ -1263,9 +1448,10 @@ void qemu_mutex_lock_iothread(void)
 {
     atomic_inc(&iothread_requesting_mutex);
     /* In the simple case there is no need to bump the VCPU thread out of
-     * TCG code execution.
+     * TCG code execution.  The vCPU threads of -tcg-threads multi do not
+     * hold the lock while executing guest code.
      */
-    if (!tcg_enabled() || qemu_in_vcpu_thread() ||
+    if (!tcg_enabled() || qemu_tcg_mttcg_enabled() || qemu_in_vcpu_thread() ||
         !first_cpu || !first_cpu->created) {
         qemu_mutex_lock(&qemu_global_mutex);
         atomic_dec(&iothread_requesting_mutex);
@@ -1311,7 +1497,8 @@ void pause_all_vcpus(void)
 
     if (qemu_in_vcpu_thread()) {
         cpu_stop_current();
-        if (!kvm_enabled()) {
+        /* the other vCPUs only stop in their own thread */
+        if (!kvm_enabled() && !qemu_tcg_mttcg_enabled()) {
             CPU_FOREACH(cpu) {
                 cpu->stop = false;
                 cpu->stopped = true;
@@ -1354,6 +1541,24 @@ static void qemu_tcg_init_vcpu(CPUState *cpu)
     static QemuCond *tcg_halt_cond;
     static QemuThread *tcg_cpu_thread;
 
+    if (qemu_tcg_mttcg_enabled()) {
+        cpu->thread = g_malloc0(sizeof(QemuThread));
+        cpu->halt_cond = g_malloc0(sizeof(QemuCond));
+        qemu_cond_init(cpu->halt_cond);
+        snprintf(thread_name, VCPU_THREAD_NAME_SIZE, "CPU %d/TCG",
+                 cpu->cpu_index);
+        qemu_thread_create(cpu->thread, thread_name,
+                           qemu_tcg_mttcg_cpu_thread_fn,
+                           cpu, QEMU_THREAD_JOINABLE);
+#ifdef _WIN32
+        cpu->hThread = qemu_thread_get_handle(cpu->thread);
+#endif
+        while (!cpu->created) {
+            qemu_cond_wait(&qemu_cpu_cond, &qemu_global_mutex);
+        }
+        return;
+    }
+
     /* share a single thread for all cpus with TCG */
     if (!tcg_cpu_thread) {
         cpu->thread = g_malloc0(sizeof(QemuThread));
@@ -1543,8 +1748,6 @@ static int tcg_cpu_exec(CPUState *cpu)
 
 static void tcg_exec_all(void)
 {
-    int r;
-
     /* Account partial waits to QEMU_CLOCK_VIRTUAL.  */
     qemu_account_warp_timer();
 
@@ -1553,38 +1756,43 @@ static void tcg_exec_all(void)
     }
     for (; next_cpu != NULL && !exit_request; ) {
         CPUState *cpu = next_cpu;
+        int r = EXCP_HALTED;
 
         qemu_clock_enable(QEMU_CLOCK_VIRTUAL,
                           (cpu->singlestep_enabled & SSTEP_NOTIMER) == 0);
 
         if (cpu_can_run(cpu)) {
+#ifdef CONFIG_FLEXUS
+            QEMU_sampling_cpu_resume(cpu->cpu_index);
+#endif
             r = tcg_cpu_exec(cpu);
             if (r == EXCP_DEBUG) {
                 cpu_handle_guest_debug(cpu);
                 break;
-            }            
-            else if (r == EXCP_INTERRUPT || r == EXCP_HLT || r == EXCP_HALTED || r == EXCP_YIELD)
-            {
-                 next_cpu->hasReachedInstrLimit = true;
             }
-
-            cpu->nr_exp[r-EXCP_INTERRUPT]++;
-
+            if (!cpu->hasReachedInstrLimit
+                && r >= EXCP_INTERRUPT && r <= EXCP_YIELD) {
+                cpu->nr_exp[r - EXCP_INTERRUPT]++;
+            }
         } else if (cpu->stop || cpu->stopped) {
             break;
         }
 
-
-        /*everytime we are looping through our vCPUs
-        we will limit the insructions that are executed by that specific CPU
-        to a number that is defined as an program argument. this limit prevents
-        further instruction to get generated in the Translation file of the relative guest Architecture.*/
-        if (next_cpu->hasReachedInstrLimit){
-            next_cpu->hasReachedInstrLimit = false;
-            next_cpu->nr_instr = 0;
-            next_cpu = CPU_NEXT(next_cpu);
-
-            }
+        /* With a quantum, a vCPU keeps running until the generated code
+         * has charged quantum_value instructions to it, unless it halts or
+         * yields.  Being kicked out of cpu_exec (EXCP_INTERRUPT) does not
+         * end the quantum, so the interleaving of the vCPUs only depends
+         * on the instruction counts.  Without a quantum, plain round-robin.
+         */
+        if (quantum_value <= 0 || cpu->hasReachedInstrLimit
+            || r == EXCP_HLT || r == EXCP_HALTED || r == EXCP_YIELD) {
+            cpu->hasReachedInstrLimit = false;
+            cpu_quantum_refill(cpu);
+            next_cpu = CPU_NEXT(cpu);
+#ifdef CONFIG_FLEXUS
+            QEMU_trace_end_quantum(cpu->cpu_index, next_cpu == NULL);
+#endif
+        }
     }
 
     /* Pairs with smp_wmb in qemu_cpu_kick.  */
@@ -1777,7 +1985,27 @@ void dump_drift_info(FILE *f, fprintf_function cpu_fprintf)
     }
 }
 
-extern sig_atomic_t quantum_value;
+/* -tcg-threads: run the TCG vCPUs in turn in a single thread, or each in
+ * its own thread.  The multi-threaded mode relies on the guest being ARM,
+ * and on the host doing the guest loads and stores in order or with the
+ * barriers of the guest.
+ */
+void qemu_tcg_configure(const char *mode, Error **errp)
+{
+    if (!strcmp(mode, "single")) {
+        mttcg_enabled = false;
+    } else if (!strcmp(mode, "multi")) {
+#if defined(TARGET_ARM) && (defined(__x86_64__) || defined(__aarch64__))
+        mttcg_enabled = true;
+#else
+        error_setg(errp, "-tcg-threads multi is not supported for this "
+                   "guest on this host");
+#endif
+    } else {
+        error_setg(errp, "invalid -tcg-threads mode '%s', "
+                   "expected single or multi", mode);
+    }
+}
 
 void cpu_get_quantum(const char* val)
 {
@@ -1788,7 +2016,26 @@ void cpu_get_quantum(const char* val)
 
 void cpu_set_quantum(const char* val)
 {
-   quantum_value = atoi(val);
+    qemu_set_quantum(atoi(val));
+}
+
+/* Start a new quantum of @quantum instructions on every vCPU.  The
+ * budget is charged by the generated code, so no retranslation is needed.
+ */
+void qemu_set_quantum(int quantum)
+{
+    CPUState *cpu;
+    bool counted = cpu_quantum_counted();
+
+    quantum_value = quantum < 0 ? 0 : quantum;
+    /* the TBs charge the quantum budget only while it is needed */
+    if (counted != cpu_quantum_counted() && tcg_enabled() && first_cpu) {
+        tb_flush(first_cpu);
+    }
+    CPU_FOREACH(cpu) {
+        cpu->hasReachedInstrLimit = false;
+        cpu_quantum_refill(cpu);
+    }
 }
 
 void cpu_get_ic(const char *str)
@@ -1798,7 +2045,7 @@ void cpu_get_ic(const char *str)
     char * tmp = malloc (1024);
     CPU_FOREACH(cpu)
     {
-        length += sprintf(tmp+ length, "CPU %d has executed %d instructions so far.\n", cpu->cpu_index, cpu->nr_total_instr);
+        length += sprintf(tmp+ length, "CPU %d has executed %" PRIu64 " instructions so far.\n", cpu->cpu_index, cpu_executed_instructions(cpu));
     }
 
     length += sprintf(tmp+ length, "\nDetails:\nCPU\tQUANTUM-HITS\tIRQs\tEXP-DEBUGs\tHLTs\tSTOPs\tYIELDs\n");
@@ -1826,8 +2073,18 @@ void cpu_zero_all(void)
     CPUState *cpu;
     CPU_FOREACH(cpu)
     {
+        /* The end of the quantum and the instruction event stay the same
+         * number of instructions ahead.  */
+        uint64_t executed = cpu_executed_instructions(cpu);
+        if (cpu->quantum_end != UINT64_MAX) {
+            cpu->quantum_end -= executed;
+        }
+        if (cpu->instr_event != UINT64_MAX) {
+            cpu->instr_event -= executed;
+        }
         cpu->nr_quantumHits = 0;
         cpu->nr_total_instr = 0;
+        cpu->quantum_refill = cpu->quantum_budget;
         cpu->nr_exp[0] = 0;
         cpu->nr_exp[1] = 0;
         cpu->nr_exp[2] = 0;
@@ -1837,40 +2094,56 @@ void cpu_zero_all(void)
 
 }
 
-#ifdef CONFIG_FLEXUS
-//NOOSHIN: test begin
-int get_info(void *opaque){
-  CPUState* cpu = (CPUState*)opaque;
-
-  int r = 0;
-  printf("QEMU: in get_info\n");
-
-  /* Account partial waits to QEMU_CLOCK_VIRTUAL.  */
-    qemu_account_warp_timer();
-
-    qemu_clock_enable(QEMU_CLOCK_VIRTUAL,
-                          (cpu->singlestep_enabled & SSTEP_NOTIMER) == 0);
+int cpu_exec_instructions(CPUState *cpu, uint64_t count, uint64_t *executed)
+{
+    uint64_t start = cpu_executed_instructions(cpu);
+    uint64_t quantum_end = cpu->quantum_end;
+    CPUState *other_cpu;
+    int r = EXCP_INTERRUPT;
 
-    if (cpu_can_run(cpu)) {
+    /* The step takes the place of the quantum, so the generated code
+     * stops on its last instruction and the instruction events still fire.
+     */
+    cpu->quantum_end = start + count;
+    cpu_budget_update(cpu);
+    while (cpu_executed_instructions(cpu) < start + count) {
+        if (!cpu_can_run(cpu)) {
+            r = EXCP_HALTED;
+            break;
+        }
         r = tcg_cpu_exec(cpu);
-        if (r == EXCP_DEBUG) {
-            cpu_handle_guest_debug(cpu);
-           
+        /* Pairs with smp_wmb in qemu_cpu_kick.  */
+        atomic_mb_set(&exit_request, 0);
+        if (r != EXCP_INTERRUPT) {
+            break;
         }
-    } 
-    /* Pairs with smp_wmb in qemu_cpu_kick.  */
-    atomic_mb_set(&exit_request, 0);
-
-    if (use_icount) {
-        int64_t deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL);
+        /* Kicked before the end of the step, by the main loop asking for
+         * the lock, by a stop request or by work queued on some CPU.
+         */
+        while (iothread_requesting_mutex) {
+            qemu_cond_wait(&qemu_io_proceeded_cond, &qemu_global_mutex);
+        }
+        CPU_FOREACH(other_cpu) {
+            qemu_wait_io_event_common(other_cpu);
+        }
+    }
+    if (r == EXCP_DEBUG) {
+        cpu_handle_guest_debug(cpu);
+    }
+    cpu->hasReachedInstrLimit = false;
+    *executed = cpu_executed_instructions(cpu) - start;
+    cpu->quantum_end = quantum_end;
+    cpu_budget_update(cpu);
 
-        if (deadline == 0) {
-            qemu_clock_notify(QEMU_CLOCK_VIRTUAL);
+    if (r != EXCP_INTERRUPT) {
+        /* Sleeps if no CPU has work, until the main loop wakes one.  */
+        qemu_tcg_wait_io_event(cpu);
+    } else {
+        while (iothread_requesting_mutex) {
+            qemu_cond_wait(&qemu_io_proceeded_cond, &qemu_global_mutex);
         }
     }
-    qemu_tcg_wait_io_event(QTAILQ_FIRST(&cpus));
+    return r;
 }
-//NOOSHIN: test end
-#endif
 
 
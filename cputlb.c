@@ -29,6 +29,9 @@
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
+#include "qemu/main-loop.h"
+#include "exec/helper-proto.h"
+#include "translate-all.h"
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -58,6 +61,74 @@
 /* statistics */
 int tlb_flush_count;
 
+/* With -tcg-threads multi, the TLB of a vCPU is only modified by its own
+ * thread, or in an exclusive section: the flushes asked by the other
+ * threads are queued as work for it, and done before it executes guest
+ * code again.
+ */
+static bool tlb_flush_is_remote(CPUState *cpu)
+{
+    return qemu_tcg_mttcg_enabled() && cpu->created && !qemu_cpu_is_self(cpu);
+}
+
+typedef struct TLBFlushWork {
+    CPUState *cpu;
+    target_ulong addr;
+    uint16_t idxmap;
+} TLBFlushWork;
+
+QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
+
+static void tlb_flush_page_by_mmuidx_map(CPUState *cpu, target_ulong addr,
+                                         uint16_t idxmap);
+
+static uint16_t tlb_mmuidx_map(va_list argp)
+{
+    uint16_t idxmap = 0;
+
+    for (;;) {
+        int mmu_idx = va_arg(argp, int);
+
+        if (mmu_idx < 0) {
+            break;
+        }
+        idxmap |= 1 << mmu_idx;
+    }
+    return idxmap;
+}
+
+static void tlb_flush_work(void *data)
+{
+    tlb_flush(data, 1);
+}
+
+static void tlb_flush_page_work(void *data)
+{
+    TLBFlushWork *w = data;
+
+    tlb_flush_page(w->cpu, w->addr);
+    g_free(w);
+}
+
+static void tlb_flush_page_by_mmuidx_work(void *data)
+{
+    TLBFlushWork *w = data;
+
+    tlb_flush_page_by_mmuidx_map(w->cpu, w->addr, w->idxmap);
+    g_free(w);
+}
+
+static void tlb_flush_queue(CPUState *cpu, target_ulong addr,
+                            uint16_t idxmap, void (*func)(void *data))
+{
+    TLBFlushWork *w = g_new(TLBFlushWork, 1);
+
+    w->cpu = cpu;
+    w->addr = addr;
+    w->idxmap = idxmap;
+    async_run_on_cpu(cpu, func, w);
+}
+
 /* NOTE:
  * If flush_global is true (the usual case), flush all tlb entries.
  * If flush_global is false, flush (at least) all tlb entries not
@@ -70,12 +141,10 @@ int tlb_flush_count;
  * entries from the TLB at any time, so flushing more entries than
  * required is only an efficiency issue, not a correctness issue.
  */
-void tlb_flush(CPUState *cpu, int flush_global)
+static void tlb_flush_nocheck(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
 
-    tlb_debug("(%d)\n", flush_global);
-
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     cpu->current_tb = NULL;
@@ -87,23 +156,36 @@ void tlb_flush(CPUState *cpu, int flush_global)
     env->vtlb_index = 0;
     env->tlb_flush_addr = -1;
     env->tlb_flush_mask = 0;
+#ifdef CONFIG_FLEXUS
+    memset(env->flexus_v2p, -1, sizeof(env->flexus_v2p));
+#endif
     tlb_flush_count++;
 }
 
-static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
+void tlb_flush(CPUState *cpu, int flush_global)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        async_run_on_cpu(cpu, tlb_flush_work, cpu);
+        return;
+    }
+
+    tlb_debug("(%d)\n", flush_global);
+    tlb_flush_nocheck(cpu);
+}
+
+static void tlb_flush_by_mmuidx_map(CPUState *cpu, uint16_t idxmap)
 {
     CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
 
     tlb_debug("start\n");
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    for (;;) {
-        int mmu_idx = va_arg(argp, int);
-
-        if (mmu_idx < 0) {
-            break;
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (!(idxmap & (1 << mmu_idx))) {
+            continue;
         }
 
         tlb_debug("%d\n", mmu_idx);
@@ -112,15 +194,34 @@ static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
         memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
     }
 
+#ifdef CONFIG_FLEXUS
+    memset(env->flexus_v2p, -1, sizeof(env->flexus_v2p));
+#endif
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
 }
 
+static void tlb_flush_by_mmuidx_work(void *data)
+{
+    TLBFlushWork *w = data;
+
+    tlb_flush_by_mmuidx_map(w->cpu, w->idxmap);
+    g_free(w);
+}
+
 void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 {
     va_list argp;
+    uint16_t idxmap;
+
     va_start(argp, cpu);
-    v_tlb_flush_by_mmuidx(cpu, argp);
+    idxmap = tlb_mmuidx_map(argp);
     va_end(argp);
+
+    if (tlb_flush_is_remote(cpu)) {
+        tlb_flush_queue(cpu, 0, idxmap, tlb_flush_by_mmuidx_work);
+        return;
+    }
+    tlb_flush_by_mmuidx_map(cpu, idxmap);
 }
 
 static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
@@ -135,7 +236,26 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
     }
 }
 
-void tlb_flush_page(CPUState *cpu, target_ulong addr)
+#ifdef CONFIG_FLEXUS
+static inline CPUFlexusV2PEntry *flexus_v2p_entry(CPUArchState *env,
+                                                  target_ulong addr)
+{
+    return &env->flexus_v2p[(addr >> TARGET_PAGE_BITS) &
+                            (CPU_FLEXUS_V2P_SIZE - 1)];
+}
+
+static inline void flexus_v2p_flush_page(CPUArchState *env,
+                                         target_ulong addr)
+{
+    CPUFlexusV2PEntry *entry = flexus_v2p_entry(env, addr);
+
+    if (entry->vaddr == addr) {
+        memset(entry, -1, sizeof(*entry));
+    }
+}
+#endif
+
+static void tlb_flush_page_nocheck(CPUState *cpu, target_ulong addr)
 {
     CPUArchState *env = cpu->env_ptr;
     int i;
@@ -149,7 +269,7 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   env->tlb_flush_addr, env->tlb_flush_mask);
 
-        tlb_flush(cpu, 1);
+        tlb_flush_nocheck(cpu);
         return;
     }
     /* must reset current TB so that interrupts cannot modify the
@@ -169,17 +289,44 @@ void tlb_flush_page(CPUState *cpu, target_ulong addr)
             tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
         }
     }
+#ifdef CONFIG_FLEXUS
+    flexus_v2p_flush_page(env, addr);
+#endif
 
     tb_flush_jmp_cache(cpu, addr);
 }
 
+void tlb_flush_page(CPUState *cpu, target_ulong addr)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        tlb_flush_queue(cpu, addr, 0, tlb_flush_page_work);
+        return;
+    }
+    tlb_flush_page_nocheck(cpu, addr);
+}
+
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
 {
-    CPUArchState *env = cpu->env_ptr;
-    int i, k;
     va_list argp;
+    uint16_t idxmap;
 
     va_start(argp, addr);
+    idxmap = tlb_mmuidx_map(argp);
+    va_end(argp);
+
+    if (tlb_flush_is_remote(cpu)) {
+        tlb_flush_queue(cpu, addr, idxmap, tlb_flush_page_by_mmuidx_work);
+        return;
+    }
+    tlb_flush_page_by_mmuidx_map(cpu, addr, idxmap);
+}
+
+static void tlb_flush_page_by_mmuidx_map(CPUState *cpu, target_ulong addr,
+                                         uint16_t idxmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int i, k;
+    int mmu_idx;
 
     tlb_debug("addr "TARGET_FMT_lx"\n", addr);
 
@@ -189,8 +336,7 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
                   TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
                   env->tlb_flush_addr, env->tlb_flush_mask);
 
-        v_tlb_flush_by_mmuidx(cpu, argp);
-        va_end(argp);
+        tlb_flush_by_mmuidx_map(cpu, idxmap);
         return;
     }
     /* must reset current TB so that interrupts cannot modify the
@@ -200,11 +346,9 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
     addr &= TARGET_PAGE_MASK;
     i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
 
-    for (;;) {
-        int mmu_idx = va_arg(argp, int);
-
-        if (mmu_idx < 0) {
-            break;
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (!(idxmap & (1 << mmu_idx))) {
+            continue;
         }
 
         tlb_debug("idx %d\n", mmu_idx);
@@ -216,11 +360,126 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
             tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
         }
     }
-    va_end(argp);
+#ifdef CONFIG_FLEXUS
+    flexus_v2p_flush_page(env, addr);
+#endif
 
     tb_flush_jmp_cache(cpu, addr);
 }
 
+/* The broadcast invalidations must have completed on every vCPU before
+ * the one that issued them executes another guest instruction, a
+ * barrier after them could not order anything otherwise.  Queueing work
+ * for the other vCPUs is not enough with -tcg-threads multi: they may
+ * keep running with the stale entries for a while.  Instead the issuing
+ * vCPU flushes its own TLB, leaves its TB (the write to the system
+ * register ends it) and flushes the other TLBs in an exclusive section
+ * before it runs again.
+ */
+typedef void TLBFlushFunc(CPUState *cpu, target_ulong addr, uint16_t idxmap);
+
+typedef struct TLBFlushSyncedWork {
+    CPUState *src;
+    target_ulong addr;
+    uint16_t idxmap;
+    TLBFlushFunc *flush;
+} TLBFlushSyncedWork;
+
+static void tlb_flush_all_map(CPUState *cpu, target_ulong addr,
+                              uint16_t idxmap)
+{
+    tlb_flush_nocheck(cpu);
+}
+
+static void tlb_flush_page_all_map(CPUState *cpu, target_ulong addr,
+                                   uint16_t idxmap)
+{
+    tlb_flush_page_nocheck(cpu, addr);
+}
+
+static void tlb_flush_by_mmuidx_all_map(CPUState *cpu, target_ulong addr,
+                                        uint16_t idxmap)
+{
+    tlb_flush_by_mmuidx_map(cpu, idxmap);
+}
+
+/* Run in an exclusive section: none of the vCPUs executes guest code */
+static void tlb_flush_synced_work(void *data)
+{
+    TLBFlushSyncedWork *w = data;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != w->src) {
+            w->flush(cpu, w->addr, w->idxmap);
+        }
+    }
+    g_free(w);
+}
+
+static void tlb_flush_all_cpus(CPUState *src, target_ulong addr,
+                               uint16_t idxmap, TLBFlushFunc *flush)
+{
+    TLBFlushSyncedWork *w;
+    CPUState *cpu;
+
+    if (!qemu_tcg_mttcg_enabled()) {
+        CPU_FOREACH(cpu) {
+            flush(cpu, addr, idxmap);
+        }
+        return;
+    }
+
+    flush(src, addr, idxmap);
+
+    w = g_new(TLBFlushSyncedWork, 1);
+    w->src = src;
+    w->addr = addr;
+    w->idxmap = idxmap;
+    w->flush = flush;
+    async_safe_run(tlb_flush_synced_work, w);
+
+    /* the vCPU goes through its wait loop, where the safe work is done,
+     * at the end of the current TB */
+    cpu_exit(src);
+}
+
+void tlb_flush_all_cpus_synced(CPUState *src, int flush_global)
+{
+    tlb_debug("(%d)\n", flush_global);
+    tlb_flush_all_cpus(src, 0, 0, tlb_flush_all_map);
+}
+
+void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr)
+{
+    tlb_flush_all_cpus(src, addr, 0, tlb_flush_page_all_map);
+}
+
+void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src, ...)
+{
+    va_list argp;
+    uint16_t idxmap;
+
+    va_start(argp, src);
+    idxmap = tlb_mmuidx_map(argp);
+    va_end(argp);
+
+    tlb_flush_all_cpus(src, 0, idxmap, tlb_flush_by_mmuidx_all_map);
+}
+
+void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src,
+                                              target_ulong addr, ...)
+{
+    va_list argp;
+    uint16_t idxmap;
+
+    va_start(argp, addr);
+    idxmap = tlb_mmuidx_map(argp);
+    va_end(argp);
+
+    tlb_flush_all_cpus(src, addr, idxmap, tlb_flush_page_by_mmuidx_map);
+}
+
 /* update the TLBs so that writes to code in the virtual page 'addr'
    can be detected */
 void tlb_protect_code(ram_addr_t ram_addr)
@@ -249,6 +508,16 @@ void tlb_reset_dirty_range(CPUTLBEntry *tlb_entry, uintptr_t start,
     if (tlb_is_dirty_ram(tlb_entry)) {
         addr = (tlb_entry->addr_write & TARGET_PAGE_MASK) + tlb_entry->addend;
         if ((addr - start) < length) {
+#if HOST_LONG_BITS >= TARGET_LONG_BITS
+            /* the vCPU owning the entry may be refilling it concurrently */
+            if (qemu_tcg_mttcg_enabled()) {
+                target_ulong orig = atomic_read(&tlb_entry->addr_write);
+
+                atomic_cmpxchg(&tlb_entry->addr_write, orig,
+                               orig | TLB_NOTDIRTY);
+                return;
+            }
+#endif
             tlb_entry->addr_write |= TLB_NOTDIRTY;
         }
     }
@@ -401,15 +670,6 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     te = &env->tlb_table[mmu_idx][index];
 
-    /* Flexus code here */
-   #ifdef CONFIG_FLEXUS
-   /* Saving physical address along with the virtual address of a memory operation */
-    te->paddr = paddr;
-    #ifdef TARGET_SPARC64
-	te->dummy[0] = cbits;
-    #endif
-    #endif
-
     /* do not discard the translation in te, evict it into a victim tlb */
     env->tlb_v_table[mmu_idx][vidx] = *te;
     env->iotlb_v[mmu_idx][vidx] = env->iotlb[mmu_idx][index];
@@ -417,6 +677,12 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     /* refill the tlb */
     env->iotlb[mmu_idx][index].addr = iotlb - vaddr;
     env->iotlb[mmu_idx][index].attrs = attrs;
+#ifdef CONFIG_FLEXUS
+    env->iotlb[mmu_idx][index].paddr = paddr;
+#ifdef TARGET_SPARC64
+    env->iotlb[mmu_idx][index].cache_bits = cbits;
+#endif
+#endif
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -513,6 +779,70 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     return qemu_ram_addr_from_host_nofail(p);
 }
 
+#ifdef CONFIG_FLEXUS
+/* Record the data access being made through the softmmu helpers, the
+ * TLB entry of its page must be in the main TLB.
+ */
+static inline void flexus_record_access(CPUArchState *env, target_ulong addr,
+                                        int mmu_idx, int index,
+                                        target_ulong tlb_addr)
+{
+    env->flexus_access.vaddr = addr;
+    env->flexus_access.paddr = env->iotlb[mmu_idx][index].paddr
+                               + (addr & ~TARGET_PAGE_MASK);
+    env->flexus_access.io = (tlb_addr & TLB_MMIO) != 0;
+}
+
+static inline bool flexus_tlb_hit(CPUTLBEntry *tlb_entry, target_ulong addr)
+{
+    return addr == (tlb_entry->addr_read &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_write &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_code &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK));
+}
+
+hwaddr tlb_vaddr_to_paddr(CPUState *cpu, target_ulong addr)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong page = addr & TARGET_PAGE_MASK;
+    target_ulong offset = addr & ~TARGET_PAGE_MASK;
+    int mmu_idx, index, k;
+    CPUFlexusV2PEntry *entry;
+    hwaddr paddr;
+
+    if (!qemu_cpu_is_self(cpu)) {
+        paddr = cpu_get_phys_page_debug(cpu, page);
+        return paddr == -1 ? -1 : paddr + offset;
+    }
+
+    mmu_idx = cpu_mmu_index(env, false);
+    index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    if (flexus_tlb_hit(&env->tlb_table[mmu_idx][index], page)) {
+        return env->iotlb[mmu_idx][index].paddr + offset;
+    }
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        if (flexus_tlb_hit(&env->tlb_v_table[mmu_idx][k], page)) {
+            return env->iotlb_v[mmu_idx][k].paddr + offset;
+        }
+    }
+
+    entry = flexus_v2p_entry(env, page);
+    if (entry->vaddr == page && entry->mmu_idx == mmu_idx) {
+        return entry->paddr + offset;
+    }
+    paddr = cpu_get_phys_page_debug(cpu, page);
+    if (paddr == -1) {
+        return -1;
+    }
+    entry->vaddr = page;
+    entry->paddr = paddr;
+    entry->mmu_idx = mmu_idx;
+    return paddr + offset;
+}
+#endif
+
 #define MMUSUFFIX _mmu
 
 #define SHIFT 0
@@ -528,6 +858,137 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 #include "softmmu_template.h"
 #undef MMUSUFFIX
 
+/* An atomic operation writes to a page holding code: invalidate the TBs
+ * of the bytes written and mark them dirty, as notdirty_mem_write does for
+ * the other stores.  The host then does the access as for any RAM page.
+ */
+static void atomic_notdirty_write(CPUArchState *env, target_ulong addr,
+                                  int size, unsigned mmu_idx, int index,
+                                  uintptr_t retaddr)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    ram_addr_t ram_addr = (env->iotlb[mmu_idx][index].addr & TARGET_PAGE_MASK)
+                          + addr;
+
+    cpu->mem_io_pc = retaddr;
+    if (!cpu_physical_memory_get_dirty_flag(ram_addr, DIRTY_MEMORY_CODE)) {
+        tb_invalidate_phys_page_fast(ram_addr, size);
+    }
+    cpu_physical_memory_set_dirty_range(ram_addr, size, DIRTY_CLIENTS_NOCODE);
+    if (!cpu_physical_memory_is_clean(ram_addr)) {
+        tlb_set_dirty(cpu, addr & TARGET_PAGE_MASK);
+    }
+}
+
+/* Host address of an atomic operation of the guest.  The host cannot do
+ * it atomically on MMIO, pages with watchpoints, unaligned addresses and
+ * without 64-bit atomics for the 64-bit ones: those leave the execution
+ * loop with EXCP_ATOMIC, to be replayed by cpu_exec_step_atomic with the
+ * other vCPUs stopped.  There, NULL is returned and the operation takes
+ * the slow path below, a byte at a time.
+ */
+void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                        TCGMemOpIdx oi, int size, uintptr_t retaddr)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    unsigned mmu_idx = get_mmuidx(oi);
+    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    CPUTLBEntry *tlbe = &env->tlb_table[mmu_idx][index];
+    target_ulong tlb_addr = tlbe->addr_write;
+
+    /* Adjust the given return address.  */
+    retaddr -= GETPC_ADJ;
+
+    if (addr & (size - 1)) {
+        if ((get_memop(oi) & MO_AMASK) == MO_ALIGN) {
+            cpu_unaligned_access(cpu, addr, MMU_DATA_STORE, mmu_idx, retaddr);
+        }
+        goto stop_the_world;
+    }
+
+    if ((addr & TARGET_PAGE_MASK)
+        != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+        if (!VICTIM_TLB_HIT(addr_write)) {
+            tlb_fill(cpu, addr, MMU_DATA_STORE, mmu_idx, retaddr);
+        }
+        tlb_addr = tlbe->addr_write;
+    }
+
+    if ((tlb_addr & ~TARGET_PAGE_MASK) == TLB_NOTDIRTY) {
+        atomic_notdirty_write(env, addr, size, mmu_idx, index, retaddr);
+    } else if (tlb_addr & ~TARGET_PAGE_MASK) {
+        goto stop_the_world;
+    }
+#ifndef CONFIG_ATOMIC64
+    if (size == 8) {
+        goto stop_the_world;
+    }
+#endif
+    return (void *)((uintptr_t)addr + tlbe->addend);
+
+stop_the_world:
+    if (!qemu_tcg_mttcg_enabled() || cpu->exclusive_step) {
+        return NULL;
+    }
+    cpu->exception_index = EXCP_ATOMIC;
+    cpu_loop_exit_restore(cpu, retaddr);
+}
+
+uint64_t atomic_slow_ld(CPUArchState *env, target_ulong addr,
+                        TCGMemOpIdx oi, int size, bool be, uintptr_t retaddr)
+{
+    TCGMemOpIdx oib = make_memop_idx(MO_UB, get_mmuidx(oi));
+    uint64_t val = 0;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        uint64_t b = helper_ret_ldub_mmu(env, addr + i, oib, retaddr);
+
+        val |= b << (8 * (be ? size - 1 - i : i));
+    }
+    return val;
+}
+
+void atomic_slow_st(CPUArchState *env, target_ulong addr, uint64_t val,
+                    TCGMemOpIdx oi, int size, bool be, uintptr_t retaddr)
+{
+    TCGMemOpIdx oib = make_memop_idx(MO_UB, get_mmuidx(oi));
+    int i;
+
+    for (i = 0; i < size; i++) {
+        helper_ret_stb_mmu(env, addr + i, val >> (8 * (be ? size - 1 - i : i)),
+                           oib, retaddr);
+    }
+}
+
+#define SHIFT 0
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 1
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 1
+#define ATOMIC_BE 1
+#include "atomic_template.h"
+
+#define SHIFT 2
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 2
+#define ATOMIC_BE 1
+#include "atomic_template.h"
+
+#define SHIFT 3
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 3
+#define ATOMIC_BE 1
+#include "atomic_template.h"
+
 #define MMUSUFFIX _cmmu
 #undef GETPC_ADJ
 #define GETPC_ADJ 0
@@ -20,6 +20,9 @@
 int dma_memory_set(AddressSpace *as, dma_addr_t addr, uint8_t c, dma_addr_t len)
 {
     dma_barrier(as, DMA_DIRECTION_FROM_DEVICE);
+#ifdef CONFIG_FLEXUS
+    QEMU_dma_transaction(as, addr, len, true);
+#endif
 
 #define FILLBUF_SIZE 512
     uint8_t fillbuf[FILLBUF_SIZE];
@@ -580,6 +580,12 @@ void cpu_address_space_init(CPUState *cpu, AddressSpace *as, int asidx)
     newas = &cpu->cpu_ases[asidx];
     newas->cpu = cpu;
     newas->as = as;
+#ifdef CONFIG_FLEXUS
+    /* The memory is shared with the devices, private spaces are not */
+    if (as != &address_space_memory) {
+        QEMU_dma_ignore_address_space(as);
+    }
+#endif
     if (tcg_enabled()) {
         newas->tcg_as_listener.commit = tcg_commit;
         memory_listener_register(&newas->tcg_as_listener, as);
@@ -2349,6 +2355,8 @@ static void io_mem_init(void)
                           NULL, UINT64_MAX);
     memory_region_init_io(&io_mem_notdirty, NULL, &notdirty_mem_ops, NULL,
                           NULL, UINT64_MAX);
+    /* the stores to pages with code only need tb_lock */
+    memory_region_clear_global_locking(&io_mem_notdirty);
     memory_region_init_io(&io_mem_watch, NULL, &watch_mem_ops, NULL,
                           NULL, UINT64_MAX);
 }
@@ -2450,6 +2458,9 @@ static void memory_map_init(void)
     memory_region_init_io(system_io, NULL, &unassigned_io_ops, NULL, "io",
                           65536);
     address_space_init(&address_space_io, system_io, "I/O");
+#ifdef CONFIG_FLEXUS
+    QEMU_dma_ignore_address_space(&address_space_io);
+#endif
 }
 
 MemoryRegion *get_system_memory(void)
@@ -370,6 +370,68 @@ STEXI
 @item delvm @var{tag}|@var{id}
 @findex delvm
 Delete the snapshot identified by @var{tag} or @var{id}.
+ETEXI
+
+    {
+        .name       = "cpt-start",
+        .args_type  = "dir:s",
+        .params     = "dir",
+        .help       = "record the base checkpoint of a checkpoint library in dir",
+        .mhandler.cmd = hmp_checkpoint_start,
+    },
+
+STEXI
+@item cpt-start @var{dir}
+@findex cpt-start
+Start recording a checkpoint library in directory @var{dir} with a full
+checkpoint of the RAM and device state.  Block devices are not part of the
+library, the guest disks must not be written while recording.
+ETEXI
+
+    {
+        .name       = "cpt-save",
+        .args_type  = "",
+        .params     = "",
+        .help       = "record a sample checkpoint in the current checkpoint library",
+        .mhandler.cmd = hmp_checkpoint_save,
+    },
+
+STEXI
+@item cpt-save
+@findex cpt-save
+Record the next sample checkpoint of the checkpoint library.  It only holds
+the device state and the RAM pages written since the base checkpoint.
+ETEXI
+
+    {
+        .name       = "cpt-stop",
+        .args_type  = "",
+        .params     = "",
+        .help       = "stop recording the current checkpoint library",
+        .mhandler.cmd = hmp_checkpoint_stop,
+    },
+
+STEXI
+@item cpt-stop
+@findex cpt-stop
+Stop recording the checkpoint library.
+ETEXI
+
+    {
+        .name       = "cpt-load",
+        .args_type  = "dir:s,index:i",
+        .params     = "dir index",
+        .help       = "restore a checkpoint of the checkpoint library in dir, -1 for its base",
+        .mhandler.cmd = hmp_checkpoint_load,
+    },
+
+STEXI
+@item cpt-load @var{dir} @var{index}
+@findex cpt-load
+Set the whole virtual machine but its disks to sample checkpoint @var{index}
+of the checkpoint library in @var{dir}, or to its base checkpoint for -1.
+The RAM image of the base is mapped copy-on-write, so only the pages of the
+sample are read.
 ETEXI
 
     {
@@ -1780,6 +1842,62 @@ STEXI
 @findex zero total instructions, Debug information
 Zero out total number of instructions, Debug information.
 
+ETEXI
+
+#if defined(CONFIG_FLEXUS)
+    {
+        .name       = "flexus-bench",
+        .args_type  = "instructions:l,file:s,modes:s?",
+        .params     = "instructions file [mode,...]",
+        .help       = "measure the MIPS and the instrumentation callback costs "
+                      "of each mode (off, fetch, ls, both, dma)",
+        .mhandler.cmd = hmp_flexus_bench,
+    },
+#endif
+
+STEXI
+@item flexus-bench @var{instructions} @var{file} [@var{mode},...]
+@findex flexus-bench
+Measure the MIPS and the cost of the Flexus instrumentation callbacks for
+@var{instructions} instructions in each of the comma-separated modes
+@code{off}, @code{fetch}, @code{ls}, @code{both} and @code{dma}, all of
+them by default.  The guest keeps running and the JSON report is written to
+@var{file} once the last mode is done.
+ETEXI
+
+#if defined(CONFIG_FLEXUS)
+    {
+        .name       = "flexus-trace-record-start",
+        .args_type  = "file:F",
+        .params     = "file",
+        .help       = "record the memory accesses of the cpus and the devices "
+                      "to a compressed trace file",
+        .mhandler.cmd = hmp_flexus_trace_record_start,
+    },
+#endif
+
+STEXI
+@item flexus-trace-record-start @var{file}
+@findex flexus-trace-record-start
+Record the instruction fetches, loads and stores of the cpus and the DMA
+accesses of the devices to the compressed trace @var{file}, until
+@code{flexus-trace-record-stop}.  The cpus are instrumented while recording.
+ETEXI
+
+#if defined(CONFIG_FLEXUS)
+    {
+        .name       = "flexus-trace-record-stop",
+        .args_type  = "",
+        .params     = "",
+        .help       = "stop recording the trace",
+        .mhandler.cmd = hmp_flexus_trace_record_stop,
+    },
+#endif
+
+STEXI
+@item flexus-trace-record-stop
+@findex flexus-trace-record-stop
+Stop recording the trace and finish writing its file.
 ETEXI
 
     {
@@ -1928,6 +1928,52 @@ void hmp_cpu_zero_all(Monitor *mon,  const QDict *qdict)
 
 }
 
+void hmp_flexus_bench(Monitor *mon, const QDict *qdict)
+{
+    int64_t instructions = qdict_get_int(qdict, "instructions");
+    const char *file = qdict_get_str(qdict, "file");
+    const char *modes_str = qdict_get_try_str(qdict, "modes");
+    FlexusBenchModeList *modes = NULL, **tail = &modes;
+    Error *err = NULL;
+
+    if (modes_str) {
+        char **names = g_strsplit(modes_str, ",", 0);
+        int i;
+
+        for (i = 0; names[i] && !err; i++) {
+            int mode = qapi_enum_parse(FlexusBenchMode_lookup, names[i],
+                                       FLEXUS_BENCH_MODE__MAX, -1, &err);
+            if (mode >= 0) {
+                *tail = g_new0(FlexusBenchModeList, 1);
+                (*tail)->value = mode;
+                tail = &(*tail)->next;
+            }
+        }
+        g_strfreev(names);
+    }
+    if (!err) {
+        qmp_flexus_bench(instructions, file, modes != NULL, modes, &err);
+    }
+    qapi_free_FlexusBenchModeList(modes);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_flexus_trace_record_start(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_flexus_trace_record_start(qdict_get_str(qdict, "file"), &err);
+    hmp_handle_error(mon, &err);
+}
+
+void hmp_flexus_trace_record_stop(Monitor *mon, const QDict *qdict)
+{
+    Error *err = NULL;
+
+    qmp_flexus_trace_record_stop(&err);
+    hmp_handle_error(mon, &err);
+}
+
 
 void hmp_chardev_add(Monitor *mon, const QDict *qdict)
 {
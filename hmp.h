@@ -104,6 +104,9 @@ void hmp_cpu_get_quantum(Monitor *mon,  const QDict *qdict);
 void hmp_cpu_set_quantum(Monitor *mon, const QDict *qdict);
 void hmp_cpu_get_ic(Monitor *mon,  const QDict *qdict);
 void hmp_cpu_zero_all(Monitor *mon,  const QDict *qdict);
+void hmp_flexus_bench(Monitor *mon, const QDict *qdict);
+void hmp_flexus_trace_record_start(Monitor *mon, const QDict *qdict);
+void hmp_flexus_trace_record_stop(Monitor *mon, const QDict *qdict);
 
 
 void hmp_object_add(Monitor *mon, const QDict *qdict);
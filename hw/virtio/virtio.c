@@ -23,6 +23,9 @@
 #include "hw/virtio/virtio-bus.h"
 #include "migration/migration.h"
 #include "hw/virtio/virtio-access.h"
+#ifdef CONFIG_FLEXUS
+#include "hw/pci/pci.h"
+#endif
 
 /*
  * The alignment to use between consumer and producer parts of vring.
@@ -450,7 +453,24 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
-static void virtqueue_map_desc(unsigned int *p_num_sg, hwaddr *addr, struct iovec *iov,
+#ifdef CONFIG_FLEXUS
+/* The buffers are mapped from the system memory, but a device behind a PCI
+ * function is reported as that function like its other DMA.
+ */
+static AddressSpace *virtio_dma_address_space(VirtIODevice *vdev)
+{
+    BusState *bus = qdev_get_parent_bus(DEVICE(vdev));
+
+    if (bus && bus->parent &&
+        object_dynamic_cast(OBJECT(bus->parent), TYPE_PCI_DEVICE)) {
+        return pci_get_address_space(PCI_DEVICE(bus->parent));
+    }
+    return &address_space_memory;
+}
+#endif
+
+static void virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
+                               hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
                                hwaddr pa, size_t sz)
 {
@@ -466,6 +486,10 @@ static void virtqueue_map_desc(unsigned int *p_num_sg, hwaddr *addr, struct iove
         }
 
         iov[num_sg].iov_base = cpu_physical_memory_map(pa, &len, is_write);
+#ifdef CONFIG_FLEXUS
+        QEMU_dma_transaction(virtio_dma_address_space(vdev), pa, len,
+                             is_write);
+#endif
         iov[num_sg].iov_len = len;
         addr[num_sg] = pa;
 
@@ -583,14 +607,14 @@ void *virtqueue_pop(VirtQueue *vq, size_t sz)
     /* Collect all the descriptors */
     do {
         if (desc.flags & VRING_DESC_F_WRITE) {
-            virtqueue_map_desc(&in_num, addr + out_num, iov + out_num,
+            virtqueue_map_desc(vdev, &in_num, addr + out_num, iov + out_num,
                                VIRTQUEUE_MAX_SIZE - out_num, true, desc.addr, desc.len);
         } else {
             if (in_num) {
                 error_report("Incorrect order for descriptors");
                 exit(1);
             }
-            virtqueue_map_desc(&out_num, addr, iov,
+            virtqueue_map_desc(vdev, &out_num, addr, iov,
                                VIRTQUEUE_MAX_SIZE, false, desc.addr, desc.len);
         }
 
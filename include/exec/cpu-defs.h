@@ -56,30 +56,12 @@ typedef uint64_t target_ulong;
 #if !defined(CONFIG_USER_ONLY)
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
-/*
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
-*/
-
-#ifdef CONFIG_FLEXUS
-	#if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
-	#define CPU_TLB_ENTRY_BITS 5
-	#else
-	#define CPU_TLB_ENTRY_BITS 6
-	#endif
-#else
-	#if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
-	#define CPU_TLB_ENTRY_BITS 4
-	#else
-	#define CPU_TLB_ENTRY_BITS 5
-	#endif
-#endif
-
-
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -129,28 +111,11 @@ typedef struct CPUTLBEntry {
             uintptr_t addend;
         };
         /* padding to get a power of two size */
-       // uint8_t dummy[1 << CPU_TLB_ENTRY_BITS];
-       #ifdef CONFIG_FLEXUS
-    target_ulong paddr;
-    /* padding to get a power of two size */
-    uint8_t dummy[(1 << CPU_TLB_ENTRY_BITS) -
-                  (sizeof(target_ulong) * 4 +
-                   ((-sizeof(target_ulong) * 4) & (sizeof(uintptr_t) - 1)) +
-                   sizeof(uintptr_t))];
-#else
-    /* padding to get a power of two size */
-    uint8_t dummy[(1 << CPU_TLB_ENTRY_BITS) -
-                  (sizeof(target_ulong) * 3 +
-                   ((-sizeof(target_ulong) * 3) & (sizeof(uintptr_t) - 1)) +
-                   sizeof(uintptr_t))];
-#endif
-        
+        uint8_t dummy[1 << CPU_TLB_ENTRY_BITS];
     };
 } CPUTLBEntry;
 
-#ifndef CONFIG_FLEXUS// Don't know why it is not working
 QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
-#endif
 
 /* The IOTLB is not accessed directly inline by generated TCG code,
  * so the CPUIOTLBEntry layout is not as critical as that of the
@@ -160,8 +125,48 @@ QEMU_BUILD_BUG_ON(sizeof(CPUTLBEntry) != (1 << CPU_TLB_ENTRY_BITS));
 typedef struct CPUIOTLBEntry {
     hwaddr addr;
     MemTxAttrs attrs;
+#ifdef CONFIG_FLEXUS
+    /* Guest physical address of the page.  Kept here rather than in the
+     * CPUTLBEntry so that the fast path entry keeps its size.
+     */
+    hwaddr paddr;
+#ifdef TARGET_SPARC64
+    uint8_t cache_bits;
+#endif
+#endif
 } CPUIOTLBEntry;
 
+#ifdef CONFIG_FLEXUS
+/* The last data access made through the softmmu helpers.  Instrumented
+ * TBs make all their guest accesses through them, so that the tracing
+ * helpers find the physical address here instead of probing the TLB
+ * again.
+ */
+typedef struct CPUFlexusAccess {
+    target_ulong vaddr;
+    hwaddr paddr;
+    bool io;
+} CPUFlexusAccess;
+
+/* Translations that tlb_vaddr_to_paddr found by walking the page tables,
+ * direct mapped by virtual page and flushed along with the TLB.
+ */
+#define CPU_FLEXUS_V2P_BITS 6
+#define CPU_FLEXUS_V2P_SIZE (1 << CPU_FLEXUS_V2P_BITS)
+
+typedef struct CPUFlexusV2PEntry {
+    target_ulong vaddr;
+    hwaddr paddr;
+    int mmu_idx;
+} CPUFlexusV2PEntry;
+
+#define CPU_COMMON_FLEXUS_ACCESS                                        \
+    CPUFlexusAccess flexus_access;                                      \
+    CPUFlexusV2PEntry flexus_v2p[CPU_FLEXUS_V2P_SIZE];
+#else
+#define CPU_COMMON_FLEXUS_ACCESS
+#endif
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
@@ -171,6 +176,7 @@ typedef struct CPUIOTLBEntry {
     target_ulong tlb_flush_addr;                                        \
     target_ulong tlb_flush_mask;                                        \
     target_ulong vtlb_index;                                            \
+    CPU_COMMON_FLEXUS_ACCESS                                            \
 
 #else
 
@@ -81,6 +81,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 void cpu_exec_init(CPUState *cpu, Error **errp);
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
+#if !defined(CONFIG_USER_ONLY)
+void cpu_exec_step_atomic(CPUState *cpu);
+#endif
 
 #if !defined(CONFIG_USER_ONLY)
 void cpu_reloading_memory_map(void);
@@ -153,6 +156,45 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...);
  * MMU indexes.
  */
 void tlb_flush_by_mmuidx(CPUState *cpu, ...);
+/**
+ * tlb_flush_all_cpus_synced:
+ * @src: CPU that issued the flush
+ * @flush_global: ignored
+ *
+ * Flush the entire TLB of every CPU, like tlb_flush() on each of them.
+ * The flush has completed everywhere before @src executes another guest
+ * instruction: with -tcg-threads multi, @src leaves its current TB and
+ * the TLBs of the other CPUs are flushed in an exclusive section.  This
+ * is what the broadcast (inner shareable) invalidations need.
+ */
+void tlb_flush_all_cpus_synced(CPUState *src, int flush_global);
+/**
+ * tlb_flush_page_all_cpus_synced:
+ * @src: CPU that issued the flush
+ * @addr: virtual address of page to be flushed
+ *
+ * Like tlb_flush_all_cpus_synced(), for one page.
+ */
+void tlb_flush_page_all_cpus_synced(CPUState *src, target_ulong addr);
+/**
+ * tlb_flush_by_mmuidx_all_cpus_synced:
+ * @src: CPU that issued the flush
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Like tlb_flush_all_cpus_synced(), for the specified MMU indexes.
+ */
+void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src, ...);
+/**
+ * tlb_flush_page_by_mmuidx_all_cpus_synced:
+ * @src: CPU that issued the flush
+ * @addr: virtual address of page to be flushed
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Like tlb_flush_all_cpus_synced(), for one page and the specified MMU
+ * indexes.
+ */
+void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src,
+                                              target_ulong addr, ...);
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
@@ -204,6 +246,20 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
 			       int prot, int mmu_idx, target_ulong size);
 #endif
 
+#ifdef CONFIG_FLEXUS
+/**
+ * tlb_vaddr_to_paddr:
+ * @cpu: CPU whose translation to use
+ * @addr: virtual address to translate
+ *
+ * Return the physical address the CPU accesses data at @addr with in
+ * its current MMU mode, or -1 if the page is not mapped.  The TLB and
+ * the pages already translated are looked up before walking the page
+ * tables.  Only the thread running the CPU looks at its TLB, the other
+ * threads always walk the page tables.
+ */
+hwaddr tlb_vaddr_to_paddr(CPUState *cpu, target_ulong addr);
+#endif
 
 void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr);
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
@@ -225,12 +281,38 @@ static inline void tlb_flush_page_by_mmuidx(CPUState *cpu,
 static inline void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 {
 }
+
+static inline void tlb_flush_all_cpus_synced(CPUState *src, int flush_global)
+{
+}
+
+static inline void tlb_flush_page_all_cpus_synced(CPUState *src,
+                                                  target_ulong addr)
+{
+}
+
+static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src, ...)
+{
+}
+
+static inline void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src,
+                                                            target_ulong addr,
+                                                            ...)
+{
+}
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
-#define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+/* initial size of tb_ctx.htable, which grows with the number of TBs */
+#define CODE_GEN_HTABLE_BITS     15
+#define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
+
+/* The code buffer is split in up to that many regions, filled one after the
+   other; a region is never smaller than CODE_GEN_MIN_REGION_SIZE so that
+   any TB fits in a region once it was emptied.  */
+#define CODE_GEN_MAX_REGIONS        8
+#define CODE_GEN_MIN_REGION_SIZE    (1024 * 1024)
 
 /* Estimated block size for TB allocation.  */
 /* ??? The following is based on a 2015 survey of x86_64 host output.
@@ -263,11 +345,12 @@ struct TranslationBlock {
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
 #define CF_IGNORE_ICOUNT 0x40000 /* Do not generate icount code */
+#define CF_STEP        0x80000 /* Runs exactly CF_COUNT_MASK insns, only
+                                  found by its count */
+#define CF_QUANTUM     0x100000 /* Charges its insns to the quantum budget */
 
     void *tc_ptr;    /* pointer to the translated code */
     uint8_t *tc_search;  /* pointer to search data */
-    /* next matching tb for physical address. */
-    struct TranslationBlock *phys_hash_next;
     /* original tb when cflags has CF_NOCACHE */
     struct TranslationBlock *orig_tb;
     /* first and second physical page containing code. The lower bit
@@ -289,22 +372,49 @@ struct TranslationBlock {
        jmp_first */
     struct TranslationBlock *jmp_next[2];
     struct TranslationBlock *jmp_first;
+#ifdef CONFIG_FLEXUS
+    /* static descriptors of the guest instructions, NULL when the target
+       does not describe them; released with the region of the TB */
+    struct QEMU_insn_desc *flexus_descs;
+#endif
 };
 
 #include "qemu/thread.h"
+#include "qemu/qht.h"
 
 typedef struct TBContext TBContext;
 
+/* A slice of the code buffer and of the tbs array, whose TBs are evicted
+   together when the buffer is full.  */
+typedef struct TBRegion {
+    void *code_start;
+    void *code_end;
+    /* end of the generated code, code_gen_ptr for the current region */
+    void *code_ptr;
+    /* the TBs of the region are tbs[tb_start] to tbs[tb_start + nb_tbs - 1],
+       in the order of their code */
+    int tb_start;
+    int tb_max;
+    int nb_tbs;
+} TBRegion;
+
 struct TBContext {
 
     TranslationBlock *tbs;
-    TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
+    /* the TBs by tb_hash_func of their key, looked up under RCU */
+    struct qht htable;
     int nb_tbs;
+    /* set up by the first allocation, once the prologue was generated;
+       the region after the current one is the oldest */
+    TBRegion regions[CODE_GEN_MAX_REGIONS];
+    int nb_regions;
+    int cur_region;
     /* any access to the tbs or the page table must use this lock */
     QemuMutex tb_lock;
 
     /* statistics */
     int tb_flush_count;
+    int tb_region_evict_count;
     int tb_phys_invalidate_count;
 
     int tb_invalidated_flag;
@@ -312,6 +422,9 @@ struct TBContext {
 
 void tb_free(TranslationBlock *tb);
 void tb_flush(CPUState *cpu);
+#if !defined(CONFIG_USER_ONLY)
+void tb_revalidate_code(CPUState *cpu);
+#endif
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 
 #if defined(USE_DIRECT_JUMP)
@@ -329,8 +442,8 @@ void ppc_tb_set_jmp_target(uintptr_t jmp_addr, uintptr_t addr);
 #elif defined(__i386__) || defined(__x86_64__)
 static inline void tb_set_jmp_target1(uintptr_t jmp_addr, uintptr_t addr)
 {
-    /* patch the branch destination */
-    stl_le_p((void*)jmp_addr, addr - (jmp_addr + 4));
+    /* patch the branch destination, aligned by the backend */
+    atomic_set((int32_t *)jmp_addr, addr - (jmp_addr + 4));
     /* no need to flush icache explicitly */
 }
 #elif defined(__s390x__)
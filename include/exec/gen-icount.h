@@ -8,6 +8,7 @@
 static TCGArg *icount_arg;
 static TCGLabel *icount_label;
 static TCGLabel *exitreq_label;
+static TCGArg *quantum_arg;
 
 static inline void gen_tb_start(TranslationBlock *tb)
 {
@@ -21,6 +22,34 @@ static inline void gen_tb_start(TranslationBlock *tb)
     tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
     tcg_temp_free_i32(flag);
 
+    if (!(tb->cflags & CF_QUANTUM)) {
+        goto icount;
+    }
+
+    /* Charge the whole block to the quantum budget of the CPU up front,
+     * the same way icount does.  If the budget does not cover the block
+     * none of it is executed and cpu_exec finishes the quantum.
+     */
+    count = tcg_temp_local_new_i32();
+    tcg_gen_ld_i32(count, cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, quantum_budget));
+
+    imm = tcg_temp_new_i32();
+    tcg_gen_movi_i32(imm, 0xdeadbeef);
+
+    i = tcg_ctx.gen_last_op_idx;
+    i = tcg_ctx.gen_op_buf[i].args;
+    quantum_arg = &tcg_ctx.gen_opparam_buf[i + 1];
+
+    tcg_gen_sub_i32(count, count, imm);
+    tcg_temp_free_i32(imm);
+
+    tcg_gen_brcondi_i32(TCG_COND_LT, count, 0, exitreq_label);
+    tcg_gen_st_i32(count, cpu_env,
+                   -ENV_OFFSET + offsetof(CPUState, quantum_budget));
+    tcg_temp_free_i32(count);
+
+ icount:
     if (!(tb->cflags & CF_USE_ICOUNT)) {
         return;
     }
@@ -49,6 +78,9 @@ static inline void gen_tb_start(TranslationBlock *tb)
 
 static void gen_tb_end(TranslationBlock *tb, int num_insns)
 {
+    if (tb->cflags & CF_QUANTUM) {
+        *quantum_arg = num_insns;
+    }
     gen_set_label(exitreq_label);
     tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
 
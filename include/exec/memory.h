@@ -31,6 +31,9 @@
 #include "qemu/notify.h"
 #include "qom/object.h"
 #include "qemu/rcu.h"
+#ifdef CONFIG_FLEXUS
+#include "libqemuflex/dma.h"
+#endif
 
 #define MAX_PHYS_ADDR_SPACE_BITS 62
 #define MAX_PHYS_ADDR            (((hwaddr)1 << MAX_PHYS_ADDR_SPACE_BITS) - 1)
@@ -249,6 +252,10 @@ struct AddressSpace {
     struct AddressSpaceDispatch *dispatch;
     struct AddressSpaceDispatch *next_dispatch;
     MemoryListener dispatch_listener;
+#ifdef CONFIG_FLEXUS
+    /* Initiator of the DMA reported to Flexus through this space */
+    QEMU_dma_initiator_t *dma_initiator;
+#endif
 
     QTAILQ_ENTRY(AddressSpace) address_spaces_link;
 };
@@ -0,0 +1,68 @@
+/*
+ * Checkpoint library for sampled simulation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ */
+
+#ifndef QEMU_MIGRATION_CHECKPOINT_H
+#define QEMU_MIGRATION_CHECKPOINT_H
+
+/*
+ * A checkpoint library is a directory holding a full base checkpoint and
+ * the checkpoints of the sample points recorded after it in the same run.
+ * A sample checkpoint only holds the RAM pages written since the base and
+ * the device state, so restoring it maps the base RAM image copy-on-write
+ * and reads nothing but its own pages.  Block devices are not part of the
+ * library, the guest disks must not be written while recording.
+ */
+
+/**
+ * checkpoint_start: Record the base checkpoint of a new library
+ *
+ * Returns 0 on success, -1 on error
+ *
+ * @dir: directory of the library, created if needed
+ * @errp: pointer to Error*, to store an error if it happens
+ */
+int checkpoint_start(const char *dir, Error **errp);
+
+/**
+ * checkpoint_save: Record a sample checkpoint in the current library
+ *
+ * Returns the index of the checkpoint on success, -1 on error
+ *
+ * @errp: pointer to Error*, to store an error if it happens
+ */
+int checkpoint_save(Error **errp);
+
+/**
+ * checkpoint_request: Record a sample checkpoint at the current instruction
+ *
+ * Can be called from any thread.  Called while a vCPU executes, e.g. from
+ * an instrumentation callback, the vCPU stops when it leaves its current
+ * TB: exactly at the current instruction from a callback run between two
+ * TBs, like the sampling phase changes, otherwise after the rest of the TB.
+ * The checkpoint is recorded from the main loop, and the VM resumes if it
+ * was running.
+ */
+void checkpoint_request(void);
+
+/**
+ * checkpoint_stop: Stop recording the current library
+ */
+void checkpoint_stop(void);
+
+/**
+ * checkpoint_load: Restore a checkpoint of a library
+ *
+ * Returns 0 on success, -1 on error
+ *
+ * @dir: directory of the library
+ * @index: index of the sample checkpoint, -1 for the base checkpoint
+ * @errp: pointer to Error*, to store an error if it happens
+ */
+int checkpoint_load(const char *dir, int index, Error **errp);
+
+#endif
@@ -133,6 +133,22 @@
     _old;                                                               \
     })
 
+/* The same without the size check, for the 64-bit values of the hosts
+ * with CONFIG_ATOMIC64 */
+#define atomic_xchg__nocheck(ptr, i)    ({                  \
+    typeof(*ptr) _new = (i), _old;                          \
+    __atomic_exchange(ptr, &_new, &_old, __ATOMIC_SEQ_CST); \
+    _old;                                                   \
+})
+
+#define atomic_cmpxchg__nocheck(ptr, old, new)                          \
+    ({                                                                  \
+    typeof(*ptr) _old = (old), _new = (new);                            \
+    __atomic_compare_exchange(ptr, &_old, &_new, false,                 \
+                              __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);      \
+    _old;                                                               \
+    })
+
 /* Provide shorter names for GCC atomic builtins, return old value */
 #define atomic_fetch_inc(ptr)  __atomic_fetch_add(ptr, 1, __ATOMIC_SEQ_CST)
 #define atomic_fetch_dec(ptr)  __atomic_fetch_sub(ptr, 1, __ATOMIC_SEQ_CST)
@@ -140,6 +156,7 @@
 #define atomic_fetch_sub(ptr, n) __atomic_fetch_sub(ptr, n, __ATOMIC_SEQ_CST)
 #define atomic_fetch_and(ptr, n) __atomic_fetch_and(ptr, n, __ATOMIC_SEQ_CST)
 #define atomic_fetch_or(ptr, n)  __atomic_fetch_or(ptr, n, __ATOMIC_SEQ_CST)
+#define atomic_fetch_xor(ptr, n) __atomic_fetch_xor(ptr, n, __ATOMIC_SEQ_CST)
 
 /* And even shorter names that return void.  */
 #define atomic_inc(ptr)    ((void) __atomic_fetch_add(ptr, 1, __ATOMIC_SEQ_CST))
@@ -334,8 +351,12 @@
 #define atomic_fetch_sub       __sync_fetch_and_sub
 #define atomic_fetch_and       __sync_fetch_and_and
 #define atomic_fetch_or        __sync_fetch_and_or
+#define atomic_fetch_xor       __sync_fetch_and_xor
 #define atomic_cmpxchg         __sync_val_compare_and_swap
 
+#define atomic_xchg__nocheck     atomic_xchg
+#define atomic_cmpxchg__nocheck  atomic_cmpxchg
+
 /* And even shorter names that return void.  */
 #define atomic_inc(ptr)        ((void) __sync_fetch_and_add(ptr, 1))
 #define atomic_dec(ptr)        ((void) __sync_fetch_and_add(ptr, -1))
@@ -345,4 +366,75 @@
 #define atomic_or(ptr, n)      ((void) __sync_fetch_and_or(ptr, n))
 
 #endif /* __ATOMIC_RELAXED */
+
+/* Hosts that can do the operations above on 64-bit values */
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8
+#define CONFIG_ATOMIC64 1
+#endif
+
+/* Hosts that can compare-and-swap 16 bytes at once.  atomic16_cmpxchg
+ * compares the 16 aligned bytes at @ptr with @cmp and replaces them with
+ * @newv if they match.  Both are in memory order, and @cmp receives the
+ * previous contents.  Returns whether the bytes were replaced.  It may
+ * only be called if atomic16_cmpxchg_supported() returns true.
+ */
+#if defined(__x86_64__) && defined(CONFIG_CPUID_H)
+#include <cpuid.h>
+#define CONFIG_ATOMIC128 1
+
+/* cmpxchg16b is missing on the very first x86_64 processors: unless the
+ * compiler was allowed to use it (-mcx16), look at CPUID.1:ECX.CX16 once.
+ */
+static inline bool atomic16_cmpxchg_supported(void)
+{
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+    return true;
+#else
+    static int supported; /* 0 until known, then 1 or -1 */
+    int s = atomic_read(&supported);
+
+    if (!s) {
+        unsigned int a, b, c, d;
+
+        s = __get_cpuid(1, &a, &b, &c, &d) && (c & bit_CMPXCHG16B) ? 1 : -1;
+        atomic_set(&supported, s);
+    }
+    return s > 0;
+#endif
+}
+
+static inline bool atomic16_cmpxchg(void *ptr, uint64_t *cmp,
+                                    const uint64_t *newv)
+{
+    bool ok;
+
+    asm volatile("lock; cmpxchg16b %1; sete %0"
+                 : "=q"(ok), "+m"(*(__int128 *)ptr),
+                   "+a"(cmp[0]), "+d"(cmp[1])
+                 : "b"(newv[0]), "c"(newv[1])
+                 : "memory", "cc");
+    return ok;
+}
+#elif defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_16) && \
+      !defined(HOST_WORDS_BIGENDIAN)
+#define CONFIG_ATOMIC128 1
+static inline bool atomic16_cmpxchg_supported(void)
+{
+    return true;
+}
+
+static inline bool atomic16_cmpxchg(void *ptr, uint64_t *cmp,
+                                    const uint64_t *newv)
+{
+    unsigned __int128 c = cmp[0] | (unsigned __int128)cmp[1] << 64;
+    unsigned __int128 n = newv[0] | (unsigned __int128)newv[1] << 64;
+    unsigned __int128 old;
+
+    old = __sync_val_compare_and_swap((unsigned __int128 *)ptr, c, n);
+    cmp[0] = old;
+    cmp[1] = old >> 64;
+    return old == c;
+}
+#endif
+
 #endif /* __QEMU_ATOMIC_H */
@@ -0,0 +1,116 @@
+/*
+ * Resizable hash table with RCU-safe lookups
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_QHT_H
+#define QEMU_QHT_H 1
+
+struct qht_map;
+
+/* The table stores pointers under a 32-bit hash chosen by the caller, and
+ * grows as entries are inserted so that chains stay short.
+ *
+ * Lookups only need to be in an RCU read-side critical section.  Writers
+ * (insert, remove, reset, resize) must be serialized by the caller, e.g.
+ * with tb_lock for the translation blocks.
+ */
+struct qht {
+    struct qht_map *map;
+    size_t n_entries;
+};
+
+struct qht_stats {
+    size_t head_buckets;
+    size_t used_head_buckets;
+    size_t entries;
+    /* length in buckets of the longest chain, and average over the used
+     * chains */
+    size_t max_chain;
+    double avg_chain;
+};
+
+typedef bool (*qht_lookup_func_t)(const void *obj, const void *userp);
+typedef void (*qht_iter_func_t)(struct qht *ht, void *p, uint32_t hash,
+                                void *userp);
+
+/**
+ * qht_init:
+ * @ht: the table to initialize
+ * @n_elems: number of entries the table is sized for at first
+ */
+void qht_init(struct qht *ht, size_t n_elems);
+
+/**
+ * qht_destroy:
+ * @ht: the table, which must not be used by readers anymore
+ */
+void qht_destroy(struct qht *ht);
+
+/**
+ * qht_insert:
+ * @ht: the table
+ * @p: the pointer to insert, not NULL
+ * @hash: its hash
+ *
+ * Returns false if @p was already in the table under @hash.
+ */
+bool qht_insert(struct qht *ht, void *p, uint32_t hash);
+
+/**
+ * qht_lookup:
+ * @ht: the table
+ * @func: compares an entry of the table with @userp
+ * @userp: the key looked up
+ * @hash: the hash of the key
+ *
+ * Must be called in an RCU read-side critical section; @func may longjmp
+ * out as long as the caller leaves that section itself.  An entry removed
+ * or inserted concurrently may or may not be found.
+ *
+ * Returns the first entry under @hash for which @func returns true, or NULL.
+ */
+void *qht_lookup(struct qht *ht, qht_lookup_func_t func, const void *userp,
+                 uint32_t hash);
+
+/**
+ * qht_remove:
+ * @ht: the table
+ * @p: the pointer to remove
+ * @hash: the hash it was inserted with
+ *
+ * Returns false if @p was not in the table.
+ */
+bool qht_remove(struct qht *ht, const void *p, uint32_t hash);
+
+/**
+ * qht_reset:
+ * @ht: the table to empty, keeping its size
+ */
+void qht_reset(struct qht *ht);
+
+/**
+ * qht_resize:
+ * @ht: the table
+ * @n_elems: number of entries the table is sized for from now on
+ */
+void qht_resize(struct qht *ht, size_t n_elems);
+
+/**
+ * qht_iter:
+ * @ht: the table
+ * @func: called for every entry, must not modify the table
+ * @userp: passed to @func
+ */
+void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp);
+
+/**
+ * qht_statistics:
+ * @ht: the table
+ * @stats: filled with the occupancy of the table
+ */
+void qht_statistics(struct qht *ht, struct qht_stats *stats);
+
+#endif
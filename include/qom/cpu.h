@@ -230,6 +230,8 @@ struct kvm_run;
  * @numa_node: NUMA node this CPU is belonging to.
  * @host_tid: Host thread ID.
  * @running: #true if CPU is currently running (usermode).
+ * @exclusive_step: #true while the CPU executes an instruction with the
+ *                  other vCPUs stopped, see cpu_exec_step_atomic().
  * @created: Indicates whether the CPU thread has been successfully created.
  * @interrupt_request: Indicates a pending interrupt request.
  * @halted: Nonzero if the CPU is in suspended state.
@@ -243,6 +245,15 @@ struct kvm_run;
  * @icount_decr: Number of cycles left, with interrupt flag in high bit.
  * This allows a single read-compare-cbranch-write sequence to test
  * for both decrementer underflow and exceptions.
+ * @quantum_budget: Instructions left in the current quantum, charged by
+ * the generated code at the start of every TB.
+ * @quantum_refill: Value @quantum_budget was last refilled with.
+ * @quantum_end: Executed instruction count at which the current quantum
+ * ends, UINT64_MAX without a quantum.
+ * @instr_event: Executed instruction count at which the CPU stops to raise
+ * an instruction event, UINT64_MAX for none.
+ * @exception_taken: Number of the last exception or interrupt taken by
+ * the CPU, -1 for none.
  * @can_do_io: Nonzero if memory-mapped IO is safe. Deterministic execution
  * requires that IO only be performed on the last instruction of a TB
  * so that interrupts take effect immediately.
@@ -275,8 +286,11 @@ struct CPUState {
     int nr_threads;
     int numa_node;
 
-    int nr_instr;
-    int nr_total_instr; /*shows how many instructions this CPU has executed so far*/
+    int32_t quantum_budget;
+    int32_t quantum_refill;
+    uint64_t nr_total_instr; /*instructions executed before the current quantum*/
+    uint64_t quantum_end;
+    uint64_t instr_event;
     bool hasReachedInstrLimit;
     int nr_exp[5];
     int nr_quantumHits;
@@ -288,6 +302,7 @@ struct CPUState {
     int thread_id;
     uint32_t host_tid;
     bool running;
+    bool exclusive_step;
     struct QemuCond *halt_cond;
     bool thread_kicked;
     bool created;
@@ -344,6 +359,7 @@ struct CPUState {
     } icount_decr;
     uint32_t can_do_io;
     int32_t exception_index; /* used by m68k TCG */
+    int32_t exception_taken;
 
     /* Used to keep track of an outstanding cpu throttle thread for migration
      * autoconverge
@@ -369,6 +385,17 @@ extern struct CPUTailQ cpus;
 
 extern __thread CPUState *current_cpu;
 
+/* Set by -tcg-threads multi, before any vCPU is created */
+extern bool mttcg_enabled;
+
+/**
+ * qemu_tcg_mttcg_enabled:
+ *
+ * Returns: %true if each TCG vCPU runs in its own thread, %false if a
+ * single thread runs them in turn.
+ */
+#define qemu_tcg_mttcg_enabled() (mttcg_enabled)
+
 /**
  * cpu_paging_enabled:
  * @cpu: The CPU whose state is to be inspected.
@@ -617,6 +644,17 @@ void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
  */
 void async_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
 
+/**
+ * async_safe_run:
+ * @func: The function to be executed.
+ * @data: Data to pass to the function.
+ *
+ * Schedules the function @func for execution by one of the vCPU threads,
+ * with the BQL held, once none of the vCPUs executes guest code.  All the
+ * vCPUs are kicked out of the execution loop.
+ */
+void async_safe_run(void (*func)(void *data), void *data);
+
 /**
  * qemu_get_cpu:
  * @index: The CPUState@cpu_index value of the CPU to obtain.
@@ -751,6 +789,103 @@ void cpu_reset_interrupt(CPUState *cpu, int mask);
  */
 void cpu_exit(CPUState *cpu);
 
+/* Instructions per quantum of the round-robin scheduler, 0 for none */
+extern sig_atomic_t quantum_value;
+
+/**
+ * cpu_quantum_counted:
+ *
+ * Returns: Whether the TBs translated now charge their instructions to the
+ * quantum budget (CF_QUANTUM).  Flexus always reads the instruction counts
+ * and raises instruction events; otherwise only a quantum needs them.
+ */
+static inline bool cpu_quantum_counted(void)
+{
+#ifdef CONFIG_FLEXUS
+    return true;
+#else
+    return quantum_value > 0;
+#endif
+}
+
+/**
+ * cpu_executed_instructions:
+ * @cpu: The CPU to query.
+ *
+ * Returns: The number of guest instructions executed by @cpu, as far as
+ * they were counted (see cpu_quantum_counted()).
+ */
+static inline uint64_t cpu_executed_instructions(CPUState *cpu)
+{
+    return cpu->nr_total_instr + (cpu->quantum_refill - cpu->quantum_budget);
+}
+
+/**
+ * cpu_budget_update:
+ * @cpu: The CPU to update.
+ *
+ * Accounts the instructions charged to the budget of @cpu so far and
+ * gives it a new budget that runs out at the end of its quantum or at its
+ * instruction event, whichever comes first.
+ */
+static inline void cpu_budget_update(CPUState *cpu)
+{
+    uint64_t limit = MIN(cpu->quantum_end, cpu->instr_event);
+
+    cpu->nr_total_instr += cpu->quantum_refill - cpu->quantum_budget;
+    if (limit <= cpu->nr_total_instr) {
+        cpu->quantum_refill = 0;
+    } else {
+        cpu->quantum_refill = MIN(limit - cpu->nr_total_instr, INT32_MAX);
+    }
+    cpu->quantum_budget = cpu->quantum_refill;
+}
+
+/**
+ * cpu_quantum_refill:
+ * @cpu: The CPU starting a new quantum.
+ *
+ * Starts a new quantum of quantum_value instructions on @cpu.  Without a
+ * quantum the budget is only used for counting instructions and raising
+ * instruction events.
+ */
+static inline void cpu_quantum_refill(CPUState *cpu)
+{
+    cpu->quantum_end = quantum_value > 0
+        ? cpu_executed_instructions(cpu) + quantum_value : UINT64_MAX;
+    cpu_budget_update(cpu);
+}
+
+/**
+ * cpu_set_instr_event:
+ * @cpu: The CPU to stop.
+ * @count: Executed instruction count of @cpu to stop at, UINT64_MAX for
+ * none.
+ *
+ * Makes @cpu raise an instruction event once it has executed exactly
+ * @count instructions.  Must be called from the thread running @cpu.
+ */
+static inline void cpu_set_instr_event(CPUState *cpu, uint64_t count)
+{
+    cpu->instr_event = count;
+    cpu_budget_update(cpu);
+}
+
+/**
+ * cpu_exec_instructions:
+ * @cpu: The CPU to run.
+ * @count: Number of instructions to execute.
+ * @executed: Set to the number of instructions executed.
+ *
+ * Executes exactly @count instructions of @cpu, fewer if it halts or the
+ * VM stops first.  Must be called from the TCG thread with the iothread
+ * lock held.  The main loop only gets the lock when it asks for it.
+ *
+ * Returns: The cpu_exec() exit code of the last run, EXCP_INTERRUPT once
+ * @count instructions have been executed.
+ */
+int cpu_exec_instructions(CPUState *cpu, uint64_t count, uint64_t *executed);
+
 /**
  * cpu_resume:
  * @cpu: The CPU to resume.
@@ -15,8 +15,11 @@ void cpu_synchronize_all_post_init(void);
 void qtest_clock_warp(int64_t dest);
 
 
+void qemu_tcg_configure(const char *mode, Error **errp);
+
 void cpu_get_quantum(const char* val);
 void cpu_set_quantum(const char* str);
+void qemu_set_quantum(int quantum);
 void cpu_get_ic(const char *str);
 void cpu_zero_all(void);
 
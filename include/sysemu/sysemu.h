@@ -78,6 +78,10 @@ void qemu_remove_exit_notifier(Notifier *notify);
 void qemu_add_machine_init_done_notifier(Notifier *notify);
 
 void hmp_savevm(Monitor *mon, const QDict *qdict);
+void hmp_checkpoint_start(Monitor *mon, const QDict *qdict);
+void hmp_checkpoint_save(Monitor *mon, const QDict *qdict);
+void hmp_checkpoint_stop(Monitor *mon, const QDict *qdict);
+void hmp_checkpoint_load(Monitor *mon, const QDict *qdict);
 int load_vmstate(const char *name, const int id);//inc snapshots support--added extra parameter to function
 int incremental_load_vmstate(const char *name);//inc snapshots support
 void hmp_delvm(Monitor *mon, const QDict *qdict);
@@ -132,6 +136,8 @@ void qemu_savevm_send_postcopy_ram_discard(QEMUFile *f, const char *name,
                                            uint64_t *length_list);
 
 int qemu_loadvm_state(QEMUFile *f);
+/* Save everything but RAM, in a stream that qemu_loadvm_state reads */
+int qemu_save_device_state(QEMUFile *f);
 
 typedef enum DisplayType
 {
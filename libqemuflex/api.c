@@ -20,8 +20,12 @@ extern "C" {
 #include "cpu.h"
 #include "qom/cpu.h"
 #include "qemu/config-file.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/error-report.h"
 #include "sysemu/cpus.h"
 #include "qmp-commands.h"
+#include "migration/checkpoint.h"
 
 #define QEMUFLEX_PROTOTYPES
 #define QEMUFLEX_QEMU_INTERNAL
@@ -32,7 +36,6 @@ extern "C" {
 #endif
 
 extern int smp_cpus;
-extern sig_atomic_t quantum_value;
 
 
 //Functions I am not sure on(wasn't the last person to work on them)
@@ -60,7 +63,7 @@ extern sig_atomic_t quantum_value;
 
 //QEMU_get_program_counter
 
-static QEMU_callback_table_t * QEMU_all_callbacks_tables = NULL;
+QEMU_callback_table_t * QEMU_all_callbacks_tables = NULL;
 
 int QEMU_clear_exception(void)
 {
@@ -354,22 +357,31 @@ instruction_error_t QEMU_instruction_handle_interrupt(conf_object_t *cpu, pseudo
 	return QEMU_IE_OK;
 }
  
+// cpu the simulator stepped last, QEMU_advance steps it again
+static CPUState *QEMU_step_cpu = NULL;
+
+static int QEMU_step(CPUState *cs, uint64_t count, uint64_t *executed) {
+  uint64_t n;
+
+  cs->exception_taken = -1;
+  cpu_exec_instructions(cs, count, &n);
+  if( executed != NULL )
+    *executed = n;
+  QEMU_step_cpu = cs;
+  return cs->exception_taken;
+}
+
 int QEMU_get_pending_exception(void) {
-  return 0;
-} 
+  return QEMU_step_cpu != NULL ? QEMU_step_cpu->exception_taken : -1;
+}
 
 int QEMU_advance(void) {
-  printf("QEMU_advance called!\n");
-  //CPUState * cpu_state = cpu->object;
-  //CPUArchState *env = cpu_state->env_ptr;
-  //printf("before calling cpu_exec\n");
-  //return get_info(env);
-
-  printf("Need to advance an instruction properly and return the exception id, if one was raised!\n"); 
-  //ALEX - May need to change function's signature; how do we specify which core to proceed by 1 instr?
-  assert(false);
-  return 0;
-} 
+  return QEMU_step(QEMU_step_cpu != NULL ? QEMU_step_cpu : first_cpu, 1, NULL);
+}
+
+int QEMU_cpu_execute(conf_object_t *cpu, uint64_t count, uint64_t *executed) {
+  return QEMU_step(cpu->object, count, executed);
+}
 
 conf_object_t *QEMU_get_object(const char *name) {
 	//TODO: lookup request object by name and return reference to it
@@ -379,21 +391,9 @@ conf_object_t *QEMU_get_object(const char *name) {
 }
 //ALEX - end
 
-//NOOSHIN: begin --> dummy
-int QEMU_cpu_exec_proc (conf_object_t *cpu) {
-  
-  int ret;
-  //TODO: call the cpu_exec function and synchronize the exception IDs
-  printf("QEMU_CPU_EXEC_PROC called\n");
-  CPUState * cpu_state = cpu->object;
-  //CPUArchState *env = cpu_state->env_ptr;
-  printf("before calling cpu_exec\n");
-  ret =  get_info(cpu_state);
-  //assert(false);//Need to handle exceptions
-  return ret;
- //return cpu_exec(env); 
-}
-//NOOSHIN: end
+int QEMU_cpu_exec_proc(conf_object_t *cpu) {
+  return QEMU_step(cpu->object, 1, NULL);
+}
 
 int flexus_is_simulating = 0;
 
@@ -402,10 +402,124 @@ int QEMU_is_in_simulation(void) {
 }
 
 void QEMU_toggle_simulation(int enable) {
+  if( enable && qemu_tcg_mttcg_enabled() ) {
+    // the trace rings and the instrumented TBs expect the vCPUs to run in turn
+    error_report("The simulation cannot be started with -tcg-threads multi");
+    return;
+  }
   if( enable != QEMU_is_in_simulation() ) {
+    if( !enable )
+      QEMU_trace_flush(-1);
     flexus_is_simulating = enable;
-    QEMU_flush_tb_cache();
+    QEMU_filter_coalesce_reset();
+    // The simulation state is part of the TB flags, so instrumented and
+    // plain TBs coexist in the code cache and no flush is needed. Only
+    // make every cpu leave its current chain of TBs, so that the next TB
+    // is looked up with the new flags.
+    CPUState *cpu;
+    CPU_FOREACH(cpu) {
+      cpu_exit(cpu);
+    }
+  }
+}
+
+void QEMU_checkpoint_request(void) {
+  if( qemu_tcg_mttcg_enabled() ) {
+    // the other vCPUs would not stop at the requested instruction
+    error_report("Sample checkpoints cannot be requested with -tcg-threads multi");
+    return;
+  }
+  checkpoint_request();
+}
+
+// Last snapshot handed out for every cpu, the dirty variant compares the
+// current state against it
+typedef struct QEMU_arch_snapshot {
+  QEMU_arch_state_t state;
+  int valid;
+} QEMU_arch_snapshot_t;
+
+static QEMU_arch_snapshot_t *QEMU_arch_snapshots = NULL;
+
+void QEMU_arch_state_init(void) {
+  QEMU_arch_snapshots = calloc(QEMU_get_num_cpus(), sizeof(QEMU_arch_snapshot_t));
+}
+
+void QEMU_arch_state_deinit(void) {
+  free(QEMU_arch_snapshots);
+  QEMU_arch_snapshots = NULL;
+}
+
+int QEMU_read_arch_state(conf_object_t *cpu, QEMU_arch_state_t *state) {
+  REQUIRES(cpu->type == QEMU_CPUState);
+  CPUState *qemucpu = cpu->object;
+  QEMU_arch_snapshot_t *last = &QEMU_arch_snapshots[qemucpu->cpu_index];
+
+  if( cpu_read_arch_state(qemucpu, &last->state) < 0 )
+    return -1;
+  last->valid = 1;
+  memcpy(state, &last->state, sizeof(QEMU_arch_state_t));
+  return 0;
+}
+
+int QEMU_read_arch_state_dirty(conf_object_t *cpu, QEMU_arch_state_t *state,
+                               uint64_t *dirty) {
+  REQUIRES(cpu->type == QEMU_CPUState);
+  CPUState *qemucpu = cpu->object;
+  QEMU_arch_snapshot_t *last = &QEMU_arch_snapshots[qemucpu->cpu_index];
+  QEMU_arch_state_t *old = &last->state;
+  QEMU_arch_state_t now;
+
+  if( cpu_read_arch_state(qemucpu, &now) < 0 )
+    return -1;
+  if( !last->valid ) {
+    memcpy(state, &now, sizeof(QEMU_arch_state_t));
+    memcpy(old, &now, sizeof(QEMU_arch_state_t));
+    last->valid = 1;
+    *dirty = QEMU_ARCH_DIRTY_ALL;
+    return 0;
+  }
+
+  uint64_t changed = 0;
+  int i = 0;
+  for( ; i < 31; i++ ) {
+    if( now.x[i] != old->x[i] ) {
+      state->x[i] = now.x[i];
+      changed |= QEMU_ARCH_DIRTY_X(i);
+    }
+  }
+  if( now.sp != old->sp ) {
+    state->sp = now.sp;
+    changed |= QEMU_ARCH_DIRTY_SP;
+  }
+  if( now.pc != old->pc ) {
+    state->pc = now.pc;
+    changed |= QEMU_ARCH_DIRTY_PC;
+  }
+  if( now.pstate != old->pstate || now.aarch64 != old->aarch64
+      || now.el != old->el ) {
+    state->pstate = now.pstate;
+    state->aarch64 = now.aarch64;
+    state->el = now.el;
+    changed |= QEMU_ARCH_DIRTY_PSTATE;
+  }
+  if( now.fpcr != old->fpcr || now.fpsr != old->fpsr ) {
+    state->fpcr = now.fpcr;
+    state->fpsr = now.fpsr;
+    changed |= QEMU_ARCH_DIRTY_FPCTRL;
+  }
+  if( memcmp(now.v, old->v, sizeof(now.v)) != 0 ) {
+    memcpy(state->v, now.v, sizeof(now.v));
+    changed |= QEMU_ARCH_DIRTY_V;
   }
+  if( memcmp(now.sysregs, old->sysregs, sizeof(now.sysregs)) != 0 ) {
+    memcpy(state->sysregs, now.sysregs, sizeof(now.sysregs));
+    changed |= QEMU_ARCH_DIRTY_SYSREGS;
+  }
+
+  memcpy(old, &now, sizeof(QEMU_arch_state_t));
+  *dirty = changed;
+  return 0;
 }
 
 int64_t flexus_simulation_length = -1;
@@ -454,45 +568,214 @@ void QEMU_break_simulation(const char * msg)
 void QEMU_initialize(void) {
   QEMU_initialize_counts();
   QEMU_setup_callback_tables();
+  QEMU_trace_ring_init();
+  QEMU_filter_init();
+  QEMU_arch_state_init();
+  QEMU_physmem_init();
 }
 
 void QEMU_shutdown(void) {
+  QEMU_physmem_deinit();
+  QEMU_arch_state_deinit();
+  QEMU_filter_deinit();
+  QEMU_trace_ring_deinit();
   QEMU_free_callback_tables();
   QEMU_deinitialize_counts();
 }
 
-uint64_t QEMU_total_instruction_count = 0;
-uint64_t *QEMU_instruction_counts = NULL;
+// Every counter has its own cache line and is only written by the thread
+// running its cpu, the total is computed when it is asked for.
+typedef struct QEMU_instruction_counter {
+  uint64_t count;
+} __attribute__((aligned(64))) QEMU_instruction_counter_t;
+
+static QEMU_instruction_counter_t *QEMU_instruction_counts = NULL;
+static int QEMU_num_instruction_counts = 0;
 
 void QEMU_initialize_counts(void) {
-  int num_cpus = QEMU_get_num_cpus();
-  QEMU_instruction_counts = (uint64_t*)malloc(num_cpus*sizeof(uint64_t));
-  
-  QEMU_total_instruction_count = 0;
-  int i = 0;
-  for( ; i < num_cpus; i++ )
-    QEMU_instruction_counts[i] = 0;
+  QEMU_num_instruction_counts = QEMU_get_num_cpus();
+  QEMU_instruction_counts = qemu_memalign(sizeof(QEMU_instruction_counter_t),
+                                          QEMU_num_instruction_counts * sizeof(QEMU_instruction_counter_t));
+  memset(QEMU_instruction_counts, 0,
+         QEMU_num_instruction_counts * sizeof(QEMU_instruction_counter_t));
 }
 
 void QEMU_deinitialize_counts(void) {
-  free(QEMU_instruction_counts);
+  qemu_vfree(QEMU_instruction_counts);
+  QEMU_instruction_counts = NULL;
+  QEMU_num_instruction_counts = 0;
 }
 
 uint64_t QEMU_get_instruction_count(int cpu_number) {
-  return QEMU_instruction_counts[cpu_number];
+  return atomic_read(&QEMU_instruction_counts[cpu_number].count);
 }
 
 void QEMU_increment_instruction_count(int cpu_number) {
-  QEMU_total_instruction_count++;
-  QEMU_instruction_counts[cpu_number]++;
+  // single writer, the atomic accesses only keep the readers from tearing
+  QEMU_instruction_counter_t *counter = &QEMU_instruction_counts[cpu_number];
+  atomic_set(&counter->count, counter->count + 1);
 }
 
 uint64_t QEMU_get_total_instruction_count(void) {
-  return QEMU_total_instruction_count;
+  uint64_t total = 0;
+  int i = 0;
+  for( ; i < QEMU_num_instruction_counts; i++ )
+    total += atomic_read(&QEMU_instruction_counts[i].count);
+  return total;
+}
+
+// Callbacks registered without an object are called through these
+// trampolines, with the registered function as the object, so that every
+// entry of a dispatch list is called the same way.
+static void cb_void_trampoline(void *fn) {
+  (*(cb_func_void)fn)();
+}
+static void cb_noc_trampoline(void *fn, void *class_data, conf_object_t *obj) {
+  (*(cb_func_noc_t)fn)(class_data, obj);
+}
+static void cb_nocI_trampoline(void *fn, void *class_data, conf_object_t *obj,
+                               int64_t bigint) {
+  (*(cb_func_nocI_t)fn)(class_data, obj, bigint);
+}
+static void cb_nocIs_trampoline(void *fn, void *class_data, conf_object_t *obj,
+                                int64_t bigint, char *string) {
+  (*(cb_func_nocIs_t)fn)(class_data, obj, bigint, string);
+}
+static void cb_nocs_trampoline(void *fn, void *class_data, conf_object_t *obj,
+                               char *string) {
+  (*(cb_func_nocs_t)fn)(class_data, obj, string);
+}
+static void cb_ncm_trampoline(void *fn, conf_object_t *space,
+                              memory_transaction_t *trans) {
+  (*(cb_func_ncm_t)fn)(space, trans);
+}
+static void cb_noiiI_trampoline(void *fn, void *class_data, int integer0,
+                                int integer1, int64_t bigint) {
+  (*(cb_func_noiiI_t)fn)(class_data, integer0, integer1, bigint);
+}
+static void cb_noII_trampoline(void *fn, void *class_data, int64_t bigint0,
+                               int64_t bigint1) {
+  (*(cb_func_noII_t)fn)(class_data, bigint0, bigint1);
+}
+static void cb_nib_trampoline(void *fn, int cpu_id,
+                              QEMU_mem_trace_record_t *records, size_t count) {
+  (*(cb_func_nib_t)fn)(cpu_id, records, count);
+}
+
+static void *QEMU_callback_trampolines[QEMU_callback_event_count] = {
+  [QEMU_config_ready] = cb_void_trampoline,
+  [QEMU_continuation] = cb_noc_trampoline,
+  [QEMU_simulation_stopped] = cb_nocIs_trampoline,
+  [QEMU_asynchronous_trap] = cb_noc_trampoline,
+  [QEMU_exception_return] = cb_noc_trampoline,
+  [QEMU_magic_instruction] = cb_nocI_trampoline,
+  [QEMU_ethernet_frame] = cb_noc_trampoline,
+  [QEMU_ethernet_network_frame] = cb_noc_trampoline,
+  [QEMU_periodic_event] = cb_noc_trampoline,
+  [QEMU_xterm_break_string] = cb_nocs_trampoline,
+  [QEMU_gfx_break_string] = cb_nocs_trampoline,
+  [QEMU_cpu_mem_trans] = cb_ncm_trampoline,
+  [QEMU_dma_mem_trans] = cb_ncm_trampoline,
+  [QEMU_cpu_mem_trans_batch] = cb_nib_trampoline,
+  [QEMU_sampling_phase] = cb_noiiI_trampoline,
+  [QEMU_phys_memory_unmapped] = cb_noII_trampoline,
+};
+
+static void make_callback_entry(QEMU_callback_entry_t *entry,
+                                QEMU_callback_event_t event,
+                                const QEMU_callback_container_t *container) {
+  // QEMU_config_ready callbacks never got their object
+  if( container->obj != NULL && event != QEMU_config_ready ) {
+    entry->fn = container->callback;
+    entry->obj = container->obj;
+  } else {
+    entry->fn = QEMU_callback_trampolines[event];
+    entry->obj = container->callback;
+  }
+}
+
+static int count_callbacks(const QEMU_callback_container_t *container) {
+  int count = 0;
+  for( ; container != NULL; container = container->next )
+    count++;
+  return count;
+}
+
+// a dispatch list and its entries in a single allocation, so that it can
+// be freed as a whole once no reader walks it anymore
+typedef struct QEMU_dispatch_block {
+  struct rcu_head rcu;
+  QEMU_callback_list_t list;
+  QEMU_callback_entry_t entries[];
+} QEMU_dispatch_block_t;
+
+// the list of every event without callbacks, never freed
+static QEMU_callback_list_t QEMU_empty_dispatch_list;
+
+static void free_dispatch_block(QEMU_dispatch_block_t *block) {
+  free(block);
+}
+
+// rebuild the dispatch list of one table and event: the callbacks of the
+// table itself followed by the generic ones, the order in which they have
+// always been called. The trace threads may still walk the old list, it
+// is only freed after a grace period.
+static void rebuild_dispatch_list(int table_index, QEMU_callback_event_t event) {
+  QEMU_callback_table_t *table = &QEMU_all_callbacks_tables[table_index];
+  QEMU_callback_table_t *generic_table = &QEMU_all_callbacks_tables[0];
+  QEMU_callback_list_t *old_list = table->dispatch[event];
+  QEMU_callback_list_t *list = &QEMU_empty_dispatch_list;
+  const QEMU_callback_container_t *curr;
+
+  int own_count = count_callbacks(table->callbacks[event]);
+  int count = own_count;
+  if( table_index != 0 )
+    count += count_callbacks(generic_table->callbacks[event]);
+
+  if( count > 0 ) {
+    QEMU_dispatch_block_t *block =
+      malloc(sizeof(QEMU_dispatch_block_t) + count * sizeof(QEMU_callback_entry_t));
+    int i = 0;
+
+    for( curr = table->callbacks[event]; curr != NULL; curr = curr->next )
+      make_callback_entry(&block->entries[i++], event, curr);
+    if( table_index != 0 ) {
+      for( curr = generic_table->callbacks[event]; curr != NULL; curr = curr->next )
+        make_callback_entry(&block->entries[i++], event, curr);
+    }
+    list = &block->list;
+    list->entries = block->entries;
+    list->count = count;
+    list->own_count = own_count;
+  }
+
+  atomic_rcu_set(&table->dispatch[event], list);
+  if( old_list != &QEMU_empty_dispatch_list )
+    call_rcu(container_of(old_list, QEMU_dispatch_block_t, list),
+             free_dispatch_block, rcu);
+  if( count > 0 )
+    table->has_callbacks |= 1u << event;
+  else
+    table->has_callbacks &= ~(1u << event);
+}
+
+// the callbacks of a table changed, a generic callback concerns every table
+static void update_dispatch_lists(int cpu_id, QEMU_callback_event_t event) {
+  if( cpu_id != QEMUFLEX_GENERIC_CALLBACK ) {
+    rebuild_dispatch_list(cpu_id + 1, event);
+    return;
+  }
+
+  int numTables = QEMU_get_num_cpus() + 1;
+  int i = 0;
+  for( ; i < numTables; i++ )
+    rebuild_dispatch_list(i, event);
 }
 
 // setup the callbacks for every cpu
 void QEMU_setup_callback_tables(void) {
+  QEMU_BUILD_BUG_ON(QEMU_callback_event_count > 32);
+
   // one table for every cpu + one for generic callbacks
   int numTables = QEMU_get_num_cpus() + 1;
   QEMU_all_callbacks_tables = (QEMU_callback_table_t*)malloc(sizeof(QEMU_callback_table_t)*numTables);
@@ -501,9 +784,11 @@ void QEMU_setup_callback_tables(void) {
   for( ; i < numTables; i++ ) {
     QEMU_callback_table_t * table = QEMU_all_callbacks_tables + i;
     table->next_callback_id = 0;
+    table->has_callbacks = 0;
     int j = 0;
     for( ; j < QEMU_callback_event_count; j++ ) {
       table->callbacks[j] = NULL;
+      table->dispatch[j] = &QEMU_empty_dispatch_list;
     }
   }
 }
@@ -523,9 +808,13 @@ void QEMU_free_callback_tables(void) {
         free(table->callbacks[j]);
         table->callbacks[j] = next;
       }
+      // nothing runs the callbacks anymore
+      if( table->dispatch[j] != &QEMU_empty_dispatch_list )
+        free(container_of(table->dispatch[j], QEMU_dispatch_block_t, list));
     }
   }
   free(QEMU_all_callbacks_tables);
+  QEMU_all_callbacks_tables = NULL;
 }
 // note: see QEMU_callback_table in api.h
 // return a unique identifier to the callback struct or -1
@@ -566,6 +855,7 @@ int QEMU_insert_callback(
     container->next = containerNew;
   }
   table->next_callback_id++;
+  update_dispatch_lists(cpu_id, event);
   return containerNew->id;
 }
 
@@ -593,6 +883,7 @@ void QEMU_delete_callback(
         table->callbacks[event] = container->next;
       }
       free(container);
+      update_dispatch_lists(cpu_id, event);
       break;
     }
     prev = container;
@@ -601,127 +892,99 @@ void QEMU_delete_callback(
 }
 
 static void do_execute_callback(
-			 QEMU_callback_container_t *curr,
+			 const QEMU_callback_entry_t *curr,
 			 QEMU_callback_event_t event,
 			 QEMU_callback_args_t *event_data);
 
 static void do_execute_callback(
-			 QEMU_callback_container_t *curr,
+			 const QEMU_callback_entry_t *curr,
 			 QEMU_callback_event_t event,
 			 QEMU_callback_args_t *event_data) {
-  dbg_printf("Executing callback id %"PRId64"\n");
-  void *callback = curr->callback;
+  void *callback = curr->fn;
   switch (event) {
-    // noc : class_data, conf_object_t
   case QEMU_config_ready:
-    (*(cb_func_void)callback)(
-							);
-               
+    (*(cb_func_void_t2)callback)(
+				 curr->obj
+				 );
     break;
+    // nocI : class_data, conf_object_t, int64_t
   case QEMU_magic_instruction:
-    if (!curr->obj)
-      (*(cb_func_nocI_t)callback)(
-				  event_data->nocI->class_data
-				  , event_data->nocI->obj
-				  , event_data->nocI->bigint
-				  );
-    else
-      (*(cb_func_nocI_t2)callback)(
-				   (void*)curr->obj,
-				   event_data->nocI->class_data
-				   , event_data->nocI->obj
-				   , event_data->nocI->bigint
-				   );   
+    (*(cb_func_nocI_t2)callback)(
+				 curr->obj
+				 , event_data->nocI->class_data
+				 , event_data->nocI->obj
+				 , event_data->nocI->bigint
+				 );
     break;
+    // noc : class_data, conf_object_t
   case QEMU_continuation:
   case QEMU_asynchronous_trap:
   case QEMU_exception_return:
   case QEMU_ethernet_network_frame:
   case QEMU_ethernet_frame:
   case QEMU_periodic_event:
-    if (!curr->obj){
-      (*(cb_func_noc_t)callback)(
-				 event_data->noc->class_data
-				 , event_data->noc->obj
-				 );
-    }else{
-
-      (*(cb_func_noc_t2)callback)(
-				  (void *) curr->obj
-				  , event_data->noc->class_data
-				  , event_data->noc->obj
-				  );
-    }
+    (*(cb_func_noc_t2)callback)(
+				curr->obj
+				, event_data->noc->class_data
+				, event_data->noc->obj
+				);
     break;
     // nocIs : class_data, conf_object_t, int64_t, char*
   case QEMU_simulation_stopped:
-    if (!curr->obj)
-      (*(cb_func_nocIs_t)callback)(
-				   event_data->nocIs->class_data
-				   , event_data->nocIs->obj
-				   , event_data->nocIs->bigint
-				   , event_data->nocIs->string
-				   );
-    else
-      (*(cb_func_nocIs_t2)callback)(
-				    (void *) curr->obj
-				    , event_data->nocIs->class_data
-				    , event_data->nocIs->obj
-				    , event_data->nocIs->bigint
-				    , event_data->nocIs->string
-				    );
-
+    (*(cb_func_nocIs_t2)callback)(
+				  curr->obj
+				  , event_data->nocIs->class_data
+				  , event_data->nocIs->obj
+				  , event_data->nocIs->bigint
+				  , event_data->nocIs->string
+				  );
     break;
     // nocs : class_data, conf_object_t, char*
   case QEMU_xterm_break_string:
   case QEMU_gfx_break_string:
-    if (!curr->obj)
-      (*(cb_func_nocs_t)callback)(
-				  event_data->nocs->class_data
-				  , event_data->nocs->obj
-				  , event_data->nocs->string
-				  );
-    else
-      (*(cb_func_nocs_t2)callback)(
-				   (void *) curr->obj
-				   , event_data->nocs->class_data
-				   , event_data->nocs->obj
-				   , event_data->nocs->string
-				   );
-
+    (*(cb_func_nocs_t2)callback)(
+				 curr->obj
+				 , event_data->nocs->class_data
+				 , event_data->nocs->obj
+				 , event_data->nocs->string
+				 );
     break;
     // ncm : conf_object_t, memory_transaction_t
   case QEMU_cpu_mem_trans:
-    if (!curr->obj)
-      (*(cb_func_ncm_t)callback)(
-				 event_data->ncm->space
-				 , event_data->ncm->trans
-				 );
-    else
-      (*(cb_func_ncm_t2)callback)(
-				  (void *) curr->obj
-				  , event_data->ncm->space
-				  , event_data->ncm->trans
+  case QEMU_dma_mem_trans:
+    (*(cb_func_ncm_t2)callback)(
+				curr->obj
+				, event_data->ncm->space
+				, event_data->ncm->trans
+				);
+    break;
+    // nib : cpu_id, QEMU_mem_trace_record_t*, size_t
+  case QEMU_cpu_mem_trans_batch:
+    (*(cb_func_nib_t2)callback)(
+				curr->obj
+				, event_data->nib->cpu_id
+				, event_data->nib->records
+				, event_data->nib->count
+				);
+    break;
+    // noiiI : class_data, int, int, int64_t
+  case QEMU_sampling_phase:
+    (*(cb_func_noiiI_t2)callback)(
+				  curr->obj
+				  , event_data->noiiI->class_data
+				  , event_data->noiiI->integer0
+				  , event_data->noiiI->integer1
+				  , event_data->noiiI->bigint
 				  );
-
     break;
-
-  case QEMU_dma_mem_trans:
-    if (!curr->obj){
-      (*(cb_func_ncm_t)callback)(
-				 event_data->ncm->space
-				 , event_data->ncm->trans
+    // noII : class_data, int64_t, int64_t
+  case QEMU_phys_memory_unmapped:
+    (*(cb_func_noII_t2)callback)(
+				 curr->obj
+				 , event_data->noII->class_data
+				 , event_data->noII->bigint0
+				 , event_data->noII->bigint1
 				 );
-    }
-    else
-      {
-	//  printf("is this run(ifobj)\n");
-	(*(cb_func_ncm_t2)callback)(
-				    (void *) curr->obj
-				    , event_data->ncm->space
-				    , event_data->ncm->trans
-				    );
-      }
     break;
   default:
     dbg_printf("Event not found...\n");
@@ -735,25 +998,36 @@ void QEMU_execute_callbacks(
 			       QEMU_callback_args_t *event_data) {
 
   dbg_printf("Executing cpu specific callbacks for event %d\n", event);
-  QEMU_callback_table_t * generic_table = &QEMU_all_callbacks_tables[0];
-  QEMU_callback_table_t * table = &QEMU_all_callbacks_tables[cpu_id+1];
-  QEMU_callback_container_t *curr = table->callbacks[event];
+  // the callbacks of the cpu followed by the generic ones, or only the
+  // generic ones for cpu_id -1
+  const QEMU_callback_list_t *list;
+  int i = 0;
+
+  rcu_read_lock();
+  list = atomic_rcu_read(&QEMU_all_callbacks_tables[cpu_id+1].dispatch[event]);
+  for( ; i < list->count; i++ )
+    do_execute_callback(&list->entries[i], event, event_data);
+  rcu_read_unlock();
+}
 
-  // execute specified callbacks
-  for (; curr != NULL; curr = curr->next)
-      do_execute_callback(curr, event, event_data);
+void QEMU_execute_cpu_callbacks(
+			       int cpu_id,
+			       QEMU_callback_event_t event,
+			       QEMU_callback_args_t *event_data) {
 
-  if( cpu_id + 1 != 0 ) {
-    // only execute the generic callbacks once
-    curr = generic_table->callbacks[event];
-    for (; curr != NULL; curr = curr->next)
-      do_execute_callback(curr, event, event_data);
-  }
+  const QEMU_callback_list_t *list;
+  int i = 0;
+
+  rcu_read_lock();
+  list = atomic_rcu_read(&QEMU_all_callbacks_tables[cpu_id+1].dispatch[event]);
+  for( ; i < list->own_count; i++ )
+    do_execute_callback(&list->entries[i], event, event_data);
+  rcu_read_unlock();
 }
 void QEMU_cpu_set_quantum(const int * val)
 {
     if (*val > 0)
-        quantum_value = *val;
+        qemu_set_quantum(*val);
 }
 #endif /* CONFIG_FLEXUS */
 
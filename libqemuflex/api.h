@@ -103,6 +103,48 @@ typedef enum {
   QEMU_BRANCH_TYPE_COUNT
 } branch_type_t;
 
+// Opcode classes of the instruction descriptors
+typedef enum {
+  QEMU_Insn_Unknown = 0, // unallocated, or not decoded for this target
+  QEMU_Insn_Int_Alu,
+  QEMU_Insn_Int_Mul,
+  QEMU_Insn_Int_Div,
+  QEMU_Insn_Fp,
+  QEMU_Insn_Simd,
+  QEMU_Insn_Load,
+  QEMU_Insn_Store,
+  QEMU_Insn_Atomic,      // exclusive and acquire/release accesses
+  QEMU_Insn_Branch,
+  QEMU_Insn_System,      // exceptions, barriers, hints, system registers
+  QEMU_INSN_CLASS_COUNT
+} insn_class_t;
+
+#define QEMU_INSN_MAX_SRCS 4
+#define QEMU_INSN_MAX_DSTS 3
+
+// Register numbers of the operands of an instruction descriptor. The zero
+// register is not an operand.
+#define QEMU_INSN_REG_X(n)  (n)        // general purpose registers 0-30
+#define QEMU_INSN_REG_SP    31
+#define QEMU_INSN_REG_V(n)  (32 + (n)) // SIMD and floating point registers
+#define QEMU_INSN_REG_NZCV  64
+
+// Static description of a guest instruction, decoded once when the block
+// holding it is translated. The fetch transactions of an instruction point
+// to its descriptor so that timing models need not decode it again. The
+// descriptors live until the translated code is flushed, which never
+// happens while a callback or a batch carrying them runs.
+typedef struct QEMU_insn_desc {
+  uint32_t encoding;
+  uint8_t op_class;    // insn_class_t
+  uint8_t branch_type; // branch_type_t
+  uint8_t mem_size;    // bytes accessed by a load or store, 0 otherwise
+  uint8_t num_srcs;
+  uint8_t num_dsts;
+  uint8_t srcs[QEMU_INSN_MAX_SRCS];
+  uint8_t dsts[QEMU_INSN_MAX_DSTS];
+} QEMU_insn_desc_t;
+
 //Original definition in /home/parsacom/tools/simics/src/include/simics/core/memory.h
 struct generic_transaction {
         void *cpu_state;// (CPUState*) state of the CPU source of the transaction
@@ -124,6 +166,11 @@ struct generic_transaction {
 	unsigned int speculative:1;
 	unsigned int ignore:1;
 	unsigned int inverse_endian:1;
+        // descriptor of the fetched instruction, NULL for data accesses
+        // and when the target does not describe its instructions
+        const QEMU_insn_desc_t *insn;
+        // count record of the coalescing, as in QEMU_mem_trace_record_t
+        uint32_t repeat;
 };
 typedef struct generic_transaction generic_transaction_t;
 
@@ -254,6 +301,101 @@ typedef struct memory_transaction {
   };
 } memory_transaction_t;
 
+// compact record of a memory transaction, used by the batched trace API.
+// Records are accumulated in a per-cpu buffer and handed to the
+// QEMU_cpu_mem_trans_batch callbacks once the buffer is full.
+typedef struct QEMU_mem_trace_record {
+  logical_address_t pc;
+  logical_address_t logical_address;
+  physical_address_t physical_address;
+  // virtual address that physical_address translates: the target of the
+  // branch for fetches, whose logical_address is the pc, and the same as
+  // logical_address for the other records
+  logical_address_t target_address;
+  uint32_t size;
+  // a data record with a size of 0 is not an access but a count record of
+  // the coalescing (QEMU_filter_set_coalescing): repeat accesses to the
+  // line of its addresses were dropped since the line was last passed on.
+  // 0 for the other records.
+  uint32_t repeat;
+  uint8_t type;        // mem_op_type_t
+  uint8_t branch_type; // branch_type_t, only meaningful for fetches
+  uint8_t flags;       // QEMU_TRACE_* bits
+  uint8_t pad;
+  const QEMU_insn_desc_t *insn; // as in generic_transaction_t
+} QEMU_mem_trace_record_t;
+
+#define QEMU_TRACE_USER    0x01
+#define QEMU_TRACE_IO      0x02
+#define QEMU_TRACE_ATOMIC  0x04
+#define QEMU_TRACE_ANNUL   0x08
+
+// Kinds of accesses kept by the instrumentation filter
+#define QEMU_FILTER_USER    0x01
+#define QEMU_FILTER_KERNEL  0x02
+#define QEMU_FILTER_RAM     0x04
+#define QEMU_FILTER_IO      0x08
+#define QEMU_FILTER_ALL     0x0f
+
+// Address space of a filter range
+#define QEMU_FILTER_VIRTUAL   0
+#define QEMU_FILTER_PHYSICAL  1
+
+// Phases of the sampling controller
+#define QEMU_SAMPLING_FAST_FORWARD  0
+#define QEMU_SAMPLING_WARM          1
+#define QEMU_SAMPLING_MEASURE       2
+
+// System registers in QEMU_arch_state_t, as seen from EL1
+typedef enum {
+  QEMU_ARCH_SCTLR_EL1,
+  QEMU_ARCH_TTBR0_EL1,
+  QEMU_ARCH_TTBR1_EL1,
+  QEMU_ARCH_TCR_EL1,
+  QEMU_ARCH_MAIR_EL1,
+  QEMU_ARCH_VBAR_EL1,
+  QEMU_ARCH_CONTEXTIDR_EL1,
+  QEMU_ARCH_CPACR_EL1,
+  QEMU_ARCH_ELR_EL1,
+  QEMU_ARCH_SPSR_EL1,
+  QEMU_ARCH_ESR_EL1,
+  QEMU_ARCH_FAR_EL1,
+  QEMU_ARCH_TPIDR_EL0,
+  QEMU_ARCH_TPIDRRO_EL0,
+  QEMU_ARCH_TPIDR_EL1,
+  QEMU_ARCH_SYSREG_COUNT
+} QEMU_arch_sysreg_t;
+
+// Architectural state of an ARM cpu, copied in one call. In AArch32 the
+// general purpose registers are r0-r15 in x[0-15], sp is r13 and pc r15.
+typedef struct QEMU_arch_state {
+  uint64_t x[31];
+  uint64_t sp;
+  uint64_t pc;
+  // PSTATE in AArch64, CPSR in AArch32
+  uint32_t pstate;
+  uint32_t aarch64;
+  uint32_t el;
+  uint32_t fpcr;
+  uint32_t fpsr;
+  uint32_t pad;
+  // Q registers, low half first
+  uint64_t v[32][2];
+  uint64_t sysregs[QEMU_ARCH_SYSREG_COUNT];
+} QEMU_arch_state_t;
+
+// Parts of a QEMU_arch_state_t that changed since the last snapshot
+#define QEMU_ARCH_DIRTY_X(n)    (1ULL << (n))
+#define QEMU_ARCH_DIRTY_SP      (1ULL << 31)
+#define QEMU_ARCH_DIRTY_PC      (1ULL << 32)
+// pstate, aarch64 and el
+#define QEMU_ARCH_DIRTY_PSTATE  (1ULL << 33)
+// fpcr and fpsr
+#define QEMU_ARCH_DIRTY_FPCTRL  (1ULL << 34)
+#define QEMU_ARCH_DIRTY_V       (1ULL << 35)
+#define QEMU_ARCH_DIRTY_SYSREGS (1ULL << 36)
+#define QEMU_ARCH_DIRTY_ALL     ((1ULL << 37) - 1)
+
 typedef enum {
 	QEMU_DI_Instruction,
 	QEMU_DI_Data
@@ -369,6 +511,8 @@ typedef conf_object_t* (*QEMU_GET_OBJECT_PROC)(const char *name);
 //For Timing
 typedef int (*QEMU_CPU_EXEC_PROC)(conf_object_t *cpu);
 //NOOSHIN - end
+typedef int (*QEMU_CPU_EXECUTE_PROC)(conf_object_t *cpu, uint64_t count,
+                                     uint64_t *executed);
 
 /// DAMIEN - 
 /// Higher order API functions
@@ -380,6 +524,34 @@ typedef void (*QEMU_FLUSH_TB_CACHE_PROC)(void);
 typedef uint64_t (*QEMU_GET_INSTRUCTION_COUNT_PROC)(int cpu_number);
 /// END DAMIEN
 
+// Batched trace
+typedef void (*QEMU_TRACE_SET_BATCH_SIZE_PROC)(int records);
+typedef void (*QEMU_TRACE_FLUSH_PROC)(int cpu_id);
+typedef void (*QEMU_TRACE_SET_PARALLEL_PROC)(int enable);
+
+// Instrumentation filter
+typedef void (*QEMU_FILTER_SET_CPU_PROC)(int cpu_id, int enable);
+typedef void (*QEMU_FILTER_SET_KINDS_PROC)(int kinds);
+typedef int (*QEMU_FILTER_ADD_RANGE_PROC)(int space, uint64_t start, uint64_t end);
+typedef void (*QEMU_FILTER_CLEAR_RANGES_PROC)(void);
+typedef int (*QEMU_FILTER_SET_COALESCING_PROC)(int line_size, int window);
+typedef uint64_t (*QEMU_FILTER_GET_COALESCED_PROC)(int cpu_id);
+
+// Sampling controller
+typedef int (*QEMU_SAMPLING_CONFIGURE_PROC)(uint64_t period, uint64_t warm,
+                                            uint64_t measure, int cpu_id);
+
+// Checkpoint library
+typedef void (*QEMU_CHECKPOINT_REQUEST_PROC)(void);
+
+// Bulk architectural state
+typedef int (*QEMU_READ_ARCH_STATE_PROC)(conf_object_t *cpu, QEMU_arch_state_t *state);
+typedef int (*QEMU_READ_ARCH_STATE_DIRTY_PROC)(conf_object_t *cpu, QEMU_arch_state_t *state,
+                                               uint64_t *dirty);
+
+// Guest RAM window
+typedef void *(*QEMU_MAP_PHYS_MEMORY_PROC)(physical_address_t pa, uint64_t *len);
+
 #ifndef QEMUFLEX_PROTOTYPES
 extern CPU_READ_REGISTER_PROC cpu_read_register;
 extern READREG_PROC readReg;
@@ -459,12 +631,44 @@ extern QEMU_GET_OBJECT_PROC QEMU_get_object;
 //NOOSHIN: begin
 extern QEMU_CPU_EXEC_PROC QEMU_cpu_exec_proc;
 //NOOSHIN: end
+extern QEMU_CPU_EXECUTE_PROC QEMU_cpu_execute;
 
 extern QEMU_IS_IN_SIMULATION_PROC QEMU_is_in_simulation;
 extern QEMU_TOGGLE_SIMULATION_PROC QEMU_toggle_simulation;
 extern QEMU_FLUSH_TB_CACHE_PROC QEMU_flush_tb_cache;
 
 extern QEMU_GET_INSTRUCTION_COUNT_PROC QEMU_get_instruction_count;
+
+// deliver memory transactions in batches of the given number of records
+// instead of one QEMU_cpu_mem_trans callback per access (0 disables)
+extern QEMU_TRACE_SET_BATCH_SIZE_PROC QEMU_trace_set_batch_size;
+
+// hand the pending records of a cpu (or -1 for all) to the batch callbacks
+extern QEMU_TRACE_FLUSH_PROC QEMU_trace_flush;
+
+// run the cpu specific batch callbacks on one host thread per cpu (see below)
+extern QEMU_TRACE_SET_PARALLEL_PROC QEMU_trace_set_parallel;
+
+// restrict the memory transactions reaching the callbacks (see below)
+extern QEMU_FILTER_SET_CPU_PROC QEMU_filter_set_cpu;
+extern QEMU_FILTER_SET_KINDS_PROC QEMU_filter_set_kinds;
+extern QEMU_FILTER_ADD_RANGE_PROC QEMU_filter_add_range;
+extern QEMU_FILTER_CLEAR_RANGES_PROC QEMU_filter_clear_ranges;
+extern QEMU_FILTER_SET_COALESCING_PROC QEMU_filter_set_coalescing;
+extern QEMU_FILTER_GET_COALESCED_PROC QEMU_filter_get_coalesced;
+
+// alternate uninstrumented and instrumented windows (see below)
+extern QEMU_SAMPLING_CONFIGURE_PROC QEMU_sampling_configure;
+
+// record a sample checkpoint at the current instruction (see below)
+extern QEMU_CHECKPOINT_REQUEST_PROC QEMU_checkpoint_request;
+
+// copy the whole architectural state of a cpu (see below)
+extern QEMU_READ_ARCH_STATE_PROC QEMU_read_arch_state;
+extern QEMU_READ_ARCH_STATE_DIRTY_PROC QEMU_read_arch_state_dirty;
+
+// host pointer to a range of guest RAM (see below)
+extern QEMU_MAP_PHYS_MEMORY_PROC QEMU_map_phys_memory;
 #else /* QEMUFLEX_PROTOTYPES */
 // query the content/size of a register
 // if reg_size != NULL, write the size of the register (in bytes) in reg_size
@@ -560,21 +764,32 @@ int QEMU_mem_op_is_read(generic_transaction_t *mop);
 //ALEX - begin 
 ////For Timing (mai) 
 instruction_error_t QEMU_instruction_handle_interrupt(conf_object_t *cpu, pseudo_exceptions_t pendingInterrupt); 
+// Exception or interrupt taken during the last step of a cpu, -1 for none
 int QEMU_get_pending_exception(void); 
+// Execute one instruction of the cpu stepped last, the first cpu at first,
+// and return the exception or interrupt it took, -1 for none
 int QEMU_advance(void); 
 conf_object_t *QEMU_get_object(const char *name);	//generic function to get a pointer to a QEMU object by name
 ////ALEX - end 
 //
 
 //NOOSHIN: begin
-// cpu must point to a CPUState object
-int get_info(void *cpu);
-
+// Execute one instruction of the cpu, see QEMU_cpu_execute
 int QEMU_cpu_exec_proc(conf_object_t *cpu);
 //NOOSHIN: end
+// Execute exactly count instructions of the cpu and return the last
+// exception or interrupt it took meanwhile, -1 for none. Set executed to
+// the instructions executed, fewer than count if the cpu halted or the VM
+// stopped. Only from the thread that called startTiming; the code the cpu
+// stops in the middle of is translated once and then reused, and the main
+// loop only runs when it asks for the lock, so steps of a few instructions
+// are cheap.
+int QEMU_cpu_execute(conf_object_t *cpu, uint64_t count, uint64_t *executed);
 
 int QEMU_is_in_simulation(void);
 
+// Turning the simulation on is refused with -tcg-threads multi, where the
+// vCPUs do not run in turn.
 void QEMU_toggle_simulation(int enable);
 
 // Return the number of instructions to simulate for.
@@ -589,6 +804,89 @@ uint64_t QEMU_get_instruction_count(int cpu_number);
 // Get the total instruction count for all the processors.
 uint64_t QEMU_get_total_instruction_count(void);
 
+// deliver memory transactions in batches of the given number of records
+// instead of one QEMU_cpu_mem_trans callback per access (0 disables)
+void QEMU_trace_set_batch_size(int records);
+
+// hand the pending records of a cpu (or -1 for all) to the batch callbacks
+void QEMU_trace_flush(int cpu_id);
+
+// Parallel trace mode. The batch callbacks registered for a specific cpu
+// run on a host thread of that cpu while the vcpus keep executing, so they
+// may only touch state private to their cpu. Generic batch callbacks keep
+// running on the vcpu thread in execution order. All the threads are
+// drained at the end of every round of quanta and by QEMU_trace_flush, so
+// with a quantum set every run delivers the same batches at the same points.
+void QEMU_trace_set_parallel(int enable);
+
+// Instrumentation filter. Instruction fetches and data accesses that do
+// not pass it never reach the QEMU_cpu_mem_trans callbacks or the trace.
+// The cpu and user/kernel parts are decided when translating, so code
+// filtered out this way runs without instrumentation.
+// (Do not) instrument the given cpu, every cpu is instrumented by default
+void QEMU_filter_set_cpu(int cpu_id, int enable);
+// Only keep the given QEMU_FILTER_* kinds of accesses (default QEMU_FILTER_ALL)
+void QEMU_filter_set_kinds(int kinds);
+// Only keep accesses to [start, end) and the other ranges of the same
+// QEMU_FILTER_VIRTUAL or QEMU_FILTER_PHYSICAL space, -1 if there are
+// too many ranges
+int QEMU_filter_add_range(int space, uint64_t start, uint64_t end);
+// Remove every range, all addresses are kept again
+void QEMU_filter_clear_ranges(void);
+// Coalescing of the data accesses, for functional warming. A load (store)
+// of a cpu to one of the line_size bytes lines of its last 4 loads (stores)
+// passed on is dropped. After window accesses to a line were dropped the
+// next one is passed on again, 0 drops them until the line is replaced.
+// The accesses dropped to a line are delivered as a count record before
+// the access that passes the line on again or replaces it.
+// I/O accesses and accesses crossing a line are always passed on. A
+// line_size of 0 disables the coalescing, -1 if it is not a power of two.
+int QEMU_filter_set_coalescing(int line_size, int window);
+// Number of accesses of a cpu (or of all the cpus for -1) dropped by the
+// coalescing
+uint64_t QEMU_filter_get_coalesced(int cpu_id);
+
+// Sampling controller. Every period instructions, run without
+// instrumentation for period - warm - measure instructions, then with it
+// for warm and measure instructions. The phases end on the exact
+// instruction counts of cpu_id, or on their sum over all the cpus for -1,
+// and every change is announced by a QEMU_sampling_phase callback with
+// the new QEMU_SAMPLING_* phase, cpu_id and the sample number. A period
+// of 0 stops the controller and leaves the instrumentation as it is.
+// Returns -1 if the arguments are invalid, or with -tcg-threads multi.
+int QEMU_sampling_configure(uint64_t period, uint64_t warm,
+                            uint64_t measure, int cpu_id);
+
+// Record a sample checkpoint in the checkpoint library started with the
+// cpt-start monitor command, e.g. from a QEMU_sampling_phase callback.
+// The cpu stops when it leaves its current TB: from a QEMU_sampling_phase
+// callback, which runs between two TBs, the checkpoint is taken exactly
+// before the next instruction of the cpu; from a callback of an instruction
+// in the middle of a TB, after the rest of that TB. The VM resumes once the
+// checkpoint has been written, if it was running.
+// Does nothing when no library is being recorded, or with -tcg-threads multi.
+void QEMU_checkpoint_request(void);
+
+// Copy the registers, PSTATE, FP/SIMD state and QEMU_arch_sysreg_t system
+// registers of the cpu to state in a single call, instead of one
+// QEMU_read_register per register. The copy becomes the last snapshot of
+// the cpu. Returns -1 if the target has no QEMU_arch_state_t.
+int QEMU_read_arch_state(conf_object_t *cpu, QEMU_arch_state_t *state);
+// Same, but only copy the QEMU_ARCH_DIRTY_* parts of the state that changed
+// since the last snapshot of the cpu, and set them in dirty. state must
+// hold that snapshot. Everything is dirty on the first snapshot.
+int QEMU_read_arch_state_dirty(conf_object_t *cpu, QEMU_arch_state_t *state,
+                               uint64_t *dirty);
+
+// Return the host address of the guest RAM at the physical address pa,
+// and set len to the number of bytes from pa that are contiguous in the
+// host, at most the len asked for. Returns NULL if pa is not RAM or ROM.
+// Nothing is copied: the pointer stays valid until a
+// QEMU_phys_memory_unmapped callback covers pa, and sees every write of
+// the guest, the devices, an incoming migration or a checkpoint restore.
+// ROM must not be written through it.
+void *QEMU_map_phys_memory(physical_address_t pa, uint64_t *len);
+
 #endif /* QEMUFLEX_PROTOTYPES */
 
 ///
@@ -610,7 +908,15 @@ uint64_t QEMU_get_total_instruction_count(void);
 // m - generic_transaction_t*
 // c - conf_object_t*
 // v - void*
+// b - QEMU_mem_trace_record_t* batch and its length
+//
+// QEMU_sampling_phase callbacks are noiiI: class_data, phase, cpu_id and
+// sample number.
+// QEMU_phys_memory_unmapped callbacks are noII: class_data, start and length
+// of the guest physical range whose QEMU_map_phys_memory pointers are no
+// longer valid, called before the RAM goes away.
 typedef void (*cb_func_void)(void);
+typedef void (*cb_func_void_t2)(void *);
 typedef void (*cb_func_noc_t)(void *, conf_object_t *);
 typedef void (*cb_func_noc_t2)(void*, void *, conf_object_t *);
 typedef void (*cb_func_nocI_t)(void *, conf_object_t *, int64_t);
@@ -619,6 +925,8 @@ typedef void (*cb_func_nocIs_t)(void *, conf_object_t *, int64_t, char *);
 typedef void (*cb_func_nocIs_t2)(void *, void *, conf_object_t *, int64_t, char *);
 typedef void (*cb_func_noiiI_t)(void *, int, int, int64_t);
 typedef void (*cb_func_noiiI_t2)(void *, void *, int, int, int64_t);
+typedef void (*cb_func_noII_t)(void *, int64_t, int64_t);
+typedef void (*cb_func_noII_t2)(void *, void *, int64_t, int64_t);
 
 typedef void (*cb_func_ncm_t)(
 		  conf_object_t *
@@ -631,6 +939,8 @@ typedef void (*cb_func_ncm_t2)(
 		);
 typedef void (*cb_func_nocs_t)(void *, conf_object_t *, char *);
 typedef void (*cb_func_nocs_t2)(void *, void *, conf_object_t *, char *);
+typedef void (*cb_func_nib_t)(int, QEMU_mem_trace_record_t *, size_t);
+typedef void (*cb_func_nib_t2)(void *, int, QEMU_mem_trace_record_t *, size_t);
 
 
 typedef struct {
@@ -658,6 +968,12 @@ typedef struct {
 	int64_t bigint;
 } QEMU_noiiI;
 
+typedef struct {
+	void *class_data;
+	int64_t bigint0;
+	int64_t bigint1;
+} QEMU_noII;
+
 typedef struct {
 	conf_object_t *space;
 	memory_transaction_t *trans;
@@ -668,13 +984,21 @@ typedef struct {
 	conf_object_t *obj;
 	char *string;
 } QEMU_nocs;
+
+typedef struct {
+	int cpu_id;
+	QEMU_mem_trace_record_t *records;
+	size_t count;
+} QEMU_nib;
 typedef union {
 	QEMU_noc	*noc;
 	QEMU_nocIs	*nocIs;
 	QEMU_nocI   *nocI;
 	QEMU_noiiI	*noiiI;
+	QEMU_noII	*noII;
 	QEMU_nocs	*nocs;
 	QEMU_ncm	*ncm;
+	QEMU_nib	*nib;
 } QEMU_callback_args_t;
 
 typedef enum {
@@ -691,6 +1015,9 @@ typedef enum {
     QEMU_gfx_break_string,
     QEMU_cpu_mem_trans,
 	QEMU_dma_mem_trans,
+    QEMU_cpu_mem_trans_batch,
+    QEMU_sampling_phase,
+    QEMU_phys_memory_unmapped,
     QEMU_callback_event_count // MUST BE LAST.
 } QEMU_callback_event_t;
 
@@ -702,9 +1029,35 @@ struct QEMU_callback_container {
 };
 typedef struct QEMU_callback_container QEMU_callback_container_t;
 
+// A callback ready to be called, fn always takes obj as first argument.
+// Callbacks registered without an object are called through a trampoline
+// that gets the registered function as obj.
+struct QEMU_callback_entry {
+	void *fn;
+	void *obj;
+};
+typedef struct QEMU_callback_entry QEMU_callback_entry_t;
+
+// Contiguous list of the callbacks to run for one event of a table
+struct QEMU_callback_list {
+	QEMU_callback_entry_t *entries;
+	int count;
+	// the first own_count entries are the callbacks of the table itself,
+	// the generic callbacks are merged in after them
+	int own_count;
+};
+typedef struct QEMU_callback_list QEMU_callback_list_t;
+
 struct QEMU_callback_table {
 	uint64_t next_callback_id;
+	// registered callbacks, in insertion order
 	QEMU_callback_container_t *callbacks[QEMU_callback_event_count];
+	// rebuilt from the callbacks on every insertion and deletion, so they
+	// must not be changed from a callback of the same event; published
+	// with RCU since the trace threads walk them without the BQL
+	QEMU_callback_list_t *dispatch[QEMU_callback_event_count];
+	// bit e is set when dispatch[e] is not empty
+	uint32_t has_callbacks;
 };
 typedef struct QEMU_callback_table QEMU_callback_table_t;
 
@@ -731,6 +1084,8 @@ void QEMU_delete_callback( int cpu_id, QEMU_callback_event_t event, uint64_t cal
 ///
 
 #ifdef QEMUFLEX_QEMU_INTERNAL
+#include "qemu/rcu.h"
+
 // Initialize the callback tables for every processor and also the
 // different counts.
 void QEMU_initialize(void);
@@ -748,6 +1103,37 @@ void QEMU_execute_callbacks(
 		  QEMU_callback_event_t event,
 		  QEMU_callback_args_t *event_data
 		);
+// execute only the callbacks specific to the given cpu
+void QEMU_execute_cpu_callbacks(
+		  int cpu_id,
+		  QEMU_callback_event_t event,
+		  QEMU_callback_args_t *event_data
+		);
+
+// one table for generic callbacks followed by one for every cpu
+extern QEMU_callback_table_t *QEMU_all_callbacks_tables;
+
+// tell whether QEMU_execute_callbacks would run any callback, to be
+// checked before building the event data
+static inline int QEMU_has_callbacks(int cpu_id, QEMU_callback_event_t event) {
+  return (QEMU_all_callbacks_tables[cpu_id+1].has_callbacks >> event) & 1;
+}
+
+// QEMU_execute_callbacks for QEMU_cpu_mem_trans, without going through
+// the event dispatch
+static inline void QEMU_execute_mem_trans_callbacks(
+		  int cpu_id,
+		  conf_object_t *space,
+		  memory_transaction_t *trans) {
+  const QEMU_callback_list_t *list;
+  int i = 0;
+
+  rcu_read_lock();
+  list = atomic_rcu_read(&QEMU_all_callbacks_tables[cpu_id+1].dispatch[QEMU_cpu_mem_trans]);
+  for( ; i < list->count; i++ )
+    (*(cb_func_ncm_t2)list->entries[i].fn)(list->entries[i].obj, space, trans);
+  rcu_read_unlock();
+}
 
 // Initialize to 0 the instruction counts for every processor
 void QEMU_initialize_counts(void);
@@ -755,6 +1141,39 @@ void QEMU_initialize_counts(void);
 void QEMU_deinitialize_counts(void);
 // Increment the instruction count for the given cpu
 void QEMU_increment_instruction_count(int cpu_number);
+
+// Allocate the per-cpu trace buffers used by the batched trace API
+void QEMU_trace_ring_init(void);
+// Flush and free the per-cpu trace buffers
+void QEMU_trace_ring_deinit(void);
+// A quantum of the cpu ended, end_of_round is set for the last cpu
+void QEMU_trace_end_quantum(int cpu_id, int end_of_round);
+
+// Setup and free the instrumentation filter, everything passes it
+void QEMU_filter_init(void);
+void QEMU_filter_deinit(void);
+// Tell whether the memory accesses of TBs translated for the cpu in user
+// or kernel mode are instrumented
+int QEMU_filter_trace_tb(int cpu_id, int is_user);
+// Forget the last accesses of the coalescing, the next access of every
+// cpu is passed on. The accesses dropped so far are only counted by
+// QEMU_filter_get_coalesced.
+void QEMU_filter_coalesce_reset(void);
+
+// The instruction event set by the sampling controller was reached
+void QEMU_sampling_instr_event(int cpu_id);
+// The cpu is about to execute, arm the end of the current phase on it
+void QEMU_sampling_cpu_resume(int cpu_id);
+
+// Allocate and free the last QEMU_read_arch_state snapshot of every cpu
+void QEMU_arch_state_init(void);
+void QEMU_arch_state_deinit(void);
+// Copy the architectural state of the cpu, -1 if the target cannot
+int cpu_read_arch_state(void *cs, QEMU_arch_state_t *state);
+
+// Start and stop watching the guest RAM for QEMU_phys_memory_unmapped
+void QEMU_physmem_init(void);
+void QEMU_physmem_deinit(void);
 #endif /* QEMUFLEX_QEMU_INTERNAL */
 
 ///
@@ -839,6 +1258,7 @@ QEMU_GET_OBJECT_PROC QEMU_get_object;
 //NOOSHIN: begin
 QEMU_CPU_EXEC_PROC QEMU_cpu_exec_proc;
 //NOOSHIN: end
+QEMU_CPU_EXECUTE_PROC QEMU_cpu_execute;
 
 QEMU_IS_IN_SIMULATION_PROC QEMU_is_in_simulation;
 QEMU_TOGGLE_SIMULATION_PROC QEMU_toggle_simulation;
@@ -851,6 +1271,37 @@ QEMU_INSERT_CALLBACK_PROC QEMU_insert_callback;
 QEMU_DELETE_CALLBACK_PROC QEMU_delete_callback;
 
 QEMU_GET_INSTRUCTION_COUNT_PROC QEMU_get_instruction_count;
+
+// deliver memory transactions in batches of the given number of records
+// instead of one QEMU_cpu_mem_trans callback per access (0 disables)
+QEMU_TRACE_SET_BATCH_SIZE_PROC QEMU_trace_set_batch_size;
+
+// hand the pending records of a cpu (or -1 for all) to the batch callbacks
+QEMU_TRACE_FLUSH_PROC QEMU_trace_flush;
+
+// run the cpu specific batch callbacks on one host thread per cpu
+QEMU_TRACE_SET_PARALLEL_PROC QEMU_trace_set_parallel;
+
+// restrict the memory transactions reaching the callbacks
+QEMU_FILTER_SET_CPU_PROC QEMU_filter_set_cpu;
+QEMU_FILTER_SET_KINDS_PROC QEMU_filter_set_kinds;
+QEMU_FILTER_ADD_RANGE_PROC QEMU_filter_add_range;
+QEMU_FILTER_CLEAR_RANGES_PROC QEMU_filter_clear_ranges;
+QEMU_FILTER_SET_COALESCING_PROC QEMU_filter_set_coalescing;
+QEMU_FILTER_GET_COALESCED_PROC QEMU_filter_get_coalesced;
+
+// alternate uninstrumented and instrumented windows
+QEMU_SAMPLING_CONFIGURE_PROC QEMU_sampling_configure;
+
+// record a sample checkpoint at the current instruction
+QEMU_CHECKPOINT_REQUEST_PROC QEMU_checkpoint_request;
+
+// copy the whole architectural state of a cpu
+QEMU_READ_ARCH_STATE_PROC QEMU_read_arch_state;
+QEMU_READ_ARCH_STATE_DIRTY_PROC QEMU_read_arch_state_dirty;
+
+// host pointer to a range of guest RAM
+QEMU_MAP_PHYS_MEMORY_PROC QEMU_map_phys_memory;
 } QFLEX_API_Interface_Hooks_t;
 
 
@@ -0,0 +1,290 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "qemu/host-utils.h"
+#include "qemu/error-report.h"
+#include "qom/cpu.h"
+#include "qapi/error.h"
+#include "qapi/qmp/types.h"
+#include "qapi/qmp/qjson.h"
+#include "qmp-commands.h"
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "api.h"
+#include "bench.h"
+
+// How often the main loop checks whether the current mode has executed
+// its instructions
+#define QEMU_BENCH_POLL_MS 10
+// Bucket i of a histogram counts the events that took 2^i to 2^(i+1) ns
+#define QEMU_BENCH_BUCKETS 32
+
+QEMU_bench_t QEMU_bench = {
+  .events = (1 << QEMU_BENCH_EVENTS) - 1,
+};
+
+typedef struct QEMU_bench_result {
+  uint64_t instructions;
+  int64_t ns;
+  uint64_t count[QEMU_BENCH_EVENTS];
+  uint64_t timed[QEMU_BENCH_EVENTS];
+  int64_t timed_ns[QEMU_BENCH_EVENTS];
+  uint64_t histogram[QEMU_BENCH_EVENTS][QEMU_BENCH_BUCKETS];
+} QEMU_bench_result_t;
+
+// A benchmark runs its modes one after the other, each for the same number
+// of instructions of all the cpus, from the main loop. Everything is done
+// with the iothread lock held, like the execution of the cpus.
+typedef struct QEMU_bench_run {
+  int running;
+  FlexusBenchMode modes[FLEXUS_BENCH_MODE__MAX];
+  int num_modes;
+  int current;
+  uint64_t window;
+  char *file;
+  QEMUTimer *timer;
+  uint64_t start_instructions;
+  int64_t start_ns;
+  int was_simulating;
+  // callbacks added so that the events go through the dispatch
+  int mem_trans_callback;
+  int dma_callback;
+  QEMU_bench_result_t results[FLEXUS_BENCH_MODE__MAX];
+} QEMU_bench_run_t;
+
+static QEMU_bench_run_t QEMU_bench_run;
+
+static const char *bench_event_names[QEMU_BENCH_EVENTS] = {
+  [QEMU_BENCH_EVENT_FETCH] = "fetch",
+  [QEMU_BENCH_EVENT_LS] = "ls",
+  [QEMU_BENCH_EVENT_DMA] = "dma",
+};
+
+static void bench_null_mem_trans(conf_object_t *space,
+                                 memory_transaction_t *trans) {
+}
+
+static uint64_t bench_instructions(void) {
+  uint64_t total = 0;
+  CPUState *cpu;
+  CPU_FOREACH(cpu) {
+    total += cpu_executed_instructions(cpu);
+  }
+  return total;
+}
+
+void QEMU_bench_record(int event, int64_t ns) {
+  QEMU_bench_result_t *result = &QEMU_bench_run.results[QEMU_bench_run.current];
+  int bucket = ns > 1 ? 63 - clz64(ns) : 0;
+
+  if( bucket >= QEMU_BENCH_BUCKETS )
+    bucket = QEMU_BENCH_BUCKETS - 1;
+  result->timed[event]++;
+  result->timed_ns[event] += ns;
+  result->histogram[event][bucket]++;
+}
+
+static void bench_start_mode(void) {
+  FlexusBenchMode mode = QEMU_bench_run.modes[QEMU_bench_run.current];
+  CPUState *cpu;
+  int events = 0;
+
+  switch( mode ) {
+  case FLEXUS_BENCH_MODE_FETCH:
+    events = 1 << QEMU_BENCH_EVENT_FETCH;
+    break;
+  case FLEXUS_BENCH_MODE_LS:
+    events = 1 << QEMU_BENCH_EVENT_LS;
+    break;
+  case FLEXUS_BENCH_MODE_BOTH:
+    events = (1 << QEMU_BENCH_EVENT_FETCH) | (1 << QEMU_BENCH_EVENT_LS);
+    break;
+  case FLEXUS_BENCH_MODE_DMA:
+    events = 1 << QEMU_BENCH_EVENT_DMA;
+    break;
+  default:
+    break;
+  }
+  memset(QEMU_bench.count, 0, sizeof(QEMU_bench.count));
+  QEMU_bench.events = events;
+  QEMU_bench.timing = events != 0;
+  // the cpus are only instrumented while simulating
+  QEMU_toggle_simulation((events & ~(1 << QEMU_BENCH_EVENT_DMA)) != 0);
+  // the instrumented events are part of the TB flags: make every cpu look
+  // up its next TB, translated without the helpers of the other events
+  CPU_FOREACH(cpu) {
+    cpu_exit(cpu);
+  }
+
+  QEMU_bench_run.start_instructions = bench_instructions();
+  QEMU_bench_run.start_ns = get_clock();
+}
+
+static QObject *bench_report(void) {
+  QDict *report = qdict_new();
+  QList *modes = qlist_new();
+  int i = 0;
+
+  qdict_put(report, "instructions", qint_from_int(QEMU_bench_run.window));
+  qdict_put(report, "sample-period", qint_from_int(QEMU_BENCH_SAMPLE_MASK + 1));
+  for( ; i < QEMU_bench_run.num_modes; i++ ) {
+    const QEMU_bench_result_t *result = &QEMU_bench_run.results[i];
+    QDict *entry = qdict_new();
+    QDict *events = qdict_new();
+    int event = 0;
+
+    qdict_put(entry, "mode",
+              qstring_from_str(FlexusBenchMode_lookup[QEMU_bench_run.modes[i]]));
+    qdict_put(entry, "instructions", qint_from_int(result->instructions));
+    qdict_put(entry, "ns", qint_from_int(result->ns));
+    qdict_put(entry, "mips", qfloat_from_double(
+                result->ns > 0 ? result->instructions * 1000.0 / result->ns : 0));
+    for( ; event < QEMU_BENCH_EVENTS; event++ ) {
+      QDict *stats;
+      QList *histogram;
+      int bucket = 0;
+
+      if( result->count[event] == 0 )
+        continue;
+      stats = qdict_new();
+      histogram = qlist_new();
+      qdict_put(stats, "count", qint_from_int(result->count[event]));
+      qdict_put(stats, "timed", qint_from_int(result->timed[event]));
+      qdict_put(stats, "mean-ns", qfloat_from_double(
+                  result->timed[event] > 0
+                  ? (double)result->timed_ns[event] / result->timed[event] : 0));
+      for( ; bucket < QEMU_BENCH_BUCKETS; bucket++ )
+        qlist_append(histogram, qint_from_int(result->histogram[event][bucket]));
+      qdict_put(stats, "histogram-log2-ns", histogram);
+      qdict_put(events, bench_event_names[event], stats);
+    }
+    qdict_put(entry, "events", events);
+    qlist_append(modes, entry);
+  }
+  qdict_put(report, "modes", modes);
+  return QOBJECT(report);
+}
+
+static void bench_finish(void) {
+  QObject *report = bench_report();
+  QString *json = qobject_to_json_pretty(report);
+  FILE *file = fopen(QEMU_bench_run.file, "w");
+  CPUState *cpu;
+
+  if( file != NULL ) {
+    fprintf(file, "%s\n", qstring_get_str(json));
+    fclose(file);
+  } else {
+    error_report("flexus-bench: cannot write %s: %s", QEMU_bench_run.file,
+                 strerror(errno));
+  }
+  QDECREF(json);
+  qobject_decref(report);
+
+  QEMU_bench.timing = 0;
+  QEMU_bench.events = (1 << QEMU_BENCH_EVENTS) - 1;
+  QEMU_toggle_simulation(QEMU_bench_run.was_simulating);
+  CPU_FOREACH(cpu) {
+    cpu_exit(cpu);
+  }
+  if( QEMU_bench_run.mem_trans_callback >= 0 )
+    QEMU_delete_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_cpu_mem_trans,
+                         QEMU_bench_run.mem_trans_callback);
+  if( QEMU_bench_run.dma_callback >= 0 )
+    QEMU_delete_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans,
+                         QEMU_bench_run.dma_callback);
+  timer_free(QEMU_bench_run.timer);
+  g_free(QEMU_bench_run.file);
+  QEMU_bench_run.running = 0;
+}
+
+static void bench_poll(void *opaque) {
+  QEMU_bench_result_t *result = &QEMU_bench_run.results[QEMU_bench_run.current];
+  uint64_t executed = bench_instructions() - QEMU_bench_run.start_instructions;
+
+  if( executed >= QEMU_bench_run.window ) {
+    result->instructions = executed;
+    result->ns = get_clock() - QEMU_bench_run.start_ns;
+    memcpy(result->count, QEMU_bench.count, sizeof(result->count));
+    if( ++QEMU_bench_run.current == QEMU_bench_run.num_modes ) {
+      bench_finish();
+      return;
+    }
+    bench_start_mode();
+  }
+  timer_mod(QEMU_bench_run.timer,
+            qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + QEMU_BENCH_POLL_MS);
+}
+
+void qmp_flexus_bench(int64_t instructions, const char *file,
+                      bool has_modes, FlexusBenchModeList *modes,
+                      Error **errp) {
+  int i = 0;
+
+  if( QEMU_bench_run.running ) {
+    error_setg(errp, "A benchmark is already running");
+    return;
+  }
+  if( qemu_tcg_mttcg_enabled() ) {
+    // the counters and the instrumented TBs expect the vCPUs to run in turn
+    error_setg(errp, "The benchmark cannot run with -tcg-threads multi");
+    return;
+  }
+  if( QEMU_all_callbacks_tables == NULL ) {
+    error_setg(errp, "The Flexus API is not initialized yet");
+    return;
+  }
+  if( instructions <= 0 ) {
+    error_setg(errp, "The number of instructions must be positive");
+    return;
+  }
+
+  memset(&QEMU_bench_run, 0, sizeof(QEMU_bench_run));
+  if( has_modes ) {
+    for( ; modes != NULL; modes = modes->next ) {
+      if( QEMU_bench_run.num_modes == FLEXUS_BENCH_MODE__MAX ) {
+        error_setg(errp, "Too many modes");
+        return;
+      }
+      QEMU_bench_run.modes[QEMU_bench_run.num_modes++] = modes->value;
+    }
+  } else {
+    for( ; i < FLEXUS_BENCH_MODE__MAX; i++ )
+      QEMU_bench_run.modes[QEMU_bench_run.num_modes++] = i;
+  }
+  if( QEMU_bench_run.num_modes == 0 ) {
+    error_setg(errp, "No mode to measure");
+    return;
+  }
+  QEMU_bench_run.window = instructions;
+  QEMU_bench_run.file = g_strdup(file);
+  QEMU_bench_run.was_simulating = QEMU_is_in_simulation();
+
+  // measure the dispatch even without a simulator listening
+  QEMU_bench_run.mem_trans_callback = -1;
+  QEMU_bench_run.dma_callback = -1;
+  if( !QEMU_has_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_cpu_mem_trans) )
+    QEMU_bench_run.mem_trans_callback =
+      QEMU_insert_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_cpu_mem_trans,
+                           NULL, (void *)bench_null_mem_trans);
+  if( !QEMU_has_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans) )
+    QEMU_bench_run.dma_callback =
+      QEMU_insert_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans,
+                           NULL, (void *)bench_null_mem_trans);
+
+  QEMU_bench_run.running = 1;
+  QEMU_bench_run.timer = timer_new_ms(QEMU_CLOCK_REALTIME, bench_poll, NULL);
+  bench_start_mode();
+  timer_mod(QEMU_bench_run.timer,
+            qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + QEMU_BENCH_POLL_MS);
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,44 @@
+#ifndef __LIBQEMUFLEX_BENCH_H__
+#define __LIBQEMUFLEX_BENCH_H__
+
+#include "qemu/timer.h"
+
+// Instrumentation events timed by the benchmark
+#define QEMU_BENCH_EVENT_FETCH  0
+#define QEMU_BENCH_EVENT_LS     1
+#define QEMU_BENCH_EVENT_DMA    2
+#define QEMU_BENCH_EVENTS       3
+
+// Only one event out of QEMU_BENCH_SAMPLE_MASK + 1 is timed, reading the
+// clock around every callback would slow down the MIPS being measured
+#define QEMU_BENCH_SAMPLE_MASK  63
+
+typedef struct QEMU_bench {
+  // (1 << QEMU_BENCH_EVENT_*) events that are reported, all of them when
+  // no benchmark is running
+  int events;
+  // set while a benchmark times the events
+  int timing;
+  // events reported in the current mode of the benchmark
+  uint64_t count[QEMU_BENCH_EVENTS];
+} QEMU_bench_t;
+
+extern QEMU_bench_t QEMU_bench;
+
+// Add the cost of a timed event to the histograms of the current mode
+void QEMU_bench_record(int event, int64_t ns);
+
+// Report an event with stmt, which runs the callbacks, and time it if it
+// is sampled by a running benchmark
+#define QEMU_BENCH_TIME(event, stmt) do {                             \
+    if( unlikely(QEMU_bench.timing)                                   \
+        && (QEMU_bench.count[event]++ & QEMU_BENCH_SAMPLE_MASK) == 0 ) { \
+      int64_t bench_start = get_clock();                              \
+      stmt;                                                           \
+      QEMU_bench_record(event, get_clock() - bench_start);            \
+    } else {                                                          \
+      stmt;                                                           \
+    }                                                                 \
+  } while( 0 )
+
+#endif /* __LIBQEMUFLEX_BENCH_H__ */
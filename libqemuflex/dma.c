@@ -0,0 +1,80 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "exec/memory.h"
+#include "hw/pci/pci.h"
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "api.h"
+#include "dma.h"
+#include "bench.h"
+
+struct QEMU_dma_initiator {
+  // handed to the callbacks as the space and the initiator
+  conf_object_t obj;
+  ini_type_t type;
+  int ignore;
+};
+
+void QEMU_dma_init_address_space(AddressSpace *as) {
+  QEMU_dma_initiator_t *initiator = calloc(1, sizeof(QEMU_dma_initiator_t));
+  Object *owner = as->root->owner;
+
+  initiator->obj.name = as->name;
+  initiator->obj.object = as;
+  initiator->obj.type = QEMU_AddressSpace;
+  // a PCI device masters the bus through its own address space, the other
+  // devices share the memory
+  if( owner != NULL && object_dynamic_cast(owner, TYPE_PCI_DEVICE) != NULL )
+    initiator->type = QEMU_Initiator_PCI_Device;
+  else
+    initiator->type = QEMU_Initiator_Device;
+  as->dma_initiator = initiator;
+}
+
+void QEMU_dma_destroy_address_space(AddressSpace *as) {
+  free(as->dma_initiator);
+  as->dma_initiator = NULL;
+}
+
+void QEMU_dma_ignore_address_space(AddressSpace *as) {
+  as->dma_initiator->ignore = 1;
+}
+
+void QEMU_dma_transaction(AddressSpace *as, hwaddr addr, hwaddr len,
+                          bool is_write) {
+  QEMU_dma_initiator_t *initiator = as->dma_initiator;
+  memory_transaction_t trans;
+  QEMU_ncm args;
+  QEMU_callback_args_t event_data;
+
+  // devices already do DMA before the callback tables exist
+  if( QEMU_all_callbacks_tables == NULL
+      || !QEMU_has_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans)
+      || initiator->ignore
+      || !(QEMU_bench.events & (1 << QEMU_BENCH_EVENT_DMA)) )
+    return;
+
+  memset(&trans, 0, sizeof(trans));
+  trans.s.ini_ptr = &initiator->obj;
+  trans.s.ini_type = initiator->type;
+  trans.s.physical_address = addr;
+  trans.s.size = len;
+  trans.s.type = is_write ? QEMU_Trans_Store : QEMU_Trans_Load;
+
+  args.space = &initiator->obj;
+  args.trans = &trans;
+  event_data.ncm = &args;
+  QEMU_BENCH_TIME(QEMU_BENCH_EVENT_DMA,
+                  QEMU_execute_callbacks(QEMUFLEX_GENERIC_CALLBACK,
+                                         QEMU_dma_mem_trans, &event_data));
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
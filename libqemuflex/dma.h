@@ -0,0 +1,25 @@
+#ifndef __LIBQEMUFLEX_DMA_H__
+#define __LIBQEMUFLEX_DMA_H__
+
+#include "exec/hwaddr.h"
+
+// Identity of an address space in the QEMU_dma_mem_trans events, every
+// AddressSpace has one
+typedef struct QEMU_dma_initiator QEMU_dma_initiator_t;
+
+// Give a new address space its identity
+void QEMU_dma_init_address_space(AddressSpace *as);
+// Free the identity of a destroyed address space
+void QEMU_dma_destroy_address_space(AddressSpace *as);
+// Only cpus access the address space, do not report anything through it
+void QEMU_dma_ignore_address_space(AddressSpace *as);
+
+// Report an access of len bytes at addr through the address space to the
+// QEMU_dma_mem_trans callbacks, without allocating anything. Only the DMA
+// helpers of the devices call it (dma_memory_rw/map/set, which the PCI
+// helpers use, and the virtio rings), so that the cpus, the monitor, the
+// debugger, the ROM loaders and the simulator itself are never reported.
+void QEMU_dma_transaction(AddressSpace *as, hwaddr addr, hwaddr len,
+                          bool is_write);
+
+#endif /* __LIBQEMUFLEX_DMA_H__ */
@@ -0,0 +1,125 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "qom/cpu.h"
+#include "filter.h"
+
+QEMU_filter_t QEMU_filter;
+
+static void filter_update_check_access(void) {
+  QEMU_filter.check_access =
+    (QEMU_filter.kinds & (QEMU_FILTER_RAM | QEMU_FILTER_IO))
+      != (QEMU_FILTER_RAM | QEMU_FILTER_IO)
+    || QEMU_filter.num_ranges[QEMU_FILTER_VIRTUAL] != 0
+    || QEMU_filter.num_ranges[QEMU_FILTER_PHYSICAL] != 0;
+}
+
+// The cpu and user/kernel parts of the filter are in the TB flags, make
+// every cpu look its next TB up again so that they take effect.
+static void filter_kick_cpus(void) {
+  CPUState *cpu;
+  CPU_FOREACH(cpu) {
+    cpu_exit(cpu);
+  }
+}
+
+void QEMU_filter_coalesce_reset(void) {
+  int i = 0;
+  for( ; i < QEMU_filter.num_cpus; i++ ) {
+    QEMU_coalesce_t *c = &QEMU_filter.coalesce[i];
+    memset(c->lines, 0xff, sizeof(c->lines));
+    memset(c->folded, 0, sizeof(c->folded));
+    c->next[0] = c->next[1] = 0;
+  }
+}
+
+void QEMU_filter_init(void) {
+  memset(&QEMU_filter, 0, sizeof(QEMU_filter));
+  QEMU_filter.kinds = QEMU_FILTER_ALL;
+  QEMU_filter.num_cpus = QEMU_get_num_cpus();
+  QEMU_filter.cpus = malloc(QEMU_filter.num_cpus);
+  memset(QEMU_filter.cpus, 1, QEMU_filter.num_cpus);
+  QEMU_filter.coalesce = qemu_memalign(QEMU_FILTER_COALESCE_ALIGN,
+                                       QEMU_filter.num_cpus * sizeof(QEMU_coalesce_t));
+  memset(QEMU_filter.coalesce, 0, QEMU_filter.num_cpus * sizeof(QEMU_coalesce_t));
+  QEMU_filter_coalesce_reset();
+}
+
+void QEMU_filter_deinit(void) {
+  free(QEMU_filter.cpus);
+  QEMU_filter.cpus = NULL;
+  qemu_vfree(QEMU_filter.coalesce);
+  QEMU_filter.coalesce = NULL;
+  QEMU_filter.line_mask = 0;
+  QEMU_filter.num_cpus = 0;
+}
+
+int QEMU_filter_trace_tb(int cpu_id, int is_user) {
+  if( cpu_id < QEMU_filter.num_cpus && !QEMU_filter.cpus[cpu_id] )
+    return 0;
+  return (QEMU_filter.kinds & (is_user ? QEMU_FILTER_USER : QEMU_FILTER_KERNEL)) != 0;
+}
+
+void QEMU_filter_set_cpu(int cpu_id, int enable) {
+  if( cpu_id < 0 || cpu_id >= QEMU_filter.num_cpus )
+    return;
+  QEMU_filter.cpus[cpu_id] = enable != 0;
+  QEMU_filter_coalesce_reset();
+  filter_kick_cpus();
+}
+
+void QEMU_filter_set_kinds(int kinds) {
+  QEMU_filter.kinds = kinds & QEMU_FILTER_ALL;
+  filter_update_check_access();
+  QEMU_filter_coalesce_reset();
+  filter_kick_cpus();
+}
+
+int QEMU_filter_add_range(int space, uint64_t start, uint64_t end) {
+  if( space != QEMU_FILTER_VIRTUAL && space != QEMU_FILTER_PHYSICAL )
+    return -1;
+  if( QEMU_filter.num_ranges[space] == QEMU_FILTER_MAX_RANGES )
+    return -1;
+
+  QEMU_filter_range_t *range = &QEMU_filter.ranges[space][QEMU_filter.num_ranges[space]++];
+  range->start = start;
+  range->end = end;
+  filter_update_check_access();
+  return 0;
+}
+
+void QEMU_filter_clear_ranges(void) {
+  QEMU_filter.num_ranges[QEMU_FILTER_VIRTUAL] = 0;
+  QEMU_filter.num_ranges[QEMU_FILTER_PHYSICAL] = 0;
+  filter_update_check_access();
+}
+
+int QEMU_filter_set_coalescing(int line_size, int window) {
+  if( line_size < 0 || (line_size & (line_size - 1)) != 0 || window < 0 )
+    return -1;
+
+  QEMU_filter.line_mask = line_size ? ~(uint64_t)(line_size - 1) : 0;
+  QEMU_filter.window = window;
+  QEMU_filter_coalesce_reset();
+  return 0;
+}
+
+uint64_t QEMU_filter_get_coalesced(int cpu_id) {
+  uint64_t total = 0;
+  int i = 0;
+
+  if( cpu_id >= 0 )
+    return cpu_id < QEMU_filter.num_cpus ? QEMU_filter.coalesce[cpu_id].dropped : 0;
+  for( ; i < QEMU_filter.num_cpus; i++ )
+    total += QEMU_filter.coalesce[i].dropped;
+  return total;
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,129 @@
+#ifndef __LIBQEMUFLEX_FILTER_H__
+#define __LIBQEMUFLEX_FILTER_H__
+
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "api.h"
+
+#define QEMU_FILTER_MAX_RANGES 8
+
+typedef struct QEMU_filter_range {
+  uint64_t start;
+  uint64_t end;
+} QEMU_filter_range_t;
+
+// the states of different cpus never share a host cache line
+#define QEMU_FILTER_COALESCE_ALIGN 64
+// recent lines kept per cpu for the loads and for the stores
+#define QEMU_FILTER_COALESCE_WAYS 4
+
+// Recent lines of the loads [0] and of the stores [1] of a cpu passed on by
+// the coalescing, only touched by the thread running the cpu
+typedef struct QEMU_coalesce {
+  // -1 for none
+  uint64_t lines[2][QEMU_FILTER_COALESCE_WAYS];
+  // virtual address of the line when it was passed on
+  uint64_t vlines[2][QEMU_FILTER_COALESCE_WAYS];
+  // accesses to the line dropped since it was passed on
+  uint32_t folded[2][QEMU_FILTER_COALESCE_WAYS];
+  // way replaced by the next line passed on
+  uint8_t next[2];
+  uint64_t dropped;
+} __attribute__((aligned(QEMU_FILTER_COALESCE_ALIGN))) QEMU_coalesce_t;
+
+// Accesses dropped to a line that leave the coalescing, to deliver as a
+// count record before the access passed on
+typedef struct QEMU_coalesce_flush {
+  uint64_t vline;
+  uint64_t line;
+  // 0 when there is no count record
+  uint32_t folded;
+} QEMU_coalesce_flush_t;
+
+typedef struct QEMU_filter {
+  // QEMU_FILTER_* kinds of accesses to keep
+  int kinds;
+  // an address passes if there is no range for its space or if it is in
+  // one of them
+  int num_ranges[2];
+  QEMU_filter_range_t ranges[2][QEMU_FILTER_MAX_RANGES];
+  // set when QEMU_filter_access has something to check
+  int check_access;
+  // instrumented cpus
+  uint8_t *cpus;
+  int num_cpus;
+  // mask of the coalesced lines, 0 when disabled
+  uint64_t line_mask;
+  uint32_t window;
+  QEMU_coalesce_t *coalesce;
+} QEMU_filter_t;
+
+extern QEMU_filter_t QEMU_filter;
+
+static inline int QEMU_filter_in_ranges(int space, uint64_t address) {
+  int i = 0;
+  if( QEMU_filter.num_ranges[space] == 0 )
+    return 1;
+  for( ; i < QEMU_filter.num_ranges[space]; i++ ) {
+    const QEMU_filter_range_t *range = &QEMU_filter.ranges[space][i];
+    if( address >= range->start && address < range->end )
+      return 1;
+  }
+  return 0;
+}
+
+// tell whether an access of an instrumented TB passes the parts of the
+// filter that are not known when translating
+static inline int QEMU_filter_access(uint64_t vaddr, uint64_t paddr, int io) {
+  if( !QEMU_filter.check_access )
+    return 1;
+  if( !(QEMU_filter.kinds & (io ? QEMU_FILTER_IO : QEMU_FILTER_RAM)) )
+    return 0;
+  return QEMU_filter_in_ranges(QEMU_FILTER_VIRTUAL, vaddr)
+      && QEMU_filter_in_ranges(QEMU_FILTER_PHYSICAL, paddr);
+}
+
+// tell whether a data access of the cpu that passed the filter is dropped
+// by the coalescing, otherwise flush tells the count record to deliver
+// before it
+static inline int QEMU_filter_coalesce(int cpu_id, uint64_t vaddr, uint64_t paddr,
+                                       int size, int is_store, int io,
+                                       QEMU_coalesce_flush_t *flush) {
+  flush->folded = 0;
+  if( QEMU_filter.line_mask == 0 || io || cpu_id >= QEMU_filter.num_cpus )
+    return 0;
+
+  uint64_t line = paddr & QEMU_filter.line_mask;
+  if( ((paddr + size - 1) & QEMU_filter.line_mask) != line )
+    return 0;
+
+  QEMU_coalesce_t *c = &QEMU_filter.coalesce[cpu_id];
+  int i = 0;
+  for( ; i < QEMU_FILTER_COALESCE_WAYS; i++ ) {
+    if( c->lines[is_store][i] != line )
+      continue;
+    if( QEMU_filter.window != 0 && c->folded[is_store][i] >= QEMU_filter.window ) {
+      flush->vline = c->vlines[is_store][i];
+      flush->line = line;
+      flush->folded = c->folded[is_store][i];
+      c->vlines[is_store][i] = vaddr & QEMU_filter.line_mask;
+      c->folded[is_store][i] = 0;
+      return 0;
+    }
+    c->folded[is_store][i]++;
+    c->dropped++;
+    return 1;
+  }
+
+  i = c->next[is_store];
+  flush->vline = c->vlines[is_store][i];
+  flush->line = c->lines[is_store][i];
+  flush->folded = c->folded[is_store][i];
+  c->lines[is_store][i] = line;
+  c->vlines[is_store][i] = vaddr & QEMU_filter.line_mask;
+  c->folded[is_store][i] = 0;
+  c->next[is_store] = (i + 1) % QEMU_FILTER_COALESCE_WAYS;
+  return 0;
+}
+
+#endif /* __LIBQEMUFLEX_FILTER_H__ */
@@ -52,9 +52,24 @@ void QFLEX_API_get_interface_hooks(QFLEX_API_Interface_Hooks_t* hooks) {
   hooks->QEMU_insert_callback= QEMU_insert_callback;
   hooks->QEMU_delete_callback= QEMU_delete_callback;
   hooks->QEMU_get_instruction_count = QEMU_get_instruction_count;
+  hooks->QEMU_trace_set_batch_size = QEMU_trace_set_batch_size;
+  hooks->QEMU_trace_flush = QEMU_trace_flush;
+  hooks->QEMU_trace_set_parallel = QEMU_trace_set_parallel;
+  hooks->QEMU_filter_set_cpu = QEMU_filter_set_cpu;
+  hooks->QEMU_filter_set_kinds = QEMU_filter_set_kinds;
+  hooks->QEMU_filter_add_range = QEMU_filter_add_range;
+  hooks->QEMU_filter_clear_ranges = QEMU_filter_clear_ranges;
+  hooks->QEMU_filter_set_coalescing = QEMU_filter_set_coalescing;
+  hooks->QEMU_filter_get_coalesced = QEMU_filter_get_coalesced;
+  hooks->QEMU_sampling_configure = QEMU_sampling_configure;
+  hooks->QEMU_checkpoint_request = QEMU_checkpoint_request;
+  hooks->QEMU_read_arch_state = QEMU_read_arch_state;
+  hooks->QEMU_read_arch_state_dirty = QEMU_read_arch_state_dirty;
+  hooks->QEMU_map_phys_memory = QEMU_map_phys_memory;
   //NOOSHIN: begin
   hooks->QEMU_cpu_exec_proc = QEMU_cpu_exec_proc;
   //NOOSHIN: end
+  hooks->QEMU_cpu_execute = QEMU_cpu_execute;
 }
 
 #include <stdlib.h>
@@ -0,0 +1,113 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "insn_desc.h"
+#include "trace_ring.h"
+
+// descriptors per chunk, a block never spans two chunks
+#define QEMU_INSN_DESC_CHUNK (64 * 1024)
+
+// Chunks are kept across flushes and refilled from the first one, so that
+// the pointers baked in the translated code stay valid until the region of
+// the code is released.
+typedef struct QEMU_insn_desc_pool {
+  QEMU_insn_desc_t **chunks;
+  int num_chunks;
+  int chunk;
+  int used;
+} QEMU_insn_desc_pool_t;
+
+// one pool per region of the code buffer, grown as regions are started
+static QEMU_insn_desc_pool_t *desc_pools = NULL;
+static int desc_num_pools = 0;
+static int desc_region = 0;
+
+static QEMU_insn_desc_pool_t *QEMU_insn_desc_pool(int region) {
+  if( region >= desc_num_pools ) {
+    desc_pools = g_renew(QEMU_insn_desc_pool_t, desc_pools, region + 1);
+    memset(desc_pools + desc_num_pools, 0,
+           (region + 1 - desc_num_pools) * sizeof(QEMU_insn_desc_pool_t));
+    desc_num_pools = region + 1;
+  }
+  return &desc_pools[region];
+}
+
+// whether pending records may point to descriptors of the pool
+static bool QEMU_insn_desc_pool_used(QEMU_insn_desc_pool_t *pool) {
+  return pool->chunk > 0 || pool->used > 0;
+}
+
+QEMU_insn_desc_t *QEMU_insn_desc_reserve(int max_insns) {
+  QEMU_insn_desc_pool_t *pool = QEMU_insn_desc_pool(desc_region);
+  assert(max_insns <= QEMU_INSN_DESC_CHUNK);
+
+  if( pool->num_chunks == 0
+      || pool->used + max_insns > QEMU_INSN_DESC_CHUNK ) {
+    if( pool->num_chunks > 0 )
+      pool->chunk++;
+    if( pool->chunk == pool->num_chunks ) {
+      pool->chunks = g_renew(QEMU_insn_desc_t *, pool->chunks,
+                             pool->num_chunks + 1);
+      pool->chunks[pool->num_chunks++] = g_new(QEMU_insn_desc_t,
+                                               QEMU_INSN_DESC_CHUNK);
+    }
+    pool->used = 0;
+  }
+  return &pool->chunks[pool->chunk][pool->used];
+}
+
+void QEMU_insn_desc_commit(QEMU_insn_desc_t *descs, int count) {
+  QEMU_insn_desc_pool_t *pool = &desc_pools[desc_region];
+
+  assert(descs == &pool->chunks[pool->chunk][pool->used]);
+  pool->used += count;
+}
+
+void QEMU_insn_desc_rewind(QEMU_insn_desc_t *descs) {
+  if( desc_region >= desc_num_pools )
+    return;
+
+  QEMU_insn_desc_pool_t *pool = &desc_pools[desc_region];
+  if( pool->num_chunks == 0 )
+    return;
+
+  QEMU_insn_desc_t *chunk = pool->chunks[pool->chunk];
+  if( descs >= chunk && descs < chunk + pool->used )
+    pool->used = descs - chunk;
+}
+
+void QEMU_insn_desc_start_region(int region) {
+  QEMU_insn_desc_pool_t *pool = QEMU_insn_desc_pool(region);
+
+  // the pending records still point to the descriptors
+  if( QEMU_insn_desc_pool_used(pool) && QEMU_trace_is_batched() )
+    QEMU_trace_flush(-1);
+  pool->chunk = 0;
+  pool->used = 0;
+  desc_region = region;
+}
+
+void QEMU_insn_desc_flush(void) {
+  bool used = false;
+  int i;
+
+  for( i = 0; i < desc_num_pools; i++ )
+    used |= QEMU_insn_desc_pool_used(&desc_pools[i]);
+  // the pending records still point to the descriptors
+  if( used && QEMU_trace_is_batched() )
+    QEMU_trace_flush(-1);
+  for( i = 0; i < desc_num_pools; i++ ) {
+    desc_pools[i].chunk = 0;
+    desc_pools[i].used = 0;
+  }
+  desc_region = 0;
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,31 @@
+#ifndef __LIBQEMUFLEX_INSN_DESC_H__
+#define __LIBQEMUFLEX_INSN_DESC_H__
+
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "api.h"
+
+// Storage of the instruction descriptors of the translated blocks. Like
+// the translated code, descriptors are allocated one block after the other
+// in the current region of the code buffer, and released with the region
+// when it is evicted or by tb_flush. All the functions are called with the
+// translation lock held.
+
+// room for the descriptors of a block of up to max_insns instructions,
+// the room is only kept by QEMU_insn_desc_commit
+QEMU_insn_desc_t *QEMU_insn_desc_reserve(int max_insns);
+
+// keep the first count descriptors of the last reservation
+void QEMU_insn_desc_commit(QEMU_insn_desc_t *descs, int count);
+
+// give back the descriptors of the last committed block, see tb_free
+void QEMU_insn_desc_rewind(QEMU_insn_desc_t *descs);
+
+// release the descriptors of the region, after the pending batches were
+// delivered, and allocate the next ones there
+void QEMU_insn_desc_start_region(int region);
+
+// release all the descriptors, after the pending batches were delivered
+void QEMU_insn_desc_flush(void);
+
+#endif /* __LIBQEMUFLEX_INSN_DESC_H__ */
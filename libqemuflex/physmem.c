@@ -0,0 +1,66 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "exec/memory.h"
+#include "exec/address-spaces.h"
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "api.h"
+
+// Tells the simulator about the RAM leaving the guest physical memory, the
+// RAMBlock behind it is only freed once the listeners have been told.
+static MemoryListener QEMU_physmem_listener;
+static int QEMU_physmem_listening = 0;
+
+static void physmem_region_del(MemoryListener *listener,
+                               MemoryRegionSection *section) {
+  QEMU_noII args;
+  QEMU_callback_args_t event_data;
+
+  if( !memory_access_is_direct(section->mr, false) )
+    return;
+
+  args.class_data = NULL;
+  args.bigint0 = section->offset_within_address_space;
+  args.bigint1 = int128_get64(section->size);
+  event_data.noII = &args;
+  QEMU_execute_callbacks(QEMUFLEX_GENERIC_CALLBACK, QEMU_phys_memory_unmapped,
+                         &event_data);
+}
+
+void QEMU_physmem_init(void) {
+  memset(&QEMU_physmem_listener, 0, sizeof(QEMU_physmem_listener));
+  QEMU_physmem_listener.region_del = physmem_region_del;
+  memory_listener_register(&QEMU_physmem_listener, &address_space_memory);
+  QEMU_physmem_listening = 1;
+}
+
+void QEMU_physmem_deinit(void) {
+  if( QEMU_physmem_listening )
+    memory_listener_unregister(&QEMU_physmem_listener);
+  QEMU_physmem_listening = 0;
+}
+
+void *QEMU_map_phys_memory(physical_address_t pa, uint64_t *len) {
+  MemoryRegion *mr;
+  hwaddr xlat, l = *len;
+  void *ptr = NULL;
+
+  rcu_read_lock();
+  mr = address_space_translate(&address_space_memory, pa, &xlat, &l, false);
+  if( memory_access_is_direct(mr, false) ) {
+    ptr = qemu_get_ram_ptr(mr->ram_block, memory_region_get_ram_addr(mr) + xlat);
+    *len = l;
+  }
+  rcu_read_unlock();
+  return ptr;
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,150 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "qom/cpu.h"
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "api.h"
+
+// The end of a phase is the instruction event of one cpu: the cpu driving
+// the phases, or in global mode the cpu that is running, which hands what
+// is left of the phase over to the next cpu when the round-robin switches.
+// The controller only touches the cpus from the thread running them.
+typedef struct QEMU_sampling {
+  // length of every QEMU_SAMPLING_* phase in instructions
+  uint64_t length[3];
+  // cpu whose instructions are counted, -1 for all of them
+  int cpu_id;
+  int enabled;
+  int phase;
+  int64_t sample;
+  // set by QEMU_sampling_configure, applied by the next cpu to resume
+  int reconfigure;
+  // instructions of the phase not handed to a cpu yet
+  int has_pending;
+  uint64_t pending;
+  // cpu whose instruction event ends the phase
+  CPUState *armed;
+} QEMU_sampling_t;
+
+static QEMU_sampling_t QEMU_sampling;
+
+static void sampling_enter_phase(int phase) {
+  QEMU_noiiI args;
+  QEMU_callback_args_t event_data;
+
+  while( QEMU_sampling.length[phase] == 0 ) {
+    if( phase == QEMU_SAMPLING_MEASURE )
+      QEMU_sampling.sample++;
+    phase = (phase + 1) % 3;
+  }
+  QEMU_sampling.phase = phase;
+  QEMU_sampling.pending = QEMU_sampling.length[phase];
+  QEMU_sampling.has_pending = 1;
+
+  // no batch spans two phases
+  QEMU_trace_flush(-1);
+  QEMU_toggle_simulation(phase != QEMU_SAMPLING_FAST_FORWARD);
+
+  args.class_data = NULL;
+  args.integer0 = phase;
+  args.integer1 = QEMU_sampling.cpu_id;
+  args.bigint = QEMU_sampling.sample;
+  event_data.noiiI = &args;
+  QEMU_execute_callbacks(-1, QEMU_sampling_phase, &event_data);
+}
+
+static void sampling_arm(CPUState *cpu) {
+  cpu_set_instr_event(cpu, cpu_executed_instructions(cpu) + QEMU_sampling.pending);
+  QEMU_sampling.armed = cpu;
+  QEMU_sampling.has_pending = 0;
+}
+
+static void sampling_disarm(void) {
+  CPUState *cpu;
+  CPU_FOREACH(cpu) {
+    if( cpu->instr_event != UINT64_MAX )
+      cpu_set_instr_event(cpu, UINT64_MAX);
+  }
+  QEMU_sampling.armed = NULL;
+  QEMU_sampling.has_pending = 0;
+}
+
+int QEMU_sampling_configure(uint64_t period, uint64_t warm,
+                            uint64_t measure, int cpu_id) {
+  if( period != 0 ) {
+    // the phases hand the instruction count from one cpu to the next
+    if( qemu_tcg_mttcg_enabled() )
+      return -1;
+    if( cpu_id < -1 || cpu_id >= QEMU_get_num_cpus() )
+      return -1;
+    if( warm + measure == 0 || warm + measure > period )
+      return -1;
+  }
+
+  QEMU_sampling.length[QEMU_SAMPLING_FAST_FORWARD] = period - warm - measure;
+  QEMU_sampling.length[QEMU_SAMPLING_WARM] = warm;
+  QEMU_sampling.length[QEMU_SAMPLING_MEASURE] = measure;
+  QEMU_sampling.cpu_id = cpu_id;
+  QEMU_sampling.enabled = period != 0;
+  atomic_mb_set(&QEMU_sampling.reconfigure, 1);
+
+  CPUState *cpu;
+  CPU_FOREACH(cpu) {
+    cpu_exit(cpu);
+  }
+  return 0;
+}
+
+void QEMU_sampling_instr_event(int cpu_id) {
+  CPUState *cpu = qemu_get_cpu(cpu_id);
+
+  if( !QEMU_sampling.enabled || cpu != QEMU_sampling.armed )
+    return;
+
+  if( QEMU_sampling.phase == QEMU_SAMPLING_MEASURE )
+    QEMU_sampling.sample++;
+  sampling_enter_phase((QEMU_sampling.phase + 1) % 3);
+  sampling_arm(cpu);
+}
+
+void QEMU_sampling_cpu_resume(int cpu_id) {
+  if( atomic_read(&QEMU_sampling.reconfigure) ) {
+    atomic_set(&QEMU_sampling.reconfigure, 0);
+    sampling_disarm();
+    if( QEMU_sampling.enabled ) {
+      QEMU_sampling.sample = 0;
+      sampling_enter_phase(QEMU_SAMPLING_FAST_FORWARD);
+    }
+  }
+  if( !QEMU_sampling.enabled )
+    return;
+
+  CPUState *cpu = qemu_get_cpu(cpu_id);
+  if( QEMU_sampling.cpu_id >= 0 ) {
+    if( cpu_id == QEMU_sampling.cpu_id && QEMU_sampling.has_pending )
+      sampling_arm(cpu);
+    return;
+  }
+
+  if( cpu == QEMU_sampling.armed )
+    return;
+  CPUState *armed = QEMU_sampling.armed;
+  if( armed != NULL ) {
+    uint64_t executed = cpu_executed_instructions(armed);
+    QEMU_sampling.pending = armed->instr_event > executed
+      ? armed->instr_event - executed : 0;
+    QEMU_sampling.has_pending = 1;
+    cpu_set_instr_event(armed, UINT64_MAX);
+  }
+  sampling_arm(cpu);
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,360 @@
+#ifndef __LIBQEMUFLEX_TRACE_FORMAT_H__
+#define __LIBQEMUFLEX_TRACE_FORMAT_H__
+
+// Format of the trace files written by trace_record.c. This header only
+// depends on the C library so that tools reading the traces outside of
+// QEMU can include it.
+//
+// A file is a file header followed by blocks up to the end of the file.
+// A block holds the records of one stream, a cpu or the devices, and is
+// compressed with zlib unless QEMU_TRACE_BLOCK_RAW is set. All the
+// integers of the headers are little endian.
+//
+// The records are delta-encoded against the previous record of the same
+// block: a tag byte tells which fields differ from their prediction and
+// only those follow, as (zigzag) varints. The encoder state is reset at
+// the start of every block, so blocks decode independently. The count
+// records of the coalescing always carry a size of 0, followed by their
+// repeat count, and leave the predictions of the accesses alone.
+//
+// Ordering across streams is kept at the granularity of the batches of
+// the batched trace API: every batch gets the next global sequence number,
+// and a sequence record precedes the records of a new batch. The device
+// records carry the sequence number of the next batch, so they are
+// replayed before it.
+
+#include <stdint.h>
+#include <string.h>
+
+#define QEMU_TRACE_FILE_MAGIC   "QFLXTRC\0"
+#define QEMU_TRACE_FILE_VERSION 2
+
+// stream of the device (DMA) records, the cpus are numbered from 0
+#define QEMU_TRACE_STREAM_DMA   0xffffffffu
+
+// the records of the block are stored uncompressed
+#define QEMU_TRACE_BLOCK_RAW    0x1
+
+#define QEMU_TRACE_FILE_HEADER_SIZE  24
+#define QEMU_TRACE_BLOCK_HEADER_SIZE 32
+
+typedef struct QEMU_trace_file_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_cpus;
+  // largest uncompressed size of a block
+  uint32_t block_size;
+  uint32_t reserved;
+} QEMU_trace_file_header_t;
+
+typedef struct QEMU_trace_block_header {
+  uint32_t stream;
+  uint32_t flags;
+  // size of the records before and after compression
+  uint32_t raw_size;
+  uint32_t stored_size;
+  uint32_t records;
+  uint32_t reserved;
+  // sequence number in effect at the start of the block
+  uint64_t seq;
+} QEMU_trace_block_header_t;
+
+// A decoded record, with the fields of QEMU_mem_trace_record_t. The
+// device records have a pc of 0 and the same logical and physical address.
+// The fetch records are stored with the logical address of their pc.
+typedef struct QEMU_trace_file_record {
+  uint64_t pc;
+  uint64_t logical_address;
+  uint64_t physical_address;
+  uint64_t target_address;
+  uint64_t size;
+  uint32_t repeat;     // count records of the coalescing, if size is 0
+  uint8_t type;        // mem_op_type_t, or QEMU_TRACE_KIND_SEQ
+  uint8_t branch_type; // branch_type_t, only meaningful for fetches
+  uint8_t flags;       // QEMU_TRACE_* bits of api.h
+  uint8_t pci;         // device records: issued by a PCI device
+} QEMU_trace_file_record_t;
+
+// the record is a sequence record, the new sequence number is in the codec
+#define QEMU_TRACE_KIND_SEQ     7
+
+// tag byte: the kind, then the fields that differ from their prediction
+#define QEMU_TRACE_TAG_KIND     0x07
+#define QEMU_TRACE_TAG_PC       0x08
+#define QEMU_TRACE_TAG_ADDRESS  0x10
+#define QEMU_TRACE_TAG_OFFSET   0x20
+#define QEMU_TRACE_TAG_SIZE     0x40
+#define QEMU_TRACE_TAG_ATTR     0x80
+
+// attribute byte: flags, branch type and initiator
+#define QEMU_TRACE_ATTR_FLAGS   0x0f
+#define QEMU_TRACE_ATTR_BRANCH_SHIFT 4
+#define QEMU_TRACE_ATTR_BRANCH  0x70
+#define QEMU_TRACE_ATTR_PCI     0x80
+
+// largest encoded record: tag, attribute, five varints
+#define QEMU_TRACE_MAX_RECORD   (2 + 5 * 10)
+
+// value of mem_op_type_t QEMU_Trans_Instr_Fetch
+#define QEMU_TRACE_FETCH        2
+
+// Instruction fetches and the other records are predicted separately,
+// they interleave but each of them is regular
+typedef struct QEMU_trace_class_state {
+  // physical minus target address of the previous record
+  uint64_t offset;
+  uint64_t size;
+  uint8_t attr;
+} QEMU_trace_class_state_t;
+
+typedef struct QEMU_trace_codec {
+  // pc of the previous record
+  uint64_t pc;
+  // address following the previous fetch
+  uint64_t next_pc;
+  // address following the previous data access
+  uint64_t next_address;
+  QEMU_trace_class_state_t fetch;
+  QEMU_trace_class_state_t data;
+  uint64_t seq;
+} QEMU_trace_codec_t;
+
+static inline void QEMU_trace_codec_reset(QEMU_trace_codec_t *codec,
+                                          uint64_t seq) {
+  memset(codec, 0, sizeof(*codec));
+  codec->seq = seq;
+}
+
+static inline void QEMU_trace_put_le32(uint8_t *p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static inline void QEMU_trace_put_le64(uint8_t *p, uint64_t v) {
+  QEMU_trace_put_le32(p, v);
+  QEMU_trace_put_le32(p + 4, v >> 32);
+}
+
+static inline uint32_t QEMU_trace_get_le32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t QEMU_trace_get_le64(const uint8_t *p) {
+  return QEMU_trace_get_le32(p) | ((uint64_t)QEMU_trace_get_le32(p + 4) << 32);
+}
+
+static inline void QEMU_trace_pack_file_header(uint8_t *p,
+                                               const QEMU_trace_file_header_t *h) {
+  memcpy(p, h->magic, 8);
+  QEMU_trace_put_le32(p + 8, h->version);
+  QEMU_trace_put_le32(p + 12, h->num_cpus);
+  QEMU_trace_put_le32(p + 16, h->block_size);
+  QEMU_trace_put_le32(p + 20, h->reserved);
+}
+
+// returns 0 if the magic or the version do not match
+static inline int QEMU_trace_unpack_file_header(const uint8_t *p,
+                                                QEMU_trace_file_header_t *h) {
+  memcpy(h->magic, p, 8);
+  h->version = QEMU_trace_get_le32(p + 8);
+  h->num_cpus = QEMU_trace_get_le32(p + 12);
+  h->block_size = QEMU_trace_get_le32(p + 16);
+  h->reserved = QEMU_trace_get_le32(p + 20);
+  return memcmp(h->magic, QEMU_TRACE_FILE_MAGIC, 8) == 0
+         && h->version == QEMU_TRACE_FILE_VERSION;
+}
+
+static inline void QEMU_trace_pack_block_header(uint8_t *p,
+                                                const QEMU_trace_block_header_t *h) {
+  QEMU_trace_put_le32(p, h->stream);
+  QEMU_trace_put_le32(p + 4, h->flags);
+  QEMU_trace_put_le32(p + 8, h->raw_size);
+  QEMU_trace_put_le32(p + 12, h->stored_size);
+  QEMU_trace_put_le32(p + 16, h->records);
+  QEMU_trace_put_le32(p + 20, h->reserved);
+  QEMU_trace_put_le64(p + 24, h->seq);
+}
+
+static inline void QEMU_trace_unpack_block_header(const uint8_t *p,
+                                                  QEMU_trace_block_header_t *h) {
+  h->stream = QEMU_trace_get_le32(p);
+  h->flags = QEMU_trace_get_le32(p + 4);
+  h->raw_size = QEMU_trace_get_le32(p + 8);
+  h->stored_size = QEMU_trace_get_le32(p + 12);
+  h->records = QEMU_trace_get_le32(p + 16);
+  h->reserved = QEMU_trace_get_le32(p + 20);
+  h->seq = QEMU_trace_get_le64(p + 24);
+}
+
+static inline uint8_t *QEMU_trace_put_varint(uint8_t *p, uint64_t v) {
+  while( v >= 0x80 ) {
+    *p++ = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+// returns NULL if the varint does not end before end
+static inline const uint8_t *QEMU_trace_get_varint(const uint8_t *p,
+                                                   const uint8_t *end,
+                                                   uint64_t *v) {
+  int shift = 0;
+  *v = 0;
+  for( ; p < end && shift < 64; shift += 7 ) {
+    uint8_t byte = *p++;
+    *v |= (uint64_t)(byte & 0x7f) << shift;
+    if( !(byte & 0x80) )
+      return p;
+  }
+  return NULL;
+}
+
+static inline uint64_t QEMU_trace_zigzag(uint64_t delta) {
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static inline uint64_t QEMU_trace_unzigzag(uint64_t v) {
+  return (v >> 1) ^ -(v & 1);
+}
+
+// Append the sequence record of seq, which must be after the current one
+static inline uint8_t *QEMU_trace_encode_seq(QEMU_trace_codec_t *codec,
+                                             uint8_t *p, uint64_t seq) {
+  *p++ = QEMU_TRACE_KIND_SEQ;
+  p = QEMU_trace_put_varint(p, seq - codec->seq);
+  codec->seq = seq;
+  return p;
+}
+
+// Append the record, at most QEMU_TRACE_MAX_RECORD bytes
+static inline uint8_t *QEMU_trace_encode(QEMU_trace_codec_t *codec, uint8_t *p,
+                                         const QEMU_trace_file_record_t *rec) {
+  int fetch = rec->type == QEMU_TRACE_FETCH;
+  QEMU_trace_class_state_t *cls = fetch ? &codec->fetch : &codec->data;
+  uint64_t pc = fetch ? codec->next_pc : codec->pc;
+  // the address of a fetch is its target, usually the next instruction
+  uint64_t address = fetch ? rec->pc + rec->size : codec->next_address;
+  uint64_t offset = rec->physical_address - rec->target_address;
+  uint8_t attr = (rec->flags & QEMU_TRACE_ATTR_FLAGS)
+               | ((rec->branch_type << QEMU_TRACE_ATTR_BRANCH_SHIFT)
+                  & QEMU_TRACE_ATTR_BRANCH)
+               | (rec->pci ? QEMU_TRACE_ATTR_PCI : 0);
+  uint8_t *tag = p++;
+
+  *tag = rec->type & QEMU_TRACE_TAG_KIND;
+  if( attr != cls->attr ) {
+    *tag |= QEMU_TRACE_TAG_ATTR;
+    *p++ = attr;
+    cls->attr = attr;
+  }
+  if( rec->size == 0 ) {
+    *tag |= QEMU_TRACE_TAG_SIZE;
+    p = QEMU_trace_put_varint(p, 0);
+    p = QEMU_trace_put_varint(p, rec->repeat);
+  } else if( rec->size != cls->size ) {
+    *tag |= QEMU_TRACE_TAG_SIZE;
+    p = QEMU_trace_put_varint(p, rec->size);
+    cls->size = rec->size;
+  }
+  if( rec->pc != pc ) {
+    *tag |= QEMU_TRACE_TAG_PC;
+    p = QEMU_trace_put_varint(p, QEMU_trace_zigzag(rec->pc - pc));
+  }
+  if( rec->target_address != address ) {
+    *tag |= QEMU_TRACE_TAG_ADDRESS;
+    p = QEMU_trace_put_varint(p, QEMU_trace_zigzag(rec->target_address - address));
+  }
+  if( offset != cls->offset ) {
+    *tag |= QEMU_TRACE_TAG_OFFSET;
+    p = QEMU_trace_put_varint(p, QEMU_trace_zigzag(offset - cls->offset));
+    cls->offset = offset;
+  }
+
+  codec->pc = rec->pc;
+  if( fetch )
+    codec->next_pc = rec->pc + rec->size;
+  else if( rec->size != 0 )
+    codec->next_address = rec->logical_address + rec->size;
+  return p;
+}
+
+// Decode the record at p, returns NULL if it is truncated. A sequence
+// record only updates codec->seq, rec->type is then QEMU_TRACE_KIND_SEQ.
+static inline const uint8_t *QEMU_trace_decode(QEMU_trace_codec_t *codec,
+                                               const uint8_t *p,
+                                               const uint8_t *end,
+                                               QEMU_trace_file_record_t *rec) {
+  QEMU_trace_class_state_t *cls;
+  uint64_t v, pc, address, size;
+  uint8_t tag;
+  int fetch;
+
+  if( p >= end )
+    return NULL;
+  tag = *p++;
+  rec->type = tag & QEMU_TRACE_TAG_KIND;
+  if( rec->type == QEMU_TRACE_KIND_SEQ ) {
+    if( (p = QEMU_trace_get_varint(p, end, &v)) == NULL )
+      return NULL;
+    codec->seq += v;
+    return p;
+  }
+
+  fetch = rec->type == QEMU_TRACE_FETCH;
+  cls = fetch ? &codec->fetch : &codec->data;
+  if( tag & QEMU_TRACE_TAG_ATTR ) {
+    if( p >= end )
+      return NULL;
+    cls->attr = *p++;
+  }
+  size = cls->size;
+  rec->repeat = 0;
+  if( tag & QEMU_TRACE_TAG_SIZE ) {
+    if( (p = QEMU_trace_get_varint(p, end, &size)) == NULL )
+      return NULL;
+    if( size != 0 )
+      cls->size = size;
+    else if( (p = QEMU_trace_get_varint(p, end, &v)) == NULL )
+      return NULL;
+    else
+      rec->repeat = v;
+  }
+  pc = fetch ? codec->next_pc : codec->pc;
+  if( tag & QEMU_TRACE_TAG_PC ) {
+    if( (p = QEMU_trace_get_varint(p, end, &v)) == NULL )
+      return NULL;
+    pc += QEMU_trace_unzigzag(v);
+  }
+  address = fetch ? pc + size : codec->next_address;
+  if( tag & QEMU_TRACE_TAG_ADDRESS ) {
+    if( (p = QEMU_trace_get_varint(p, end, &v)) == NULL )
+      return NULL;
+    address += QEMU_trace_unzigzag(v);
+  }
+  if( tag & QEMU_TRACE_TAG_OFFSET ) {
+    if( (p = QEMU_trace_get_varint(p, end, &v)) == NULL )
+      return NULL;
+    cls->offset += QEMU_trace_unzigzag(v);
+  }
+
+  rec->pc = pc;
+  rec->logical_address = fetch ? pc : address;
+  rec->physical_address = address + cls->offset;
+  rec->target_address = address;
+  rec->size = size;
+  rec->flags = cls->attr & QEMU_TRACE_ATTR_FLAGS;
+  rec->branch_type = (cls->attr & QEMU_TRACE_ATTR_BRANCH) >> QEMU_TRACE_ATTR_BRANCH_SHIFT;
+  rec->pci = !!(cls->attr & QEMU_TRACE_ATTR_PCI);
+
+  codec->pc = pc;
+  if( fetch )
+    codec->next_pc = pc + rec->size;
+  else if( rec->size != 0 )
+    codec->next_address = address + rec->size;
+  return p;
+}
+
+#endif /* __LIBQEMUFLEX_TRACE_FORMAT_H__ */
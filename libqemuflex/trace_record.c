@@ -0,0 +1,382 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/queue.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "qmp-commands.h"
+#include "qom/cpu.h"
+#include <zlib.h>
+#include "trace_ring.h"
+#include "trace_format.h"
+#include "trace_record.h"
+
+// uncompressed size of a block
+#define QEMU_TRACE_RECORD_BLOCK_SIZE (256 * 1024)
+// blocks per stream that can wait for the writer thread
+#define QEMU_TRACE_RECORD_BLOCKS 4
+// batch size used while recording if the batched trace API was not in use
+#define QEMU_TRACE_RECORD_BATCH 4096
+
+typedef struct QEMU_trace_block {
+  QSIMPLEQ_ENTRY(QEMU_trace_block) next;
+  // stream the block goes back to once written
+  struct QEMU_trace_stream *owner;
+  uint32_t stream;
+  uint32_t records;
+  uint64_t seq;
+  uint32_t used;
+  uint8_t data[QEMU_TRACE_RECORD_BLOCK_SIZE];
+} QEMU_trace_block_t;
+
+// The block being filled by a stream. The stream of a cpu is only written
+// by the batch callbacks of that cpu, the device stream with the iothread
+// lock held.
+typedef struct QEMU_trace_stream {
+  QEMU_trace_block_t *block;
+  QEMU_trace_codec_t codec;
+  uint64_t seq;
+  // the other blocks of the stream that are not queued, under the lock of
+  // the recorder
+  QSIMPLEQ_HEAD(, QEMU_trace_block) free;
+} __attribute__((aligned(QEMU_TRACE_RING_ALIGN))) QEMU_trace_stream_t;
+
+// The streams hand their full blocks to the writer thread, which compresses
+// and writes them to the file. A stream only waits for the writer when all
+// its own blocks are queued, so a busy stream never holds the others back,
+// and the disk is never accessed by the cpus.
+typedef struct QEMU_trace_recorder {
+  int recording;
+  FILE *file;
+  char *path;
+  int num_cpus;
+  // the cpus, then the devices
+  QEMU_trace_stream_t *streams;
+  // next batch
+  uint64_t seq;
+
+  QemuThread thread;
+  QemuMutex lock;
+  // signalled whenever a block is queued or written
+  QemuCond cond;
+  bool stop;
+  QSIMPLEQ_HEAD(, QEMU_trace_block) full;
+  // errno of the first write that failed, nothing is written after it
+  int error;
+
+  int batch_callback;
+  int dma_callback;
+  int old_batch_size;
+  int was_simulating;
+} QEMU_trace_recorder_t;
+
+static QEMU_trace_recorder_t QEMU_trace_recorder;
+
+static void trace_record_write(const void *data, size_t size) {
+  if( QEMU_trace_recorder.error == 0
+      && fwrite(data, 1, size, QEMU_trace_recorder.file) != size )
+    QEMU_trace_recorder.error = errno ? errno : EIO;
+}
+
+static void trace_record_write_block(QEMU_trace_block_t *block,
+                                     uint8_t *out, uLong out_size) {
+  QEMU_trace_block_header_t header;
+  uint8_t packed[QEMU_TRACE_BLOCK_HEADER_SIZE];
+  uLongf stored = out_size;
+  const uint8_t *data = out;
+
+  memset(&header, 0, sizeof(header));
+  header.stream = block->stream;
+  header.raw_size = block->used;
+  header.records = block->records;
+  header.seq = block->seq;
+  if( compress2(out, &stored, block->data, block->used, Z_BEST_SPEED) != Z_OK
+      || stored >= block->used ) {
+    header.flags |= QEMU_TRACE_BLOCK_RAW;
+    stored = block->used;
+    data = block->data;
+  }
+  header.stored_size = stored;
+
+  QEMU_trace_pack_block_header(packed, &header);
+  trace_record_write(packed, sizeof(packed));
+  trace_record_write(data, stored);
+}
+
+static void *trace_record_thread(void *opaque) {
+  uLong out_size = compressBound(QEMU_TRACE_RECORD_BLOCK_SIZE);
+  uint8_t *out = g_malloc(out_size);
+  QEMU_trace_block_t *block;
+
+  qemu_mutex_lock(&QEMU_trace_recorder.lock);
+  for( ;; ) {
+    while( QSIMPLEQ_EMPTY(&QEMU_trace_recorder.full) && !QEMU_trace_recorder.stop )
+      qemu_cond_wait(&QEMU_trace_recorder.cond, &QEMU_trace_recorder.lock);
+    block = QSIMPLEQ_FIRST(&QEMU_trace_recorder.full);
+    if( block == NULL )
+      break;
+    QSIMPLEQ_REMOVE_HEAD(&QEMU_trace_recorder.full, next);
+    qemu_mutex_unlock(&QEMU_trace_recorder.lock);
+
+    trace_record_write_block(block, out, out_size);
+
+    qemu_mutex_lock(&QEMU_trace_recorder.lock);
+    QSIMPLEQ_INSERT_TAIL(&block->owner->free, block, next);
+    qemu_cond_broadcast(&QEMU_trace_recorder.cond);
+  }
+  qemu_mutex_unlock(&QEMU_trace_recorder.lock);
+  g_free(out);
+  return NULL;
+}
+
+static void trace_stream_reset(QEMU_trace_stream_t *stream,
+                               QEMU_trace_block_t *block, uint32_t id) {
+  block->stream = id;
+  block->records = 0;
+  block->used = 0;
+  block->seq = stream->seq;
+  stream->block = block;
+  QEMU_trace_codec_reset(&stream->codec, stream->seq);
+}
+
+// queue the block of the stream for the writer and start a new one
+static void trace_stream_submit(QEMU_trace_stream_t *stream) {
+  QEMU_trace_block_t *block = stream->block;
+
+  qemu_mutex_lock(&QEMU_trace_recorder.lock);
+  QSIMPLEQ_INSERT_TAIL(&QEMU_trace_recorder.full, block, next);
+  qemu_cond_broadcast(&QEMU_trace_recorder.cond);
+  while( QSIMPLEQ_EMPTY(&stream->free) )
+    qemu_cond_wait(&QEMU_trace_recorder.cond, &QEMU_trace_recorder.lock);
+  stream->block = QSIMPLEQ_FIRST(&stream->free);
+  QSIMPLEQ_REMOVE_HEAD(&stream->free, next);
+  qemu_mutex_unlock(&QEMU_trace_recorder.lock);
+
+  trace_stream_reset(stream, stream->block, block->stream);
+}
+
+// make room for one more record in the block of the stream
+static inline void trace_stream_reserve(QEMU_trace_stream_t *stream) {
+  if( stream->block->used + QEMU_TRACE_MAX_RECORD > QEMU_TRACE_RECORD_BLOCK_SIZE )
+    trace_stream_submit(stream);
+}
+
+static void trace_stream_set_seq(QEMU_trace_stream_t *stream, uint64_t seq) {
+  QEMU_trace_block_t *block = stream->block;
+
+  stream->seq = seq;
+  if( block->used == 0 ) {
+    block->seq = seq;
+    stream->codec.seq = seq;
+    return;
+  }
+  trace_stream_reserve(stream);
+  block = stream->block;
+  block->used = QEMU_trace_encode_seq(&stream->codec, block->data + block->used, seq)
+                - block->data;
+}
+
+static void trace_stream_append(QEMU_trace_stream_t *stream,
+                                const QEMU_trace_file_record_t *rec) {
+  QEMU_trace_block_t *block;
+
+  trace_stream_reserve(stream);
+  block = stream->block;
+  block->used = QEMU_trace_encode(&stream->codec, block->data + block->used, rec)
+                - block->data;
+  block->records++;
+}
+
+static void trace_record_batch(int cpu_id, QEMU_mem_trace_record_t *records,
+                               size_t count) {
+  QEMU_trace_stream_t *stream = &QEMU_trace_recorder.streams[cpu_id];
+  QEMU_trace_file_record_t rec;
+  size_t i = 0;
+
+  trace_stream_set_seq(stream, atomic_fetch_inc(&QEMU_trace_recorder.seq));
+  rec.pci = 0;
+  for( ; i < count; i++ ) {
+    rec.pc = records[i].pc;
+    rec.logical_address = records[i].logical_address;
+    rec.physical_address = records[i].physical_address;
+    rec.target_address = records[i].target_address;
+    rec.size = records[i].size;
+    rec.repeat = records[i].repeat;
+    rec.type = records[i].type;
+    rec.branch_type = records[i].branch_type;
+    rec.flags = records[i].flags;
+    trace_stream_append(stream, &rec);
+  }
+}
+
+static void trace_record_dma(conf_object_t *space, memory_transaction_t *trans) {
+  QEMU_trace_stream_t *stream =
+    &QEMU_trace_recorder.streams[QEMU_trace_recorder.num_cpus];
+  QEMU_trace_file_record_t rec;
+  uint64_t seq;
+
+  // the accesses the cpus made before the DMA get their batch first, the
+  // DMA is replayed before the next batch
+  QEMU_trace_flush(-1);
+  seq = atomic_read(&QEMU_trace_recorder.seq);
+  if( seq != stream->seq )
+    trace_stream_set_seq(stream, seq);
+  memset(&rec, 0, sizeof(rec));
+  rec.logical_address = trans->s.physical_address;
+  rec.physical_address = trans->s.physical_address;
+  rec.target_address = trans->s.physical_address;
+  rec.size = trans->s.size;
+  rec.type = trans->s.type;
+  rec.pci = trans->s.ini_type == QEMU_Initiator_PCI_Device;
+  trace_stream_append(stream, &rec);
+}
+
+void qmp_flexus_trace_record_start(const char *file, Error **errp) {
+  QEMU_trace_file_header_t header;
+  uint8_t packed[QEMU_TRACE_FILE_HEADER_SIZE];
+  int num_streams, i = 0;
+
+  if( QEMU_trace_recorder.recording ) {
+    error_setg(errp, "A trace is already being recorded to %s",
+               QEMU_trace_recorder.path);
+    return;
+  }
+  if( qemu_tcg_mttcg_enabled() ) {
+    // the recorder expects the vCPUs to run in turn
+    error_setg(errp, "Traces cannot be recorded with -tcg-threads multi");
+    return;
+  }
+  if( QEMU_all_callbacks_tables == NULL ) {
+    error_setg(errp, "The Flexus API is not initialized yet");
+    return;
+  }
+
+  memset(&QEMU_trace_recorder, 0, sizeof(QEMU_trace_recorder));
+  QEMU_trace_recorder.file = fopen(file, "wb");
+  if( QEMU_trace_recorder.file == NULL ) {
+    error_setg_file_open(errp, errno, file);
+    return;
+  }
+  QEMU_trace_recorder.path = g_strdup(file);
+  QEMU_trace_recorder.num_cpus = QEMU_get_num_cpus();
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, QEMU_TRACE_FILE_MAGIC, sizeof(header.magic));
+  header.version = QEMU_TRACE_FILE_VERSION;
+  header.num_cpus = QEMU_trace_recorder.num_cpus;
+  header.block_size = QEMU_TRACE_RECORD_BLOCK_SIZE;
+  QEMU_trace_pack_file_header(packed, &header);
+  trace_record_write(packed, sizeof(packed));
+
+  qemu_mutex_init(&QEMU_trace_recorder.lock);
+  qemu_cond_init(&QEMU_trace_recorder.cond);
+  QSIMPLEQ_INIT(&QEMU_trace_recorder.full);
+  num_streams = QEMU_trace_recorder.num_cpus + 1;
+  QEMU_trace_recorder.streams =
+    qemu_memalign(QEMU_TRACE_RING_ALIGN, num_streams * sizeof(QEMU_trace_stream_t));
+  memset(QEMU_trace_recorder.streams, 0, num_streams * sizeof(QEMU_trace_stream_t));
+  for( ; i < num_streams; i++ ) {
+    QEMU_trace_stream_t *stream = &QEMU_trace_recorder.streams[i];
+    int j = 0;
+    QSIMPLEQ_INIT(&stream->free);
+    for( ; j < QEMU_TRACE_RECORD_BLOCKS; j++ ) {
+      QEMU_trace_block_t *block = g_new(QEMU_trace_block_t, 1);
+      block->owner = stream;
+      QSIMPLEQ_INSERT_TAIL(&stream->free, block, next);
+    }
+    stream->block = QSIMPLEQ_FIRST(&stream->free);
+    QSIMPLEQ_REMOVE_HEAD(&stream->free, next);
+    trace_stream_reset(stream, stream->block,
+                       i < QEMU_trace_recorder.num_cpus ? i : QEMU_TRACE_STREAM_DMA);
+  }
+  qemu_thread_create(&QEMU_trace_recorder.thread, "flexus trace record",
+                     trace_record_thread, NULL, QEMU_THREAD_JOINABLE);
+
+  // the records come from the batched trace API
+  QEMU_trace_recorder.old_batch_size = QEMU_trace_batch_size;
+  if( !QEMU_trace_is_batched() )
+    QEMU_trace_set_batch_size(QEMU_TRACE_RECORD_BATCH);
+  QEMU_trace_recorder.batch_callback =
+    QEMU_insert_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_cpu_mem_trans_batch,
+                         NULL, (void *)trace_record_batch);
+  QEMU_trace_recorder.dma_callback =
+    QEMU_insert_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans,
+                         NULL, (void *)trace_record_dma);
+
+  // the cpus are only instrumented while simulating
+  QEMU_trace_recorder.was_simulating = QEMU_is_in_simulation();
+  QEMU_toggle_simulation(1);
+  QEMU_trace_recorder.recording = 1;
+}
+
+void qmp_flexus_trace_record_stop(Error **errp) {
+  QEMU_trace_block_t *block;
+  int i = 0;
+
+  if( !QEMU_trace_recorder.recording ) {
+    error_setg(errp, "No trace is being recorded");
+    return;
+  }
+
+  QEMU_toggle_simulation(QEMU_trace_recorder.was_simulating);
+  QEMU_trace_flush(-1);
+  QEMU_delete_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_cpu_mem_trans_batch,
+                       QEMU_trace_recorder.batch_callback);
+  QEMU_delete_callback(QEMUFLEX_GENERIC_CALLBACK, QEMU_dma_mem_trans,
+                       QEMU_trace_recorder.dma_callback);
+  QEMU_trace_set_batch_size(QEMU_trace_recorder.old_batch_size);
+
+  // write the partial blocks and wait for the writer to finish
+  qemu_mutex_lock(&QEMU_trace_recorder.lock);
+  for( ; i <= QEMU_trace_recorder.num_cpus; i++ ) {
+    block = QEMU_trace_recorder.streams[i].block;
+    if( block->used > 0 )
+      QSIMPLEQ_INSERT_TAIL(&QEMU_trace_recorder.full, block, next);
+    else
+      QSIMPLEQ_INSERT_TAIL(&block->owner->free, block, next);
+  }
+  QEMU_trace_recorder.stop = true;
+  qemu_cond_broadcast(&QEMU_trace_recorder.cond);
+  qemu_mutex_unlock(&QEMU_trace_recorder.lock);
+  qemu_thread_join(&QEMU_trace_recorder.thread);
+
+  for( i = 0; i <= QEMU_trace_recorder.num_cpus; i++ ) {
+    QEMU_trace_stream_t *stream = &QEMU_trace_recorder.streams[i];
+    while( (block = QSIMPLEQ_FIRST(&stream->free)) != NULL ) {
+      QSIMPLEQ_REMOVE_HEAD(&stream->free, next);
+      g_free(block);
+    }
+  }
+  qemu_vfree(QEMU_trace_recorder.streams);
+  qemu_cond_destroy(&QEMU_trace_recorder.cond);
+  qemu_mutex_destroy(&QEMU_trace_recorder.lock);
+
+  if( fclose(QEMU_trace_recorder.file) != 0 && QEMU_trace_recorder.error == 0 )
+    QEMU_trace_recorder.error = errno;
+  if( QEMU_trace_recorder.error != 0 )
+    error_setg_errno(errp, QEMU_trace_recorder.error, "Cannot write the trace to %s",
+                     QEMU_trace_recorder.path);
+  g_free(QEMU_trace_recorder.path);
+  QEMU_trace_recorder.recording = 0;
+}
+
+void QEMU_trace_record_exit(void) {
+  Error *err = NULL;
+
+  if( !QEMU_trace_recorder.recording )
+    return;
+  qmp_flexus_trace_record_stop(&err);
+  if( err )
+    error_report_err(err);
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,7 @@
+#ifndef __LIBQEMUFLEX_TRACE_RECORD_H__
+#define __LIBQEMUFLEX_TRACE_RECORD_H__
+
+// Finish the trace being recorded, if any, when QEMU exits
+void QEMU_trace_record_exit(void);
+
+#endif /* __LIBQEMUFLEX_TRACE_RECORD_H__ */
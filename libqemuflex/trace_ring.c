@@ -0,0 +1,273 @@
+#ifdef __cplusplus
+extern "C" {
+#endif
+#ifdef CONFIG_FLEXUS
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/rcu.h"
+#include "trace_ring.h"
+
+QEMU_trace_ring_t *QEMU_trace_rings = NULL;
+int QEMU_trace_batch_size = 0;
+
+static int QEMU_trace_num_rings = 0;
+
+// Buffers of a cpu in parallel trace mode: the one filled by the vcpu
+// and the ones queued for or being delivered by the trace thread. The
+// vcpu waits for the trace thread when all of them are full.
+#define QEMU_TRACE_WORKER_BUFFERS 4
+
+typedef struct QEMU_trace_worker {
+  QemuThread thread;
+  QemuMutex lock;
+  // signalled whenever a batch is queued or delivered
+  QemuCond cond;
+  int cpu_id;
+  bool stop;
+  // full batches, delivered in order
+  QEMU_nib queue[QEMU_TRACE_WORKER_BUFFERS];
+  int queue_head;
+  int queued;
+  // empty buffers
+  QEMU_mem_trace_record_t *free[QEMU_TRACE_WORKER_BUFFERS];
+  int num_free;
+} __attribute__((aligned(QEMU_TRACE_RING_ALIGN))) QEMU_trace_worker_t;
+
+static QEMU_trace_worker_t *QEMU_trace_workers = NULL;
+static int QEMU_trace_parallel = 0;
+
+static void trace_ring_alloc_records(int records) {
+  int i = 0;
+  for( ; i < QEMU_trace_num_rings; i++ ) {
+    QEMU_trace_ring_t *ring = &QEMU_trace_rings[i];
+    ring->head = 0;
+    ring->capacity = records;
+    ring->records = NULL;
+    if( records > 0 )
+      ring->records = qemu_memalign(QEMU_TRACE_RING_ALIGN,
+                                    records * sizeof(QEMU_mem_trace_record_t));
+  }
+}
+
+static void trace_ring_free_records(void) {
+  int i = 0;
+  for( ; i < QEMU_trace_num_rings; i++ ) {
+    QEMU_trace_ring_t *ring = &QEMU_trace_rings[i];
+    qemu_vfree(ring->records);
+    ring->records = NULL;
+    ring->head = 0;
+    ring->capacity = 0;
+  }
+}
+
+void QEMU_trace_ring_init(void) {
+  QEMU_trace_num_rings = QEMU_get_num_cpus();
+  QEMU_trace_rings = qemu_memalign(QEMU_TRACE_RING_ALIGN,
+                                   QEMU_trace_num_rings * sizeof(QEMU_trace_ring_t));
+  memset(QEMU_trace_rings, 0, QEMU_trace_num_rings * sizeof(QEMU_trace_ring_t));
+  trace_ring_alloc_records(QEMU_trace_batch_size);
+}
+
+void QEMU_trace_ring_deinit(void) {
+  QEMU_trace_set_parallel(0);
+  QEMU_trace_flush(-1);
+  trace_ring_free_records();
+  qemu_vfree(QEMU_trace_rings);
+  QEMU_trace_rings = NULL;
+  QEMU_trace_num_rings = 0;
+}
+
+void QEMU_trace_ring_flush(QEMU_trace_ring_t *ring, int cpu_id) {
+  if( ring->head == 0 )
+    return;
+
+  QEMU_nib nib;
+  nib.cpu_id = cpu_id;
+  nib.records = ring->records;
+  nib.count = ring->head;
+
+  QEMU_callback_args_t event_data;
+  event_data.nib = &nib;
+
+  // empty the ring first so that a callback flushing again does not
+  // deliver the same records twice
+  ring->head = 0;
+  if( !QEMU_trace_parallel ) {
+    QEMU_execute_callbacks(cpu_id, QEMU_cpu_mem_trans_batch, &event_data);
+    return;
+  }
+
+  // generic callbacks see the batches of all the cpus, keep them in
+  // execution order on this thread
+  QEMU_execute_callbacks(-1, QEMU_cpu_mem_trans_batch, &event_data);
+
+  QEMU_trace_worker_t *worker = &QEMU_trace_workers[cpu_id];
+  qemu_mutex_lock(&worker->lock);
+  worker->queue[(worker->queue_head + worker->queued) % QEMU_TRACE_WORKER_BUFFERS] = nib;
+  worker->queued++;
+  qemu_cond_broadcast(&worker->cond);
+  while( worker->num_free == 0 )
+    qemu_cond_wait(&worker->cond, &worker->lock);
+  ring->records = worker->free[--worker->num_free];
+  qemu_mutex_unlock(&worker->lock);
+}
+
+static void *trace_worker_thread(void *opaque) {
+  QEMU_trace_worker_t *worker = opaque;
+  QEMU_callback_args_t event_data;
+  QEMU_nib nib;
+
+  // the callback dispatch lists are read under RCU
+  rcu_register_thread();
+  qemu_mutex_lock(&worker->lock);
+  for( ;; ) {
+    while( worker->queued == 0 && !worker->stop )
+      qemu_cond_wait(&worker->cond, &worker->lock);
+    if( worker->queued == 0 )
+      break;
+    nib = worker->queue[worker->queue_head];
+    qemu_mutex_unlock(&worker->lock);
+
+    event_data.nib = &nib;
+    QEMU_execute_cpu_callbacks(worker->cpu_id, QEMU_cpu_mem_trans_batch, &event_data);
+
+    qemu_mutex_lock(&worker->lock);
+    worker->queue_head = (worker->queue_head + 1) % QEMU_TRACE_WORKER_BUFFERS;
+    worker->queued--;
+    worker->free[worker->num_free++] = nib.records;
+    qemu_cond_broadcast(&worker->cond);
+  }
+  qemu_mutex_unlock(&worker->lock);
+  rcu_unregister_thread();
+  return NULL;
+}
+
+// wait until the trace thread of the cpu delivered all its batches
+static void trace_worker_drain(int cpu_id) {
+  QEMU_trace_worker_t *worker = &QEMU_trace_workers[cpu_id];
+
+  qemu_mutex_lock(&worker->lock);
+  while( worker->queued != 0 )
+    qemu_cond_wait(&worker->cond, &worker->lock);
+  qemu_mutex_unlock(&worker->lock);
+}
+
+static void trace_workers_start(void) {
+  char name[32];
+  int i = 0;
+
+  QEMU_trace_workers = qemu_memalign(QEMU_TRACE_RING_ALIGN,
+                                     QEMU_trace_num_rings * sizeof(QEMU_trace_worker_t));
+  memset(QEMU_trace_workers, 0, QEMU_trace_num_rings * sizeof(QEMU_trace_worker_t));
+  for( ; i < QEMU_trace_num_rings; i++ ) {
+    QEMU_trace_worker_t *worker = &QEMU_trace_workers[i];
+    worker->cpu_id = i;
+    qemu_mutex_init(&worker->lock);
+    qemu_cond_init(&worker->cond);
+    // the ring keeps its own buffer
+    for( ; worker->num_free < QEMU_TRACE_WORKER_BUFFERS - 1; worker->num_free++ ) {
+      worker->free[worker->num_free] = NULL;
+      if( QEMU_trace_batch_size > 0 )
+        worker->free[worker->num_free] =
+          qemu_memalign(QEMU_TRACE_RING_ALIGN,
+                        QEMU_trace_batch_size * sizeof(QEMU_mem_trace_record_t));
+    }
+    snprintf(name, sizeof(name), "CPU %d/TRACE", i);
+    qemu_thread_create(&worker->thread, name, trace_worker_thread,
+                       worker, QEMU_THREAD_JOINABLE);
+  }
+}
+
+// the trace threads must have been drained
+static void trace_workers_stop(void) {
+  int i = 0;
+  for( ; i < QEMU_trace_num_rings; i++ ) {
+    QEMU_trace_worker_t *worker = &QEMU_trace_workers[i];
+    qemu_mutex_lock(&worker->lock);
+    worker->stop = true;
+    qemu_cond_broadcast(&worker->cond);
+    qemu_mutex_unlock(&worker->lock);
+    qemu_thread_join(&worker->thread);
+
+    while( worker->num_free > 0 )
+      qemu_vfree(worker->free[--worker->num_free]);
+    qemu_cond_destroy(&worker->cond);
+    qemu_mutex_destroy(&worker->lock);
+  }
+  qemu_vfree(QEMU_trace_workers);
+  QEMU_trace_workers = NULL;
+}
+
+void QEMU_trace_flush(int cpu_id) {
+  if( QEMU_trace_rings == NULL )
+    return;
+
+  if( cpu_id >= 0 ) {
+    if( cpu_id < QEMU_trace_num_rings ) {
+      QEMU_trace_ring_flush(&QEMU_trace_rings[cpu_id], cpu_id);
+      if( QEMU_trace_parallel )
+        trace_worker_drain(cpu_id);
+    }
+    return;
+  }
+
+  int i = 0;
+  for( ; i < QEMU_trace_num_rings; i++ )
+    QEMU_trace_ring_flush(&QEMU_trace_rings[i], i);
+  if( QEMU_trace_parallel ) {
+    for( i = 0; i < QEMU_trace_num_rings; i++ )
+      trace_worker_drain(i);
+  }
+}
+
+void QEMU_trace_end_quantum(int cpu_id, int end_of_round) {
+  if( !QEMU_trace_parallel || cpu_id >= QEMU_trace_num_rings )
+    return;
+
+  // batches never span quanta, and no trace thread runs ahead into the
+  // next round
+  QEMU_trace_ring_flush(&QEMU_trace_rings[cpu_id], cpu_id);
+  if( end_of_round ) {
+    int i = 0;
+    for( ; i < QEMU_trace_num_rings; i++ )
+      trace_worker_drain(i);
+  }
+}
+
+void QEMU_trace_set_parallel(int enable) {
+  enable = !!enable;
+  if( enable == QEMU_trace_parallel || QEMU_trace_rings == NULL )
+    return;
+
+  QEMU_trace_flush(-1);
+  if( enable ) {
+    trace_workers_start();
+  } else {
+    trace_workers_stop();
+  }
+  QEMU_trace_parallel = enable;
+}
+
+void QEMU_trace_set_batch_size(int records) {
+  if( records < 0 )
+    records = 0;
+  if( records == QEMU_trace_batch_size )
+    return;
+
+  // pending records are delivered with the old batch size, the trace
+  // threads are restarted with buffers of the new size
+  int parallel = QEMU_trace_parallel;
+  QEMU_trace_set_parallel(0);
+  QEMU_trace_flush(-1);
+  trace_ring_free_records();
+  QEMU_trace_batch_size = records;
+  trace_ring_alloc_records(records);
+  QEMU_trace_set_parallel(parallel);
+}
+
+#endif /* CONFIG_FLEXUS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,45 @@
+#ifndef __LIBQEMUFLEX_TRACE_RING_H__
+#define __LIBQEMUFLEX_TRACE_RING_H__
+
+#define QEMUFLEX_PROTOTYPES
+#define QEMUFLEX_QEMU_INTERNAL
+#include "api.h"
+
+// rings and their records are aligned on host cache lines so that
+// the rings of different cpus never share a line
+#define QEMU_TRACE_RING_ALIGN 64
+
+// Per-cpu buffer of trace records. A ring is only filled by the thread
+// running its cpu and the batch callbacks are executed by that same thread
+// when it is full, so no locking is required. In parallel trace mode the
+// full buffer is handed to the trace thread of the cpu and swapped for an
+// empty one instead, see trace_ring.c.
+typedef struct QEMU_trace_ring {
+  QEMU_mem_trace_record_t *records;
+  uint32_t head;
+  uint32_t capacity;
+} __attribute__((aligned(QEMU_TRACE_RING_ALIGN))) QEMU_trace_ring_t;
+
+extern QEMU_trace_ring_t *QEMU_trace_rings;
+
+// number of records per batch, 0 when batching is disabled
+extern int QEMU_trace_batch_size;
+
+// hand the records of the ring to the batch callbacks and empty it,
+// in parallel trace mode this returns before the cpu callbacks ran
+void QEMU_trace_ring_flush(QEMU_trace_ring_t *ring, int cpu_id);
+
+static inline int QEMU_trace_is_batched(void) {
+  return QEMU_trace_batch_size > 0;
+}
+
+// return the next free record of the cpu's ring, flushing it first if needed
+static inline QEMU_mem_trace_record_t *QEMU_trace_ring_next(int cpu_id) {
+  QEMU_trace_ring_t *ring = &QEMU_trace_rings[cpu_id];
+
+  if (ring->head == ring->capacity)
+    QEMU_trace_ring_flush(ring, cpu_id);
+  return &ring->records[ring->head++];
+}
+
+#endif /* __LIBQEMUFLEX_TRACE_RING_H__ */
@@ -2227,6 +2227,9 @@ void address_space_init(AddressSpace *as, MemoryRegion *root, const char *name)
     as->ioeventfds = NULL;
     QTAILQ_INSERT_TAIL(&address_spaces, as, address_spaces_link);
     as->name = g_strdup(name ? name : "anonymous");
+#ifdef CONFIG_FLEXUS
+    QEMU_dma_init_address_space(as);
+#endif
     address_space_init_dispatch(as);
     memory_region_update_pending |= root->enabled;
     memory_region_transaction_commit();
@@ -2244,6 +2247,9 @@ static void do_address_space_destroy(AddressSpace *as)
     }
 
     flatview_unref(as->current_map);
+#ifdef CONFIG_FLEXUS
+    QEMU_dma_destroy_address_space(as);
+#endif
     g_free(as->name);
     g_free(as->ioeventfds);
     memory_region_unref(as->root);
@@ -0,0 +1,666 @@
+/*
+ * Checkpoint library for sampled simulation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A library directory holds:
+ *   blocks        layout of the RAM blocks the library was recorded with
+ *   ram           RAM image of the base checkpoint, every block at its
+ *                 ram_addr offset so that it can be mapped in place
+ *   base.state    device state of the base checkpoint
+ *   <n>.ram       RAM pages written between the base and sample <n>
+ *   <n>.state     device state of sample <n>
+ */
+
+#include "qemu/osdep.h"
+#include <sys/mman.h>
+#include "qapi/error.h"
+#include "qemu-common.h"
+#include "cpu.h"
+#include "monitor/monitor.h"
+#include "sysemu/sysemu.h"
+#include "sysemu/cpus.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+#include "migration/checkpoint.h"
+#include "exec/address-spaces.h"
+#include "exec/ram_addr.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu_queue.h"
+
+#define CHECKPOINT_MAGIC    0x51435054  /* "QCPT" */
+#define CHECKPOINT_VERSION  1
+/* ends the list of pages of a sample */
+#define CHECKPOINT_EOS      UINT64_MAX
+
+typedef struct CheckpointLibrary {
+    char *dir;
+    int next_index;
+    ram_addr_t pages;
+    /* pages written since the base checkpoint */
+    unsigned long *dirty;
+    /* pages the library took out of the migration dirty log, given back
+     * when recording stops so that incremental snapshots still see them
+     */
+    unsigned long *taken;
+    /* set by checkpoint_request until the VM stopped for it */
+    bool requested;
+    /* the VM was running when the checkpoint was requested */
+    bool resume;
+    QEMUBH *bh;
+    VMChangeStateEntry *vmstate_change;
+} CheckpointLibrary;
+
+static CheckpointLibrary *checkpoint_library;
+
+static char *checkpoint_path(const char *dir, int index, const char *suffix)
+{
+    if (index < 0) {
+        return g_strdup_printf("%s/base.%s", dir, suffix);
+    }
+    return g_strdup_printf("%s/%d.%s", dir, index, suffix);
+}
+
+static void checkpoint_put_header(QEMUFile *f)
+{
+    qemu_put_be32(f, CHECKPOINT_MAGIC);
+    qemu_put_be32(f, CHECKPOINT_VERSION);
+    qemu_put_be32(f, TARGET_PAGE_SIZE);
+}
+
+static int checkpoint_get_header(QEMUFile *f, const char *path, Error **errp)
+{
+    if (qemu_get_be32(f) != CHECKPOINT_MAGIC ||
+        qemu_get_be32(f) != CHECKPOINT_VERSION ||
+        qemu_get_be32(f) != TARGET_PAGE_SIZE) {
+        error_setg(errp, "'%s' is not a checkpoint of this machine", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int checkpoint_close(QEMUFile *f, const char *path, Error **errp)
+{
+    int ret = qemu_file_get_error(f);
+
+    qemu_fclose(f);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret, "Error accessing '%s'", path);
+        return -1;
+    }
+    return 0;
+}
+
+static RAMBlock *checkpoint_find_block(ram_addr_t addr)
+{
+    RAMBlock *block;
+
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        if (addr >= block->offset &&
+            addr + TARGET_PAGE_SIZE <= block->offset + block->used_length) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+/* Move the pages written since the last sync from the migration dirty
+ * log to the dirty bitmap of the library.
+ */
+static void checkpoint_sync_dirty(CheckpointLibrary *lib)
+{
+    RAMBlock *block;
+
+    address_space_sync_dirty_bitmap(&address_space_memory);
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        cpu_physical_memory_sync_dirty_bitmap(lib->dirty, block->offset,
+                                              block->used_length);
+    }
+    rcu_read_unlock();
+    bitmap_or(lib->taken, lib->taken, lib->dirty, lib->pages);
+}
+
+static int checkpoint_save_blocks(const char *dir, Error **errp)
+{
+    char *path = g_strdup_printf("%s/blocks", dir);
+    QEMUFile *f = qemu_fopen(path, "wb");
+    RAMBlock *block;
+    uint32_t count = 0;
+    int ret;
+
+    if (!f) {
+        error_setg_file_open(errp, errno, path);
+        g_free(path);
+        return -1;
+    }
+    checkpoint_put_header(f);
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        count++;
+    }
+    qemu_put_be32(f, count);
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        qemu_put_byte(f, strlen(block->idstr));
+        qemu_put_buffer(f, (uint8_t *)block->idstr, strlen(block->idstr));
+        qemu_put_be64(f, block->offset);
+        qemu_put_be64(f, block->used_length);
+    }
+    rcu_read_unlock();
+    ret = checkpoint_close(f, path, errp);
+    g_free(path);
+    return ret;
+}
+
+/* Check that the RAM blocks are laid out the way they were recorded */
+static int checkpoint_check_blocks(const char *dir, Error **errp)
+{
+    char *path = g_strdup_printf("%s/blocks", dir);
+    QEMUFile *f = qemu_fopen(path, "rb");
+    RAMBlock *block;
+    char idstr[256];
+    uint32_t count = 0, i;
+    int ret = -1;
+
+    if (!f) {
+        error_setg_file_open(errp, errno, path);
+        g_free(path);
+        return -1;
+    }
+    if (checkpoint_get_header(f, path, errp) < 0) {
+        goto out;
+    }
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        count++;
+    }
+    if (qemu_get_be32(f) != count) {
+        error_setg(errp, "Checkpoint library '%s' has other RAM blocks", dir);
+        goto out_unlock;
+    }
+    for (i = 0; i < count; i++) {
+        int len = qemu_get_byte(f);
+        uint64_t offset, length;
+
+        qemu_get_buffer(f, (uint8_t *)idstr, len);
+        idstr[len] = 0;
+        offset = qemu_get_be64(f);
+        length = qemu_get_be64(f);
+        block = qemu_ram_block_by_name(idstr);
+        if (!block || block->offset != offset ||
+            block->used_length != length) {
+            error_setg(errp, "RAM block '%s' of checkpoint library '%s' "
+                       "does not match", idstr, dir);
+            goto out_unlock;
+        }
+    }
+    ret = 0;
+out_unlock:
+    rcu_read_unlock();
+out:
+    if (checkpoint_close(f, path, ret < 0 ? NULL : errp) < 0) {
+        ret = -1;
+    }
+    g_free(path);
+    return ret;
+}
+
+/* Write the RAM image of the base checkpoint, leaving holes for the zero
+ * pages.  The guest RAM may be a private mapping of the current image of
+ * the library (see checkpoint_load_ram_image), so the new image is written
+ * aside and renamed over it: truncating the mapped file would lose the
+ * pages the guest has not written yet.
+ */
+static int checkpoint_save_ram_image(const char *dir, Error **errp)
+{
+    char *path = g_strdup_printf("%s/ram", dir);
+    char *tmp_path = g_strdup_printf("%s/ram.tmp", dir);
+    RAMBlock *block;
+    ram_addr_t addr;
+    int fd, ret = -1;
+
+    fd = qemu_open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, tmp_path);
+        goto out_free;
+    }
+    if (ftruncate(fd, last_ram_offset()) < 0) {
+        error_setg_errno(errp, errno, "Error writing '%s'", tmp_path);
+        goto out;
+    }
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        for (addr = 0; addr < block->used_length; addr += TARGET_PAGE_SIZE) {
+            uint8_t *host = ramblock_ptr(block, addr);
+
+            if (buffer_is_zero(host, TARGET_PAGE_SIZE)) {
+                continue;
+            }
+            if (pwrite(fd, host, TARGET_PAGE_SIZE,
+                       block->offset + addr) != TARGET_PAGE_SIZE) {
+                error_setg_errno(errp, errno, "Error writing '%s'", tmp_path);
+                rcu_read_unlock();
+                goto out;
+            }
+        }
+    }
+    rcu_read_unlock();
+    ret = 0;
+out:
+    qemu_close(fd);
+    if (ret == 0 && rename(tmp_path, path) < 0) {
+        error_setg_errno(errp, errno, "Error renaming '%s'", tmp_path);
+        ret = -1;
+    }
+    if (ret < 0) {
+        unlink(tmp_path);
+    }
+out_free:
+    g_free(tmp_path);
+    g_free(path);
+    return ret;
+}
+
+/* Map the RAM image of the base checkpoint over guest RAM.  The mappings
+ * are private, so the guest writes never reach the image and restoring
+ * another checkpoint drops them.  Blocks that cannot be mapped in place
+ * are read instead.
+ */
+static int checkpoint_load_ram_image(const char *dir, Error **errp)
+{
+    char *path = g_strdup_printf("%s/ram", dir);
+    RAMBlock *block;
+    int fd, ret = -1;
+
+    fd = qemu_open(path, O_RDONLY);
+    if (fd < 0) {
+        error_setg_file_open(errp, errno, path);
+        g_free(path);
+        return -1;
+    }
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        if (block->fd < 0 &&
+            QEMU_IS_ALIGNED((uintptr_t)block->host, qemu_real_host_page_size) &&
+            QEMU_IS_ALIGNED(block->offset, qemu_real_host_page_size) &&
+            QEMU_IS_ALIGNED(block->used_length, qemu_real_host_page_size) &&
+            mmap(block->host, block->used_length, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, block->offset) != MAP_FAILED) {
+            continue;
+        }
+        if (pread(fd, block->host, block->used_length,
+                  block->offset) != block->used_length) {
+            error_setg_errno(errp, errno, "Error reading '%s'", path);
+            rcu_read_unlock();
+            goto out;
+        }
+    }
+    rcu_read_unlock();
+    ret = 0;
+out:
+    qemu_close(fd);
+    g_free(path);
+    return ret;
+}
+
+static int checkpoint_save_pages(CheckpointLibrary *lib, int index,
+                                 Error **errp)
+{
+    char *path = checkpoint_path(lib->dir, index, "ram");
+    QEMUFile *f = qemu_fopen(path, "wb");
+    RAMBlock *block;
+    int ret;
+
+    if (!f) {
+        error_setg_file_open(errp, errno, path);
+        g_free(path);
+        return -1;
+    }
+    checkpoint_put_header(f);
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        unsigned long first = block->offset >> TARGET_PAGE_BITS;
+        unsigned long last = first + (block->used_length >> TARGET_PAGE_BITS);
+        unsigned long page = find_next_bit(lib->dirty, last, first);
+
+        for (; page < last; page = find_next_bit(lib->dirty, last, page + 1)) {
+            ram_addr_t addr = (ram_addr_t)page << TARGET_PAGE_BITS;
+
+            qemu_put_be64(f, addr);
+            qemu_put_buffer(f, ramblock_ptr(block, addr - block->offset),
+                            TARGET_PAGE_SIZE);
+        }
+    }
+    rcu_read_unlock();
+    qemu_put_be64(f, CHECKPOINT_EOS);
+    ret = checkpoint_close(f, path, errp);
+    g_free(path);
+    return ret;
+}
+
+static int checkpoint_load_pages(const char *dir, int index, Error **errp)
+{
+    char *path = checkpoint_path(dir, index, "ram");
+    QEMUFile *f = qemu_fopen(path, "rb");
+    RAMBlock *block;
+    uint64_t addr;
+    int ret = -1;
+
+    if (!f) {
+        error_setg_file_open(errp, errno, path);
+        g_free(path);
+        return -1;
+    }
+    if (checkpoint_get_header(f, path, errp) < 0) {
+        goto out;
+    }
+    rcu_read_lock();
+    while ((addr = qemu_get_be64(f)) != CHECKPOINT_EOS &&
+           !qemu_file_get_error(f)) {
+        block = checkpoint_find_block(addr);
+        if (!block) {
+            error_setg(errp, "Checkpoint '%s' has a page outside of RAM at "
+                       RAM_ADDR_FMT, path, (ram_addr_t)addr);
+            rcu_read_unlock();
+            goto out;
+        }
+        qemu_get_buffer(f, ramblock_ptr(block, addr - block->offset),
+                        TARGET_PAGE_SIZE);
+    }
+    rcu_read_unlock();
+    ret = 0;
+out:
+    if (checkpoint_close(f, path, ret < 0 ? NULL : errp) < 0) {
+        ret = -1;
+    }
+    g_free(path);
+    return ret;
+}
+
+static int checkpoint_save_state(const char *dir, int index, Error **errp)
+{
+    char *path = checkpoint_path(dir, index, "state");
+    QEMUFile *f = qemu_fopen(path, "wb");
+    int ret;
+
+    if (!f) {
+        error_setg_file_open(errp, errno, path);
+        g_free(path);
+        return -1;
+    }
+    qemu_save_device_state(f);
+    ret = checkpoint_close(f, path, errp);
+    g_free(path);
+    return ret;
+}
+
+static int checkpoint_load_state(const char *dir, int index, Error **errp)
+{
+    char *path = checkpoint_path(dir, index, "state");
+    QEMUFile *f = qemu_fopen(path, "rb");
+    int ret;
+
+    if (!f) {
+        error_setg_file_open(errp, errno, path);
+        g_free(path);
+        return -1;
+    }
+    migration_incoming_state_new(f);
+    ret = qemu_loadvm_state(f);
+    qemu_fclose(f);
+    migration_incoming_state_destroy();
+    if (ret < 0) {
+        error_setg(errp, "Error %d while loading '%s'", ret, path);
+    }
+    g_free(path);
+    return ret < 0 ? -1 : 0;
+}
+
+static bool checkpoint_migration_active(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return migration_in_setup(s) || s->state == MIGRATION_STATUS_ACTIVE ||
+           migration_in_postcopy(s);
+}
+
+static void checkpoint_bh(void *opaque)
+{
+    CheckpointLibrary *lib = opaque;
+    Error *local_err = NULL;
+
+    lib->requested = false;
+    if (checkpoint_save(&local_err) < 0) {
+        error_report_err(local_err);
+    }
+    if (lib->resume) {
+        vm_start();
+    }
+}
+
+static void checkpoint_vm_state_change(void *opaque, int running,
+                                       RunState state)
+{
+    CheckpointLibrary *lib = opaque;
+
+    if (!running && state == RUN_STATE_SAVE_VM && lib->requested) {
+        qemu_bh_schedule(lib->bh);
+    }
+}
+
+int checkpoint_start(const char *dir, Error **errp)
+{
+    CheckpointLibrary *lib;
+    int saved_vm_running;
+    int ret = -1;
+
+    if (checkpoint_library) {
+        error_setg(errp, "Already recording checkpoint library '%s'",
+                   checkpoint_library->dir);
+        return -1;
+    }
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        error_setg_errno(errp, errno, "Could not create '%s'", dir);
+        return -1;
+    }
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    lib = g_new0(CheckpointLibrary, 1);
+    lib->dir = g_strdup(dir);
+    lib->pages = last_ram_offset() >> TARGET_PAGE_BITS;
+    lib->dirty = bitmap_new(lib->pages);
+    lib->taken = bitmap_new(lib->pages);
+
+    memory_global_dirty_log_start();
+    checkpoint_sync_dirty(lib);
+    bitmap_zero(lib->dirty, lib->pages);
+
+    if (checkpoint_save_blocks(dir, errp) < 0 ||
+        checkpoint_save_ram_image(dir, errp) < 0 ||
+        checkpoint_save_state(dir, -1, errp) < 0) {
+        checkpoint_library = lib;
+        checkpoint_stop();
+        goto out;
+    }
+
+    lib->bh = qemu_bh_new(checkpoint_bh, lib);
+    lib->vmstate_change =
+        qemu_add_vm_change_state_handler(checkpoint_vm_state_change, lib);
+    checkpoint_library = lib;
+    ret = 0;
+out:
+    if (saved_vm_running) {
+        vm_start();
+    }
+    return ret;
+}
+
+int checkpoint_save(Error **errp)
+{
+    CheckpointLibrary *lib = checkpoint_library;
+    int saved_vm_running;
+    int index = -1;
+
+    if (!lib) {
+        error_setg(errp, "No checkpoint library is being recorded");
+        return -1;
+    }
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    checkpoint_sync_dirty(lib);
+    if (checkpoint_save_pages(lib, lib->next_index, errp) == 0 &&
+        checkpoint_save_state(lib->dir, lib->next_index, errp) == 0) {
+        index = lib->next_index++;
+    }
+
+    if (saved_vm_running) {
+        vm_start();
+    }
+    return index;
+}
+
+void checkpoint_request(void)
+{
+    if (!checkpoint_library || checkpoint_library->requested) {
+        return;
+    }
+    checkpoint_library->requested = true;
+    checkpoint_library->resume = runstate_is_running();
+    if (!checkpoint_library->resume) {
+        /* no state change to wait for */
+        qemu_bh_schedule(checkpoint_library->bh);
+    } else if (qemu_in_vcpu_thread()) {
+        /* stops the vCPU when it leaves its current TB */
+        vm_stop(RUN_STATE_SAVE_VM);
+    } else {
+        qemu_system_vmstop_request_prepare();
+        qemu_system_vmstop_request(RUN_STATE_SAVE_VM);
+    }
+}
+
+void checkpoint_stop(void)
+{
+    CheckpointLibrary *lib = checkpoint_library;
+    unsigned long page;
+
+    if (!lib) {
+        return;
+    }
+    checkpoint_library = NULL;
+
+    /* a migration started meanwhile still needs the log */
+    if (!checkpoint_migration_active()) {
+        memory_global_dirty_log_stop();
+    }
+    for (page = find_first_bit(lib->taken, lib->pages); page < lib->pages;
+         page = find_next_bit(lib->taken, lib->pages, page + 1)) {
+        cpu_physical_memory_set_dirty_range(page << TARGET_PAGE_BITS,
+                                            TARGET_PAGE_SIZE,
+                                            1 << DIRTY_MEMORY_MIGRATION);
+    }
+
+    if (lib->vmstate_change) {
+        qemu_del_vm_change_state_handler(lib->vmstate_change);
+    }
+    if (lib->bh) {
+        qemu_bh_delete(lib->bh);
+    }
+    g_free(lib->taken);
+    g_free(lib->dirty);
+    g_free(lib->dir);
+    g_free(lib);
+}
+
+int checkpoint_load(const char *dir, int index, Error **errp)
+{
+    RAMBlock *block;
+    CPUState *cpu;
+    int saved_vm_running;
+    int ret = -1;
+
+    if (checkpoint_library) {
+        error_setg(errp, "Cannot restore while recording checkpoint "
+                   "library '%s'", checkpoint_library->dir);
+        return -1;
+    }
+    if (checkpoint_check_blocks(dir, errp) < 0) {
+        return -1;
+    }
+
+    saved_vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_RESTORE_VM);
+
+    qemu_system_reset(VMRESET_SILENT);
+    if (checkpoint_load_ram_image(dir, errp) < 0 ||
+        (index >= 0 && checkpoint_load_pages(dir, index, errp) < 0) ||
+        checkpoint_load_state(dir, index, errp) < 0) {
+        goto out;
+    }
+
+    /* RAM changed behind the back of the dirty log and of the translated
+     * code, the next incremental snapshot has to save all of it.
+     */
+    rcu_read_lock();
+    QLIST_FOREACH_RCU(block, &ram_list.blocks, next) {
+        cpu_physical_memory_set_dirty_range(block->offset, block->used_length,
+                                            DIRTY_CLIENTS_ALL);
+    }
+    rcu_read_unlock();
+    /* restores of the same sample mostly bring back the same code, keep
+     * the TBs of the pages that did not change
+     */
+    tb_revalidate_code(first_cpu);
+    CPU_FOREACH(cpu) {
+        tlb_flush(cpu, 1);
+    }
+    ret = 0;
+out:
+    if (ret == 0 && saved_vm_running) {
+        vm_start();
+    }
+    return ret;
+}
+
+void hmp_checkpoint_start(Monitor *mon, const QDict *qdict)
+{
+    Error *local_err = NULL;
+
+    if (checkpoint_start(qdict_get_str(qdict, "dir"), &local_err) < 0) {
+        error_report_err(local_err);
+    }
+}
+
+void hmp_checkpoint_save(Monitor *mon, const QDict *qdict)
+{
+    Error *local_err = NULL;
+    int index = checkpoint_save(&local_err);
+
+    if (index < 0) {
+        error_report_err(local_err);
+        return;
+    }
+    monitor_printf(mon, "Saved checkpoint %d\n", index);
+}
+
+void hmp_checkpoint_stop(Monitor *mon, const QDict *qdict)
+{
+    checkpoint_stop();
+}
+
+void hmp_checkpoint_load(Monitor *mon, const QDict *qdict)
+{
+    Error *local_err = NULL;
+
+    if (checkpoint_load(qdict_get_str(qdict, "dir"),
+                        qdict_get_int(qdict, "index"), &local_err) < 0) {
+        error_report_err(local_err);
+    }
+}
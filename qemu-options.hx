@@ -3267,6 +3267,8 @@ STEXI
 @item -set_quantum @var{num}
 @findex -set_quantum
 Specify the number of instructions to execute per vcpu in each iteration.
+Unless QEMU is built with Flexus, the instructions executed by each vcpu
+are only counted while a quantum is set.
 ETEXI
 
 DEF("loadvm", HAS_ARG, QEMU_OPTION_loadvm, \
@@ -3279,6 +3281,18 @@ STEXI
 Start right away with a saved state (@code{loadvm} in monitor)
 ETEXI
 
+DEF("loadcpt", HAS_ARG, QEMU_OPTION_loadcpt, \
+    "-loadcpt dir:index\n" \
+    "                start right away with a checkpoint of a checkpoint library\n" \
+    "                (cpt-load in monitor)\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -loadcpt @var{dir}:@var{index}
+@findex -loadcpt
+Start right away with checkpoint @var{index} of the checkpoint library
+recorded in @var{dir}, -1 for its base checkpoint (@code{cpt-load} in monitor)
+ETEXI
+
 #ifndef _WIN32
 DEF("daemonize", 0, QEMU_OPTION_daemonize, \
     "-daemonize      daemonize QEMU after initializing\n", QEMU_ARCH_ALL)
@@ -3487,6 +3501,27 @@ STEXI
 Set TB size.
 ETEXI
 
+DEF("tcg-threads", HAS_ARG, QEMU_OPTION_tcg_threads, \
+    "-tcg-threads single|multi\n" \
+    "                run the TCG vCPUs in turn in a single thread (default),\n" \
+    "                or each in its own thread\n", QEMU_ARCH_ARM)
+STEXI
+@item -tcg-threads single|multi
+@findex -tcg-threads
+Run all the TCG vCPUs in turn in a single thread (@option{single}, the
+default), or each vCPU in its own thread (@option{multi}) so that the guest
+uses several host cores.  The multi-threaded mode requires an x86_64 or
+aarch64 host, and cannot be combined with @option{-icount}, record/replay
+or the Flexus simulation, timing and tracing options.
+
+The Flexus instrumentation expects the vCPUs to run in turn, so it is only
+available with @option{single}: with @option{multi}, the magic instructions
+that start the simulation, the @code{flexus-bench} and
+@code{flexus-trace-record-start} commands, the sample checkpoints and the
+sampling controller are refused.  Fast-forwarding with @option{multi} and
+simulating with @option{single} takes two runs, joined by a checkpoint.
+ETEXI
+
 DEF("incoming", HAS_ARG, QEMU_OPTION_incoming, \
     "-incoming tcp:[host]:port[,to=maxport][,ipv4][,ipv6]\n" \
     "-incoming rdma:host:port[,ipv4][,ipv6]\n" \
@@ -4007,6 +4042,34 @@ STEXI
 Specify the number of instructions to execute during the simulation, then exits. Must be used in conjunction with
 the @code{-startsimulation} option, or the simulation must be trigerred by magic instructions or another way.
 ETEXI
+
+DEF("flexus-bench", HAS_ARG, QEMU_OPTION_flexus_bench, \
+	"-flexus-bench instructions=n,file=path[,modes=mode:...]\n"
+	"                measure the MIPS and the instrumentation callback costs of\n"
+	"                each mode (off, fetch, ls, both, dma) for n instructions\n",
+	QEMU_ARCH_ALL)
+STEXI
+@item -flexus-bench instructions=@var{n},file=@var{path}[,modes=@var{mode}:...]
+@findex -flexus-bench
+Measure the MIPS and the cost of the Flexus instrumentation callbacks for
+@var{n} instructions in each of the colon-separated modes @code{off},
+@code{fetch}, @code{ls}, @code{both} and @code{dma}, all of them by default,
+and write the JSON report to @var{path}.  The guest keeps running afterwards
+(@code{flexus-bench} in monitor).
+ETEXI
+
+DEF("flexus-trace-record", HAS_ARG, QEMU_OPTION_flexus_trace_record, \
+	"-flexus-trace-record file\n"
+	"                record the memory accesses of the cpus and the devices\n"
+	"                to a compressed trace file until QEMU exits\n",
+	QEMU_ARCH_ALL)
+STEXI
+@item -flexus-trace-record @var{file}
+@findex -flexus-trace-record
+Record the instruction fetches, loads and stores of the cpus and the DMA
+accesses of the devices to the compressed trace @var{file} from the start,
+until QEMU exits or @code{flexus-trace-record-stop} is issued in the monitor.
+ETEXI
 #endif
 
 
@@ -4856,6 +4856,89 @@ Example:
 
 EQMP
 
+#if defined(CONFIG_FLEXUS)
+    {
+        .name       = "flexus-bench",
+        .args_type  = "instructions:l,file:s,modes:q?",
+        .mhandler.cmd_new = qmp_marshal_flexus_bench,
+    },
+#endif
+
+SQMP
+flexus-bench
+------------
+
+Measure the MIPS and the cost of the Flexus instrumentation callbacks in
+each instrumentation mode, one mode after the other, while the guest keeps
+running.  A JSON report is written to the file once the last mode is done.
+
+Arguments:
+
+- "instructions": instructions executed by all the cpus in each mode (json-int)
+- "file": file the report is written to (json-string)
+- "modes": modes to measure, in order, all of them by default (json-array
+  of "off", "fetch", "ls", "both" or "dma", optional)
+
+Example:
+
+-> { "execute": "flexus-bench",
+     "arguments": { "instructions": 100000000, "file": "bench.json",
+                    "modes": [ "off", "both" ] } }
+<- { "return": {} }
+
+EQMP
+
+#if defined(CONFIG_FLEXUS)
+    {
+        .name       = "flexus-trace-record-start",
+        .args_type  = "file:s",
+        .mhandler.cmd_new = qmp_marshal_flexus_trace_record_start,
+    },
+#endif
+
+SQMP
+flexus-trace-record-start
+-------------------------
+
+Record the instruction fetches, loads and stores of the cpus and the DMA
+accesses of the devices to a compressed trace file, until
+flexus-trace-record-stop.
+
+Arguments:
+
+- "file": file the trace is written to (json-string)
+
+Example:
+
+-> { "execute": "flexus-trace-record-start",
+     "arguments": { "file": "boot.trace" } }
+<- { "return": {} }
+
+EQMP
+
+#if defined(CONFIG_FLEXUS)
+    {
+        .name       = "flexus-trace-record-stop",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_flexus_trace_record_stop,
+    },
+#endif
+
+SQMP
+flexus-trace-record-stop
+------------------------
+
+Stop recording the trace and finish writing its file.
+
+Arguments: None.
+
+Example:
+
+-> { "execute": "flexus-trace-record-stop" }
+<- { "return": {} }
+
+EQMP
+
 #if defined TARGET_ARM
     {
         .name       = "query-gic-capabilities",
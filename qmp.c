@@ -166,6 +166,25 @@ void qmp_cpu_zero_all(Error **errp)
     cpu_zero_all();
 }
 
+#ifndef CONFIG_FLEXUS
+void qmp_flexus_bench(int64_t instructions, const char *file,
+                      bool has_modes, FlexusBenchModeList *modes,
+                      Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "flexus");
+}
+
+void qmp_flexus_trace_record_start(const char *file, Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "flexus");
+}
+
+void qmp_flexus_trace_record_stop(Error **errp)
+{
+    error_setg(errp, QERR_FEATURE_DISABLED, "flexus");
+}
+#endif
+
 
 
 #ifndef CONFIG_VNC
@@ -141,6 +141,15 @@
     vidx >= 0;                                                                \
 })
 
+/* Flexus tracing helpers find the physical address of data accesses in
+   env->flexus_access, see flexus_record_access().  */
+#if defined(CONFIG_FLEXUS) && !defined(SOFTMMU_CODE_ACCESS)
+#define FLEXUS_RECORD_ACCESS() \
+    flexus_record_access(env, addr, mmu_idx, index, tlb_addr)
+#else
+#define FLEXUS_RECORD_ACCESS() do { } while (0)
+#endif
+
 #ifndef SOFTMMU_CODE_ACCESS
 static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
                                               CPUIOTLBEntry *iotlbentry,
@@ -151,6 +160,7 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr physaddr = iotlbentry->addr;
     MemoryRegion *mr = iotlb_to_region(cpu, physaddr, iotlbentry->attrs);
+    bool locked = false;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     cpu->mem_io_pc = retaddr;
@@ -159,8 +169,16 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
     }
 
     cpu->mem_io_vaddr = addr;
+    /* the vCPUs of -tcg-threads multi run without the BQL */
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
     memory_region_dispatch_read(mr, physaddr, &val, 1 << SHIFT,
                                 iotlbentry->attrs);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
     return val;
 }
 #endif
@@ -199,6 +217,7 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
             goto do_unaligned_access;
         }
         iotlbentry = &env->iotlb[mmu_idx][index];
+        FLEXUS_RECORD_ACCESS();
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
@@ -225,6 +244,7 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
            Undo that for the recursion.  */
         res1 = helper_le_ld_name(env, addr1, oi, retaddr + GETPC_ADJ);
         res2 = helper_le_ld_name(env, addr2, oi, retaddr + GETPC_ADJ);
+        FLEXUS_RECORD_ACCESS();
         shift = (addr & (DATA_SIZE - 1)) * 8;
 
         /* Little-endian combine.  */
@@ -239,6 +259,7 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
                              mmu_idx, retaddr);
     }
 
+    FLEXUS_RECORD_ACCESS();
     haddr = addr + env->tlb_table[mmu_idx][index].addend;
 #if DATA_SIZE == 1
     res = glue(glue(ld, LSUFFIX), _p)((uint8_t *)haddr);
@@ -283,6 +304,7 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
             goto do_unaligned_access;
         }
         iotlbentry = &env->iotlb[mmu_idx][index];
+        FLEXUS_RECORD_ACCESS();
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
@@ -309,6 +331,7 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
            Undo that for the recursion.  */
         res1 = helper_be_ld_name(env, addr1, oi, retaddr + GETPC_ADJ);
         res2 = helper_be_ld_name(env, addr2, oi, retaddr + GETPC_ADJ);
+        FLEXUS_RECORD_ACCESS();
         shift = (addr & (DATA_SIZE - 1)) * 8;
 
         /* Big-endian combine.  */
@@ -323,6 +346,7 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
                              mmu_idx, retaddr);
     }
 
+    FLEXUS_RECORD_ACCESS();
     haddr = addr + env->tlb_table[mmu_idx][index].addend;
     res = glue(glue(ld, LSUFFIX), _be_p)((uint8_t *)haddr);
     return res;
@@ -358,6 +382,7 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr physaddr = iotlbentry->addr;
     MemoryRegion *mr = iotlb_to_region(cpu, physaddr, iotlbentry->attrs);
+    bool locked = false;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     if (mr != &io_mem_rom && mr != &io_mem_notdirty && !cpu->can_do_io) {
@@ -366,8 +391,15 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
 
     cpu->mem_io_vaddr = addr;
     cpu->mem_io_pc = retaddr;
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
     memory_region_dispatch_write(mr, physaddr, val, 1 << SHIFT,
                                  iotlbentry->attrs);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
@@ -402,6 +434,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
             goto do_unaligned_access;
         }
         iotlbentry = &env->iotlb[mmu_idx][index];
+        FLEXUS_RECORD_ACCESS();
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
@@ -431,6 +464,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
             glue(helper_ret_stb, MMUSUFFIX)(env, addr + i, val8,
                                             oi, retaddr + GETPC_ADJ);
         }
+        FLEXUS_RECORD_ACCESS();
         return;
     }
 
@@ -441,6 +475,7 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                              mmu_idx, retaddr);
     }
 
+    FLEXUS_RECORD_ACCESS();
     haddr = addr + env->tlb_table[mmu_idx][index].addend;
 #if DATA_SIZE == 1
     glue(glue(st, SUFFIX), _p)((uint8_t *)haddr, val);
@@ -482,6 +517,7 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
             goto do_unaligned_access;
         }
         iotlbentry = &env->iotlb[mmu_idx][index];
+        FLEXUS_RECORD_ACCESS();
 
         /* ??? Note that the io helpers always read data in the target
            byte ordering.  We should push the LE/BE request down into io.  */
@@ -511,6 +547,7 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
             glue(helper_ret_stb, MMUSUFFIX)(env, addr + i, val8,
                                             oi, retaddr + GETPC_ADJ);
         }
+        FLEXUS_RECORD_ACCESS();
         return;
     }
 
@@ -521,6 +558,7 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                              mmu_idx, retaddr);
     }
 
+    FLEXUS_RECORD_ACCESS();
     haddr = addr + env->tlb_table[mmu_idx][index].addend;
     glue(glue(st, SUFFIX), _be_p)((uint8_t *)haddr, val);
 }
@@ -574,3 +612,4 @@ void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
 #undef helper_be_st_name
 #undef helper_te_ld_name
 #undef helper_te_st_name
+#undef FLEXUS_RECORD_ACCESS
@@ -47,7 +47,6 @@
 #define EXCP_BKPT            7
 #define EXCP_EXCEPTION_EXIT  8   /* Return from v7M exception.  */
 #define EXCP_KERNEL_TRAP     9   /* Jumped to kernel code page.  */
-#define EXCP_STREX          10
 #define EXCP_HVC            11   /* HyperVisor Call */
 #define EXCP_HYP_TRAP       12
 #define EXCP_SMC            13   /* Secure Monitor Call */
@@ -465,10 +464,6 @@ typedef struct CPUARMState {
     uint64_t exclusive_addr;
     uint64_t exclusive_val;
     uint64_t exclusive_high;
-#if defined(CONFIG_USER_ONLY)
-    uint64_t exclusive_test;
-    uint32_t exclusive_info;
-#endif
 
     /* iwMMXt coprocessor state.  */
     struct {
@@ -934,6 +929,7 @@ enum arm_features {
     ARM_FEATURE_V8_SHA256, /* implements SHA256 part of v8 Crypto Extensions */
     ARM_FEATURE_V8_PMULL, /* implements PMULL part of v8 Crypto Extensions */
     ARM_FEATURE_THUMB_DSP, /* DSP insns supported in the Thumb encodings */
+    ARM_FEATURE_V8_ATOMICS, /* ARMv8.1 CAS, CASP, LD<op> and SWP */
 };
 
 static inline int arm_feature(CPUARMState *env, int feature)
@@ -1960,6 +1956,20 @@ static inline bool arm_cpu_data_is_big_endian(CPUARMState *env)
 /* Target EL if we take a floating-point-disabled exception */
 #define ARM_TBFLAG_FPEXC_EL_SHIFT 24
 #define ARM_TBFLAG_FPEXC_EL_MASK (0x3 << ARM_TBFLAG_FPEXC_EL_SHIFT)
+/* Set if the TB was translated with the Flexus instrumentation helpers.
+ * Instrumented and plain TBs for the same code coexist in the code cache,
+ * so toggling the simulation does not require a tb_flush().
+ */
+#define ARM_TBFLAG_FLEXUS_SHIFT 23
+#define ARM_TBFLAG_FLEXUS_MASK (1 << ARM_TBFLAG_FLEXUS_SHIFT)
+/* Set if the Flexus instrumentation leaves out the instruction fetches,
+ * respectively the memory accesses, of the TB: the filter leaves out both
+ * and a flexus-bench mode the events it does not measure.
+ */
+#define ARM_TBFLAG_FLEXUS_NOFETCH_SHIFT 22
+#define ARM_TBFLAG_FLEXUS_NOFETCH_MASK (1 << ARM_TBFLAG_FLEXUS_NOFETCH_SHIFT)
+#define ARM_TBFLAG_FLEXUS_NOLS_SHIFT 21
+#define ARM_TBFLAG_FLEXUS_NOLS_MASK (1 << ARM_TBFLAG_FLEXUS_NOLS_SHIFT)
 
 /* Bit usage when in AArch32 state: */
 #define ARM_TBFLAG_THUMB_SHIFT      0
@@ -2001,6 +2011,12 @@ static inline bool arm_cpu_data_is_big_endian(CPUARMState *env)
     (((F) & ARM_TBFLAG_PSTATE_SS_MASK) >> ARM_TBFLAG_PSTATE_SS_SHIFT)
 #define ARM_TBFLAG_FPEXC_EL(F) \
     (((F) & ARM_TBFLAG_FPEXC_EL_MASK) >> ARM_TBFLAG_FPEXC_EL_SHIFT)
+#define ARM_TBFLAG_FLEXUS(F) \
+    (((F) & ARM_TBFLAG_FLEXUS_MASK) >> ARM_TBFLAG_FLEXUS_SHIFT)
+#define ARM_TBFLAG_FLEXUS_NOFETCH(F) \
+    (((F) & ARM_TBFLAG_FLEXUS_NOFETCH_MASK) >> ARM_TBFLAG_FLEXUS_NOFETCH_SHIFT)
+#define ARM_TBFLAG_FLEXUS_NOLS(F) \
+    (((F) & ARM_TBFLAG_FLEXUS_NOLS_MASK) >> ARM_TBFLAG_FLEXUS_NOLS_SHIFT)
 #define ARM_TBFLAG_THUMB(F) \
     (((F) & ARM_TBFLAG_THUMB_MASK) >> ARM_TBFLAG_THUMB_SHIFT)
 #define ARM_TBFLAG_VECLEN(F) \
@@ -2116,6 +2132,15 @@ static inline bool arm_cpu_bswap_data(CPUARMState *env)
 }
 #endif
 
+#ifdef CONFIG_FLEXUS
+/* Non-zero while Flexus is simulating (see libqemuflex/api.c) */
+extern int flexus_is_simulating;
+/* Instrumentation filter (see libqemuflex/filter.c) */
+int QEMU_filter_trace_tb(int cpu_id, int is_user);
+/* Events measured by flexus-bench */
+#include "libqemuflex/bench.h"
+#endif
+
 static inline void cpu_get_tb_cpu_state(CPUARMState *env, target_ulong *pc,
                                         target_ulong *cs_base, int *flags)
 {
@@ -2164,6 +2189,22 @@ static inline void cpu_get_tb_cpu_state(CPUARMState *env, target_ulong *pc,
         *flags |= ARM_TBFLAG_BE_DATA_MASK;
     }
     *flags |= fp_exception_el(env) << ARM_TBFLAG_FPEXC_EL_SHIFT;
+#ifdef CONFIG_FLEXUS
+    if (flexus_is_simulating) {
+        *flags |= ARM_TBFLAG_FLEXUS_MASK;
+        if (!QEMU_filter_trace_tb(ENV_GET_CPU(env)->cpu_index,
+                                  arm_current_el(env) == 0)) {
+            *flags |= ARM_TBFLAG_FLEXUS_NOFETCH_MASK
+                      | ARM_TBFLAG_FLEXUS_NOLS_MASK;
+        }
+        if (!(QEMU_bench.events & (1 << QEMU_BENCH_EVENT_FETCH))) {
+            *flags |= ARM_TBFLAG_FLEXUS_NOFETCH_MASK;
+        }
+        if (!(QEMU_bench.events & (1 << QEMU_BENCH_EVENT_LS))) {
+            *flags |= ARM_TBFLAG_FLEXUS_NOLS_MASK;
+        }
+    }
+#endif
 
     *cs_base = 0;
 }
@@ -26,6 +26,7 @@
 #include "qemu/bitops.h"
 #include "internals.h"
 #include "qemu/crc32c.h"
+#include "tcg.h"
 #include <zlib.h> /* For crc32 */
 
 /* C2.4.7 Multiply and divide */
@@ -444,16 +445,120 @@ uint64_t HELPER(crc32c_64)(uint64_t acc, uint64_t val, uint32_t bytes)
     return crc32c(acc, buf, bytes) ^ 0xffffffff;
 }
 
+/* serializes the 16-byte compare-and-swaps where the host has no such insn */
+static int paired_cmpxchg_lock;
+
+/* Compare-and-swap of the 16 bytes at @haddr, see atomic16_cmpxchg */
+static bool paired_cmpxchg_host(void *haddr, uint64_t *cmpm,
+                                const uint64_t *newm)
+{
+    bool ok;
+
+#ifdef CONFIG_ATOMIC128
+    if (atomic16_cmpxchg_supported()) {
+        return atomic16_cmpxchg(haddr, cmpm, newm);
+    }
+#endif
+    while (atomic_xchg(&paired_cmpxchg_lock, 1)) {
+        /* spin, the holder cannot fault */
+    }
+    ok = !memcmp(haddr, cmpm, 16);
+    if (ok) {
+        memcpy(haddr, newm, 16);
+    } else {
+        memcpy(cmpm, haddr, 16);
+    }
+    atomic_mb_set(&paired_cmpxchg_lock, 0);
+    return ok;
+}
+
+/* Compare-and-swap of the two doublewords at @addr, in the byte order of
+ * @oi: the pair @cmp is replaced by @newv if it matches, and receives the
+ * previous contents.  Returns whether the pair was replaced.  Like the
+ * operations of atomic_template.h, the accesses the host cannot do
+ * atomically go through the slow path, and the same goes for the hosts
+ * without a 16-byte compare-and-swap.
+ */
+static bool do_paired_cmpxchg64(CPUARMState *env, uint64_t addr,
+                                uint64_t *cmp, const uint64_t *newv,
+                                TCGMemOpIdx oi, uintptr_t ra)
+{
+    bool be = (get_memop(oi) & MO_BSWAP) == MO_BE;
+    uint64_t cmpm[2], newm[2], old[2];
+    void *haddr = atomic_mmu_lookup(env, addr, oi, 16, ra);
+    bool ok;
+    int i;
+
+    if (haddr) {
+        /* the pair as it is in memory */
+        for (i = 0; i < 2; i++) {
+            if (be) {
+                stq_be_p(&cmpm[i], cmp[i]);
+                stq_be_p(&newm[i], newv[i]);
+            } else {
+                stq_le_p(&cmpm[i], cmp[i]);
+                stq_le_p(&newm[i], newv[i]);
+            }
+        }
+        ok = paired_cmpxchg_host(haddr, cmpm, newm);
+        for (i = 0; i < 2; i++) {
+            cmp[i] = be ? ldq_be_p(&cmpm[i]) : ldq_le_p(&cmpm[i]);
+        }
+        return ok;
+    }
+
+    old[0] = atomic_slow_ld(env, addr, oi, 8, be, ra);
+    old[1] = atomic_slow_ld(env, addr + 8, oi, 8, be, ra);
+    ok = old[0] == cmp[0] && old[1] == cmp[1];
+    if (ok) {
+        atomic_slow_st(env, addr, newv[0], oi, 8, be, ra);
+        atomic_slow_st(env, addr + 8, newv[1], oi, 8, be, ra);
+    }
+    cmp[0] = old[0];
+    cmp[1] = old[1];
+    return ok;
+}
+
+/* STXP of two doublewords: compares with the pair of the load-exclusive.
+ * Returns 0 if the pair was stored, 1 otherwise.
+ */
+uint64_t HELPER(paired_cmpxchg64)(CPUARMState *env, uint64_t addr,
+                                  uint64_t newlo, uint64_t newhi, uint32_t oi)
+{
+    uint64_t cmp[2] = { env->exclusive_val, env->exclusive_high };
+    uint64_t newv[2] = { newlo, newhi };
+
+    return !do_paired_cmpxchg64(env, addr, cmp, newv, oi, GETRA());
+}
+
+/* CASP of two doublewords: the pair of registers from the even @rs is
+ * compared with memory and receives its previous contents.
+ */
+void HELPER(casp_64)(CPUARMState *env, uint32_t rs, uint64_t addr,
+                     uint64_t newlo, uint64_t newhi, uint32_t oi)
+{
+    uint64_t cmp[2] = { env->xregs[rs], rs == 30 ? 0 : env->xregs[rs + 1] };
+    uint64_t newv[2] = { newlo, newhi };
+
+    do_paired_cmpxchg64(env, addr, cmp, newv, oi, GETRA());
+    env->xregs[rs] = cmp[0];
+    if (rs != 30) {
+        env->xregs[rs + 1] = cmp[1];
+    }
+}
+
 #ifdef CONFIG_FLEXUS
 /* Aarch 64 helpers */
 void helper_flexus_insn_fetch_aa64( CPUARMState *env,
 			       target_ulong pc,
 			       uint64_t targ_addr,
-			       int ins_size,
+			       void *desc,
 			       int is_user,
 			       int cond,
 			       int annul ) {
-  helper_flexus_insn_fetch(env, pc, targ_addr, ins_size, is_user, cond, annul);
+  // A64 instructions are all 4 bytes, the descriptor takes the place of
+  // the size in the arguments of the helper
+  flexus_insn_fetch(env, pc, targ_addr, 4, desc, is_user, cond, annul);
 }
 
 void helper_flexus_ld_aa64( CPUARMState *env,
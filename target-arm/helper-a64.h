@@ -1,7 +1,7 @@
 #ifdef CONFIG_FLEXUS
 // specific versions for aarch64
-// env, pc, target address, ins_size, is user, conditional or not, annulation or not (execute delay slot or not)
-DEF_HELPER_7(flexus_insn_fetch_aa64, void, env, tl, i64, int, int, int, int)
+// env, pc, target address, instruction descriptor (or NULL), is user, conditional or not, annulation or not (execute delay slot or not)
+DEF_HELPER_7(flexus_insn_fetch_aa64, void, env, tl, i64, ptr, int, int, int)
 // env, addr, size, is user, pc, is atomic
 DEF_HELPER_6(flexus_ld_aa64, void, env, i64, int, int, tl, int)
 // env, addr, size, is user, pc, is atomic
@@ -56,3 +56,5 @@ DEF_HELPER_FLAGS_2(frecpx_f32, TCG_CALL_NO_RWG, f32, f32, ptr)
 DEF_HELPER_FLAGS_2(fcvtx_f64_to_f32, TCG_CALL_NO_RWG, f32, f64, env)
 DEF_HELPER_FLAGS_3(crc32_64, TCG_CALL_NO_RWG_SE, i64, i64, i64, i32)
 DEF_HELPER_FLAGS_3(crc32c_64, TCG_CALL_NO_RWG_SE, i64, i64, i64, i32)
+DEF_HELPER_FLAGS_5(paired_cmpxchg64, TCG_CALL_NO_WG, i64, env, i64, i64, i64, i32)
+DEF_HELPER_6(casp_64, void, env, i32, i64, i64, i64, i32)
@@ -21,6 +21,9 @@
 #define QEMUFLEX_PROTOTYPES
 #define QEMUFLEX_QEMU_INTERNAL
 #include "libqemuflex/api.h"
+#include "libqemuflex/trace_ring.h"
+#include "libqemuflex/filter.h"
+#include "libqemuflex/bench.h"
 #include "exec/memory.h"
 #include "exec/address-spaces.h"
 #include "exec/cpu_ldst.h"
@@ -546,41 +549,33 @@ static void tlbimvaa_write(CPUARMState *env, const ARMCPRegInfo *ri,
 static void tlbiall_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                              uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush(other_cs, 1);
-    }
+    tlb_flush_all_cpus_synced(cs, 1);
 }
 
 static void tlbiasid_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                              uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush(other_cs, value == 0);
-    }
+    tlb_flush_all_cpus_synced(cs, value == 0);
 }
 
 static void tlbimva_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                              uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush_page(other_cs, value & TARGET_PAGE_MASK);
-    }
+    tlb_flush_page_all_cpus_synced(cs, value & TARGET_PAGE_MASK);
 }
 
 static void tlbimvaa_is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                              uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush_page(other_cs, value & TARGET_PAGE_MASK);
-    }
+    tlb_flush_page_all_cpus_synced(cs, value & TARGET_PAGE_MASK);
 }
 
 #ifdef CONFIG_FLEXUS
@@ -597,6 +592,9 @@ void flexus_cache_op_transaction(CPUARMState *env, target_ulong pc, int is_user,
     ARMCPU *cpu = arm_env_get_cpu(env);
     CPUState *cs = CPU(cpu);
 
+    // keep the cache operation ordered with the batched accesses
+    QEMU_trace_flush(cpu_proc_num(cs));
+
     // In Qemu, PhysicalIO address space and PhysicalMemory address
     // space are combined into one (the cpu address space)
     // Operations on this address space may lead to I/O and Physical Memory
@@ -2958,15 +2956,14 @@ static void tlbi_aa64_vmalle1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                       uint64_t value)
 {
     bool sec = arm_is_secure_below_el3(env);
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
 
-    CPU_FOREACH(other_cs) {
-        if (sec) {
-            tlb_flush_by_mmuidx(other_cs, ARMMMUIdx_S1SE1, ARMMMUIdx_S1SE0, -1);
-        } else {
-            tlb_flush_by_mmuidx(other_cs, ARMMMUIdx_S12NSE1,
-                                ARMMMUIdx_S12NSE0, -1);
-        }
+    if (sec) {
+        tlb_flush_by_mmuidx_all_cpus_synced(cs, ARMMMUIdx_S1SE1,
+                                            ARMMMUIdx_S1SE0, -1);
+    } else {
+        tlb_flush_by_mmuidx_all_cpus_synced(cs, ARMMMUIdx_S12NSE1,
+                                            ARMMMUIdx_S12NSE0, -1);
     }
 }
 
@@ -3019,39 +3016,35 @@ static void tlbi_aa64_alle1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
      */
     bool sec = arm_is_secure_below_el3(env);
     bool has_el2 = arm_feature(env, ARM_FEATURE_EL2);
-    CPUState *other_cs;
-
-    CPU_FOREACH(other_cs) {
-        if (sec) {
-            tlb_flush_by_mmuidx(other_cs, ARMMMUIdx_S1SE1, ARMMMUIdx_S1SE0, -1);
-        } else if (has_el2) {
-            tlb_flush_by_mmuidx(other_cs, ARMMMUIdx_S12NSE1,
-                                ARMMMUIdx_S12NSE0, ARMMMUIdx_S2NS, -1);
-        } else {
-            tlb_flush_by_mmuidx(other_cs, ARMMMUIdx_S12NSE1,
-                                ARMMMUIdx_S12NSE0, -1);
-        }
+    CPUState *cs = CPU(arm_env_get_cpu(env));
+
+    if (sec) {
+        tlb_flush_by_mmuidx_all_cpus_synced(cs, ARMMMUIdx_S1SE1,
+                                            ARMMMUIdx_S1SE0, -1);
+    } else if (has_el2) {
+        tlb_flush_by_mmuidx_all_cpus_synced(cs, ARMMMUIdx_S12NSE1,
+                                            ARMMMUIdx_S12NSE0,
+                                            ARMMMUIdx_S2NS, -1);
+    } else {
+        tlb_flush_by_mmuidx_all_cpus_synced(cs, ARMMMUIdx_S12NSE1,
+                                            ARMMMUIdx_S12NSE0, -1);
     }
 }
 
 static void tlbi_aa64_alle2is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                     uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush_by_mmuidx(other_cs, ARMMMUIdx_S1E2, -1);
-    }
+    tlb_flush_by_mmuidx_all_cpus_synced(cs, ARMMMUIdx_S1E2, -1);
 }
 
 static void tlbi_aa64_alle3is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                     uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush_by_mmuidx(other_cs, ARMMMUIdx_S1E3, -1);
-    }
+    tlb_flush_by_mmuidx_all_cpus_synced(cs, ARMMMUIdx_S1E3, -1);
 }
 
 static void tlbi_aa64_vae1_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -3107,40 +3100,36 @@ static void tlbi_aa64_vae1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                    uint64_t value)
 {
     bool sec = arm_is_secure_below_el3(env);
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
     uint64_t pageaddr = sextract64(value << 12, 0, 56);
 
-    CPU_FOREACH(other_cs) {
-        if (sec) {
-            tlb_flush_page_by_mmuidx(other_cs, pageaddr, ARMMMUIdx_S1SE1,
-                                     ARMMMUIdx_S1SE0, -1);
-        } else {
-            tlb_flush_page_by_mmuidx(other_cs, pageaddr, ARMMMUIdx_S12NSE1,
-                                     ARMMMUIdx_S12NSE0, -1);
-        }
+    if (sec) {
+        tlb_flush_page_by_mmuidx_all_cpus_synced(cs, pageaddr,
+                                                 ARMMMUIdx_S1SE1,
+                                                 ARMMMUIdx_S1SE0, -1);
+    } else {
+        tlb_flush_page_by_mmuidx_all_cpus_synced(cs, pageaddr,
+                                                 ARMMMUIdx_S12NSE1,
+                                                 ARMMMUIdx_S12NSE0, -1);
     }
 }
 
 static void tlbi_aa64_vae2is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                    uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
     uint64_t pageaddr = sextract64(value << 12, 0, 56);
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush_page_by_mmuidx(other_cs, pageaddr, ARMMMUIdx_S1E2, -1);
-    }
+    tlb_flush_page_by_mmuidx_all_cpus_synced(cs, pageaddr, ARMMMUIdx_S1E2, -1);
 }
 
 static void tlbi_aa64_vae3is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                    uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
     uint64_t pageaddr = sextract64(value << 12, 0, 56);
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush_page_by_mmuidx(other_cs, pageaddr, ARMMMUIdx_S1E3, -1);
-    }
+    tlb_flush_page_by_mmuidx_all_cpus_synced(cs, pageaddr, ARMMMUIdx_S1E3, -1);
 }
 
 static void tlbi_aa64_ipas2e1_write(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -3168,7 +3157,7 @@ static void tlbi_aa64_ipas2e1_write(CPUARMState *env, const ARMCPRegInfo *ri,
 static void tlbi_aa64_ipas2e1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
                                       uint64_t value)
 {
-    CPUState *other_cs;
+    CPUState *cs = CPU(arm_env_get_cpu(env));
     uint64_t pageaddr;
 
     if (!arm_feature(env, ARM_FEATURE_EL2) || !(env->cp15.scr_el3 & SCR_NS)) {
@@ -3177,9 +3166,7 @@ static void tlbi_aa64_ipas2e1is_write(CPUARMState *env, const ARMCPRegInfo *ri,
 
     pageaddr = sextract64(value << 12, 0, 48);
 
-    CPU_FOREACH(other_cs) {
-        tlb_flush_page_by_mmuidx(other_cs, pageaddr, ARMMMUIdx_S2NS, -1);
-    }
+    tlb_flush_page_by_mmuidx_all_cpus_synced(cs, pageaddr, ARMMMUIdx_S2NS, -1);
 }
 
 static CPAccessResult aa64_zva_access(CPUARMState *env, const ARMCPRegInfo *ri,
@@ -9583,22 +9570,35 @@ QEMU_ncm ncm_cached;
 /* Generic Flexus helper functions */
 void flexus_insn_fetch_transaction(CPUARMState *env, logical_address_t target_vaddr,
 		 physical_address_t target_phys_address, logical_address_t pc, mem_op_type_t type,
-		 int ins_size, int is_user, int cond, int annul);
+		 int ins_size, const QEMU_insn_desc_t *desc, int is_user, int cond, int annul);
 
 void flexus_insn_fetch_transaction(CPUARMState *env, logical_address_t target_vaddr,
 		 physical_address_t paddr, logical_address_t pc, mem_op_type_t type,
-		 int ins_size, int is_user, int cond, int annul) {
-#if defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_PROP)
-    test_brif_ins++;
-#endif
-
-#if (defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_FETCH)) || !defined(CONFIG_TEST_TIME)
-#if defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_FETCH_TIME)
-  int64_t start_time = clock_get_current_time_us();
-#endif /* CONFIG_TEST_TIME */
-
+		 int ins_size, const QEMU_insn_desc_t *desc, int is_user, int cond, int annul) {
     ARMCPU *cpu = arm_env_get_cpu(env);
     CPUState *cs = CPU(cpu);
+    int cpu_id = cpu_proc_num(cs);
+
+    if( QEMU_trace_is_batched() ) {
+      if( !QEMU_has_callbacks(cpu_id, QEMU_cpu_mem_trans_batch) )
+        return;
+      QEMU_mem_trace_record_t *rec = QEMU_trace_ring_next(cpu_id);
+      rec->pc = pc;
+      rec->logical_address = pc;
+      rec->physical_address = paddr;
+      rec->target_address = target_vaddr;
+      rec->size = ins_size;
+      rec->repeat = 0;
+      rec->type = type;
+      rec->branch_type = cond;
+      rec->flags = (is_user ? QEMU_TRACE_USER : 0)
+                 | (annul ? QEMU_TRACE_ANNUL : 0);
+      rec->insn = desc;
+      return;
+    }
+
+    if( !QEMU_has_callbacks(cpu_id, QEMU_cpu_mem_trans) )
+      return;
 
     // In Qemu, PhysicalIO address space and PhysicalMemory address
     // space are combined into one (the cpu address space)
@@ -9618,40 +9618,48 @@ void flexus_insn_fetch_transaction(CPUARMState *env, logical_address_t target_va
     mem_trans->s.size = ins_size;
     mem_trans->s.branch_type = cond;
     mem_trans->s.annul = annul;
+    mem_trans->s.insn = desc;
+    mem_trans->s.repeat = 0;
     mem_trans->arm_specific.user = is_user;
-    QEMU_callback_args_t * event_data = &event_data_cached;
-    event_data->ncm = &ncm_cached;
-    event_data->ncm->space = space;
-    event_data->ncm->trans = mem_trans;
-
-    QEMU_execute_callbacks(cpu_proc_num(cs) , QEMU_cpu_mem_trans, event_data);
 
-#if defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_FETCH_TIME)
-    int64_t end_time = clock_get_current_time_us();
-    test_cumulative_brif_time += (end_time - start_time);
-#endif /* CONFIG_TEST_TIME */
-#endif
+    QEMU_execute_mem_trans_callbacks(cpu_id, space, mem_trans);
 }
 
 void flexus_transaction(CPUARMState *env, logical_address_t vaddr, 
 		 physical_address_t paddr, logical_address_t pc, mem_op_type_t type, int size,
-			int is_user, int atomic, int asi, int prefetch_fcn, int io, uint8_t cache_bits);
+			int is_user, int atomic, int asi, int prefetch_fcn, int io, uint8_t cache_bits,
+			uint32_t repeat);
 
 void flexus_transaction(CPUARMState *env, logical_address_t vaddr, 
 		 physical_address_t paddr, logical_address_t pc, mem_op_type_t type, int size,
-			int is_user, int atomic, int asi, int prefetch_fcn, int io, uint8_t cache_bits)
+			int is_user, int atomic, int asi, int prefetch_fcn, int io, uint8_t cache_bits,
+			uint32_t repeat)
 {
-#if defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_PROP)
-  test_ls_ins++;
-#endif
-
-#if (defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_LS)) || !defined(CONFIG_TEST_TIME)
-#if defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_LS_TIME)
-    int64_t start_time = clock_get_current_time_us();
-#endif /* CONFIG_TEST_TIME */
-
     ARMCPU *cpu = arm_env_get_cpu(env);
     CPUState *cs = CPU(cpu);
+    int cpu_id = cpu_proc_num(cs);
+
+    if( QEMU_trace_is_batched() ) {
+      if( !QEMU_has_callbacks(cpu_id, QEMU_cpu_mem_trans_batch) )
+        return;
+      QEMU_mem_trace_record_t *rec = QEMU_trace_ring_next(cpu_id);
+      rec->pc = pc;
+      rec->logical_address = vaddr;
+      rec->physical_address = paddr;
+      rec->target_address = vaddr;
+      rec->size = size;
+      rec->repeat = repeat;
+      rec->type = type;
+      rec->branch_type = QEMU_Non_Branch;
+      rec->flags = (is_user ? QEMU_TRACE_USER : 0)
+                 | (io ? QEMU_TRACE_IO : 0)
+                 | (atomic ? QEMU_TRACE_ATOMIC : 0);
+      rec->insn = NULL;
+      return;
+    }
+
+    if( !QEMU_has_callbacks(cpu_id, QEMU_cpu_mem_trans) )
+      return;
 
     // In Qemu, PhysicalIO address space and PhysicalMemory address
     // space are combined into one (the cpu address space)
@@ -9668,6 +9676,8 @@ void flexus_transaction(CPUARMState *env, logical_address_t vaddr,
     mem_trans->s.type = type;
     mem_trans->s.size = size;
     mem_trans->s.atomic = atomic;
+    mem_trans->s.insn = NULL;
+    mem_trans->s.repeat = repeat;
     // TODO what to do here?
     /*
     // Cache_Bits: Cache Physical Bit 0
@@ -9685,18 +9695,8 @@ void flexus_transaction(CPUARMState *env, logical_address_t vaddr,
 */
     mem_trans->arm_specific.user = is_user;
     mem_trans->io = io;
-    QEMU_callback_args_t * event_data = &event_data_cached;
-    event_data->ncm = &ncm_cached;
-    event_data->ncm->space = space;
-    event_data->ncm->trans = mem_trans;
-
-    QEMU_execute_callbacks(cpu_proc_num(cs) , QEMU_cpu_mem_trans, event_data);
 
-#if defined(CONFIG_TEST_TIME) && defined(CONFIG_TEST_LS_TIME)
-    int64_t end_time = clock_get_current_time_us();
-    test_cumulative_ls_time += (end_time - start_time);
-#endif /* CONFIG_TEST_TIME */
-#endif
+    QEMU_execute_mem_trans_callbacks(cpu_id, space, mem_trans);
 }
 
 void helper_flexus_magic_ins(int v){
@@ -9779,19 +9779,7 @@ uint64_t cpu_get_program_counter(void *cs_) {
 }
 
 physical_address_t mmu_logical_to_physical(void *cs_, logical_address_t va) {
-  CPUState *cs = (CPUState*)cs_;
-  physical_address_t pa = cpu_get_phys_page_debug(cs, (va & TARGET_PAGE_MASK));
-
-  if( pa != - 1 ) {
-    // assuming phys address and logical address are the right size
-    // this gets the page then we need to do get the place in the page using va
-    // logical_address_t mask = 0x0000000000000FFF; 
-    // The offset  seems to be 12bits for 32bit or 64bit addresses
-    pa = pa + (va & ~TARGET_PAGE_MASK);
-    return pa;
-  } else {
-    return -1;
-  }
+  return tlb_vaddr_to_paddr((CPUState*)cs_, va);
 }
 
 void *cpu_get_address_space_flexus(void *cs_) {
@@ -9820,15 +9808,62 @@ void cpu_read_register( void *env_ptr, int reg_index, unsigned *reg_size, void *
     printf("WARNING: No register found, doing nothing\n");
 }
 
+int cpu_read_arch_state(void *cs_, QEMU_arch_state_t *state) {
+  CPUState *cs = (CPUState*)cs_;
+  CPUARMState *env = &ARM_CPU(cs)->env;
+  uint64_t *sysregs = state->sysregs;
+  int i = 0;
+
+  if( is_a64(env) ) {
+    for( ; i < 31; i++ )
+      state->x[i] = env->xregs[i];
+    state->sp = env->xregs[31];
+    state->pc = env->pc;
+    state->pstate = pstate_read(env);
+  } else {
+    for( ; i < 16; i++ )
+      state->x[i] = env->regs[i];
+    for( ; i < 31; i++ )
+      state->x[i] = 0;
+    state->sp = env->regs[13];
+    state->pc = env->regs[15];
+    state->pstate = cpsr_read(env);
+  }
+  state->aarch64 = env->aarch64;
+  state->el = arm_current_el(env);
+  state->fpcr = vfp_get_fpcr(env);
+  state->fpsr = vfp_get_fpsr(env);
+  state->pad = 0;
+  memcpy(state->v, env->vfp.regs, sizeof(state->v));
+
+  sysregs[QEMU_ARCH_SCTLR_EL1] = env->cp15.sctlr_el[1];
+  sysregs[QEMU_ARCH_TTBR0_EL1] = env->cp15.ttbr0_el[1];
+  sysregs[QEMU_ARCH_TTBR1_EL1] = env->cp15.ttbr1_el[1];
+  sysregs[QEMU_ARCH_TCR_EL1] = env->cp15.tcr_el[1].raw_tcr;
+  sysregs[QEMU_ARCH_MAIR_EL1] = env->cp15.mair_el[1];
+  sysregs[QEMU_ARCH_VBAR_EL1] = env->cp15.vbar_el[1];
+  sysregs[QEMU_ARCH_CONTEXTIDR_EL1] = env->cp15.contextidr_el[1];
+  sysregs[QEMU_ARCH_CPACR_EL1] = env->cp15.cpacr_el1;
+  sysregs[QEMU_ARCH_ELR_EL1] = env->elr_el[1];
+  sysregs[QEMU_ARCH_SPSR_EL1] = env->banked_spsr[aarch64_banked_spsr_index(1)];
+  sysregs[QEMU_ARCH_ESR_EL1] = env->cp15.esr_el[1];
+  sysregs[QEMU_ARCH_FAR_EL1] = env->cp15.far_el[1];
+  sysregs[QEMU_ARCH_TPIDR_EL0] = env->cp15.tpidr_el[0];
+  sysregs[QEMU_ARCH_TPIDRRO_EL0] = env->cp15.tpidrro_el[0];
+  sysregs[QEMU_ARCH_TPIDR_EL1] = env->cp15.tpidr_el[1];
+  return 0;
+}
+
 /* ARM specific helpers */
 // TODO FLEXUS: check if we must use addr_read or addr_code
-void helper_flexus_insn_fetch( CPUARMState *env,
-			       target_ulong pc,
-			       target_ulong targ_addr,
-			       int ins_size,
-			       int is_user,
-			       int cond,
-			       int annul ) {
+void flexus_insn_fetch( CPUARMState *env,
+			target_ulong pc,
+			target_ulong targ_addr,
+			int ins_size,
+			const QEMU_insn_desc_t *desc,
+			int is_user,
+			int cond,
+			int annul ) {
   ARMCPU *arm_cpu = arm_env_get_cpu(env);
   CPUState *cpu = CPU(arm_cpu);
   
@@ -9854,47 +9889,70 @@ void helper_flexus_insn_fetch( CPUARMState *env,
 		TARGET_FMT_lx "\n", targ_addr);
     }
   }
-  physical_address_t phys_address = (physical_address_t)((uintptr_t)targ_addr + env->tlb_table[mmu_idx][page_index].addend);
+  physical_address_t phys_address = env->iotlb[mmu_idx][page_index].paddr
+                                    + (targ_addr & ~TARGET_PAGE_MASK);
+
+  if( !QEMU_filter_access(targ_addr, phys_address, 0) )
+    return;
+  QEMU_BENCH_TIME(QEMU_BENCH_EVENT_FETCH,
+                  flexus_insn_fetch_transaction(env, targ_addr, phys_address, pc,
+                                                QEMU_Trans_Instr_Fetch, ins_size,
+                                                desc, is_user, cond, annul));
+}
 
-  flexus_insn_fetch_transaction(env, targ_addr, phys_address, pc, QEMU_Trans_Instr_Fetch,
-		     ins_size, is_user, cond, annul);
+void helper_flexus_insn_fetch( CPUARMState *env,
+			       target_ulong pc,
+			       target_ulong targ_addr,
+			       int ins_size,
+			       int is_user,
+			       int cond,
+			       int annul ) {
+  flexus_insn_fetch(env, pc, targ_addr, ins_size, NULL, is_user, cond, annul);
 }
 			       
+// Physical address and kind of the access to addr that the instrumented
+// TB just made, as recorded by the softmmu helpers. The recorded access
+// can be another part of the same instruction (e.g. the other half of a
+// 128-bit access), so only its page is used.
+static physical_address_t flexus_access_paddr(CPUARMState *env,
+                                              target_ulong addr, int *io) {
+  CPUFlexusAccess *access = &env->flexus_access;
+
+  if( ((addr ^ access->vaddr) & TARGET_PAGE_MASK) != 0 ) {
+    // the parts are on different pages
+    *io = 0;
+    return mmu_logical_to_physical(ENV_GET_CPU(env), addr);
+  }
+  *io = access->io;
+  return (access->paddr & TARGET_PAGE_MASK) | (addr & ~TARGET_PAGE_MASK);
+}
+
 void helper_flexus_ld( CPUARMState *env,
 		       target_ulong addr,
 		       int size,
 		       int is_user,
 		       target_ulong pc,
 		       int is_atomic ) {
-  int mmu_idx = cpu_mmu_index(env , false );                                                // Flexus Change made since function definition has changed
-  int index = ( (target_ulong)addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-  target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_read;
-
-  if ((addr & TARGET_PAGE_MASK)
-        != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
-    // Given that a previous load instruction happened, we are sure that
-    // that the TLB entry is still in the CPU TLB, if not then the previous
-    // instruction caused an error, so we just return with no tlb_fill() call
-    return;
-  }
+  int io;
 
-  int io = 0;
-  if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
-    // I/O space
-    io = 1;
-  }        
-  // Otherwise, RAM/ROM , physical memory space, io = 0
+  physical_address_t phys_address = flexus_access_paddr(env, addr, &io);
 
-  target_ulong phys_address;
-  // Getting page physical address
-  phys_address = env->tlb_table[mmu_idx][index].paddr;
-  // Resolving physical address by adding offset inside the page
-  phys_address += addr & ~TARGET_PAGE_MASK;
+  if( !QEMU_filter_access(addr, phys_address, io) )
+    return;
+  QEMU_coalesce_flush_t flush;
+  if( QEMU_filter_coalesce(cpu_proc_num(CPU(arm_env_get_cpu(env))),
+                           addr, phys_address, size, 0, io, &flush) )
+    return;
 
   int asi = 0;
   // Here, prefetch_fcn is just a dummy argument since type is not prefetch
-  flexus_transaction(env, addr, phys_address, pc, QEMU_Trans_Load,
-		     size, is_user, is_atomic, asi, 0, io, 0);
+  if( flush.folded != 0 )
+    QEMU_BENCH_TIME(QEMU_BENCH_EVENT_LS,
+                    flexus_transaction(env, flush.vline, flush.line, pc, QEMU_Trans_Load,
+                                       0, is_user, 0, asi, 0, 0, 0, flush.folded));
+  QEMU_BENCH_TIME(QEMU_BENCH_EVENT_LS,
+                  flexus_transaction(env, addr, phys_address, pc, QEMU_Trans_Load,
+                                     size, is_user, is_atomic, asi, 0, io, 0, 0));
 }
 
 void helper_flexus_st(
@@ -9905,35 +9963,70 @@ void helper_flexus_st(
 		      target_ulong pc,
 		      int is_atomic)
 {  
-  int mmu_idx = cpu_mmu_index(env , false );                                                     // Flexus Change made since function definition has changed
-  int index = ( (target_ulong)addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-  target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
-
-  if ((addr & TARGET_PAGE_MASK)
-        != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
-    // Given that a previous load instruction happened, we are sure that
-    // that the TLB entry is still in the CPU TLB, if not then the previous
-    // instruction caused an error, so we just return with no tlb_fill() call
-    return;
-  }
+  int io;
 
-  int io = 0;
-  if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
-    // I/O space
-    io = 1;
-  }        
-  // Otherwise, RAM/ROM , physical memory space, io = 0
+  physical_address_t phys_address = flexus_access_paddr(env, addr, &io);
 
-  target_ulong phys_address;
-  // Getting page physical address
-  phys_address = env->tlb_table[mmu_idx][index].paddr;
-  // Resolving physical address by adding offset inside the page
-  phys_address += addr & ~TARGET_PAGE_MASK;
+  if( !QEMU_filter_access(addr, phys_address, io) )
+    return;
+  QEMU_coalesce_flush_t flush;
+  if( QEMU_filter_coalesce(cpu_proc_num(CPU(arm_env_get_cpu(env))),
+                           addr, phys_address, size, 1, io, &flush) )
+    return;
 
   int asi = 0;
   // Here, prefetch_fcn is just a dummy argument since type is not prefetch
-  flexus_transaction(env, addr, phys_address, pc, QEMU_Trans_Store,
-		     size, is_user, is_atomic, asi, 0, io, 0);
+  if( flush.folded != 0 )
+    QEMU_BENCH_TIME(QEMU_BENCH_EVENT_LS,
+                    flexus_transaction(env, flush.vline, flush.line, pc, QEMU_Trans_Store,
+                                       0, is_user, 0, asi, 0, 0, 0, flush.folded));
+  QEMU_BENCH_TIME(QEMU_BENCH_EVENT_LS,
+                  flexus_transaction(env, addr, phys_address, pc, QEMU_Trans_Store,
+                                     size, is_user, is_atomic, asi, 0, io, 0, 0));
+}
+
+// Guest loads and stores of instrumented TBs, made through the softmmu
+// helpers rather than the inline TLB lookup so that every access records
+// its physical address in env->flexus_access. oi is the TCGMemOpIdx.
+uint64_t helper_flexus_qemu_ld(CPUARMState *env, target_ulong addr, uint32_t oi) {
+  uintptr_t ra = GETRA();
+  TCGMemOp memop = get_memop(oi);
+
+  if( (memop & MO_SIZE) == MO_8 )
+    memop &= ~MO_BSWAP;
+  switch( memop & (MO_BSWAP | MO_SSIZE) ) {
+  case MO_UB:   return helper_ret_ldub_mmu(env, addr, oi, ra);
+  case MO_SB:   return (int8_t)helper_ret_ldub_mmu(env, addr, oi, ra);
+  case MO_LEUW: return helper_le_lduw_mmu(env, addr, oi, ra);
+  case MO_LESW: return (int16_t)helper_le_lduw_mmu(env, addr, oi, ra);
+  case MO_LEUL: return helper_le_ldul_mmu(env, addr, oi, ra);
+  case MO_LESL: return (int32_t)helper_le_ldul_mmu(env, addr, oi, ra);
+  case MO_BEUW: return helper_be_lduw_mmu(env, addr, oi, ra);
+  case MO_BESW: return (int16_t)helper_be_lduw_mmu(env, addr, oi, ra);
+  case MO_BEUL: return helper_be_ldul_mmu(env, addr, oi, ra);
+  case MO_BESL: return (int32_t)helper_be_ldul_mmu(env, addr, oi, ra);
+  default:
+    if( (memop & MO_BSWAP) == MO_LE )
+      return helper_le_ldq_mmu(env, addr, oi, ra);
+    return helper_be_ldq_mmu(env, addr, oi, ra);
+  }
+}
+
+void helper_flexus_qemu_st(CPUARMState *env, target_ulong addr, uint64_t val, uint32_t oi) {
+  uintptr_t ra = GETRA();
+  TCGMemOp memop = get_memop(oi);
+
+  if( (memop & MO_SIZE) == MO_8 )
+    memop &= ~MO_BSWAP;
+  switch( memop & (MO_BSWAP | MO_SIZE) ) {
+  case MO_UB:   helper_ret_stb_mmu(env, addr, val, oi, ra); break;
+  case MO_LEUW: helper_le_stw_mmu(env, addr, val, oi, ra); break;
+  case MO_LEUL: helper_le_stl_mmu(env, addr, val, oi, ra); break;
+  case MO_LEQ:  helper_le_stq_mmu(env, addr, val, oi, ra); break;
+  case MO_BEUW: helper_be_stw_mmu(env, addr, val, oi, ra); break;
+  case MO_BEUL: helper_be_stl_mmu(env, addr, val, oi, ra); break;
+  default:      helper_be_stq_mmu(env, addr, val, oi, ra); break;
+  }
 }
 
 /* Aarch 32 helpers */
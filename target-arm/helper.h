@@ -9,6 +9,10 @@ DEF_HELPER_7(flexus_insn_fetch, void, env, tl, tl, int, int, int, int)
 DEF_HELPER_6(flexus_ld, void, env, tl, int, int, tl, int)
 // env, addr, size, is user, pc, is atomic
 DEF_HELPER_6(flexus_st, void, env, tl, int, int, tl, int)
+// env, addr, memop index: guest load of an instrumented TB
+DEF_HELPER_3(flexus_qemu_ld, i64, env, tl, i32)
+// env, addr, value, memop index: guest store of an instrumented TB
+DEF_HELPER_4(flexus_qemu_st, void, env, tl, i64, i32)
 // specific versions for aarch32
 // env, pc, target address, ins_size, is user, conditional or not, annulation or not (execute delay slot or not)
 DEF_HELPER_7(flexus_insn_fetch_aa32, void, env, tl, i32, int, int, int, int)
@@ -91,6 +95,8 @@ DEF_HELPER_2(get_cp_reg, i32, env, ptr)
 DEF_HELPER_3(set_cp_reg64, void, env, ptr, i64)
 DEF_HELPER_2(get_cp_reg64, i64, env, ptr)
 
+DEF_HELPER_FLAGS_0(memory_barrier, TCG_CALL_NO_RWG, void)
+
 DEF_HELPER_3(msr_i_pstate, void, env, i32, i32)
 DEF_HELPER_1(clear_pstate_ss, void, env)
 DEF_HELPER_1(exception_return, void, env)
@@ -21,6 +21,7 @@
 #include "exec/helper-proto.h"
 #include "internals.h"
 #include "exec/cpu_ldst.h"
+#include "qemu/main-loop.h"
 
 #define SIGNBIT (uint32_t)0x80000000
 #define SIGNBIT64 ((uint64_t)1 << 63)
@@ -677,32 +678,70 @@ void HELPER(access_check_cp_reg)(CPUARMState *env, void *rip, uint32_t syndrome,
     raise_exception(env, EXCP_UDEF, syndrome, target_el);
 }
 
+/* With -tcg-threads multi the vCPUs run without the iothread lock, take
+ * it around the registers that reach into devices (timers, GIC).
+ */
+static bool cp_reg_lock_iothread(const ARMCPRegInfo *ri)
+{
+    if (qemu_tcg_mttcg_enabled() && (ri->type & ARM_CP_IO)
+        && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
 void HELPER(set_cp_reg)(CPUARMState *env, void *rip, uint32_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
 
     ri->writefn(env, ri, value);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 uint32_t HELPER(get_cp_reg)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
+    uint32_t res;
 
-    return ri->readfn(env, ri);
+    res = ri->readfn(env, ri);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return res;
 }
 
 void HELPER(set_cp_reg64)(CPUARMState *env, void *rip, uint64_t value)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
 
     ri->writefn(env, ri, value);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 uint64_t HELPER(get_cp_reg64)(CPUARMState *env, void *rip)
 {
     const ARMCPRegInfo *ri = rip;
+    bool locked = cp_reg_lock_iothread(ri);
+    uint64_t res;
+
+    res = ri->readfn(env, ri);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+    return res;
+}
 
-    return ri->readfn(env, ri);
+void HELPER(memory_barrier)(void)
+{
+    smp_mb();
 }
 
 void HELPER(msr_i_pstate)(CPUARMState *env, uint32_t op, uint32_t imm)
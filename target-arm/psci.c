@@ -211,6 +211,10 @@ void arm_handle_psci_call(ARMCPU *cpu)
             target_cpu->env.thumb = entry & 1;
         }
         target_cpu_class->set_pc(target_cpu_state, entry);
+        /* With -tcg-threads multi the thread of the target cpu sleeps
+         * until it is woken up.
+         */
+        qemu_cpu_kick(target_cpu_state);
 
         ret = 0;
         break;
@@ -36,22 +36,36 @@
 
 #include "trace-tcg.h"
 
-extern sig_atomic_t quantum_value;
-
 #ifdef CONFIG_FLEXUS
 #define QEMUFLEX_PROTOTYPES
 #define QEMUFLEX_QEMU_INTERNAL
 #include "../libqemuflex/api.h"
+#include "../libqemuflex/insn_desc.h"
 static target_ulong flexus_ins_pc = -1;
+// descriptor of the instruction at flexus_ins_pc, passed to its fetches
+static QEMU_insn_desc_t *flexus_ins_desc = NULL;
+// set from the TB flags: only emit the helpers in instrumented TBs,
+// the fetches and memory accesses may be left out by the filter or by
+// the flexus-bench mode
+static int flexus_tb_simulating = 0;
+static int flexus_tb_fetch = 0;
+static int flexus_tb_ls = 0;
+
+#define FLEXUS_IF_FETCH( a ) do {		\
+  if( flexus_tb_fetch ) {			\
+    (a) ;					\
+  }						\
+} while(0)
 
-#define FLEXUS_IF_IN_SIMULATION( a ) do {	\
-  if( QEMU_is_in_simulation() != 0 ) {		\
+#define FLEXUS_IF_LS( a ) do {			\
+  if( flexus_tb_ls ) {				\
     (a) ;					\
   }						\
 } while(0)
 
 #else
-#define FLEXUS_IF_IN_SIMULATION( a )
+#define FLEXUS_IF_FETCH( a )
+#define FLEXUS_IF_LS( a )
 #endif /* CONFIG_FLEXUS */
 
 #if defined(CONFIG_USER_ONLY)
@@ -63,9 +77,6 @@ static target_ulong flexus_ins_pc = -1;
 static TCGv_i64 cpu_X[32];
 static TCGv_i64 cpu_pc;
 
-/* Load/store exclusive handling */
-static TCGv_i64 cpu_exclusive_high;
-
 static const char *regnames[] = {
     "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7",
     "x8", "x9", "x10", "x11", "x12", "x13", "x14", "x15",
@@ -119,9 +130,6 @@ void a64_translate_init(void)
                                           offsetof(CPUARMState, xregs[i]),
                                           regnames[i]);
     }
-
-    cpu_exclusive_high = tcg_global_mem_new_i64(cpu_env,
-        offsetof(CPUARMState, exclusive_high), "exclusive_high");
 }
 
 static inline ARMMMUIdx get_a64_user_mem_index(DisasContext *s)
@@ -748,9 +756,9 @@ static void do_gpr_st_memidx(DisasContext *s, TCGv_i64 source,
                              TCGv_i64 tcg_addr, int size, int memidx)
 {
     g_assert(size <= 3);
-    tcg_gen_qemu_st_i64(source, tcg_addr, memidx, s->be_data + size);
+    arm_gen_qemu_st_i64(s, source, tcg_addr, memidx, s->be_data + size);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_st_aa64(cpu_env,
 			      tcg_addr, tcg_const_i32( 1 << size /* size */ ),
 			      tcg_const_i32(IS_USER(s)),
 						       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -777,9 +785,9 @@ static void do_gpr_ld_memidx(DisasContext *s, TCGv_i64 dest, TCGv_i64 tcg_addr,
         memop += MO_SIGN;
     }
 
-    tcg_gen_qemu_ld_i64(dest, tcg_addr, memidx, memop);
+    arm_gen_qemu_ld_i64(s, dest, tcg_addr, memidx, memop);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_ld_aa64(cpu_env,
 			      tcg_addr, tcg_const_i32( 1 << size /* size */ ),
 			      tcg_const_i32(IS_USER(s)),
 						       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -807,22 +815,22 @@ static void do_fp_st(DisasContext *s, int srcidx, TCGv_i64 tcg_addr, int size)
     TCGv_i64 tmp = tcg_temp_new_i64();
     tcg_gen_ld_i64(tmp, cpu_env, fp_reg_offset(s, srcidx, MO_64));
     if (size < 4) {
-        tcg_gen_qemu_st_i64(tmp, tcg_addr, get_mem_index(s),
+        arm_gen_qemu_st_i64(s, tmp, tcg_addr, get_mem_index(s),
                             s->be_data + size);
     } else {
         bool be = s->be_data == MO_BE;
         TCGv_i64 tcg_hiaddr = tcg_temp_new_i64();
 
         tcg_gen_addi_i64(tcg_hiaddr, tcg_addr, 8);
-        tcg_gen_qemu_st_i64(tmp, be ? tcg_hiaddr : tcg_addr, get_mem_index(s),
-                            s->be_data | MO_Q);
+        arm_gen_qemu_st_i64(s, tmp, be ? tcg_hiaddr : tcg_addr,
+                            get_mem_index(s), s->be_data | MO_Q);
         tcg_gen_ld_i64(tmp, cpu_env, fp_reg_hi_offset(s, srcidx));
-        tcg_gen_qemu_st_i64(tmp, be ? tcg_addr : tcg_hiaddr, get_mem_index(s),
-                            s->be_data | MO_Q);
+        arm_gen_qemu_st_i64(s, tmp, be ? tcg_addr : tcg_hiaddr,
+                            get_mem_index(s), s->be_data | MO_Q);
         tcg_temp_free_i64(tcg_hiaddr);
     }
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_st_aa64(cpu_env,
 			      tcg_addr, tcg_const_i32( 1 << size /* size */ ),
 			      tcg_const_i32(IS_USER(s)),
 						       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -842,7 +850,7 @@ static void do_fp_ld(DisasContext *s, int destidx, TCGv_i64 tcg_addr, int size)
     if (size < 4) {
         TCGMemOp memop = s->be_data + size;
         tmphi = tcg_const_i64(0);
-        tcg_gen_qemu_ld_i64(tmplo, tcg_addr, get_mem_index(s), memop);
+        arm_gen_qemu_ld_i64(s, tmplo, tcg_addr, get_mem_index(s), memop);
     } else {
         bool be = s->be_data == MO_BE;
         TCGv_i64 tcg_hiaddr;
@@ -851,14 +859,14 @@ static void do_fp_ld(DisasContext *s, int destidx, TCGv_i64 tcg_addr, int size)
         tcg_hiaddr = tcg_temp_new_i64();
 
         tcg_gen_addi_i64(tcg_hiaddr, tcg_addr, 8);
-        tcg_gen_qemu_ld_i64(tmplo, be ? tcg_hiaddr : tcg_addr, get_mem_index(s),
-                            s->be_data | MO_Q);
-        tcg_gen_qemu_ld_i64(tmphi, be ? tcg_addr : tcg_hiaddr, get_mem_index(s),
-                            s->be_data | MO_Q);
+        arm_gen_qemu_ld_i64(s, tmplo, be ? tcg_hiaddr : tcg_addr,
+                            get_mem_index(s), s->be_data | MO_Q);
+        arm_gen_qemu_ld_i64(s, tmphi, be ? tcg_addr : tcg_hiaddr,
+                            get_mem_index(s), s->be_data | MO_Q);
         tcg_temp_free_i64(tcg_hiaddr);
     }
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_ld_aa64(cpu_env,
 			      tcg_addr, tcg_const_i32( 1 << size /* size */ ),
 			      tcg_const_i32(IS_USER(s)),
 						       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1002,9 +1010,9 @@ static void do_vec_st(DisasContext *s, int srcidx, int element,
     TCGv_i64 tcg_tmp = tcg_temp_new_i64();
 
     read_vec_element(s, tcg_tmp, srcidx, element, size);
-    tcg_gen_qemu_st_i64(tcg_tmp, tcg_addr, get_mem_index(s), memop);
+    arm_gen_qemu_st_i64(s, tcg_tmp, tcg_addr, get_mem_index(s), memop);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_st_aa64(cpu_env,
 			      tcg_addr, tcg_const_i32( 1 << size /* size */ ),
 			      tcg_const_i32(IS_USER(s)),
 						       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1020,9 +1028,9 @@ static void do_vec_ld(DisasContext *s, int destidx, int element,
     TCGMemOp memop = s->be_data + size;
     TCGv_i64 tcg_tmp = tcg_temp_new_i64();
 
-    tcg_gen_qemu_ld_i64(tcg_tmp, tcg_addr, get_mem_index(s), memop);
+    arm_gen_qemu_ld_i64(s, tcg_tmp, tcg_addr, get_mem_index(s), memop);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_ld_aa64(cpu_env,
 			      tcg_addr, tcg_const_i32( 1 << size /* size */ ),
 			      tcg_const_i32(IS_USER(s)),
 						       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1159,10 +1167,10 @@ static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
         /* C5.6.26 BL Branch with link */
         tcg_gen_movi_i64(cpu_reg(s, 30), s->pc);
 #ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      tcg_const_i64(addr),
-                                      tcg_const_i32(4),
+                                      tcg_const_ptr(flexus_ins_desc),
 				      tcg_const_i32(IS_USER(s)),
 				      tcg_const_i32(QEMU_Call_Branch),
 								    tcg_const_i32(1) ) );
@@ -1170,10 +1178,10 @@ static void disas_uncond_b_imm(DisasContext *s, uint32_t insn)
     }
 #ifdef CONFIG_FLEXUS
     else {
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      tcg_const_i64(addr),
-				      tcg_const_i32(4),
+				      tcg_const_ptr(flexus_ins_desc),
 				      tcg_const_i32(IS_USER(s)),
 				      tcg_const_i32(QEMU_Call_Branch),
 								    tcg_const_i32(1) ) );
@@ -1211,10 +1219,10 @@ static void disas_comp_b_imm(DisasContext *s, uint32_t insn)
     gen_goto_tb(s, 0, s->pc);
     gen_set_label(label_match);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+    FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				       tcg_const_tl(flexus_ins_pc),
 				       tcg_const_i64(addr),
-                                       tcg_const_i32(4),
+                                       tcg_const_ptr(flexus_ins_desc),
 				       tcg_const_i32(IS_USER(s)),
 				       tcg_const_i32(QEMU_Conditional_Branch),
 								tcg_const_i32(1) ) );
@@ -1249,10 +1257,10 @@ static void disas_test_b_imm(DisasContext *s, uint32_t insn)
     gen_goto_tb(s, 0, s->pc);
     gen_set_label(label_match);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+    FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				       tcg_const_tl(flexus_ins_pc),
 				       tcg_const_i64(addr),
-                                       tcg_const_i32(4),
+                                       tcg_const_ptr(flexus_ins_desc),
 				       tcg_const_i32(IS_USER(s)),
 				       tcg_const_i32(QEMU_Conditional_Branch),
 								tcg_const_i32(1) ) );
@@ -1285,10 +1293,10 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
         gen_goto_tb(s, 0, s->pc);
         gen_set_label(label_match);
 #ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				           tcg_const_tl(flexus_ins_pc),
 				           tcg_const_i64(addr),
-					   tcg_const_i32(4),
+					   tcg_const_ptr(flexus_ins_desc),
 				           tcg_const_i32(IS_USER(s)),
 				           tcg_const_i32(QEMU_Conditional_Branch),
 								    tcg_const_i32(1) ) );
@@ -1297,10 +1305,10 @@ static void disas_cond_b_imm(DisasContext *s, uint32_t insn)
     } else {
         /* 0xe and 0xf are both "always" conditions */
 #ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				           tcg_const_tl(flexus_ins_pc),
 				           tcg_const_i64(addr),
-	                                   tcg_const_i32(4),
+	                                   tcg_const_ptr(flexus_ins_desc),
 				           tcg_const_i32(IS_USER(s)),
 				           tcg_const_i32(QEMU_Unconditional_Branch),
 								    tcg_const_i32(1) ) );
@@ -1347,6 +1355,14 @@ static void gen_clrex(DisasContext *s, uint32_t insn)
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
 }
 
+/* The accesses only need ordering when other vCPUs run at the same time */
+static void gen_mb(void)
+{
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_helper_memory_barrier();
+    }
+}
+
 /* CLREX, DSB, DMB, ISB */
 static void handle_sync(DisasContext *s, uint32_t insn,
                         unsigned int op1, unsigned int op2, unsigned int crm)
@@ -1362,7 +1378,8 @@ static void handle_sync(DisasContext *s, uint32_t insn,
         return;
     case 4: /* DSB */
     case 5: /* DMB */
-        /* We don't emulate caches so barriers are no-ops */
+        /* We don't emulate caches, only the ordering of the accesses */
+        gen_mb();
         return;
     case 6: /* ISB */
         /* We need to break the TB after this insn to execute
@@ -1749,10 +1766,10 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
     switch (opc) {
     case 0: /* BR */
 #ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				           tcg_const_tl(flexus_ins_pc),
 				           cpu_reg(s, rn),
-					   tcg_const_i32(4),
+					   tcg_const_ptr(flexus_ins_desc),
 				           tcg_const_i32(IS_USER(s)),
 				           tcg_const_i32(QEMU_Unconditional_Branch),
 								    tcg_const_i32(1) ) );
@@ -1761,10 +1778,10 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
         break;
     case 2: /* RET */
 #ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				           tcg_const_tl(flexus_ins_pc),
 				           cpu_reg(s, rn),
-	                                   tcg_const_i32(4),
+	                                   tcg_const_ptr(flexus_ins_desc),
 				           tcg_const_i32(IS_USER(s)),
 				           tcg_const_i32(QEMU_Return_Branch),
 								    tcg_const_i32(1) ) );
@@ -1774,10 +1791,10 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
     case 1: /* BLR */
         tcg_gen_mov_i64(cpu_pc, cpu_reg(s, rn));
 #ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				           tcg_const_tl(flexus_ins_pc),
 				           cpu_reg(s, rn),
-					   tcg_const_i32(4),
+					   tcg_const_ptr(flexus_ins_desc),
 				           tcg_const_i32(IS_USER(s)),
 				           tcg_const_i32(QEMU_Call_Branch),
 								    tcg_const_i32(1) ) );
@@ -1847,63 +1864,106 @@ static void disas_b_exc_sys(DisasContext *s, uint32_t insn)
  * mandated semantics, but it works for typical guest code sequences
  * and avoids having to monitor regular stores.
  *
- * In system emulation mode only one CPU will be running at once, so
- * this sequence is effectively atomic.  In user emulation mode we
- * throw an exception and handle the atomic operation elsewhere.
+ * The comparison and the store are one compare-and-swap, atomic on the
+ * host whenever other vCPUs or guest threads run at the same time.
  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i64 addr, int size, bool is_pair)
 {
     TCGv_i64 tmp = tcg_temp_new_i64();
-    TCGMemOp memop = s->be_data + size;
+    TCGMemOp memop = s->be_data + size + MO_ALIGN;
 
     g_assert(size <= 3);
-    tcg_gen_qemu_ld_i64(tmp, addr, get_mem_index(s), memop);
+    if (is_pair && size == 2) {
+        /* the store-exclusive compares the two words at once */
+        memop = s->be_data + MO_64 + MO_ALIGN;
+    }
+    arm_gen_qemu_ld_i64(s, tmp, addr, get_mem_index(s), memop);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_ld_aa64(cpu_env,
 			 addr, tcg_const_i32( 1 << size /* size */ ),
 			 tcg_const_i32(IS_USER(s)),
 			 tcg_const_tl(flexus_ins_pc),
 						       tcg_const_i32(1)) );
-#endif
-
     if (is_pair) {
-        TCGv_i64 addr2 = tcg_temp_new_i64();
-        TCGv_i64 hitmp = tcg_temp_new_i64();
-
-        g_assert(size >= 2);
-        tcg_gen_addi_i64(addr2, addr, 1 << size);
-        tcg_gen_qemu_ld_i64(hitmp, addr2, get_mem_index(s), memop);
-#ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa64(cpu_env,
+        FLEXUS_IF_LS( gen_helper_flexus_ld_aa64(cpu_env,
 			          addr, tcg_const_i32( 1 << size /* size */ ),
 			          tcg_const_i32(IS_USER(s)),
 			          tcg_const_tl(flexus_ins_pc),
 							   tcg_const_i32(1)) );
+    }
 #endif
+    tcg_gen_mov_i64(cpu_exclusive_val, tmp);
+
+    if (is_pair && size == 2) {
+        /* Rt is the word at the lower address */
+        if (s->be_data == MO_LE) {
+            tcg_gen_extr32_i64(cpu_reg(s, rt), cpu_reg(s, rt2), tmp);
+        } else {
+            tcg_gen_extr32_i64(cpu_reg(s, rt2), cpu_reg(s, rt), tmp);
+        }
+    } else if (is_pair) {
+        TCGv_i64 addr2 = tcg_temp_new_i64();
+        TCGv_i64 hitmp = tcg_temp_new_i64();
+
+        tcg_gen_addi_i64(addr2, addr, 1 << size);
+        arm_gen_qemu_ld_i64(s, hitmp, addr2, get_mem_index(s), memop);
         tcg_temp_free_i64(addr2);
         tcg_gen_mov_i64(cpu_exclusive_high, hitmp);
         tcg_gen_mov_i64(cpu_reg(s, rt2), hitmp);
         tcg_temp_free_i64(hitmp);
+        tcg_gen_mov_i64(cpu_reg(s, rt), tmp);
+    } else {
+        tcg_gen_mov_i64(cpu_reg(s, rt), tmp);
     }
 
-    tcg_gen_mov_i64(cpu_exclusive_val, tmp);
-    tcg_gen_mov_i64(cpu_reg(s, rt), tmp);
-
     tcg_temp_free_i64(tmp);
     tcg_gen_mov_i64(cpu_exclusive_addr, addr);
 }
 
-#ifdef CONFIG_USER_ONLY
-static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
-                                TCGv_i64 addr, int size, int is_pair)
+/* STXP of two doublewords, branching to @fail_label if memory does not
+ * hold the pair of the load-exclusive anymore.  The instrumented TBs do it
+ * without the atomic helper, see arm_gen_atomic_cmpxchg_i64.
+ */
+static void gen_store_exclusive_pair64(DisasContext *s, int rt, int rt2,
+                                       TCGv_i64 addr, TCGLabel *fail_label)
 {
-    tcg_gen_mov_i64(cpu_exclusive_test, addr);
-    tcg_gen_movi_i32(cpu_exclusive_info,
-                     size | is_pair << 2 | (rd << 4) | (rt << 9) | (rt2 << 14));
-    gen_exception_internal_insn(s, 4, EXCP_STREX);
+    TCGMemOp memop = s->be_data + MO_64;
+    TCGv_i64 tmp;
+    TCGv_i32 tcg_oi;
+
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        TCGv_i64 addrhi = tcg_temp_local_new_i64();
+
+        tcg_gen_addi_i64(addrhi, addr, 8);
+        tmp = tcg_temp_new_i64();
+        arm_gen_qemu_ld_i64(s, tmp, addr, get_mem_index(s), memop);
+        tcg_gen_brcond_i64(TCG_COND_NE, tmp, cpu_exclusive_val, fail_label);
+        tcg_temp_free_i64(tmp);
+
+        tmp = tcg_temp_new_i64();
+        arm_gen_qemu_ld_i64(s, tmp, addrhi, get_mem_index(s), memop);
+        tcg_gen_brcond_i64(TCG_COND_NE, tmp, cpu_exclusive_high, fail_label);
+        tcg_temp_free_i64(tmp);
+
+        arm_gen_qemu_st_i64(s, cpu_reg(s, rt), addr, get_mem_index(s), memop);
+        arm_gen_qemu_st_i64(s, cpu_reg(s, rt2), addrhi, get_mem_index(s),
+                            memop);
+        tcg_temp_free_i64(addrhi);
+        return;
+    }
+#endif
+
+    tmp = tcg_temp_new_i64();
+    tcg_oi = tcg_const_i32(make_memop_idx(memop | MO_ALIGN, get_mem_index(s)));
+    gen_helper_paired_cmpxchg64(tmp, cpu_env, addr, cpu_reg(s, rt),
+                                cpu_reg(s, rt2), tcg_oi);
+    tcg_temp_free_i32(tcg_oi);
+    tcg_gen_brcondi_i64(TCG_COND_NE, tmp, 0, fail_label);
+    tcg_temp_free_i64(tmp);
 }
-#else
+
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv_i64 inaddr, int size, int is_pair)
 {
@@ -1922,7 +1982,6 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     TCGLabel *fail_label = gen_new_label();
     TCGLabel *done_label = gen_new_label();
     TCGv_i64 addr = tcg_temp_local_new_i64();
-    TCGv_i64 tmp;
 
     /* Copy input into a local temp so it is not trashed when the
      * basic block ends at the branch insn.
@@ -1930,51 +1989,50 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     tcg_gen_mov_i64(addr, inaddr);
     tcg_gen_brcond_i64(TCG_COND_NE, addr, cpu_exclusive_addr, fail_label);
 
-    tmp = tcg_temp_new_i64();
-    tcg_gen_qemu_ld_i64(tmp, addr, get_mem_index(s), s->be_data + size);
-
-    tcg_gen_brcond_i64(TCG_COND_NE, tmp, cpu_exclusive_val, fail_label);
-    tcg_temp_free_i64(tmp);
-
-    if (is_pair) {
-        TCGv_i64 addrhi = tcg_temp_new_i64();
-        TCGv_i64 tmphi = tcg_temp_new_i64();
-
-        tcg_gen_addi_i64(addrhi, addr, 1 << size);
-        tcg_gen_qemu_ld_i64(tmphi, addrhi, get_mem_index(s),
-                            s->be_data + size);
-
-        tcg_gen_brcond_i64(TCG_COND_NE, tmphi, cpu_exclusive_high, fail_label);
-
-        tcg_temp_free_i64(tmphi);
-        tcg_temp_free_i64(addrhi);
+    if (is_pair && size == 3) {
+        gen_store_exclusive_pair64(s, rt, rt2, addr, fail_label);
+    } else {
+        TCGMemOp memop = s->be_data + size + MO_ALIGN;
+        TCGv_i64 val = cpu_reg(s, rt);
+        TCGv_i64 tmp = tcg_temp_new_i64();
+
+        if (is_pair) {
+            /* the two words as one doubleword, see gen_load_exclusive */
+            val = tcg_temp_new_i64();
+            if (s->be_data == MO_LE) {
+                tcg_gen_concat32_i64(val, cpu_reg(s, rt), cpu_reg(s, rt2));
+            } else {
+                tcg_gen_concat32_i64(val, cpu_reg(s, rt2), cpu_reg(s, rt));
+            }
+            memop = s->be_data + MO_64 + MO_ALIGN;
+        }
+        arm_gen_atomic_cmpxchg_i64(s, tmp, addr, cpu_exclusive_val, val,
+                                   get_mem_index(s), memop);
+        if (is_pair) {
+            tcg_temp_free_i64(val);
+        }
+        tcg_gen_brcond_i64(TCG_COND_NE, tmp, cpu_exclusive_val, fail_label);
+        tcg_temp_free_i64(tmp);
     }
 
-    /* We seem to still have the exclusive monitor, so do the store */
-    tcg_gen_qemu_st_i64(cpu_reg(s, rt), addr, get_mem_index(s),
-                        s->be_data + size);
 #ifdef CONFIG_FLEXUS
-    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa64(cpu_env,
+    FLEXUS_IF_LS( gen_helper_flexus_st_aa64(cpu_env,
 			 addr, tcg_const_i32( 1 << size /* size */ ),
 			 tcg_const_i32(IS_USER(s)),
 			 tcg_const_tl(flexus_ins_pc),
 						       tcg_const_i32(1)) );
-#endif
     if (is_pair) {
         TCGv_i64 addrhi = tcg_temp_new_i64();
 
         tcg_gen_addi_i64(addrhi, addr, 1 << size);
-        tcg_gen_qemu_st_i64(cpu_reg(s, rt2), addrhi,
-                            get_mem_index(s), s->be_data + size);
-#ifdef CONFIG_FLEXUS
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa64(cpu_env,
+        FLEXUS_IF_LS( gen_helper_flexus_st_aa64(cpu_env,
 			          addrhi, tcg_const_i32( 1 << size /* size */ ),
 			          tcg_const_i32(IS_USER(s)),
 			          tcg_const_tl(flexus_ins_pc),
 							   tcg_const_i32(1)) );
-#endif
         tcg_temp_free_i64(addrhi);
     }
+#endif
 
     tcg_temp_free_i64(addr);
 
@@ -1984,9 +2042,77 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     tcg_gen_movi_i64(cpu_reg(s, rd), 1);
     gen_set_label(done_label);
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
+}
+
+/* Compare and swap (CAS), ARMv8.1: the old value is returned in Rs */
+static void gen_compare_and_swap(DisasContext *s, int rs, int rt,
+                                 int rn, int size)
+{
+    TCGv_i64 tcg_rs = cpu_reg(s, rs);
+    TCGv_i64 tcg_rt = cpu_reg(s, rt);
+    TCGv_i64 cmp = tcg_temp_new_i64();
+    TCGv_i64 addr;
 
+    if (rn == 31) {
+        gen_check_sp_alignment(s);
+    }
+    addr = read_cpu_reg_sp(s, rn, 1);
+    tcg_gen_andi_i64(cmp, tcg_rs, ~0ULL >> (64 - (8 << size)));
+    arm_gen_atomic_cmpxchg_i64(s, tcg_rs, addr, cmp, tcg_rt,
+                               get_mem_index(s),
+                               size | MO_ALIGN | s->be_data);
+    tcg_temp_free_i64(cmp);
+}
+
+/* Compare and swap pair (CASP), ARMv8.1: Rs and Rt are even, and the
+ * pair starting at Rs receives the old value.
+ */
+static void gen_compare_and_swap_pair(DisasContext *s, int rs, int rt,
+                                      int rn, int size)
+{
+    TCGv_i64 s1 = cpu_reg(s, rs);
+    TCGv_i64 s2 = cpu_reg(s, rs + 1);
+    TCGv_i64 t1 = cpu_reg(s, rt);
+    TCGv_i64 t2 = cpu_reg(s, rt + 1);
+    TCGv_i64 addr;
+    int memidx = get_mem_index(s);
+
+    if (rn == 31) {
+        gen_check_sp_alignment(s);
+    }
+    addr = read_cpu_reg_sp(s, rn, 1);
+
+    if (size == 2) {
+        TCGv_i64 cmp = tcg_temp_new_i64();
+        TCGv_i64 val = tcg_temp_new_i64();
+
+        if (s->be_data == MO_LE) {
+            tcg_gen_concat32_i64(val, t1, t2);
+            tcg_gen_concat32_i64(cmp, s1, s2);
+        } else {
+            tcg_gen_concat32_i64(val, t2, t1);
+            tcg_gen_concat32_i64(cmp, s2, s1);
+        }
+        arm_gen_atomic_cmpxchg_i64(s, cmp, addr, cmp, val, memidx,
+                                   MO_64 | MO_ALIGN | s->be_data);
+        tcg_temp_free_i64(val);
+
+        if (s->be_data == MO_LE) {
+            tcg_gen_extr32_i64(s1, s2, cmp);
+        } else {
+            tcg_gen_extr32_i64(s2, s1, cmp);
+        }
+        tcg_temp_free_i64(cmp);
+    } else {
+        TCGv_i32 tcg_rs = tcg_const_i32(rs);
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(MO_64 | MO_ALIGN |
+                                                   s->be_data, memidx));
+
+        gen_helper_casp_64(cpu_env, tcg_rs, addr, t1, t2, oi);
+        tcg_temp_free_i32(tcg_rs);
+        tcg_temp_free_i32(oi);
+    }
 }
-#endif
 
 /* C3.3.6 Load/store exclusive
  *
@@ -2000,6 +2126,9 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
  *  o2: 0 -> exclusive, 1 -> not
  *  o1: 0 -> single register, 1 -> register pair
  *  o0: 1 -> load-acquire/store-release, 0 -> not
+ *
+ * With ARMv8.1, o2:o1 = 11 is CAS and o2:o1 = 01 with sz < 2 is CASP (sz
+ * then selects 32 or 64 bit registers), Rt2 being 11111 for both.
  */
 static void disas_ldst_excl(DisasContext *s, uint32_t insn)
 {
@@ -2014,9 +2143,27 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
     int size = extract32(insn, 30, 2);
     TCGv_i64 tcg_addr;
 
-    if ((!is_excl && !is_pair && !is_lasr) ||
-        (!is_excl && is_pair) ||
-        (is_pair && size < 2)) {
+    if (is_pair && (!is_excl || size < 2)) {
+        /* The compare-and-swaps are full barriers whatever their
+         * acquire/release bits when the vCPUs run in parallel.
+         */
+        if (rt2 != 31 || !arm_dc_feature(s, ARM_FEATURE_V8_ATOMICS)) {
+            unallocated_encoding(s);
+            return;
+        }
+        if (!is_excl) {
+            gen_compare_and_swap(s, rs, rt, rn, size);
+        } else {
+            if ((rs | rt) & 1) {
+                unallocated_encoding(s);
+                return;
+            }
+            gen_compare_and_swap_pair(s, rs, rt, rn, size + 2);
+        }
+        return;
+    }
+
+    if (!is_excl && !is_pair && !is_lasr) {
         unallocated_encoding(s);
         return;
     }
@@ -2026,9 +2173,14 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
     }
     tcg_addr = read_cpu_reg_sp(s, rn, 1);
 
-    /* Note that since TCG is single threaded load-acquire/store-release
-     * semantics require no extra if (is_lasr) { ... } handling.
+    /* Load-acquire/store-release only need barriers when the vCPUs run in
+     * parallel: a store-release after the earlier accesses and before a
+     * later load-acquire, a load-acquire before the later accesses.  The
+     * host already keeps most of that order when TCG_TARGET_TSO.
      */
+    if (is_lasr && is_store && !TCG_TARGET_TSO) {
+        gen_mb();
+    }
 
     if (is_excl) {
         if (!is_store) {
@@ -2045,6 +2197,11 @@ static void disas_ldst_excl(DisasContext *s, uint32_t insn)
             do_gpr_ld(s, tcg_rt, tcg_addr, size, false, false);
         }
     }
+
+    if (is_lasr && (is_store ? !is_excl : !TCG_TARGET_TSO)) {
+        /* the store-exclusive compare-and-swap is already a full barrier */
+        gen_mb();
+    }
 }
 
 /*
@@ -2531,6 +2688,91 @@ static void disas_ldst_reg_unsigned_imm(DisasContext *s, uint32_t insn)
     }
 }
 
+typedef void AtomicThreeOpFn(TCGv_i64, TCGv_i64, TCGv_i64, TCGArg, TCGMemOp);
+
+/* Atomic memory operations, ARMv8.1
+ *
+ *  31  30      27  26    24  23  22  21  16  15  14  12 11 10 9  5 4  0
+ * +------+-------+---+-----+---+---+---+----+----+-----+-----+----+----+
+ * | size | 1 1 1 | V | 0 0 | A | R | 1 | Rs | o3 | opc | 0 0 | Rn | Rt |
+ * +------+-------+---+-----+---+---+---+----+----+-----+-----+----+----+
+ *
+ * Rt receives the old value, zero-extended from the size of the access.
+ * The operations are full barriers whatever A and R when the vCPUs run in
+ * parallel.
+ */
+static void disas_ldst_atomic(DisasContext *s, uint32_t insn)
+{
+    int rt = extract32(insn, 0, 5);
+    int rn = extract32(insn, 5, 5);
+    int o3_opc = extract32(insn, 12, 4);
+    int rs = extract32(insn, 16, 5);
+    bool is_vector = extract32(insn, 26, 1);
+    int size = extract32(insn, 30, 2);
+    TCGMemOp mop = size | MO_ALIGN | s->be_data;
+    TCGv_i64 tcg_rt = cpu_reg(s, rt);
+    TCGv_i64 tcg_rs = cpu_reg(s, rs);
+    TCGv_i64 addr;
+    AtomicThreeOpFn *fn;
+
+    if (is_vector || !arm_dc_feature(s, ARM_FEATURE_V8_ATOMICS)) {
+        unallocated_encoding(s);
+        return;
+    }
+    switch (o3_opc) {
+    case 000: /* LDADD */
+        fn = tcg_gen_atomic_fetch_add_i64;
+        break;
+    case 001: /* LDCLR */
+        fn = tcg_gen_atomic_fetch_and_i64;
+        break;
+    case 002: /* LDEOR */
+        fn = tcg_gen_atomic_fetch_xor_i64;
+        break;
+    case 003: /* LDSET */
+        fn = tcg_gen_atomic_fetch_or_i64;
+        break;
+    case 004: /* LDSMAX */
+        fn = tcg_gen_atomic_fetch_smax_i64;
+        mop |= MO_SIGN;
+        break;
+    case 005: /* LDSMIN */
+        fn = tcg_gen_atomic_fetch_smin_i64;
+        mop |= MO_SIGN;
+        break;
+    case 006: /* LDUMAX */
+        fn = tcg_gen_atomic_fetch_umax_i64;
+        break;
+    case 007: /* LDUMIN */
+        fn = tcg_gen_atomic_fetch_umin_i64;
+        break;
+    case 010: /* SWP */
+        fn = tcg_gen_atomic_xchg_i64;
+        break;
+    default:
+        unallocated_encoding(s);
+        return;
+    }
+
+    if (rn == 31) {
+        gen_check_sp_alignment(s);
+    }
+    addr = read_cpu_reg_sp(s, rn, 1);
+
+    if (o3_opc == 001) {
+        TCGv_i64 tmp = tcg_temp_new_i64();
+
+        tcg_gen_not_i64(tmp, tcg_rs);
+        fn(tcg_rt, addr, tmp, get_mem_index(s), mop);
+        tcg_temp_free_i64(tmp);
+    } else {
+        fn(tcg_rt, addr, tcg_rs, get_mem_index(s), mop);
+    }
+    if (mop & MO_SIGN) {
+        tcg_gen_andi_i64(tcg_rt, tcg_rt, ~0ULL >> (64 - (8 << size)));
+    }
+}
+
 /* Load/store register (all forms) */
 static void disas_ldst_reg(DisasContext *s, uint32_t insn)
 {
@@ -2538,6 +2780,9 @@ static void disas_ldst_reg(DisasContext *s, uint32_t insn)
     case 0:
         if (extract32(insn, 21, 1) == 1 && extract32(insn, 10, 2) == 2) {
             disas_ldst_reg_roffset(s, insn);
+        } else if (extract32(insn, 21, 1) == 1 &&
+                   extract32(insn, 10, 2) == 0) {
+            disas_ldst_atomic(s, insn);
         } else {
             /* Load/store register (unscaled immediate)
              * Load/store immediate pre/post-indexed
@@ -2786,10 +3031,10 @@ static void disas_ldst_single_struct(DisasContext *s, uint32_t insn)
             uint64_t mulconst;
             TCGv_i64 tcg_tmp = tcg_temp_new_i64();
 
-            tcg_gen_qemu_ld_i64(tcg_tmp, tcg_addr,
+            arm_gen_qemu_ld_i64(s, tcg_tmp, tcg_addr,
                                 get_mem_index(s), s->be_data + scale);
 #ifdef CONFIG_FLEXUS
-            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa64(cpu_env,
+            FLEXUS_IF_LS( gen_helper_flexus_ld_aa64(cpu_env,
 			              tcg_addr, tcg_const_i32( 1 << scale /* size */ ),
 			              tcg_const_i32(IS_USER(s)),
 			              tcg_const_tl(flexus_ins_pc),
@@ -11154,6 +11399,412 @@ static void disas_data_proc_simd_fp(DisasContext *s, uint32_t insn)
 }
 
 /* C3.1 A64 instruction index by encoding */
+#ifdef CONFIG_FLEXUS
+// Static descriptors of the instructions handed to the timing models with
+// their fetches. They follow the encoding groups decoded below; the
+// operands of the SIMD and floating point groups are approximated by the
+// Vd, Vn and Vm fields.
+
+static void flexus_desc_src(QEMU_insn_desc_t *d, int reg)
+{
+    if (reg >= 0 && d->num_srcs < QEMU_INSN_MAX_SRCS) {
+        d->srcs[d->num_srcs++] = reg;
+    }
+}
+
+static void flexus_desc_dst(QEMU_insn_desc_t *d, int reg)
+{
+    if (reg >= 0 && d->num_dsts < QEMU_INSN_MAX_DSTS) {
+        d->dsts[d->num_dsts++] = reg;
+    }
+}
+
+// operand of general purpose register field r: 31 is the stack pointer
+// when sp is set and otherwise the zero register, which is no operand
+static int flexus_xreg(unsigned int r, bool sp)
+{
+    if (r == 31) {
+        return sp ? QEMU_INSN_REG_SP : -1;
+    }
+    return QEMU_INSN_REG_X(r);
+}
+
+static void flexus_describe_data_proc_imm(uint32_t insn, QEMU_insn_desc_t *d)
+{
+    unsigned int rd = extract32(insn, 0, 5);
+    unsigned int rn = extract32(insn, 5, 5);
+    unsigned int opc = extract32(insn, 29, 2);
+
+    d->op_class = QEMU_Insn_Int_Alu;
+    switch (extract32(insn, 23, 6)) {
+    case 0x20: case 0x21: /* PC-rel. addressing */
+        flexus_desc_dst(d, flexus_xreg(rd, false));
+        break;
+    case 0x22: case 0x23: /* Add/subtract (immediate) */
+        flexus_desc_src(d, flexus_xreg(rn, true));
+        if (opc & 1) {
+            flexus_desc_dst(d, flexus_xreg(rd, false));
+            flexus_desc_dst(d, QEMU_INSN_REG_NZCV);
+        } else {
+            flexus_desc_dst(d, flexus_xreg(rd, true));
+        }
+        break;
+    case 0x24: /* Logical (immediate) */
+        flexus_desc_src(d, flexus_xreg(rn, false));
+        if (opc == 3) {
+            flexus_desc_dst(d, flexus_xreg(rd, false));
+            flexus_desc_dst(d, QEMU_INSN_REG_NZCV);
+        } else {
+            flexus_desc_dst(d, flexus_xreg(rd, true));
+        }
+        break;
+    case 0x25: /* Move wide (immediate) */
+        if (opc == 3) { /* MOVK */
+            flexus_desc_src(d, flexus_xreg(rd, false));
+        }
+        flexus_desc_dst(d, flexus_xreg(rd, false));
+        break;
+    case 0x26: /* Bitfield */
+        flexus_desc_src(d, flexus_xreg(rn, false));
+        if (opc == 1) { /* BFM */
+            flexus_desc_src(d, flexus_xreg(rd, false));
+        }
+        flexus_desc_dst(d, flexus_xreg(rd, false));
+        break;
+    case 0x27: /* Extract */
+        flexus_desc_src(d, flexus_xreg(rn, false));
+        flexus_desc_src(d, flexus_xreg(extract32(insn, 16, 5), false));
+        flexus_desc_dst(d, flexus_xreg(rd, false));
+        break;
+    default:
+        d->op_class = QEMU_Insn_Unknown;
+        break;
+    }
+}
+
+static void flexus_describe_b_exc_sys(uint32_t insn, QEMU_insn_desc_t *d)
+{
+    unsigned int rt = extract32(insn, 0, 5);
+    unsigned int rn = extract32(insn, 5, 5);
+
+    d->op_class = QEMU_Insn_Branch;
+    switch (extract32(insn, 25, 7)) {
+    case 0x0a: case 0x0b:
+    case 0x4a: case 0x4b: /* Unconditional branch (immediate) */
+        if (insn & (1U << 31)) { /* BL */
+            d->branch_type = QEMU_Call_Branch;
+            flexus_desc_dst(d, QEMU_INSN_REG_X(30));
+        } else {
+            d->branch_type = QEMU_Unconditional_Branch;
+        }
+        break;
+    case 0x1a: case 0x5a: /* Compare & branch (immediate) */
+    case 0x1b: case 0x5b: /* Test & branch (immediate) */
+        d->branch_type = QEMU_Conditional_Branch;
+        flexus_desc_src(d, flexus_xreg(rt, false));
+        break;
+    case 0x2a: /* Conditional branch (immediate) */
+        d->branch_type = QEMU_Conditional_Branch;
+        flexus_desc_src(d, QEMU_INSN_REG_NZCV);
+        break;
+    case 0x6a: /* Exception generation / System */
+        d->op_class = QEMU_Insn_System;
+        if ((insn & (1 << 24)) && extract32(insn, 22, 2) == 0) {
+            if (extract32(insn, 21, 1)) { /* MRS, SYSL */
+                flexus_desc_dst(d, flexus_xreg(rt, false));
+            } else if (extract32(insn, 19, 2) != 0) { /* MSR (reg), SYS */
+                flexus_desc_src(d, flexus_xreg(rt, false));
+            }
+        }
+        break;
+    case 0x6b: /* Unconditional branch (register) */
+        switch (extract32(insn, 21, 4)) {
+        case 0: /* BR */
+            d->branch_type = QEMU_Unconditional_Branch;
+            break;
+        case 1: /* BLR */
+            d->branch_type = QEMU_Call_Branch;
+            flexus_desc_dst(d, QEMU_INSN_REG_X(30));
+            break;
+        default: /* RET, ERET, DRPS */
+            d->branch_type = QEMU_Return_Branch;
+            break;
+        }
+        flexus_desc_src(d, flexus_xreg(rn, false));
+        break;
+    default:
+        d->op_class = QEMU_Insn_Unknown;
+        break;
+    }
+}
+
+static void flexus_describe_ldst(uint32_t insn, QEMU_insn_desc_t *d)
+{
+    unsigned int rt = extract32(insn, 0, 5);
+    unsigned int rn = extract32(insn, 5, 5);
+    unsigned int rt2 = extract32(insn, 10, 5);
+    unsigned int rm = extract32(insn, 16, 5);
+    unsigned int size = extract32(insn, 30, 2);
+    unsigned int opc = extract32(insn, 22, 2);
+    bool is_vector = extract32(insn, 26, 1);
+    bool is_load, is_pair = false, has_base = true, writeback = false;
+    int regs = 1;
+    int i;
+
+    switch (extract32(insn, 24, 6)) {
+    case 0x08: /* Load/store exclusive */
+        d->op_class = QEMU_Insn_Atomic;
+        is_load = extract32(insn, 22, 1);
+        if (extract32(insn, 21, 1)) {
+            is_pair = true;
+            regs = 2;
+        }
+        d->mem_size = regs << size;
+        if (!is_load && !extract32(insn, 23, 1)) { /* status of STXR */
+            flexus_desc_dst(d, flexus_xreg(rm, false));
+        }
+        break;
+    case 0x18: case 0x1c: /* Load register (literal) */
+        is_load = true;
+        has_base = false;
+        if (is_vector) {
+            d->mem_size = 4 << size;
+        } else if (size == 3) { /* PRFM */
+            regs = 0;
+        } else {
+            d->mem_size = size == 1 ? 8 : 4;
+        }
+        break;
+    case 0x28: case 0x29:
+    case 0x2c: case 0x2d: /* Load/store pair (all forms) */
+        is_load = extract32(insn, 22, 1);
+        is_pair = true;
+        regs = 2;
+        d->mem_size = 2 * (is_vector ? 4 << size : size == 2 ? 8 : 4);
+        writeback = extract32(insn, 23, 1);
+        break;
+    case 0x38: case 0x39:
+    case 0x3c: case 0x3d: /* Load/store register (all forms) */
+        if (is_vector) {
+            is_load = opc & 1;
+            size |= (opc & 2) << 1;
+        } else if (size == 3 && opc == 2) { /* PRFM */
+            is_load = true;
+            regs = 0;
+        } else {
+            is_load = opc != 0;
+        }
+        d->mem_size = 1 << size;
+        if (!extract32(insn, 24, 1)) {
+            if (extract32(insn, 21, 1)) { /* register offset */
+                flexus_desc_src(d, flexus_xreg(rm, false));
+            } else { /* pre and post-indexed */
+                writeback = extract32(insn, 10, 1);
+            }
+        }
+        break;
+    case 0x0c: /* AdvSIMD load/store multiple structures */
+    case 0x0d: /* AdvSIMD load/store single structure */
+        is_load = extract32(insn, 22, 1);
+        is_vector = true;
+        if (extract32(insn, 24, 1)) {
+            unsigned int scale = extract32(insn, 14, 2);
+
+            regs = (extract32(insn, 13, 1) << 1 | extract32(insn, 21, 1)) + 1;
+            if (scale == 3) { /* replicate */
+                scale = extract32(insn, 10, 2);
+            }
+            d->mem_size = regs << scale;
+        } else {
+            static const uint8_t ldst_multiple_regs[16] = {
+                [0x0] = 4, [0x2] = 4, [0x4] = 3, [0x6] = 3,
+                [0x7] = 1, [0x8] = 2, [0xa] = 2,
+            };
+
+            regs = ldst_multiple_regs[extract32(insn, 12, 4)];
+            d->mem_size = regs * (extract32(insn, 30, 1) ? 16 : 8);
+        }
+        if (extract32(insn, 23, 1)) { /* post-indexed */
+            writeback = true;
+            flexus_desc_src(d, flexus_xreg(rm, false));
+        }
+        break;
+    default:
+        return;
+    }
+
+    if (d->op_class == QEMU_Insn_Unknown) {
+        d->op_class = is_load ? QEMU_Insn_Load : QEMU_Insn_Store;
+    }
+    if (has_base) {
+        flexus_desc_src(d, flexus_xreg(rn, true));
+        if (writeback) {
+            flexus_desc_dst(d, flexus_xreg(rn, true));
+        }
+    }
+    /* the vector structures use consecutive registers from Rt */
+    for (i = 0; i < regs; i++) {
+        int r = is_pair && i == 1 ? rt2 : (rt + i) % 32;
+        int reg = is_vector ? QEMU_INSN_REG_V(r) : flexus_xreg(r, false);
+
+        if (is_load) {
+            flexus_desc_dst(d, reg);
+        } else {
+            flexus_desc_src(d, reg);
+        }
+    }
+}
+
+static void flexus_describe_data_proc_reg(uint32_t insn, QEMU_insn_desc_t *d)
+{
+    unsigned int rd = extract32(insn, 0, 5);
+    unsigned int rn = extract32(insn, 5, 5);
+    unsigned int rm = extract32(insn, 16, 5);
+    bool setflags = extract32(insn, 29, 1);
+    bool sp = false;
+
+    d->op_class = QEMU_Insn_Int_Alu;
+    switch (extract32(insn, 24, 5)) {
+    case 0x0a: /* Logical (shifted register) */
+        setflags = extract32(insn, 29, 2) == 3;
+        break;
+    case 0x0b: /* Add/subtract */
+        sp = extract32(insn, 21, 1); /* (extended register) */
+        break;
+    case 0x1b: /* Data-processing (3 source) */
+        d->op_class = QEMU_Insn_Int_Mul;
+        setflags = false;
+        flexus_desc_src(d, flexus_xreg(extract32(insn, 10, 5), false));
+        break;
+    case 0x1a:
+        switch (extract32(insn, 21, 3)) {
+        case 0x0: /* Add/subtract (with carry) */
+            flexus_desc_src(d, QEMU_INSN_REG_NZCV);
+            break;
+        case 0x2: /* Conditional compare */
+            flexus_desc_src(d, QEMU_INSN_REG_NZCV);
+            flexus_desc_src(d, flexus_xreg(rn, false));
+            if (!extract32(insn, 11, 1)) {
+                flexus_desc_src(d, flexus_xreg(rm, false));
+            }
+            flexus_desc_dst(d, QEMU_INSN_REG_NZCV);
+            return;
+        case 0x4: /* Conditional select */
+            setflags = false;
+            flexus_desc_src(d, QEMU_INSN_REG_NZCV);
+            break;
+        case 0x6: /* Data-processing */
+            setflags = false;
+            if (insn & (1 << 30)) { /* (1 source) */
+                rm = 31;
+            } else if ((extract32(insn, 10, 6) & ~1) == 2) { /* UDIV, SDIV */
+                d->op_class = QEMU_Insn_Int_Div;
+            }
+            break;
+        default:
+            d->op_class = QEMU_Insn_Unknown;
+            return;
+        }
+        break;
+    default:
+        d->op_class = QEMU_Insn_Unknown;
+        return;
+    }
+
+    flexus_desc_src(d, flexus_xreg(rn, sp));
+    flexus_desc_src(d, flexus_xreg(rm, false));
+    flexus_desc_dst(d, flexus_xreg(rd, sp && !setflags));
+    if (setflags) {
+        flexus_desc_dst(d, QEMU_INSN_REG_NZCV);
+    }
+}
+
+static void flexus_describe_data_proc_simd_fp(uint32_t insn,
+                                              QEMU_insn_desc_t *d)
+{
+    unsigned int rd = extract32(insn, 0, 5);
+    unsigned int rn = extract32(insn, 5, 5);
+    unsigned int rm = extract32(insn, 16, 5);
+
+    if (extract32(insn, 28, 1) == 1 && extract32(insn, 30, 1) == 0) {
+        d->op_class = QEMU_Insn_Fp;
+        if ((insn & 0x5f20fc00) == 0x1e200000) {
+            /* Conversion between floating-point and integer */
+            if (extract32(insn, 17, 2) == 1) { /* SCVTF, UCVTF */
+                flexus_desc_src(d, flexus_xreg(rn, false));
+                flexus_desc_dst(d, QEMU_INSN_REG_V(rd));
+            } else if (extract32(insn, 16, 3) == 7) { /* FMOV from X/W */
+                flexus_desc_src(d, flexus_xreg(rn, false));
+                flexus_desc_dst(d, QEMU_INSN_REG_V(rd));
+            } else {
+                flexus_desc_src(d, QEMU_INSN_REG_V(rn));
+                flexus_desc_dst(d, flexus_xreg(rd, false));
+            }
+            return;
+        }
+        if ((insn & 0x5f203c00) == 0x1e202000) { /* FCMP, FCMPE */
+            flexus_desc_src(d, QEMU_INSN_REG_V(rn));
+            flexus_desc_src(d, QEMU_INSN_REG_V(rm));
+            flexus_desc_dst(d, QEMU_INSN_REG_NZCV);
+            return;
+        }
+        if (extract32(insn, 24, 1)) { /* Floating-point data-processing
+                                         (3 source) */
+            flexus_desc_src(d, QEMU_INSN_REG_V(extract32(insn, 10, 5)));
+        } else if (extract32(insn, 21, 1)) {
+            switch (extract32(insn, 10, 2)) {
+            case 1: /* FCCMP, FCCMPE */
+                flexus_desc_src(d, QEMU_INSN_REG_NZCV);
+                flexus_desc_src(d, QEMU_INSN_REG_V(rn));
+                flexus_desc_src(d, QEMU_INSN_REG_V(rm));
+                flexus_desc_dst(d, QEMU_INSN_REG_NZCV);
+                return;
+            case 3: /* FCSEL */
+                flexus_desc_src(d, QEMU_INSN_REG_NZCV);
+                break;
+            }
+        }
+    } else {
+        d->op_class = QEMU_Insn_Simd;
+    }
+    flexus_desc_src(d, QEMU_INSN_REG_V(rn));
+    flexus_desc_src(d, QEMU_INSN_REG_V(rm));
+    flexus_desc_dst(d, QEMU_INSN_REG_V(rd));
+}
+
+static void flexus_describe_insn(uint32_t insn, QEMU_insn_desc_t *d)
+{
+    memset(d, 0, sizeof(*d));
+    d->encoding = insn;
+    d->branch_type = QEMU_Non_Branch;
+
+    switch (extract32(insn, 25, 4)) {
+    case 0x8: case 0x9: /* Data processing - immediate */
+        flexus_describe_data_proc_imm(insn, d);
+        break;
+    case 0xa: case 0xb: /* Branch, exception generation and system insns */
+        flexus_describe_b_exc_sys(insn, d);
+        break;
+    case 0x4:
+    case 0x6:
+    case 0xc:
+    case 0xe:      /* Loads and stores */
+        flexus_describe_ldst(insn, d);
+        break;
+    case 0x5:
+    case 0xd:      /* Data processing - register */
+        flexus_describe_data_proc_reg(insn, d);
+        break;
+    case 0x7:
+    case 0xf:      /* Data processing - SIMD and floating point */
+        flexus_describe_data_proc_simd_fp(insn, d);
+        break;
+    default:       /* UNALLOCATED */
+        break;
+    }
+}
+#endif /* CONFIG_FLEXUS */
+
 static void disas_a64_insn(CPUARMState *env, DisasContext *s)
 {
     uint32_t insn;
@@ -11257,6 +11908,13 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
     dc->pstate_ss = ARM_TBFLAG_PSTATE_SS(tb->flags);
     dc->is_ldex = false;
     dc->ss_same_el = (arm_debug_target_el(env) == dc->current_el);
+#ifdef CONFIG_FLEXUS
+    flexus_tb_simulating = ARM_TBFLAG_FLEXUS(tb->flags);
+    flexus_tb_fetch = flexus_tb_simulating
+                      && !ARM_TBFLAG_FLEXUS_NOFETCH(tb->flags);
+    flexus_tb_ls = flexus_tb_simulating && !ARM_TBFLAG_FLEXUS_NOLS(tb->flags);
+    dc->flexus_capture = flexus_tb_ls;
+#endif
 
     init_tmp_a64_array(dc);
 
@@ -11269,6 +11927,10 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
     if (max_insns > TCG_MAX_INSNS) {
         max_insns = TCG_MAX_INSNS;
     }
+#ifdef CONFIG_FLEXUS
+    tb->flexus_descs = flexus_tb_fetch
+                       ? QEMU_insn_desc_reserve(max_insns) : NULL;
+#endif
 
     gen_tb_start(tb);
 
@@ -11278,19 +11940,6 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
         tcg_gen_insn_start(dc->pc, 0);
         num_insns++;
 
-        cs->nr_instr++;
-        cs->nr_total_instr++;
-
-        // we set the quantum here
-        if(quantum_value != 0){
-
-            if(cs->nr_instr >= quantum_value){
-                cs->hasReachedInstrLimit = true;
-            }
-        }
-
-
-
         if (unlikely(!QTAILQ_EMPTY(&cs->breakpoints))) {
             CPUBreakpoint *bp;
             QTAILQ_FOREACH(bp, &cs->breakpoints, entry) {
@@ -11338,20 +11987,28 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
         }
 #ifdef CONFIG_FLEXUS
 	flexus_ins_pc = dc->pc;
+	flexus_ins_desc = tb->flexus_descs ? &tb->flexus_descs[num_insns - 1]
+	                                   : NULL;
 #endif /* CONFIG_FLEXUS */
 
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_periodic(cpu_env) );
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa64( cpu_env,
+	if( flexus_tb_simulating )
+	  gen_helper_flexus_periodic(cpu_env);
+	FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa64( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      tcg_const_i64(dc->thumb ? flexus_ins_pc + 2 : flexus_ins_pc + 4),
-	                              tcg_const_i32( dc->thumb ? 2 : 4 ),
+	                              tcg_const_ptr(flexus_ins_desc),
 				      tcg_const_i32(IS_USER(dc)),
 				      tcg_const_i32(QEMU_Non_Branch),
 								    tcg_const_i32(0) ) );
 #endif /* CONFIG_FLEXUS */
 
         disas_a64_insn(env, dc);
+#ifdef CONFIG_FLEXUS
+        if (flexus_ins_desc) {
+            flexus_describe_insn(dc->insn, flexus_ins_desc);
+        }
+#endif
 
         if (tcg_check_temp_count()) {
             fprintf(stderr, "TCG temporary leak before "TARGET_FMT_lx"\n",
@@ -11368,8 +12025,7 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
              !singlestep &&
              !dc->ss_active &&
              dc->pc < next_page_start &&
-             num_insns < max_insns &&
-             ! cs->hasReachedInstrLimit);
+             num_insns < max_insns);
 
     if (tb->cflags & CF_LAST_IO) {
         gen_io_end();
@@ -11432,6 +12088,11 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
 
 done_generating:
     gen_tb_end(tb, num_insns);
+#ifdef CONFIG_FLEXUS
+    if (tb->flexus_descs) {
+        QEMU_insn_desc_commit(tb->flexus_descs, num_insns);
+    }
+#endif
 
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_IN_ASM) &&
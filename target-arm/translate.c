@@ -64,10 +64,7 @@ static TCGv_i32 cpu_R[16];
 TCGv_i32 cpu_CF, cpu_NF, cpu_VF, cpu_ZF;
 TCGv_i64 cpu_exclusive_addr;
 TCGv_i64 cpu_exclusive_val;
-#ifdef CONFIG_USER_ONLY
-TCGv_i64 cpu_exclusive_test;
-TCGv_i32 cpu_exclusive_info;
-#endif
+TCGv_i64 cpu_exclusive_high;
 
 /* FIXME:  These should be removed.  */
 static TCGv_i32 cpu_F0s, cpu_F1s;
@@ -80,17 +77,28 @@ static TCGv_i64 cpu_F0d, cpu_F1d;
 #define QEMUFLEX_QEMU_INTERNAL
 #include "../libqemuflex/api.h"
 static target_ulong flexus_ins_pc = -1;
+// set from the TB flags: only emit the helpers in instrumented TBs,
+// the fetches and memory accesses may be left out by the filter or by
+// the flexus-bench mode
+static int flexus_tb_simulating = 0;
+static int flexus_tb_fetch = 0;
+static int flexus_tb_ls = 0;
+
+#define FLEXUS_IF_FETCH( a ) do {		\
+  if( flexus_tb_fetch ) {			\
+    (a) ;					\
+  }						\
+} while(0)
 
-#define FLEXUS_IF_IN_SIMULATION( a ) do {	\
-  printf(" Entering the flexus function \n") ;   \
-  if( QEMU_is_in_simulation() != 0 ) {		\
+#define FLEXUS_IF_LS( a ) do {			\
+  if( flexus_tb_ls ) {				\
     (a) ;					\
   }						\
-  printf(" Exiting the flexus function \n") ;   \
 } while(0)
 
 #else
-#define FLEXUS_IF_IN_SIMULATION( a )
+#define FLEXUS_IF_FETCH( a )
+#define FLEXUS_IF_LS( a )
 #endif /* CONFIG_FLEXUS */
 
 static const char *regnames[] =
@@ -104,6 +112,7 @@ void arm_translate_init(void)
 
 
     cpu_env = tcg_global_reg_new_ptr(TCG_AREG0, "env");
+    tcg_ctx.tcg_env = cpu_env;
 
     for (i = 0; i < 16; i++) {
         cpu_R[i] = tcg_global_mem_new_i32(cpu_env,
@@ -119,12 +128,8 @@ void arm_translate_init(void)
         offsetof(CPUARMState, exclusive_addr), "exclusive_addr");
     cpu_exclusive_val = tcg_global_mem_new_i64(cpu_env,
         offsetof(CPUARMState, exclusive_val), "exclusive_val");
-#ifdef CONFIG_USER_ONLY
-    cpu_exclusive_test = tcg_global_mem_new_i64(cpu_env,
-        offsetof(CPUARMState, exclusive_test), "exclusive_test");
-    cpu_exclusive_info = tcg_global_mem_new_i32(cpu_env,
-        offsetof(CPUARMState, exclusive_info), "exclusive_info");
-#endif
+    cpu_exclusive_high = tcg_global_mem_new_i64(cpu_env,
+        offsetof(CPUARMState, exclusive_high), "exclusive_high");
 
     a64_translate_init();
 }
@@ -201,7 +206,7 @@ static void store_reg(DisasContext *s, int reg, TCGv_i32 var)
         tcg_gen_andi_i32(var, var, ~1);
         s->is_jmp = DISAS_JUMP;
 
-        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa32( cpu_env,
+        FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa32( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      var,
 	                              tcg_const_i32( s->thumb ? 2 : 4 ),
@@ -872,6 +877,116 @@ void arm_gen_test_cc(int cc, TCGLabel *label)
     arm_free_cc(&cmp);
 }
 
+/* Guest loads and stores of both decoders.  Instrumented TBs call the
+ * softmmu helpers instead of taking the inline TLB fast path, so that
+ * they record the physical address of the access for the Flexus tracing
+ * helpers.
+ */
+void arm_gen_qemu_ld_i64(DisasContext *s, TCGv_i64 val, TCGv addr,
+                         int index, TCGMemOp memop)
+{
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, index));
+        gen_helper_flexus_qemu_ld(val, cpu_env, addr, oi);
+        tcg_temp_free_i32(oi);
+        return;
+    }
+#endif
+    tcg_gen_qemu_ld_i64(val, addr, index, memop);
+}
+
+void arm_gen_qemu_st_i64(DisasContext *s, TCGv_i64 val, TCGv addr,
+                         int index, TCGMemOp memop)
+{
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, index));
+        gen_helper_flexus_qemu_st(cpu_env, addr, val, oi);
+        tcg_temp_free_i32(oi);
+        return;
+    }
+#endif
+    tcg_gen_qemu_st_i64(val, addr, index, memop);
+}
+
+void arm_gen_qemu_ld_i32(DisasContext *s, TCGv_i32 val, TCGv addr,
+                         int index, TCGMemOp memop)
+{
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        TCGv_i64 tmp = tcg_temp_new_i64();
+        arm_gen_qemu_ld_i64(s, tmp, addr, index, memop);
+        tcg_gen_extrl_i64_i32(val, tmp);
+        tcg_temp_free_i64(tmp);
+        return;
+    }
+#endif
+    tcg_gen_qemu_ld_i32(val, addr, index, memop);
+}
+
+void arm_gen_qemu_st_i32(DisasContext *s, TCGv_i32 val, TCGv addr,
+                         int index, TCGMemOp memop)
+{
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        TCGv_i64 tmp = tcg_temp_new_i64();
+        tcg_gen_extu_i32_i64(tmp, val);
+        arm_gen_qemu_st_i64(s, tmp, addr, index, memop);
+        tcg_temp_free_i64(tmp);
+        return;
+    }
+#endif
+    tcg_gen_qemu_st_i32(val, addr, index, memop);
+}
+
+/* Compare-and-swap of the store-exclusives, @cmpv zero-extended from the
+ * size of the access.  Instrumented TBs expand it to the load and store
+ * above, which is not atomic but records the physical address like the
+ * other accesses; Flexus runs the vCPUs in turn anyway.
+ */
+void arm_gen_atomic_cmpxchg_i32(DisasContext *s, TCGv_i32 retv, TCGv addr,
+                                TCGv_i32 cmpv, TCGv_i32 newv,
+                                int index, TCGMemOp memop)
+{
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        TCGv_i32 old = tcg_temp_new_i32();
+        TCGv_i32 val = tcg_temp_new_i32();
+
+        arm_gen_qemu_ld_i32(s, old, addr, index, memop & ~MO_SIGN);
+        tcg_gen_movcond_i32(TCG_COND_EQ, val, old, cmpv, newv, old);
+        arm_gen_qemu_st_i32(s, val, addr, index, memop);
+        tcg_gen_mov_i32(retv, old);
+        tcg_temp_free_i32(val);
+        tcg_temp_free_i32(old);
+        return;
+    }
+#endif
+    tcg_gen_atomic_cmpxchg_i32(retv, addr, cmpv, newv, index, memop);
+}
+
+void arm_gen_atomic_cmpxchg_i64(DisasContext *s, TCGv_i64 retv, TCGv addr,
+                                TCGv_i64 cmpv, TCGv_i64 newv,
+                                int index, TCGMemOp memop)
+{
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        TCGv_i64 old = tcg_temp_new_i64();
+        TCGv_i64 val = tcg_temp_new_i64();
+
+        arm_gen_qemu_ld_i64(s, old, addr, index, memop & ~MO_SIGN);
+        tcg_gen_movcond_i64(TCG_COND_EQ, val, old, cmpv, newv, old);
+        arm_gen_qemu_st_i64(s, val, addr, index, memop);
+        tcg_gen_mov_i64(retv, old);
+        tcg_temp_free_i64(val);
+        tcg_temp_free_i64(old);
+        return;
+    }
+#endif
+    tcg_gen_atomic_cmpxchg_i64(retv, addr, cmpv, newv, index, memop);
+}
+
 static const uint8_t table_logic_cc[16] = {
     1, /* and */
     1, /* xor */
@@ -904,7 +1019,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
         tcg_temp_free_i32(tmp);
         
         // switch mode
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa32( cpu_env,
+	FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa32( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      tcg_const_i32( addr & ~1),
 	                              tcg_const_i32( !s->thumb ? 2 : 4 ),
@@ -913,7 +1028,7 @@ static inline void gen_bx_im(DisasContext *s, uint32_t addr)
 								    tcg_const_i32(0) ) );
     }
     else {
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa32( cpu_env,
+	FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa32( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      tcg_const_i32( addr & ~1),
 	                              tcg_const_i32( s->thumb ? 2 : 4 ),
@@ -935,7 +1050,7 @@ static inline void gen_bx(DisasContext *s, TCGv_i32 var)
    TCGv_i32 tmp = tcg_temp_new_i32();
    tcg_gen_ori_i32(tmp, var, 0);//mov
    tcg_gen_shli_i32(tmp, tmp, 1);// get size of next instruction by doing shift
-   FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa32( cpu_env,
+   FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa32( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      var,
 	                              tmp,
@@ -997,11 +1112,11 @@ static inline void gen_aa32_ld##SUFF(DisasContext *s, TCGv_i32 val,      \
     if (!IS_USER_ONLY && s->sctlr_b && BE32_XOR) {                       \
         TCGv addr_be = tcg_temp_new();                                   \
         tcg_gen_xori_i32(addr_be, addr, BE32_XOR);                       \
-        tcg_gen_qemu_ld_i32(val, addr_be, index, opc);                   \
+        arm_gen_qemu_ld_i32(s, val, addr_be, index, opc);                \
         tcg_temp_free(addr_be);                                          \
         return;                                                          \
     }                                                                    \
-    tcg_gen_qemu_ld_i32(val, addr, index, opc);                          \
+    arm_gen_qemu_ld_i32(s, val, addr, index, opc);                       \
 }
 
 #define DO_GEN_ST(SUFF, OPC, BE32_XOR)                                   \
@@ -1013,18 +1128,18 @@ static inline void gen_aa32_st##SUFF(DisasContext *s, TCGv_i32 val,      \
     if (!IS_USER_ONLY && s->sctlr_b && BE32_XOR) {                       \
         TCGv addr_be = tcg_temp_new();                                   \
         tcg_gen_xori_i32(addr_be, addr, BE32_XOR);                       \
-        tcg_gen_qemu_st_i32(val, addr_be, index, opc);                   \
+        arm_gen_qemu_st_i32(s, val, addr_be, index, opc);                \
         tcg_temp_free(addr_be);                                          \
         return;                                                          \
     }                                                                    \
-    tcg_gen_qemu_st_i32(val, addr, index, opc);                          \
+    arm_gen_qemu_st_i32(s, val, addr, index, opc);                       \
 }
 
 static inline void gen_aa32_ld64(DisasContext *s, TCGv_i64 val,
                                  TCGv_i32 addr, int index)
 {
     TCGMemOp opc = MO_Q | s->be_data;
-    tcg_gen_qemu_ld_i64(val, addr, index, opc);
+    arm_gen_qemu_ld_i64(s, val, addr, index, opc);
     /* Not needed for user-mode BE32, where we use MO_BE instead.  */
     if (!IS_USER_ONLY && s->sctlr_b) {
         tcg_gen_rotri_i64(val, val, 32);
@@ -1039,11 +1154,11 @@ static inline void gen_aa32_st64(DisasContext *s, TCGv_i64 val,
     if (!IS_USER_ONLY && s->sctlr_b) {
         TCGv_i64 tmp = tcg_temp_new_i64();
         tcg_gen_rotri_i64(tmp, val, 32);
-        tcg_gen_qemu_st_i64(tmp, addr, index, opc);
+        arm_gen_qemu_st_i64(s, tmp, addr, index, opc);
         tcg_temp_free_i64(tmp);
         return;
     }
-    tcg_gen_qemu_st_i64(val, addr, index, opc);
+    arm_gen_qemu_st_i64(s, val, addr, index, opc);
 }
 
 #else
@@ -1059,7 +1174,7 @@ static inline void gen_aa32_ld##SUFF(DisasContext *s, TCGv_i32 val,      \
     if (!IS_USER_ONLY && s->sctlr_b && BE32_XOR) {                       \
         tcg_gen_xori_i64(addr64, addr64, BE32_XOR);                      \
     }                                                                    \
-    tcg_gen_qemu_ld_i32(val, addr64, index, opc);                        \
+    arm_gen_qemu_ld_i32(s, val, addr64, index, opc);                     \
     tcg_temp_free(addr64);                                               \
 }
 
@@ -1074,7 +1189,7 @@ static inline void gen_aa32_st##SUFF(DisasContext *s, TCGv_i32 val,      \
     if (!IS_USER_ONLY && s->sctlr_b && BE32_XOR) {                       \
         tcg_gen_xori_i64(addr64, addr64, BE32_XOR);                      \
     }                                                                    \
-    tcg_gen_qemu_st_i32(val, addr64, index, opc);                        \
+    arm_gen_qemu_st_i32(s, val, addr64, index, opc);                     \
     tcg_temp_free(addr64);                                               \
 }
 
@@ -1084,7 +1199,7 @@ static inline void gen_aa32_ld64(DisasContext *s, TCGv_i64 val,
     TCGMemOp opc = MO_Q | s->be_data;
     TCGv addr64 = tcg_temp_new();
     tcg_gen_extu_i32_i64(addr64, addr);
-    tcg_gen_qemu_ld_i64(val, addr64, index, opc);
+    arm_gen_qemu_ld_i64(s, val, addr64, index, opc);
 
     /* Not needed for user-mode BE32, where we use MO_BE instead.  */
     if (!IS_USER_ONLY && s->sctlr_b) {
@@ -1104,10 +1219,10 @@ static inline void gen_aa32_st64(DisasContext *s, TCGv_i64 val,
     if (!IS_USER_ONLY && s->sctlr_b) {
         TCGv tmp = tcg_temp_new();
         tcg_gen_rotri_i64(tmp, val, 32);
-        tcg_gen_qemu_st_i64(tmp, addr64, index, opc);
+        arm_gen_qemu_st_i64(s, tmp, addr64, index, opc);
         tcg_temp_free(tmp);
     } else {
-        tcg_gen_qemu_st_i64(val, addr64, index, opc);
+        arm_gen_qemu_st_i64(s, val, addr64, index, opc);
     }
     tcg_temp_free(addr64);
 }
@@ -1126,6 +1241,40 @@ DO_GEN_ST(8, MO_UB, 3)
 DO_GEN_ST(16, MO_UW, 2)
 DO_GEN_ST(32, MO_UL, 0)
 
+/* The guest address of an access of @op that does not go through the
+   functions above, e.g. an atomic one.  */
+static TCGv gen_aa32_addr(DisasContext *s, TCGv_i32 a32, TCGMemOp op)
+{
+    TCGv addr = tcg_temp_new();
+
+    tcg_gen_extu_i32_tl(addr, a32);
+    /* Not needed for user-mode BE32, where we use MO_BE instead.  */
+    if (!IS_USER_ONLY && s->sctlr_b && (op & MO_SIZE) < MO_32) {
+        tcg_gen_xori_tl(addr, addr, 4 - (1 << (op & MO_SIZE)));
+    }
+    return addr;
+}
+
+/* SWP and SWPB, atomic like the store-exclusives, see
+   arm_gen_atomic_cmpxchg_i32 for the instrumented TBs.  */
+static void gen_aa32_swp(DisasContext *s, TCGv_i32 ret, TCGv_i32 val,
+                         TCGv_i32 a32, TCGMemOp opc)
+{
+    TCGv addr = gen_aa32_addr(s, a32, opc);
+
+    opc |= s->be_data;
+#ifdef CONFIG_FLEXUS
+    if (s->flexus_capture) {
+        arm_gen_qemu_ld_i32(s, ret, addr, get_mem_index(s), opc);
+        arm_gen_qemu_st_i32(s, val, addr, get_mem_index(s), opc);
+        tcg_temp_free(addr);
+        return;
+    }
+#endif
+    tcg_gen_atomic_xchg_i32(ret, addr, val, get_mem_index(s), opc);
+    tcg_temp_free(addr);
+}
+
 static inline void gen_set_pc_im(DisasContext *s, target_ulong val)
 {
     tcg_gen_movi_i32(cpu_R[15], val);
@@ -1421,7 +1570,7 @@ static inline void gen_vfp_ld(DisasContext *s, int dp, TCGv_i32 addr)
     if (dp) {
         gen_aa32_ld64(s, cpu_F0d, addr, get_mem_index(s));
         #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 8 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1429,7 +1578,7 @@ static inline void gen_vfp_ld(DisasContext *s, int dp, TCGv_i32 addr)
     } else {
         gen_aa32_ld32u(s, cpu_F0s, addr, get_mem_index(s));
         #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 4 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1442,7 +1591,7 @@ static inline void gen_vfp_st(DisasContext *s, int dp, TCGv_i32 addr)
     if (dp) {
         gen_aa32_st64(s, cpu_F0d, addr, get_mem_index(s));
         #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				  addr, tcg_const_i32( 8 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1450,7 +1599,7 @@ static inline void gen_vfp_st(DisasContext *s, int dp, TCGv_i32 addr)
     } else {
         gen_aa32_st32(s, cpu_F0s, addr, get_mem_index(s));
         #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				  addr, tcg_const_i32( 4 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1792,7 +1941,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                 tmp = tcg_temp_new_i32();
                 gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
                 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					  addr, tcg_const_i32( 4 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1804,7 +1953,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                     if (insn & (1 << 22)) {		/* WLDRD */
                         gen_aa32_ld64(s, cpu_M0, addr, get_mem_index(s));
 			#ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					          addr, tcg_const_i32( 8 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1814,7 +1963,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                         tmp = tcg_temp_new_i32();
                         gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					          addr, tcg_const_i32( 4 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1825,7 +1974,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                     if (insn & (1 << 22)) {		/* WLDRH */
                         gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					          addr, tcg_const_i32( 2 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1833,7 +1982,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                     } else {				/* WLDRB */
                         gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					          addr, tcg_const_i32( 1 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1851,7 +2000,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                 tmp = iwmmxt_load_creg(wrd);
                 gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 			                  addr, tcg_const_i32( 4 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1863,7 +2012,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                     if (insn & (1 << 22)) {		/* WSTRD */
                         gen_aa32_st64(s, cpu_M0, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 			                          addr, tcg_const_i32( 8 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1872,7 +2021,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                         tcg_gen_extrl_i64_i32(tmp, cpu_M0);
                         gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 			                          addr, tcg_const_i32( 4 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1883,7 +2032,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                         tcg_gen_extrl_i64_i32(tmp, cpu_M0);
                         gen_aa32_st16(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 			                          addr, tcg_const_i32( 2 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -1892,7 +2041,7 @@ static int disas_iwmmxt_insn(DisasContext *s, uint32_t insn)
                         tcg_gen_extrl_i64_i32(tmp, cpu_M0);
                         gen_aa32_st8(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		        FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		        FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 			                          addr, tcg_const_i32( 1 /* size */ ),
 					          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -2963,7 +3112,7 @@ static TCGv_i32 gen_load_and_replicate(DisasContext *s, TCGv_i32 addr, int size)
     case 0:
         gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 1 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -2973,7 +3122,7 @@ static TCGv_i32 gen_load_and_replicate(DisasContext *s, TCGv_i32 addr, int size)
     case 1:
         gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 2 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -2983,7 +3132,7 @@ static TCGv_i32 gen_load_and_replicate(DisasContext *s, TCGv_i32 addr, int size)
     case 2:
         gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 4 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4237,7 +4386,7 @@ static inline void gen_jmp (DisasContext *s, uint32_t dest)
         gen_bx_im(s, dest);
     } else {
 #ifdef CONFIG_FLEXUS
-      FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa32( cpu_env,
+      FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa32( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      tcg_const_i32( dest),
 	                              tcg_const_i32( s->thumb ? 2 : 4 ),
@@ -4885,7 +5034,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                 if (load) {
                     gen_aa32_ld64(s, tmp64, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					      addr, tcg_const_i32( 8 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4895,7 +5044,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                     neon_load_reg64(tmp64, rd);
                     gen_aa32_st64(s, tmp64, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					      addr, tcg_const_i32( 8 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4910,7 +5059,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                             tmp = tcg_temp_new_i32();
                             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					              addr, tcg_const_i32( 4 /* size */ ),
 					              tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4920,7 +5069,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                             tmp = neon_load_reg(rd, pass);
                             gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		            FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					      addr, tcg_const_i32( 4 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4933,7 +5082,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                             tmp = tcg_temp_new_i32();
                             gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		            FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					              addr, tcg_const_i32( 2 /* size */ ),
 					              tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4942,7 +5091,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                             tmp2 = tcg_temp_new_i32();
                             gen_aa32_ld16u(s, tmp2, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		            FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					              addr, tcg_const_i32( 2 /* size */ ),
 					              tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4958,7 +5107,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                             tcg_gen_shri_i32(tmp2, tmp, 16);
                             gen_aa32_st16(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		            FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					              addr, tcg_const_i32( 2 /* size */ ),
 					              tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4967,7 +5116,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                             tcg_gen_addi_i32(addr, addr, stride);
                             gen_aa32_st16(s, tmp2, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		            FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					              addr, tcg_const_i32( 2 /* size */ ),
 					              tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -4982,7 +5131,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                                 tmp = tcg_temp_new_i32();
                                 gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		                FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		                FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					                  addr, tcg_const_i32( 1 /* size */ ),
 					                  tcg_const_i32(IS_USER(s)),
 										   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -5008,7 +5157,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                                 }
                                 gen_aa32_st8(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		                FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		                FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					                  addr, tcg_const_i32( 1 /* size */ ),
 					                  tcg_const_i32(IS_USER(s)),
 										   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -5138,7 +5287,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                     case 0:
                         gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 1 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -5147,7 +5296,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                     case 1:
                         gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 2 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -5156,7 +5305,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                     case 2:
                         gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 4 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -5180,7 +5329,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                     case 0:
                         gen_aa32_st8(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 						  addr, tcg_const_i32( 1 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -5189,7 +5338,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                     case 1:
                         gen_aa32_st16(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 						  addr, tcg_const_i32( 2 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -5198,7 +5347,7 @@ static int disas_neon_ls_insn(DisasContext *s, uint32_t insn)
                     case 2:
                         gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 						  addr, tcg_const_i32( 4 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -7953,9 +8102,8 @@ static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
    the architecturally mandated semantics, and avoids having to monitor
    regular stores.
 
-   In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
-   throw an exception and handle the atomic operation elsewhere.  */
+   The comparison and the store are one compare-and-swap, atomic on the
+   host whenever other vCPUs or guest threads run at the same time.  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i32 addr, int size)
 {
@@ -7967,7 +8115,7 @@ static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
     case 0:
         gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 1 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -7976,45 +8124,61 @@ static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
     case 1:
         gen_aa32_ld16ua(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 2 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
 #endif
         break;
     case 2:
-    case 3:
         gen_aa32_ld32ua(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  addr, tcg_const_i32( 4 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
 #endif
         break;
-    default:
-        abort();
-    }
-
-    if (size == 3) {
+    case 3:
+    {
         TCGv_i32 tmp2 = tcg_temp_new_i32();
-        TCGv_i32 tmp3 = tcg_temp_new_i32();
-
-        tcg_gen_addi_i32(tmp2, addr, 4);
-        gen_aa32_ld32u(s, tmp3, tmp2, get_mem_index(s));
+        TCGv_i64 t64 = tcg_temp_new_i64();
+        TCGv taddr = gen_aa32_addr(s, addr, MO_Q);
+
+        /* Rt is the word at the lower address whatever the endianness, so
+           split a single 64-bit access instead of using gen_aa32_ld64:
+           the store-exclusive compares the doubleword at once.  */
+        arm_gen_qemu_ld_i64(s, t64, taddr, get_mem_index(s),
+                            MO_Q | MO_ALIGN | s->be_data);
+        tcg_temp_free(taddr);
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
+				  addr, tcg_const_i32( 4 /* size */ ),
+				  tcg_const_i32(IS_USER(s)),
+							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
+        tcg_gen_addi_i32(tmp2, addr, 4);
+	FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				  tmp2, tcg_const_i32( 4 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
 #endif
-        tcg_temp_free_i32(tmp2);
-        tcg_gen_concat_i32_i64(cpu_exclusive_val, tmp, tmp3);
-        store_reg(s, rt2, tmp3);
-    } else {
-        tcg_gen_extu_i32_i64(cpu_exclusive_val, tmp);
+        tcg_gen_mov_i64(cpu_exclusive_val, t64);
+        if (s->be_data == MO_BE) {
+            tcg_gen_extr_i64_i32(tmp2, tmp, t64);
+        } else {
+            tcg_gen_extr_i64_i32(tmp, tmp2, t64);
+        }
+        tcg_temp_free_i64(t64);
+        store_reg(s, rt2, tmp2);
+        break;
+    }
+    default:
+        abort();
     }
 
+    if (size < 3) {
+        tcg_gen_extu_i32_i64(cpu_exclusive_val, tmp);
+    }
     store_reg(s, rt, tmp);
     tcg_gen_extu_i32_i64(cpu_exclusive_addr, addr);
 }
@@ -8024,21 +8188,40 @@ static void gen_clrex(DisasContext *s)
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
 }
 
-#ifdef CONFIG_USER_ONLY
-static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
-                                TCGv_i32 addr, int size)
+/* The accesses only need ordering when other vCPUs run at the same time */
+static void gen_mb(void)
 {
-    tcg_gen_extu_i32_i64(cpu_exclusive_test, addr);
-    tcg_gen_movi_i32(cpu_exclusive_info,
-                     size | (rd << 4) | (rt << 8) | (rt2 << 12));
-    gen_exception_internal_insn(s, 4, EXCP_STREX);
+    if (qemu_tcg_mttcg_enabled()) {
+        gen_helper_memory_barrier();
+    }
 }
-#else
+
+/* A store-release is ordered after the earlier accesses and before a
+ * later load-acquire, a load-acquire before the later accesses; the host
+ * already keeps most of that order when TCG_TARGET_TSO, and the atomic
+ * store-exclusive is a full barrier.
+ */
+static void gen_lasr_mb_before(bool is_store)
+{
+    if (is_store && !TCG_TARGET_TSO) {
+        gen_mb();
+    }
+}
+
+static void gen_lasr_mb_after(bool is_store, bool is_excl)
+{
+    if (is_store ? !is_excl : !TCG_TARGET_TSO) {
+        gen_mb();
+    }
+}
+
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv_i32 addr, int size)
 {
-    TCGv_i32 tmp;
-    TCGv_i64 val64, extaddr;
+    TCGMemOp opc = size | MO_ALIGN | s->be_data;
+    TCGv_i32 laddr, t0, t1, t2;
+    TCGv_i64 extaddr;
+    TCGv taddr;
     TCGLabel *done_label;
     TCGLabel *fail_label;
 
@@ -8050,102 +8233,73 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
        } */
     fail_label = gen_new_label();
     done_label = gen_new_label();
+
+    /* Copy input into a local temp so it is not trashed when the
+       basic block ends at the branch insn.  */
+    laddr = tcg_temp_local_new_i32();
+    tcg_gen_mov_i32(laddr, addr);
     extaddr = tcg_temp_new_i64();
-    tcg_gen_extu_i32_i64(extaddr, addr);
+    tcg_gen_extu_i32_i64(extaddr, laddr);
     tcg_gen_brcond_i64(TCG_COND_NE, extaddr, cpu_exclusive_addr, fail_label);
     tcg_temp_free_i64(extaddr);
 
-    tmp = tcg_temp_new_i32();
-    switch (size) {
-    case 0:
-        gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
-
-        break;
-    case 1:
-        gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
-
-        break;
-    case 2:
-    case 3:
-        gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
+    taddr = gen_aa32_addr(s, laddr, opc);
+    t0 = tcg_temp_new_i32();
+    t1 = load_reg(s, rt);
+    if (size == 3) {
+        TCGv_i64 o64 = tcg_temp_new_i64();
+        TCGv_i64 n64 = tcg_temp_new_i64();
 
-        break;
-    default:
-        abort();
-    }
+        /* Rt goes to the lower address, see gen_load_exclusive */
+        t2 = load_reg(s, rt2);
+        if (s->be_data == MO_BE) {
+            tcg_gen_concat_i32_i64(n64, t2, t1);
+        } else {
+            tcg_gen_concat_i32_i64(n64, t1, t2);
+        }
+        tcg_temp_free_i32(t2);
 
-    val64 = tcg_temp_new_i64();
-    if (size == 3) {
-        TCGv_i32 tmp2 = tcg_temp_new_i32();
-        TCGv_i32 tmp3 = tcg_temp_new_i32();
-        tcg_gen_addi_i32(tmp2, addr, 4);
-        gen_aa32_ld32u(s, tmp3, tmp2, get_mem_index(s));
+        arm_gen_atomic_cmpxchg_i64(s, o64, taddr, cpu_exclusive_val, n64,
+                                   get_mem_index(s), opc);
+        tcg_temp_free_i64(n64);
 
-        tcg_temp_free_i32(tmp2);
-        tcg_gen_concat_i32_i64(val64, tmp, tmp3);
-        tcg_temp_free_i32(tmp3);
+        tcg_gen_setcond_i64(TCG_COND_NE, o64, o64, cpu_exclusive_val);
+        tcg_gen_extrl_i64_i32(t0, o64);
+        tcg_temp_free_i64(o64);
     } else {
-        tcg_gen_extu_i32_i64(val64, tmp);
+        t2 = tcg_temp_new_i32();
+        tcg_gen_extrl_i64_i32(t2, cpu_exclusive_val);
+        arm_gen_atomic_cmpxchg_i32(s, t0, taddr, t2, t1,
+                                   get_mem_index(s), opc);
+        tcg_gen_setcond_i32(TCG_COND_NE, t0, t0, t2);
+        tcg_temp_free_i32(t2);
     }
-    tcg_temp_free_i32(tmp);
-
-    tcg_gen_brcond_i64(TCG_COND_NE, val64, cpu_exclusive_val, fail_label);
-    tcg_temp_free_i64(val64);
+    tcg_temp_free_i32(t1);
+    tcg_temp_free(taddr);
+    tcg_gen_brcondi_i32(TCG_COND_NE, t0, 0, fail_label);
+    tcg_temp_free_i32(t0);
 
-    tmp = load_reg(s, rt);
-    switch (size) {
-    case 0:
-        gen_aa32_st8(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
-				  addr, tcg_const_i32( 1 /* size */ ),
-				  tcg_const_i32(IS_USER(s)),
-							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
-#endif
-        break;
-    case 1:
-        gen_aa32_st16(s, tmp, addr, get_mem_index(s));
-#ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
-				  addr, tcg_const_i32( 2 /* size */ ),
-				  tcg_const_i32(IS_USER(s)),
-							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
-#endif
-        break;
-    case 2:
-    case 3:
-        gen_aa32_st32(s, tmp, addr, get_mem_index(s));
-#ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
-				  addr, tcg_const_i32( 4 /* size */ ),
-				  tcg_const_i32(IS_USER(s)),
-							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
-#endif
-        break;
-    default:
-        abort();
-    }
-    tcg_temp_free_i32(tmp);
+    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
+			      laddr, tcg_const_i32( size == 3 ? 4 : 1 << size ),
+			      tcg_const_i32(IS_USER(s)),
+						       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
     if (size == 3) {
-        tcg_gen_addi_i32(addr, addr, 4);
-        tmp = load_reg(s, rt2);
-        gen_aa32_st32(s, tmp, addr, get_mem_index(s));
-#ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
-				  addr, tcg_const_i32( 4 /* size */ ),
+        tcg_gen_addi_i32(laddr, laddr, 4);
+	FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
+				  laddr, tcg_const_i32( 4 /* size */ ),
 				  tcg_const_i32(IS_USER(s)),
 							   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
-#endif
-        tcg_temp_free_i32(tmp);
     }
+#endif
     tcg_gen_movi_i32(cpu_R[rd], 0);
     tcg_gen_br(done_label);
     gen_set_label(fail_label);
     tcg_gen_movi_i32(cpu_R[rd], 1);
     gen_set_label(done_label);
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
+    tcg_temp_free_i32(laddr);
 }
-#endif
 
 /* gen_srs:
  * @env: CPUARMState
@@ -8367,7 +8521,8 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             case 4: /* dsb */
             case 5: /* dmb */
                 ARCH(7);
-                /* We don't emulate caches so these are a no-op.  */
+                /* We don't emulate caches, only the access ordering.  */
+                gen_mb();
                 return;
             case 6: /* isb */
                 /* We need to break the TB after this insn to execute
@@ -8406,7 +8561,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             tmp = tcg_temp_new_i32();
             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				      addr, tcg_const_i32( 4 /* size */ ),
 				      tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -8415,7 +8570,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
             tmp2 = tcg_temp_new_i32();
             gen_aa32_ld32u(s, tmp2, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				      addr, tcg_const_i32( 4 /* size */ ),
 				      tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -8904,6 +9059,9 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
 	    if( rd == rn && rn == rm && rd != 16 && rd != 1 ) {
 	      printf("Detected potential magic instructions: %d\n", rd);
 	      gen_helper_flexus_magic_ins( tcg_const_i32(rd) );
+	      // the magic instruction may toggle the simulation, end the TB
+	      // so that the next one is looked up with the new TB flags
+	      s->is_jmp = DISAS_UPDATE;
 	    }
 #endif
             tcg_gen_or_i32(tmp, tmp, tmp2);
@@ -9052,9 +9210,9 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         addr = tcg_temp_local_new_i32();
                         load_reg_var(s, addr, rn);
 
-                        /* Since the emulation does not have barriers,
-                           the acquire/release semantics need no special
-                           handling */
+                        if (op2 != 3) {
+                            gen_lasr_mb_before(!(insn & (1 << 20)));
+                        }
                         if (op2 == 0) {
                             if (insn & (1 << 20)) {
                                 tmp = tcg_temp_new_i32();
@@ -9063,7 +9221,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                     gen_aa32_ld32u(s, tmp, addr,
                                                    get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-				    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+				    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 							      addr, tcg_const_i32( 4 /* size */ ),
 							      tcg_const_i32(IS_USER(s)),
 										       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9073,7 +9231,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                     gen_aa32_ld8u(s, tmp, addr,
                                                   get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-				    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+				    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 							      addr, tcg_const_i32( 1 /* size */ ),
 							      tcg_const_i32(IS_USER(s)),
 										       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9083,7 +9241,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                     gen_aa32_ld16u(s, tmp, addr,
                                                    get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-				    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+				    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 							      addr, tcg_const_i32( 2 /* size */ ),
 							      tcg_const_i32(IS_USER(s)),
 										       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9101,7 +9259,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                     gen_aa32_st32(s, tmp, addr,
                                                   get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-				    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+				    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 							      addr, tcg_const_i32( 4 /* size */ ),
 							      tcg_const_i32(IS_USER(s)),
 										       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9111,7 +9269,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                     gen_aa32_st8(s, tmp, addr,
                                                  get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-				    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+				    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 							      addr, tcg_const_i32( 1 /* size */ ),
 							      tcg_const_i32(IS_USER(s)),
 										       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9121,7 +9279,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                     gen_aa32_st16(s, tmp, addr,
                                                   get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-				    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+				    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 							      addr, tcg_const_i32( 2 /* size */ ),
 							      tcg_const_i32(IS_USER(s)),
 										       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9168,39 +9326,37 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                                 abort();
                             }
                         }
+                        if (op2 != 3) {
+                            gen_lasr_mb_after(!(insn & (1 << 20)), op2 == 2);
+                        }
                         tcg_temp_free_i32(addr);
                     } else {
                         /* SWP instruction */
                         rm = (insn) & 0xf;
 
-                        /* ??? This is not really atomic.  However we know
-                           we never have multiple CPUs running in parallel,
-                           so it is good enough.  */
                         addr = load_reg(s, rn);
                         tmp = load_reg(s, rm);
                         tmp2 = tcg_temp_new_i32();
                         if (insn & (1 << 22)) {
-                            gen_aa32_ld8u(s, tmp2, addr, get_mem_index(s));
-                            gen_aa32_st8(s, tmp, addr, get_mem_index(s));
+                            gen_aa32_swp(s, tmp2, tmp, addr, MO_UB);
 #ifdef CONFIG_FLEXUS
-			    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						      addr, tcg_const_i32( 1 /* size */ ),
 						      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(1)) );
-			    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 						      addr, tcg_const_i32( 1 /* size */ ),
 						      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(1)) );
 #endif
                         } else {
-                            gen_aa32_ld32u(s, tmp2, addr, get_mem_index(s));
-                            gen_aa32_st32(s, tmp, addr, get_mem_index(s));
+                            gen_aa32_swp(s, tmp2, tmp, addr, MO_UL);
 #ifdef CONFIG_FLEXUS
-			    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						      addr, tcg_const_i32( 4 /* size */ ),
 						      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(1)) );
-			    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 						      addr, tcg_const_i32( 4 /* size */ ),
 						      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(1)) );
@@ -9241,7 +9397,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         tmp = load_reg(s, rd);
                         gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 						  addr, tcg_const_i32( 4 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9251,7 +9407,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         tmp = load_reg(s, rd + 1);
                         gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 						  addr, tcg_const_i32( 4 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9262,7 +9418,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         tmp = tcg_temp_new_i32();
                         gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 4 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9272,7 +9428,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                         tmp = tcg_temp_new_i32();
                         gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 4 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9287,7 +9443,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                     case 1:
                         gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 2 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9296,7 +9452,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                     case 2:
                         gen_aa32_ld8s(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 1 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9306,7 +9462,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                     case 3:
                         gen_aa32_ld16s(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 2 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9318,7 +9474,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                     tmp = load_reg(s, rd);
                     gen_aa32_st16(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 			                      addr, tcg_const_i32( 2 /* size */ ),
 			                      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9677,7 +9833,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 if (insn & (1 << 22)) {
                     gen_aa32_ld8u(s, tmp, tmp2, i);
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					      tmp2, tcg_const_i32( 1 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9685,7 +9841,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 } else {
                     gen_aa32_ld32u(s, tmp, tmp2, i);
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					      tmp2, tcg_const_i32( 4 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9697,7 +9853,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 if (insn & (1 << 22)) {
                     gen_aa32_st8(s, tmp, tmp2, i);
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					      tmp2, tcg_const_i32( 1 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9705,7 +9861,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                 } else {
                     gen_aa32_st32(s, tmp, tmp2, i);
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					      tmp2, tcg_const_i32( 4 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9784,7 +9940,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                             tmp = tcg_temp_new_i32();
                             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		            FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					              addr, tcg_const_i32( 4 /* size */ ),
 					              tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -9817,7 +9973,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                             }
                             gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		            FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		            FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					              addr, tcg_const_i32( 4 /* size */ ),
 					              tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10090,7 +10246,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp = tcg_temp_new_i32();
                     gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				              addr, tcg_const_i32( 4 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10100,7 +10256,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp = tcg_temp_new_i32();
                     gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 		                              addr, tcg_const_i32( 4 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10111,7 +10267,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp = load_reg(s, rs);
                     gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				              addr, tcg_const_i32( 4 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10121,7 +10277,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp = load_reg(s, rd);
                     gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-        	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+        	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				              addr, tcg_const_i32( 4 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10165,7 +10321,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp = tcg_temp_new_i32();
                     gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				              addr, tcg_const_i32( 2 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10176,7 +10332,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp = tcg_temp_new_i32();
                     gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-         	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+         	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 	                  		      addr, tcg_const_i32( 1 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10212,6 +10368,9 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 }
                 addr = tcg_temp_local_new_i32();
                 load_reg_var(s, addr, rn);
+                if (op2 >= 2) {
+                    gen_lasr_mb_before(!(insn & (1 << 20)));
+                }
                 if (!(op2 & 1)) {
                     if (insn & (1 << 20)) {
                         tmp = tcg_temp_new_i32();
@@ -10219,7 +10378,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         case 0: /* ldab */
                             gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-                	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+                	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				                      addr, tcg_const_i32( 1 /* size */ ),
 				                      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10228,7 +10387,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         case 1: /* ldah */
                             gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-                	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+                	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				                      addr, tcg_const_i32( 2 /* size */ ),
 				                      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10237,7 +10396,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         case 2: /* lda */
                             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-                	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+                	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				                      addr, tcg_const_i32( 4 /* size */ ),
 				                      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10253,7 +10412,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         case 0: /* stlb */
                             gen_aa32_st8(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-                	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+                	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				                      addr, tcg_const_i32( 1 /* size */ ),
 				                      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10262,7 +10421,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         case 1: /* stlh */
                             gen_aa32_st16(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-                	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+                	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				                      addr, tcg_const_i32( 2 /* size */ ),
 				                      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10271,7 +10430,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         case 2: /* stl */
                             gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-                	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+                	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				                      addr, tcg_const_i32( 4 /* size */ ),
 				                      tcg_const_i32(IS_USER(s)),
 									       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10287,6 +10446,9 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                 } else {
                     gen_store_exclusive(s, rm, rs, rd, addr, op);
                 }
+                if (op2 >= 2) {
+                    gen_lasr_mb_after(!(insn & (1 << 20)), op2 == 3);
+                }
                 tcg_temp_free_i32(addr);
             }
         } else {
@@ -10305,7 +10467,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp = tcg_temp_new_i32();
                     gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 		                              addr, tcg_const_i32( 4 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10314,7 +10476,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                     tmp2 = tcg_temp_new_i32();
                     gen_aa32_ld32u(s, tmp2, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 		                              addr, tcg_const_i32( 4 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10359,7 +10521,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         tmp = tcg_temp_new_i32();
                         gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 		                                  addr, tcg_const_i32( 4 /* size */ ),
 				                  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10377,7 +10539,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                         tmp = load_reg(s, i);
                         gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 		                                  addr, tcg_const_i32( 4 /* size */ ),
 				                  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -10971,7 +11133,8 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
                             break;
                         case 4: /* dsb */
                         case 5: /* dmb */
-                            /* These execute as NOPs.  */
+                            /* These only order the accesses.  */
+                            gen_mb();
                             break;
                         case 6: /* isb */
                             /* We need to break the TB after this insn
@@ -11345,7 +11508,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 0:
                 gen_aa32_ld8u(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					  addr, tcg_const_i32( 1 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11354,7 +11517,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 4:
                 gen_aa32_ld8s(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					  addr, tcg_const_i32( 1 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11363,7 +11526,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 1:
                 gen_aa32_ld16u(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					  addr, tcg_const_i32( 2 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11372,7 +11535,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 5:
                 gen_aa32_ld16s(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					  addr, tcg_const_i32( 2 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11381,7 +11544,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 2:
                 gen_aa32_ld32u(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					  addr, tcg_const_i32( 4 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11404,7 +11567,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 0:
                 gen_aa32_st8(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					  addr, tcg_const_i32( 1 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11413,7 +11576,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 1:
                 gen_aa32_st16(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					  addr, tcg_const_i32( 2 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11422,7 +11585,7 @@ static int disas_thumb2_insn(CPUARMState *env, DisasContext *s, uint16_t insn_hw
             case 2:
                 gen_aa32_st32(s, tmp, addr, memidx);
 #ifdef CONFIG_FLEXUS
-		FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 					  addr, tcg_const_i32( 4 /* size */ ),
 					  tcg_const_i32(IS_USER(s)),
 								   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11565,7 +11728,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = tcg_temp_new_i32();
             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 4 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11774,7 +11937,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 0: /* str */
             gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				 addr, tcg_const_i32( 4 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11783,7 +11946,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 1: /* strh */
             gen_aa32_st16(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				 addr, tcg_const_i32( 2 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11792,7 +11955,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 2: /* strb */
             gen_aa32_st8(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				 addr, tcg_const_i32( 1 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11801,7 +11964,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 3: /* ldrsb */
             gen_aa32_ld8s(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 1 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11810,7 +11973,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 4: /* ldr */
             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 4 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11819,7 +11982,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 5: /* ldrh */
             gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 2 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11828,7 +11991,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 6: /* ldrb */
             gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 1 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11837,7 +12000,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
         case 7: /* ldrsh */
             gen_aa32_ld16s(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 2 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11865,7 +12028,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = tcg_temp_new_i32();
             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 4 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11876,7 +12039,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = load_reg(s, rd);
             gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				 addr, tcg_const_i32( 4 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11899,7 +12062,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = tcg_temp_new_i32();
             gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 1 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11910,7 +12073,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = load_reg(s, rd);
             gen_aa32_st8(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				 addr, tcg_const_i32( 1 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11933,7 +12096,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = tcg_temp_new_i32();
             gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 2 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11944,7 +12107,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = load_reg(s, rd);
             gen_aa32_st16(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				 addr, tcg_const_i32( 2 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11966,7 +12129,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = tcg_temp_new_i32();
             gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 				 addr, tcg_const_i32( 4 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -11977,7 +12140,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
             tmp = load_reg(s, rd);
             gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-	    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+	    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 				 addr, tcg_const_i32( 4 /* size */ ),
 				 tcg_const_i32(IS_USER(s)),
 							       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -12051,7 +12214,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                         tmp = tcg_temp_new_i32();
                         gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 						  addr, tcg_const_i32( 4 /* size */ ),
 						  tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -12062,7 +12225,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                         tmp = load_reg(s, i);
                         gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-			FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+			FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 			                          addr, tcg_const_i32( 4 /* size */ ),
 			                          tcg_const_i32(IS_USER(s)),
 									   tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -12080,7 +12243,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                     tmp = tcg_temp_new_i32();
                     gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					      addr, tcg_const_i32( 4 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -12092,7 +12255,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                     tmp = load_reg(s, 14);
                     gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-                    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+                    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 		                 	      addr, tcg_const_i32( 4 /* size */ ),
 				              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -12227,7 +12390,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                     tmp = tcg_temp_new_i32();
                     gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_ld_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_ld_aa32(cpu_env,
 					      addr, tcg_const_i32( 4 /* size */ ),
 					      tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -12242,7 +12405,7 @@ static void disas_thumb_insn(CPUARMState *env, DisasContext *s)
                     tmp = load_reg(s, i);
                     gen_aa32_st32(s, tmp, addr, get_mem_index(s));
 #ifdef CONFIG_FLEXUS
-		    FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_st_aa32(cpu_env,
+		    FLEXUS_IF_LS( gen_helper_flexus_st_aa32(cpu_env,
 		                              addr, tcg_const_i32( 4 /* size */ ),
 		                              tcg_const_i32(IS_USER(s)),
 								       tcg_const_tl(flexus_ins_pc), tcg_const_i32(0)) );
@@ -12403,6 +12566,13 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
     dc->c15_cpar = ARM_TBFLAG_XSCALE_CPAR(tb->flags);
     dc->cp_regs = cpu->cp_regs;
     dc->features = env->features;
+#ifdef CONFIG_FLEXUS
+    flexus_tb_simulating = ARM_TBFLAG_FLEXUS(tb->flags);
+    flexus_tb_fetch = flexus_tb_simulating
+                      && !ARM_TBFLAG_FLEXUS_NOFETCH(tb->flags);
+    flexus_tb_ls = flexus_tb_simulating && !ARM_TBFLAG_FLEXUS_NOLS(tb->flags);
+    dc->flexus_capture = flexus_tb_ls;
+#endif
 
     /* Single step state. The code-generation logic here is:
      *  SS_ACTIVE == 0:
@@ -12561,8 +12731,9 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
 
 
 #ifdef CONFIG_FLEXUS
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_periodic(cpu_env) );
-	FLEXUS_IF_IN_SIMULATION( gen_helper_flexus_insn_fetch_aa32( cpu_env,
+	if( flexus_tb_simulating )
+	  gen_helper_flexus_periodic(cpu_env);
+	FLEXUS_IF_FETCH( gen_helper_flexus_insn_fetch_aa32( cpu_env,
 				      tcg_const_tl(flexus_ins_pc),
 				      tcg_const_i32(dc->thumb ? flexus_ins_pc + 2 : flexus_ins_pc + 4),
 	                              tcg_const_i32( dc->thumb ? 2 : 4 ),
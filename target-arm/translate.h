@@ -62,6 +62,10 @@ typedef struct DisasContext {
 #define TMP_A64_MAX 16
     int tmp_a64_count;
     TCGv_i64 tmp_a64[TMP_A64_MAX];
+#ifdef CONFIG_FLEXUS
+    /* Make guest accesses through helper_flexus_qemu_ld/st */
+    bool flexus_capture;
+#endif
 } DisasContext;
 
 typedef struct DisasCompare {
@@ -75,10 +79,7 @@ extern TCGv_env cpu_env;
 extern TCGv_i32 cpu_NF, cpu_ZF, cpu_CF, cpu_VF;
 extern TCGv_i64 cpu_exclusive_addr;
 extern TCGv_i64 cpu_exclusive_val;
-#ifdef CONFIG_USER_ONLY
-extern TCGv_i64 cpu_exclusive_test;
-extern TCGv_i32 cpu_exclusive_info;
-#endif
+extern TCGv_i64 cpu_exclusive_high;
 
 static inline int arm_dc_feature(DisasContext *dc, int feature)
 {
@@ -152,4 +153,19 @@ void arm_free_cc(DisasCompare *cmp);
 void arm_jump_cc(DisasCompare *cmp, TCGLabel *label);
 void arm_gen_test_cc(int cc, TCGLabel *label);
 
+void arm_gen_qemu_ld_i32(DisasContext *s, TCGv_i32 val, TCGv addr,
+                         int index, TCGMemOp memop);
+void arm_gen_qemu_st_i32(DisasContext *s, TCGv_i32 val, TCGv addr,
+                         int index, TCGMemOp memop);
+void arm_gen_qemu_ld_i64(DisasContext *s, TCGv_i64 val, TCGv addr,
+                         int index, TCGMemOp memop);
+void arm_gen_qemu_st_i64(DisasContext *s, TCGv_i64 val, TCGv addr,
+                         int index, TCGMemOp memop);
+void arm_gen_atomic_cmpxchg_i32(DisasContext *s, TCGv_i32 retv, TCGv addr,
+                                TCGv_i32 cmpv, TCGv_i32 newv,
+                                int index, TCGMemOp memop);
+void arm_gen_atomic_cmpxchg_i64(DisasContext *s, TCGv_i64 retv, TCGv addr,
+                                TCGv_i64 cmpv, TCGv_i64 newv,
+                                int index, TCGMemOp memop);
+
 #endif /* TARGET_ARM_TRANSLATE_H */
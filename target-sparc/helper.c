@@ -23,10 +23,11 @@
 #include "exec/helper-proto.h"
 #include "sysemu/sysemu.h"
 
-#if defined(CONFIG_FLEXUS) || defined(CONFIG_TEST_DETERMINISM) || defined(CONFIG_TEST_TIME)
+#if defined(CONFIG_FLEXUS) || defined(CONFIG_TEST_DETERMINISM)
 #define QEMUFLEX_PROTOTYPES
 #define QEMUFLEX_QEMU_INTERNAL
 #include "libqemuflex/api.h"
+#include "libqemuflex/bench.h"
 #include "exec/memory.h"
 #include "exec/address-spaces.h"
 #include "exec/cpu_ldst.h"
@@ -316,15 +317,13 @@ CPUState *cs = (CPUState*)cs_;
 	return cs->as;
 }
 
+int cpu_read_arch_state(void *cs_, QEMU_arch_state_t *state) {
+  // QEMU_arch_state_t only describes ARM cpus
+  return -1;
+}
+
 physical_address_t mmu_logical_to_physical(void *cs_, logical_address_t va) {
-  CPUState *cs = (CPUState*)cs_;
-	physical_address_t pa = cpu_get_phys_page_debug(cs, (va & TARGET_PAGE_MASK));
-	// assuming phys address and logical address are the right size
-    // this gets the page then we need to do get the place in the page using va
-    // logical_address_t mask = 0x0000000000000FFF; 
-	// The offset seems to be 12bits for 32bit or 64bit addresses
-    pa = pa + (va & ~TARGET_PAGE_MASK);
-	return pa;
+  return tlb_vaddr_to_paddr((CPUState*)cs_, va);
 }
 
 uint64_t readReg(void *cs_, int reg_idx, int reg_type) {
@@ -594,11 +593,11 @@ void helper_flexus_ld(CPUSPARCState *env, target_ulong addr, target_ulong pc, in
     
     target_ulong phys_address;
     // Getting page physical address
-    phys_address = env->tlb_table[mmu_idx][index].paddr;
+    phys_address = env->iotlb[mmu_idx][index].paddr;
     // Resolving physical address by adding offset inside the page
     phys_address += addr & ~TARGET_PAGE_MASK;
 
-    uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     int io = 0;
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -770,11 +769,11 @@ void helper_flexus_ld_asi(CPUSPARCState *env, target_ulong addr, target_ulong pc
 
     target_ulong phys_address;
     // Getting page physical address
-    phys_address = env->tlb_table[mmu_idx][index].paddr;
+    phys_address = env->iotlb[mmu_idx][index].paddr;
     // Resolving physical address by adding offset inside the page
     phys_address += addr & ~TARGET_PAGE_MASK;
 
-    uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     int io = 0;
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -900,11 +899,11 @@ void helper_flexus_ldf_asi(CPUSPARCState *env, target_ulong addr, target_ulong p
 
 	target_ulong phys_address;
 	// Getting page physical address
-	phys_address = env->tlb_table[mmu_idx][index].paddr;
+	phys_address = env->iotlb[mmu_idx][index].paddr;
 	// Resolving physical address by adding offset inside the page
 	phys_address += addr & ~TARGET_PAGE_MASK;
 
-    	uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    	uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
    	int io = 0;
     	if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -961,11 +960,11 @@ void helper_flexus_ldda_asi(CPUSPARCState *env, target_ulong addr, target_ulong
 
 	target_ulong phys_address;
 	// Getting page physical address
-	phys_address = env->tlb_table[4][index].paddr;
+	phys_address = env->iotlb[4][index].paddr;
 	// Resolving physical address by adding offset inside the page
 	phys_address += addr & ~TARGET_PAGE_MASK;
 
-    	uint8_t cache_bits = env->tlb_table[4][index].dummy[0];
+    	uint8_t cache_bits = env->iotlb[4][index].cache_bits;
 
     	int io = 0;
     	if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -1012,11 +1011,11 @@ void helper_flexus_st(CPUSPARCState *env, target_ulong addr, target_ulong pc, in
 
     target_ulong phys_address;
     // Getting page physical address
-    phys_address = env->tlb_table[mmu_idx][index].paddr;
+    phys_address = env->iotlb[mmu_idx][index].paddr;
     // Resolving physical address by adding offset inside the page
     phys_address += addr & ~TARGET_PAGE_MASK;
 
-    uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     int asi;
     // PSTATE.PRIV bit indicates whether we are in privileged mode
@@ -1200,11 +1199,11 @@ void helper_flexus_st_asi(CPUSPARCState *env, target_ulong addr, target_ulong pc
 
     target_ulong phys_address;
     // Getting page physical address
-    phys_address = env->tlb_table[mmu_idx][index].paddr;
+    phys_address = env->iotlb[mmu_idx][index].paddr;
     // Resolving physical address by adding offset inside the page
     phys_address += addr & ~TARGET_PAGE_MASK;
 
-    uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     int io = 0;
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -1334,11 +1333,11 @@ void helper_flexus_stf_asi(CPUSPARCState *env, target_ulong addr, target_ulong p
 
 	target_ulong phys_address;
 	// Getting page physical address
-	phys_address = env->tlb_table[mmu_idx][index].paddr;
+	phys_address = env->iotlb[mmu_idx][index].paddr;
 	// Resolving physical address by adding offset inside the page
 	phys_address += addr & ~TARGET_PAGE_MASK;
 
-    	uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    	uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     	int io = 0;
     	if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -1380,11 +1379,11 @@ void helper_flexus_rmw(CPUSPARCState *env, target_ulong addr, target_ulong pc, i
 
     target_ulong phys_address;
     // Getting page physical address
-    phys_address = env->tlb_table[mmu_idx][index].paddr;
+    phys_address = env->iotlb[mmu_idx][index].paddr;
     // Resolving physical address by adding offset inside the page
     phys_address += addr & ~TARGET_PAGE_MASK;
 
-    uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     int asi;
     // Non-alternate-space Loads (SPARC V9 documention p.73)
@@ -1565,11 +1564,11 @@ void helper_flexus_rmw_asi(CPUSPARCState *env, target_ulong addr, target_ulong p
 
     target_ulong phys_address;
     // Getting page physical address
-    phys_address = env->tlb_table[mmu_idx][index].paddr;
+    phys_address = env->iotlb[mmu_idx][index].paddr;
     // Resolving physical address by adding offset inside the page
     phys_address += addr & ~TARGET_PAGE_MASK;
 
-    uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     int io = 0;
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -1724,11 +1723,11 @@ void helper_flexus_cas_asi(CPUSPARCState *env, target_ulong addr, target_ulong p
 
     target_ulong phys_address;
     // Getting page physical address
-    phys_address = env->tlb_table[mmu_idx][index].paddr;
+    phys_address = env->iotlb[mmu_idx][index].paddr;
     // Resolving physical address by adding offset inside the page
     phys_address += addr & ~TARGET_PAGE_MASK;
 
-    uint8_t cache_bits = env->tlb_table[mmu_idx][index].dummy[0];
+    uint8_t cache_bits = env->iotlb[mmu_idx][index].cache_bits;
 
     int io = 0;
     if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)) {
@@ -1833,6 +1832,9 @@ void flexus_transaction(CPUSPARCState *env, target_ulong vaddr,
     SPARCCPU *cpu = sparc_env_get_cpu(env);
     CPUState *cs = CPU(cpu);
 
+    if( !(QEMU_bench.events & (1 << QEMU_BENCH_EVENT_LS)) )
+      return;
+
     // In Qemu, PhysicalIO address space and PhysicalMemory address
     // space are combined into one (the cpu address space)
     // Operations on this address space may lead to I/O and Physical Memory
@@ -1868,7 +1870,9 @@ void flexus_transaction(CPUSPARCState *env, target_ulong vaddr,
     event_data->ncm->space = space;
     event_data->ncm->trans = mem_trans;
 
-    QEMU_execute_callbacks(cpu_proc_num(cs) , QEMU_cpu_mem_trans, event_data);
+    QEMU_BENCH_TIME(QEMU_BENCH_EVENT_LS,
+                    QEMU_execute_callbacks(cpu_proc_num(cs), QEMU_cpu_mem_trans,
+                                           event_data));
 }
 
 void flexus_insn_fetch_transaction(CPUSPARCState *env, logical_address_t target_vaddr,
@@ -1881,6 +1885,9 @@ void flexus_insn_fetch_transaction(CPUSPARCState *env, logical_address_t target_
     SPARCCPU *cpu = sparc_env_get_cpu(env);
     CPUState *cs = CPU(cpu);
 
+    if( !(QEMU_bench.events & (1 << QEMU_BENCH_EVENT_FETCH)) )
+      return;
+
     // In Qemu, PhysicalIO address space and PhysicalMemory address
     // space are combined into one (the cpu address space)
     // Operations on this address space may lead to I/O and Physical Memory
@@ -1905,7 +1912,9 @@ void flexus_insn_fetch_transaction(CPUSPARCState *env, logical_address_t target_
     event_data->ncm->space = space;
     event_data->ncm->trans = mem_trans;
 
-    QEMU_execute_callbacks(cpu_proc_num(cs) , QEMU_cpu_mem_trans, event_data);
+    QEMU_BENCH_TIME(QEMU_BENCH_EVENT_FETCH,
+                    QEMU_execute_callbacks(cpu_proc_num(cs), QEMU_cpu_mem_trans,
+                                           event_data));
 }
 
 /* Sparc specific helpers */
@@ -696,6 +696,19 @@ static inline void tcg_out_pop(TCGContext *s, int reg)
     tcg_out_opc(s, OPC_POP_r32 + LOWREGMASK(reg), 0, reg, 0);
 }
 
+/* Emit an @n byte nop: "xchg %eax,%eax" with operand size prefixes, which
+   the recent cores decode in a single cycle.  */
+static void tcg_out_nopn(TCGContext *s, int n)
+{
+    int i;
+
+    tcg_debug_assert(n >= 1);
+    for (i = 1; i < n; ++i) {
+        tcg_out8(s, 0x66);
+    }
+    tcg_out8(s, 0x90);
+}
+
 static inline void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret,
                               TCGReg arg1, intptr_t arg2)
 {
@@ -1777,6 +1790,14 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
             /* direct jump method */
+            int gap;
+
+            /* the displacement is patched while other vCPU threads may
+               execute the jump, align it so that the store is atomic */
+            gap = -((uintptr_t)s->code_ptr + 1) & 3;
+            if (gap) {
+                tcg_out_nopn(s, gap);
+            }
             tcg_out8(s, OPC_JMP_long); /* jmp im */
             s->tb_jmp_offset[args[0]] = tcg_current_code_size(s);
             tcg_out32(s, 0);
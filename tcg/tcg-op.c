@@ -1942,3 +1942,302 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     memop = tcg_canonicalize_memop(memop, 1, 1);
     gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
 }
+
+static void tcg_gen_ext_i32(TCGv_i32 ret, TCGv_i32 val, TCGMemOp opc)
+{
+    switch (opc & MO_SSIZE) {
+    case MO_SB:
+        tcg_gen_ext8s_i32(ret, val);
+        break;
+    case MO_UB:
+        tcg_gen_ext8u_i32(ret, val);
+        break;
+    case MO_SW:
+        tcg_gen_ext16s_i32(ret, val);
+        break;
+    case MO_UW:
+        tcg_gen_ext16u_i32(ret, val);
+        break;
+    default:
+        tcg_gen_mov_i32(ret, val);
+        break;
+    }
+}
+
+static void tcg_gen_ext_i64(TCGv_i64 ret, TCGv_i64 val, TCGMemOp opc)
+{
+    switch (opc & MO_SSIZE) {
+    case MO_SB:
+        tcg_gen_ext8s_i64(ret, val);
+        break;
+    case MO_UB:
+        tcg_gen_ext8u_i64(ret, val);
+        break;
+    case MO_SW:
+        tcg_gen_ext16s_i64(ret, val);
+        break;
+    case MO_UW:
+        tcg_gen_ext16u_i64(ret, val);
+        break;
+    case MO_SL:
+        tcg_gen_ext32s_i64(ret, val);
+        break;
+    case MO_UL:
+        tcg_gen_ext32u_i64(ret, val);
+        break;
+    default:
+        tcg_gen_mov_i64(ret, val);
+        break;
+    }
+}
+
+/* The atomic operations only need to be atomic with respect to the other
+   vCPUs when they run concurrently: always for the guest threads of user
+   mode, and with -tcg-threads multi in system mode.  Otherwise they are
+   expanded inline to a load and a store, which keeps the single-threaded
+   mode as fast as before.  */
+static inline bool tcg_gen_atomic_parallel(void)
+{
+#ifdef CONFIG_USER_ONLY
+    return true;
+#else
+    return qemu_tcg_mttcg_enabled();
+#endif
+}
+
+typedef void (*gen_atomic_cx_i32)(TCGv_i32, TCGv_env, TCGv,
+                                  TCGv_i32, TCGv_i32, TCGv_i32);
+typedef void (*gen_atomic_cx_i64)(TCGv_i64, TCGv_env, TCGv,
+                                  TCGv_i64, TCGv_i64, TCGv_i32);
+typedef void (*gen_atomic_op_i32)(TCGv_i32, TCGv_env, TCGv,
+                                  TCGv_i32, TCGv_i32);
+typedef void (*gen_atomic_op_i64)(TCGv_i64, TCGv_env, TCGv,
+                                  TCGv_i64, TCGv_i32);
+
+/* The helpers are indexed by the size and byte order of the access */
+#define ATOMIC_TABLE(NAME)                                          \
+static void * const table_##NAME[16] = {                            \
+    [MO_8] = gen_helper_atomic_##NAME##b,                           \
+    [MO_16 | MO_LE] = gen_helper_atomic_##NAME##w_le,               \
+    [MO_16 | MO_BE] = gen_helper_atomic_##NAME##w_be,               \
+    [MO_32 | MO_LE] = gen_helper_atomic_##NAME##l_le,               \
+    [MO_32 | MO_BE] = gen_helper_atomic_##NAME##l_be,               \
+    [MO_64 | MO_LE] = gen_helper_atomic_##NAME##q_le,               \
+    [MO_64 | MO_BE] = gen_helper_atomic_##NAME##q_be,               \
+};
+
+ATOMIC_TABLE(cmpxchg)
+
+void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv addr, TCGv_i32 cmpv,
+                                TCGv_i32 newv, TCGArg idx, TCGMemOp memop)
+{
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+
+    if (!tcg_gen_atomic_parallel()) {
+        TCGv_i32 t1 = tcg_temp_new_i32();
+        TCGv_i32 t2 = tcg_temp_new_i32();
+
+        tcg_gen_ext_i32(t2, cmpv, memop & MO_SIZE);
+        tcg_gen_qemu_ld_i32(t1, addr, idx, memop & ~MO_SIGN);
+        tcg_gen_movcond_i32(TCG_COND_EQ, t2, t1, t2, newv, t1);
+        tcg_gen_qemu_st_i32(t2, addr, idx, memop);
+        tcg_gen_ext_i32(retv, t1, memop);
+        tcg_temp_free_i32(t2);
+        tcg_temp_free_i32(t1);
+    } else {
+        gen_atomic_cx_i32 gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+
+        tcg_debug_assert(gen != NULL);
+        gen(retv, tcg_ctx.tcg_env, addr, cmpv, newv, oi);
+        tcg_temp_free_i32(oi);
+        tcg_gen_ext_i32(retv, retv, memop);
+    }
+}
+
+void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv addr, TCGv_i64 cmpv,
+                                TCGv_i64 newv, TCGArg idx, TCGMemOp memop)
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if (!tcg_gen_atomic_parallel()) {
+        TCGv_i64 t1 = tcg_temp_new_i64();
+        TCGv_i64 t2 = tcg_temp_new_i64();
+
+        tcg_gen_ext_i64(t2, cmpv, memop & MO_SIZE);
+        tcg_gen_qemu_ld_i64(t1, addr, idx, memop & ~MO_SIGN);
+        tcg_gen_movcond_i64(TCG_COND_EQ, t2, t1, t2, newv, t1);
+        tcg_gen_qemu_st_i64(t2, addr, idx, memop);
+        tcg_gen_ext_i64(retv, t1, memop);
+        tcg_temp_free_i64(t2);
+        tcg_temp_free_i64(t1);
+    } else if ((memop & MO_SIZE) == MO_64) {
+        gen_atomic_cx_i64 gen = table_cmpxchg[memop & (MO_SIZE | MO_BSWAP)];
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, idx));
+
+        tcg_debug_assert(gen != NULL);
+        gen(retv, tcg_ctx.tcg_env, addr, cmpv, newv, oi);
+        tcg_temp_free_i32(oi);
+    } else {
+        TCGv_i32 c32 = tcg_temp_new_i32();
+        TCGv_i32 n32 = tcg_temp_new_i32();
+        TCGv_i32 r32 = tcg_temp_new_i32();
+
+        tcg_gen_extrl_i64_i32(c32, cmpv);
+        tcg_gen_extrl_i64_i32(n32, newv);
+        tcg_gen_atomic_cmpxchg_i32(r32, addr, c32, n32, idx, memop & ~MO_SIGN);
+        tcg_temp_free_i32(c32);
+        tcg_temp_free_i32(n32);
+
+        tcg_gen_extu_i32_i64(retv, r32);
+        tcg_temp_free_i32(r32);
+        tcg_gen_ext_i64(retv, retv, memop);
+    }
+}
+
+static void do_nonatomic_op_i32(TCGv_i32 ret, TCGv addr, TCGv_i32 val,
+                                TCGArg idx, TCGMemOp memop,
+                                void (*gen)(TCGv_i32, TCGv_i32, TCGv_i32))
+{
+    TCGv_i32 t1 = tcg_temp_new_i32();
+    TCGv_i32 t2 = tcg_temp_new_i32();
+
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+
+    tcg_gen_qemu_ld_i32(t1, addr, idx, memop);
+    tcg_gen_ext_i32(t2, val, memop);
+    gen(t2, t1, t2);
+    tcg_gen_qemu_st_i32(t2, addr, idx, memop);
+    tcg_gen_ext_i32(ret, t1, memop);
+
+    tcg_temp_free_i32(t1);
+    tcg_temp_free_i32(t2);
+}
+
+static void do_atomic_op_i32(TCGv_i32 ret, TCGv addr, TCGv_i32 val,
+                             TCGArg idx, TCGMemOp memop, void * const table[])
+{
+    gen_atomic_op_i32 gen;
+    TCGv_i32 oi;
+
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+
+    gen = table[memop & (MO_SIZE | MO_BSWAP)];
+    tcg_debug_assert(gen != NULL);
+
+    oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+    gen(ret, tcg_ctx.tcg_env, addr, val, oi);
+    tcg_temp_free_i32(oi);
+
+    tcg_gen_ext_i32(ret, ret, memop);
+}
+
+static void do_nonatomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
+                                TCGArg idx, TCGMemOp memop,
+                                void (*gen)(TCGv_i64, TCGv_i64, TCGv_i64))
+{
+    TCGv_i64 t1 = tcg_temp_new_i64();
+    TCGv_i64 t2 = tcg_temp_new_i64();
+
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    tcg_gen_qemu_ld_i64(t1, addr, idx, memop);
+    tcg_gen_ext_i64(t2, val, memop);
+    gen(t2, t1, t2);
+    tcg_gen_qemu_st_i64(t2, addr, idx, memop);
+    tcg_gen_ext_i64(ret, t1, memop);
+
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+}
+
+static void do_atomic_op_i64(TCGv_i64 ret, TCGv addr, TCGv_i64 val,
+                             TCGArg idx, TCGMemOp memop, void * const table[])
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if ((memop & MO_SIZE) == MO_64) {
+        gen_atomic_op_i64 gen = table[memop & (MO_SIZE | MO_BSWAP)];
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, idx));
+
+        tcg_debug_assert(gen != NULL);
+        gen(ret, tcg_ctx.tcg_env, addr, val, oi);
+        tcg_temp_free_i32(oi);
+    } else {
+        TCGv_i32 v32 = tcg_temp_new_i32();
+        TCGv_i32 r32 = tcg_temp_new_i32();
+
+        tcg_gen_extrl_i64_i32(v32, val);
+        do_atomic_op_i32(r32, addr, v32, idx, memop & ~MO_SIGN, table);
+        tcg_temp_free_i32(v32);
+
+        tcg_gen_extu_i32_i64(ret, r32);
+        tcg_temp_free_i32(r32);
+        tcg_gen_ext_i64(ret, ret, memop);
+    }
+}
+
+#define GEN_ATOMIC_HELPER(NAME, OP)                                     \
+ATOMIC_TABLE(NAME)                                                      \
+void tcg_gen_atomic_##NAME##_i32                                        \
+    (TCGv_i32 ret, TCGv addr, TCGv_i32 val, TCGArg idx, TCGMemOp memop) \
+{                                                                       \
+    if (tcg_gen_atomic_parallel()) {                                    \
+        do_atomic_op_i32(ret, addr, val, idx, memop, table_##NAME);     \
+    } else {                                                            \
+        do_nonatomic_op_i32(ret, addr, val, idx, memop,                 \
+                            glue(OP, _i32));                            \
+    }                                                                   \
+}                                                                       \
+void tcg_gen_atomic_##NAME##_i64                                        \
+    (TCGv_i64 ret, TCGv addr, TCGv_i64 val, TCGArg idx, TCGMemOp memop) \
+{                                                                       \
+    if (tcg_gen_atomic_parallel()) {                                    \
+        do_atomic_op_i64(ret, addr, val, idx, memop, table_##NAME);     \
+    } else {                                                            \
+        do_nonatomic_op_i64(ret, addr, val, idx, memop,                 \
+                            glue(OP, _i64));                            \
+    }                                                                   \
+}
+
+/* The operations computing the new value from the old one and the operand
+   for the non-atomic expansion */
+static void gen_xchg_op_i32(TCGv_i32 r, TCGv_i32 a, TCGv_i32 b)
+{
+    tcg_gen_mov_i32(r, b);
+}
+
+static void gen_xchg_op_i64(TCGv_i64 r, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_mov_i64(r, b);
+}
+
+#define GEN_MINMAX_OP(NAME, COND)                                       \
+static void glue(NAME, _i32)(TCGv_i32 r, TCGv_i32 a, TCGv_i32 b)        \
+{                                                                       \
+    tcg_gen_movcond_i32(COND, r, a, b, a, b);                           \
+}                                                                       \
+static void glue(NAME, _i64)(TCGv_i64 r, TCGv_i64 a, TCGv_i64 b)        \
+{                                                                       \
+    tcg_gen_movcond_i64(COND, r, a, b, a, b);                           \
+}
+
+GEN_MINMAX_OP(gen_smin_op, TCG_COND_LT)
+GEN_MINMAX_OP(gen_smax_op, TCG_COND_GT)
+GEN_MINMAX_OP(gen_umin_op, TCG_COND_LTU)
+GEN_MINMAX_OP(gen_umax_op, TCG_COND_GTU)
+
+#undef GEN_MINMAX_OP
+
+GEN_ATOMIC_HELPER(xchg, gen_xchg_op)
+GEN_ATOMIC_HELPER(fetch_add, tcg_gen_add)
+GEN_ATOMIC_HELPER(fetch_and, tcg_gen_and)
+GEN_ATOMIC_HELPER(fetch_or, tcg_gen_or)
+GEN_ATOMIC_HELPER(fetch_xor, tcg_gen_xor)
+GEN_ATOMIC_HELPER(fetch_smin, gen_smin_op)
+GEN_ATOMIC_HELPER(fetch_smax, gen_smax_op)
+GEN_ATOMIC_HELPER(fetch_umin, gen_umin_op)
+GEN_ATOMIC_HELPER(fetch_umax, gen_umax_op)
+
+#undef GEN_ATOMIC_HELPER
+#undef ATOMIC_TABLE
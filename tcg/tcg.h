@@ -42,6 +42,12 @@
 # endif
 #endif
 
+/* Set by the hosts that only reorder a store with a later load, so that
+ * the load-acquire and store-release of a guest need fewer barriers.  */
+#ifndef TCG_TARGET_TSO
+# define TCG_TARGET_TSO 0
+#endif
+
 #if TCG_TARGET_REG_BITS == 32
 typedef int32_t tcg_target_long;
 typedef uint32_t tcg_target_ulong;
@@ -531,6 +537,10 @@ struct TCGContext {
 
     GHashTable *helpers;
 
+    /* The env global of the frontend, passed to the helpers generated by
+       the tcg_gen_atomic_* operations.  Set by the targets using them.  */
+    TCGv_env tcg_env;
+
 #ifdef CONFIG_PROFILER
     /* profiling info */
     int64_t tb_count1;
@@ -1069,4 +1079,18 @@ uint64_t helper_be_ldq_cmmu(CPUArchState *env, target_ulong addr,
 
 #endif /* CONFIG_SOFTMMU */
 
+/*
+ * Atomic accesses to guest memory, from cputlb.c or user-exec.c.
+ * atomic_mmu_lookup returns the host address of the @size bytes at @addr,
+ * or NULL if the host cannot access them atomically; the bytes are then
+ * accessed one at a time by atomic_slow_ld/st, in the byte order given by
+ * @be.  @retaddr is the return address of the helper, as given by GETRA().
+ */
+void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                        TCGMemOpIdx oi, int size, uintptr_t retaddr);
+uint64_t atomic_slow_ld(CPUArchState *env, target_ulong addr,
+                        TCGMemOpIdx oi, int size, bool be, uintptr_t retaddr);
+void atomic_slow_st(CPUArchState *env, target_ulong addr, uint64_t val,
+                    TCGMemOpIdx oi, int size, bool be, uintptr_t retaddr);
+
 #endif /* TCG_H */
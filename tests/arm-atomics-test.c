@@ -0,0 +1,127 @@
+/*
+ * QTest testcase for the ARM exclusive accesses
+ *
+ * Two vCPUs of the virt board increment shared counters with
+ * LDREX/STREX and LDREXD/STREXD, which TCG turns into host
+ * compare-and-swaps.  Not a single increment may get lost, with the
+ * vCPUs taking turns as well as running in parallel.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <glib.h>
+#include "libqtest.h"
+#include "qemu/bswap.h"
+
+/* the kernel image is loaded at the start of RAM plus 64KiB */
+#define CODE_ADDRESS     0x40010000
+#define COUNTER_ADDRESS  0x40020000
+#define COUNTER64_ADDRESS (COUNTER_ADDRESS + 8)
+#define DONE_ADDRESS     (COUNTER_ADDRESS + 16)
+
+#define N_CPUS           2
+#define ITERATIONS       100000
+
+static const uint32_t code[] = {
+    /* _start: */
+    0xee104fb0, /* mrc   p15, 0, r4, c0, c0, 5 (MPIDR) */
+    0xe21440ff, /* ands  r4, r4, #0xff */
+    0x1a000006, /* bne   worker */
+    /* cpu 0 powers cpu 1 on at _start with PSCI CPU_ON */
+    0xe3000003, /* movw  r0, #0x0003 */
+    0xe3480400, /* movt  r0, #0x8400 */
+    0xe3a01001, /* mov   r1, #1 */
+    0xe3002000, /* movw  r2, #(CODE_ADDRESS & 0xffff) */
+    0xe3442001, /* movt  r2, #(CODE_ADDRESS >> 16) */
+    0xe3a03000, /* mov   r3, #0 */
+    0xe1400070, /* hvc   #0 */
+    /* worker: */
+    0xe3005000, /* movw  r5, #(COUNTER_ADDRESS & 0xffff) */
+    0xe3445002, /* movt  r5, #(COUNTER_ADDRESS >> 16) */
+    0xe30866a0, /* movw  r6, #(ITERATIONS & 0xffff) */
+    0xe3406001, /* movt  r6, #(ITERATIONS >> 16) */
+    /* 1: */
+    0xe1950f9f, /* ldrex  r0, [r5] */
+    0xe2800001, /* add    r0, r0, #1 */
+    0xe1851f90, /* strex  r1, r0, [r5] */
+    0xe3510000, /* cmp    r1, #0 */
+    0x1afffffa, /* bne    1b */
+    0xe2857008, /* add    r7, r5, #8 */
+    /* 2: */
+    0xe1b72f9f, /* ldrexd r2, r3, [r7] */
+    0xe2922001, /* adds   r2, r2, #1 */
+    0xe2a33000, /* adc    r3, r3, #0 */
+    0xe1a71f92, /* strexd r1, r2, r3, [r7] */
+    0xe3510000, /* cmp    r1, #0 */
+    0x1afffff9, /* bne    2b */
+    0xe2566001, /* subs   r6, r6, #1 */
+    0x1afffff1, /* bne    1b */
+    /* the cpu is done */
+    0xe2857010, /* add    r7, r5, #16 */
+    /* 3: */
+    0xe1970f9f, /* ldrex  r0, [r7] */
+    0xe2800001, /* add    r0, r0, #1 */
+    0xe1871f90, /* strex  r1, r0, [r7] */
+    0xe3510000, /* cmp    r1, #0 */
+    0x1afffffa, /* bne    3b */
+    /* 4: */
+    0xe320f003, /* wfi */
+    0xeafffffd, /* b      4b */
+};
+
+static char kernel_path[] = "/tmp/qtest-arm-atomics.XXXXXX";
+
+static void test_atomics(const void *data)
+{
+    const char *threads = data;
+    char *args;
+    uint32_t done = 0;
+    int i;
+
+    args = g_strdup_printf("-machine virt,accel=tcg -cpu cortex-a15 "
+                           "-smp %d -m 256 -kernel %s -tcg-threads %s",
+                           N_CPUS, kernel_path, threads);
+    qtest_start(args);
+
+    /* Wait at most 1 minute */
+    for (i = 0; i < 600 && done != N_CPUS; i++) {
+        g_usleep(G_USEC_PER_SEC / 10);
+        done = readl(DONE_ADDRESS);
+    }
+    g_assert_cmpuint(done, ==, N_CPUS);
+    g_assert_cmpuint(readl(COUNTER_ADDRESS), ==, N_CPUS * ITERATIONS);
+    g_assert_cmpuint(readq(COUNTER64_ADDRESS), ==, N_CPUS * ITERATIONS);
+
+    qtest_end();
+    g_free(args);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t image[ARRAY_SIZE(code)];
+    int fd, ret;
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    /* the guest is little endian */
+    for (i = 0; i < ARRAY_SIZE(code); i++) {
+        image[i] = cpu_to_le32(code[i]);
+    }
+    fd = mkstemp(kernel_path);
+    g_assert(fd >= 0);
+    ret = write(fd, image, sizeof(image));
+    g_assert(ret == sizeof(image));
+    close(fd);
+
+    qtest_add_data_func("atomics/tcg-threads-single", "single",
+                        test_atomics);
+    qtest_add_data_func("atomics/tcg-threads-multi", "multi",
+                        test_atomics);
+    ret = g_test_run();
+
+    unlink(kernel_path);
+    return ret;
+}
@@ -0,0 +1,216 @@
+/*
+ * Test the resizable hash table
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <glib.h>
+#include "qemu/qht.h"
+#include "qemu/atomic.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+
+#define N 5000
+#define N_READERS 4
+
+static struct qht ht;
+static int32_t arr[N];
+
+static bool is_equal(const void *obj, const void *userp)
+{
+    const int32_t *a = obj;
+    const int32_t *b = userp;
+
+    return *a == *b;
+}
+
+/* a poor hash, so that the entries share buckets and chains */
+static uint32_t hash_of(int32_t v)
+{
+    return v % 37;
+}
+
+static int32_t *lookup(int32_t v)
+{
+    int32_t *p;
+
+    rcu_read_lock();
+    p = qht_lookup(&ht, is_equal, &v, hash_of(v));
+    rcu_read_unlock();
+    return p;
+}
+
+static void insert(int a, int b)
+{
+    int i;
+
+    for (i = a; i < b; i++) {
+        arr[i] = i;
+        g_assert(qht_insert(&ht, &arr[i], hash_of(i)));
+    }
+}
+
+static void check(int a, int b, bool expected)
+{
+    int i;
+
+    for (i = a; i < b; i++) {
+        int32_t *p = lookup(i);
+
+        if (expected) {
+            g_assert(p == &arr[i]);
+        } else {
+            g_assert(p == NULL);
+        }
+    }
+}
+
+static void count_func(struct qht *ht, void *p, uint32_t hash, void *userp)
+{
+    size_t *count = userp;
+
+    g_assert_cmpuint(hash, ==, hash_of(*(int32_t *)p));
+    (*count)++;
+}
+
+static size_t iter_count(void)
+{
+    size_t count = 0;
+
+    qht_iter(&ht, count_func, &count);
+    return count;
+}
+
+static void test_insert_lookup_remove(void)
+{
+    int32_t other = 3;
+
+    qht_init(&ht, 0);
+    insert(0, 10);
+    check(0, 10, true);
+    check(10, 20, false);
+
+    /* the same pointer twice is refused, another one with the same
+     * contents is not */
+    g_assert(!qht_insert(&ht, &arr[3], hash_of(3)));
+    g_assert(qht_insert(&ht, &other, hash_of(3)));
+    g_assert(qht_remove(&ht, &other, hash_of(3)));
+    g_assert(!qht_remove(&ht, &other, hash_of(3)));
+    g_assert_cmpuint(ht.n_entries, ==, 10);
+
+    g_assert(qht_remove(&ht, &arr[5], hash_of(5)));
+    check(5, 6, false);
+    check(0, 5, true);
+    check(6, 10, true);
+    g_assert_cmpuint(iter_count(), ==, 9);
+
+    /* the slot of a removed entry is reused */
+    g_assert(qht_insert(&ht, &arr[5], hash_of(5)));
+    check(0, 10, true);
+    qht_destroy(&ht);
+}
+
+static void test_grow(void)
+{
+    struct qht_stats stats;
+
+    qht_init(&ht, 4);
+    qht_statistics(&ht, &stats);
+    g_assert_cmpuint(stats.head_buckets, ==, 1);
+
+    insert(0, N);
+    check(0, N, true);
+    g_assert_cmpuint(ht.n_entries, ==, N);
+    g_assert_cmpuint(iter_count(), ==, N);
+
+    qht_statistics(&ht, &stats);
+    g_assert_cmpuint(stats.entries, ==, N);
+    /* the table grew, yet a poor hash still only uses a few heads */
+    g_assert_cmpuint(stats.head_buckets, >=, N / 4);
+    g_assert_cmpuint(stats.used_head_buckets, <=, 37);
+    g_assert_cmpuint(stats.max_chain, >=, 2);
+    qht_destroy(&ht);
+}
+
+static void test_reset_resize(void)
+{
+    struct qht_stats stats;
+
+    qht_init(&ht, 0);
+    insert(0, 100);
+    qht_resize(&ht, 1024);
+    qht_statistics(&ht, &stats);
+    g_assert_cmpuint(stats.head_buckets, >=, 1024 / 8);
+    g_assert_cmpuint(stats.entries, ==, 100);
+    check(0, 100, true);
+
+    qht_reset(&ht);
+    g_assert_cmpuint(ht.n_entries, ==, 0);
+    g_assert_cmpuint(iter_count(), ==, 0);
+    check(0, 100, false);
+    insert(0, 100);
+    check(0, 100, true);
+    qht_destroy(&ht);
+}
+
+/* Readers look the first half of the entries up, which stays in the
+ * table, while the writer keeps inserting and removing the second half
+ * and grows the table under them.
+ */
+static bool stop_readers;
+
+static void *reader_thread(void *arg)
+{
+    int i;
+
+    rcu_register_thread();
+    while (!atomic_read(&stop_readers)) {
+        for (i = 0; i < N / 2; i++) {
+            g_assert(lookup(i) == &arr[i]);
+        }
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void test_concurrent_lookup(void)
+{
+    QemuThread threads[N_READERS];
+    int i, round;
+
+    qht_init(&ht, 0);
+    insert(0, N / 2);
+    atomic_set(&stop_readers, false);
+    for (i = 0; i < N_READERS; i++) {
+        qemu_thread_create(&threads[i], "reader", reader_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    for (round = 0; round < 10; round++) {
+        insert(N / 2, N);
+        for (i = N / 2; i < N; i++) {
+            g_assert(qht_remove(&ht, &arr[i], hash_of(i)));
+        }
+        qht_resize(&ht, (round + 1) * N);
+    }
+
+    atomic_set(&stop_readers, true);
+    for (i = 0; i < N_READERS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+    check(0, N / 2, true);
+    check(N / 2, N, false);
+    qht_destroy(&ht);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/qht/insert-lookup-remove", test_insert_lookup_remove);
+    g_test_add_func("/qht/grow", test_grow);
+    g_test_add_func("/qht/reset-resize", test_reset_resize);
+    g_test_add_func("/qht/concurrent-lookup", test_concurrent_lookup);
+    return g_test_run();
+}
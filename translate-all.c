@@ -56,6 +56,9 @@
 #include "qemu/bitmap.h"
 #include "qemu/timer.h"
 #include "exec/log.h"
+#ifdef CONFIG_FLEXUS
+#include "libqemuflex/insn_desc.h"
+#endif
 
 //#define DEBUG_TB_INVALIDATE
 //#define DEBUG_FLUSH
@@ -78,6 +81,9 @@ typedef struct PageDesc {
     unsigned long *code_bitmap;
 #if defined(CONFIG_USER_ONLY)
     unsigned long flags;
+#else
+    /* hash of the page when the last TB was added, see tb_revalidate_code */
+    uint64_t code_hash;
 #endif
 } PageDesc;
 
@@ -120,37 +126,60 @@ static void *l1_map[V_L1_SIZE];
 /* code generation context */
 TCGContext tcg_ctx;
 
+/* each vCPU runs in its own thread (-tcg-threads multi), see cpus.c */
+bool mttcg_enabled;
+
 /* translation block context */
-#ifdef CONFIG_USER_ONLY
 __thread int have_tb_lock;
-#endif
 
-void tb_lock(void)
+/* When a single thread runs all the vCPUs of full-system emulation, the
+   BQL already serializes the translation and tb_lock is a no-op.  */
+static inline bool tb_lock_needed(void)
 {
 #ifdef CONFIG_USER_ONLY
-    assert(!have_tb_lock);
-    qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
-    have_tb_lock++;
+    return true;
+#else
+    return qemu_tcg_mttcg_enabled();
 #endif
 }
 
+void tb_lock(void)
+{
+    if (tb_lock_needed()) {
+        assert(!have_tb_lock);
+        qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
+        have_tb_lock++;
+    }
+}
+
 void tb_unlock(void)
 {
-#ifdef CONFIG_USER_ONLY
-    assert(have_tb_lock);
-    have_tb_lock--;
-    qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
-#endif
+    if (tb_lock_needed()) {
+        assert(have_tb_lock);
+        have_tb_lock--;
+        qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+    }
 }
 
 void tb_lock_reset(void)
 {
-#ifdef CONFIG_USER_ONLY
     if (have_tb_lock) {
         qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
         have_tb_lock = 0;
     }
-#endif
+}
+
+/* The invalidations are reached from the vCPU threads, with or without
+   tb_lock, and from the device emulation.  With -tcg-threads multi they
+   take tb_lock if the caller does not hold it; returns whether it must be
+   released.  */
+static bool tb_lock_entry(void)
+{
+    if (!qemu_tcg_mttcg_enabled() || have_tb_lock) {
+        return false;
+    }
+    tb_lock();
+    return true;
 }
 
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
@@ -288,6 +317,10 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
         cpu->can_do_io = 0;
     }
     cpu->icount_decr.u16.low -= i;
+    /* Give back the quantum of the insns that did not complete.  */
+    if (tb->cflags & CF_QUANTUM) {
+        cpu->quantum_budget += num_insns - i;
+    }
     restore_state_to_opc(env, tb, data);
 
 #ifdef CONFIG_PROFILER
@@ -742,6 +775,7 @@ void tcg_exec_init(unsigned long tb_size)
 {
     cpu_gen_init();
     page_init();
+    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     code_gen_alloc(tb_size);
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
@@ -755,30 +789,99 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Generate the next TBs in an empty region.  */
+static void tb_region_start(int i)
+{
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+    r->nb_tbs = 0;
+    r->code_ptr = r->code_start;
+    tcg_ctx.tb_ctx.cur_region = i;
+    tcg_ctx.code_gen_ptr = r->code_start;
+    /* same margin as tcg_prologue_init for the whole buffer */
+    tcg_ctx.code_gen_highwater = r->code_end - 1024;
+#ifdef CONFIG_FLEXUS
+    QEMU_insn_desc_start_region(i);
+#endif
+}
+
+/* Split the code buffer and the tbs array in regions.  This must wait for
+   the prologue, which is generated at the start of the buffer.  */
+static void tb_regions_init(void)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    size_t code_size;
+    int i, n, tbs;
+
+    n = tcg_ctx.code_gen_buffer_size / CODE_GEN_MIN_REGION_SIZE;
+    n = MAX(MIN(n, CODE_GEN_MAX_REGIONS), 1);
+    code_size = QEMU_ALIGN_DOWN(tcg_ctx.code_gen_buffer_size / n,
+                                CODE_GEN_ALIGN);
+    tbs = tcg_ctx.code_gen_max_blocks / n;
+
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &tb_ctx->regions[i];
+
+        r->code_start = tcg_ctx.code_gen_buffer + i * code_size;
+        r->code_end = r->code_start + code_size;
+        r->code_ptr = r->code_start;
+        r->tb_start = i * tbs;
+        r->tb_max = tbs;
+        r->nb_tbs = 0;
+    }
+    /* the last region gets the leftovers */
+    tb_ctx->regions[n - 1].code_end = tcg_ctx.code_gen_buffer
+                                      + tcg_ctx.code_gen_buffer_size;
+    tb_ctx->regions[n - 1].tb_max = tcg_ctx.code_gen_max_blocks
+                                    - (n - 1) * tbs;
+    tb_ctx->nb_regions = n;
+    tb_region_start(0);
+}
+
+/* Allocate a new translation block in the current region.  Returns NULL
+   if the region has too many translation blocks; tcg_gen_code fails when
+   it has too much generated code.  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBRegion *r;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks) {
+    if (unlikely(tcg_ctx.tb_ctx.nb_regions == 0)) {
+        tb_regions_init();
+    }
+    r = &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region];
+    if (r->nb_tbs >= r->tb_max) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &tcg_ctx.tb_ctx.tbs[r->tb_start + r->nb_tbs++];
+    tcg_ctx.tb_ctx.nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    /* not linked yet, see tb_evict_region */
+    tb->page_addr[0] = -1;
+#ifdef CONFIG_FLEXUS
+    tb->flexus_descs = NULL;
+#endif
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    TBRegion *r = &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 &&
+            tb == &tcg_ctx.tb_ctx.tbs[r->tb_start + r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
+        r->nb_tbs--;
         tcg_ctx.tb_ctx.nb_tbs--;
+#ifdef CONFIG_FLEXUS
+        if (tb->flexus_descs) {
+            QEMU_insn_desc_rewind(tb->flexus_descs);
+        }
+#endif
     }
 }
 
@@ -822,9 +925,106 @@ static void page_flush_tb(void)
     }
 }
 
+#if !defined(CONFIG_USER_ONLY)
+/* Set by the first tb_revalidate_code, the code pages are hashed from then
+   on.  */
+static bool tb_code_hashing;
+
+static uint64_t tb_code_page_hash(tb_page_addr_t page_addr)
+{
+    const uint64_t *p;
+    uint64_t h = 0;
+    int i;
+
+    rcu_read_lock();
+    p = qemu_get_ram_ptr(NULL, page_addr);
+    for (i = 0; i < TARGET_PAGE_SIZE / sizeof(uint64_t); i++) {
+        h = rol64(h ^ (p[i] * 0x87c37b91114253d5ULL), 31)
+            * 0x4cf5ad432745937fULL;
+    }
+    rcu_read_unlock();
+    return h;
+}
+
+static void tb_revalidate_code_1(int level, void **lp, tb_page_addr_t index)
+{
+    tb_page_addr_t page_addr;
+    int i;
+
+    if (*lp == NULL) {
+        return;
+    }
+    if (level == 0) {
+        PageDesc *pd = *lp;
+
+        for (i = 0; i < V_L2_SIZE; ++i) {
+            if (pd[i].first_tb == NULL) {
+                continue;
+            }
+            page_addr = ((index << V_L2_BITS) | i) << TARGET_PAGE_BITS;
+            if (tb_code_page_hash(page_addr) != pd[i].code_hash) {
+                tb_invalidate_phys_page_range(page_addr,
+                                              page_addr + TARGET_PAGE_SIZE, 0);
+            } else {
+                /* the page may have been marked dirty with the new RAM */
+                tlb_protect_code(page_addr);
+            }
+        }
+    } else {
+        void **pp = *lp;
+
+        for (i = 0; i < V_L2_SIZE; ++i) {
+            tb_revalidate_code_1(level - 1, pp + i,
+                                 (index << V_L2_BITS) | i);
+        }
+    }
+}
+
+/* RAM was overwritten behind the back of the translated code, e.g. by a
+   snapshot restore: only invalidate the TBs of the pages whose content
+   changed since they were translated.  A TB on a page is consistent with
+   the content of the page when the last TB was added to it, as the guest
+   writes to its code invalidated it since.  The first call flushes
+   everything and starts hashing the code pages.  */
+void tb_revalidate_code(CPUState *cpu)
+{
+    int i;
+
+    if (!tb_code_hashing) {
+        tb_code_hashing = true;
+        tb_flush(cpu);
+        return;
+    }
+
+    for (i = 0; i < V_L1_SIZE; i++) {
+        tb_revalidate_code_1(V_L1_SHIFT / V_L2_BITS - 1, l1_map + i, i);
+    }
+    /* the virtual mappings may have changed as well */
+    CPU_FOREACH(cpu) {
+        memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    }
+}
+#endif
+
+#if !defined(CONFIG_USER_ONLY)
+/* Changes whenever TBs are flushed or evicted, so that the safe work
+   queued by several vCPUs for the same overflow is only done once.  */
+static unsigned tb_code_generation(void)
+{
+    return tcg_ctx.tb_ctx.tb_flush_count + tcg_ctx.tb_ctx.tb_region_evict_count;
+}
+
+/* Whether the caller runs guest code while the other vCPU threads may
+   execute TBs as well: the code buffer cannot be reused under them, it is
+   done in safe work once they all left the execution loop.  */
+static bool tb_code_in_use(void)
+{
+    return qemu_tcg_mttcg_enabled() && current_cpu && current_cpu->running;
+}
+#endif
+
 /* flush all the translation blocks */
-/* XXX: tb_flush is currently not thread safe */
-void tb_flush(CPUState *cpu)
+static void do_tb_flush(CPUState *cpu)
 {
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
@@ -843,71 +1043,96 @@ void tb_flush(CPUState *cpu)
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0, sizeof(tcg_ctx.tb_ctx.tb_phys_hash));
+    qht_reset(&tcg_ctx.tb_ctx.htable);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+#ifdef CONFIG_FLEXUS
+    QEMU_insn_desc_flush();
+#endif
+    if (tcg_ctx.tb_ctx.nb_regions == 0) {
+        tb_regions_init();
+    } else {
+        int i;
+
+        for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+            tcg_ctx.tb_ctx.regions[i].nb_tbs = 0;
+        }
+        tb_region_start(0);
+    }
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     tcg_ctx.tb_ctx.tb_flush_count++;
 }
 
-#ifdef DEBUG_TB_CHECK
-
-static void tb_invalidate_check(target_ulong address)
+#if !defined(CONFIG_USER_ONLY)
+static void tb_flush_safe_work(void *data)
 {
-    TranslationBlock *tb;
-    int i;
+    tb_lock();
+    if (tb_code_generation() == GPOINTER_TO_UINT(data)) {
+        do_tb_flush(first_cpu);
+    }
+    tb_unlock();
+}
+#endif
 
-    address &= TARGET_PAGE_MASK;
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
-             tb = tb->phys_hash_next) {
-            if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
-                  address >= tb->pc + tb->size)) {
-                printf("ERROR invalidate: address=" TARGET_FMT_lx
-                       " PC=%08lx size=%04x\n",
-                       address, (long)tb->pc, tb->size);
-            }
-        }
+/* With -tcg-threads multi, a flush asked by a running vCPU is only done
+   once all the vCPUs stopped.  */
+void tb_flush(CPUState *cpu)
+{
+#if !defined(CONFIG_USER_ONLY)
+    if (tb_code_in_use()) {
+        async_safe_run(tb_flush_safe_work,
+                       GUINT_TO_POINTER(tb_code_generation()));
+        return;
     }
+#endif
+    do_tb_flush(cpu);
 }
 
-/* verify that all the pages have correct rights for code */
-static void tb_page_check(void)
+#ifdef DEBUG_TB_CHECK
+
+static void do_tb_invalidate_check(struct qht *ht, void *p, uint32_t hash,
+                                   void *userp)
 {
-    TranslationBlock *tb;
-    int i, flags1, flags2;
-
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
-                tb = tb->phys_hash_next) {
-            flags1 = page_get_flags(tb->pc);
-            flags2 = page_get_flags(tb->pc + tb->size - 1);
-            if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
-                printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
-                       (long)tb->pc, tb->size, flags1, flags2);
-            }
-        }
+    TranslationBlock *tb = p;
+    target_ulong address = *(target_ulong *)userp;
+
+    if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
+          address >= tb->pc + tb->size)) {
+        printf("ERROR invalidate: address=" TARGET_FMT_lx
+               " PC=%08lx size=%04x\n",
+               address, (long)tb->pc, tb->size);
     }
 }
 
-#endif
+static void tb_invalidate_check(target_ulong address)
+{
+    address &= TARGET_PAGE_MASK;
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_invalidate_check, &address);
+}
 
-static inline void tb_hash_remove(TranslationBlock **ptb, TranslationBlock *tb)
+static void do_tb_page_check(struct qht *ht, void *p, uint32_t hash,
+                             void *userp)
 {
-    TranslationBlock *tb1;
+    TranslationBlock *tb = p;
+    int flags1, flags2;
 
-    for (;;) {
-        tb1 = *ptb;
-        if (tb1 == tb) {
-            *ptb = tb1->phys_hash_next;
-            break;
-        }
-        ptb = &tb1->phys_hash_next;
+    flags1 = page_get_flags(tb->pc);
+    flags2 = page_get_flags(tb->pc + tb->size - 1);
+    if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
+        printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
+               (long)tb->pc, tb->size, flags1, flags2);
     }
 }
 
+/* verify that all the pages have correct rights for code */
+static void tb_page_check(void)
+{
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_page_check, NULL);
+}
+
+#endif
+
 static inline void tb_page_remove(TranslationBlock **ptb, TranslationBlock *tb)
 {
     TranslationBlock *tb1;
@@ -970,10 +1195,10 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     tb_page_addr_t phys_pc;
     TranslationBlock *tb1, *tb2;
 
-    /* remove the TB from the hash list */
+    /* remove the TB from the hash table */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    qht_remove(&tcg_ctx.tb_ctx.htable, tb,
+               tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base));
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -1016,9 +1241,53 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((uintptr_t)tb | 2); /* fail safe */
 
+    /* unlinked, see tb_evict_region */
+    tb->page_addr[0] = -1;
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
+/* Make room for new TBs by evicting the oldest region of the code buffer,
+   the one after the current region.  Only its TBs are unlinked from the
+   hash chains, the page lists and the jumps of the other TBs, whose code
+   stays translated and chained.  */
+static void tb_evict_region(CPUState *cpu)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TranslationBlock *tb;
+    TBRegion *r;
+    int i;
+
+    if (tb_ctx->nb_regions <= 1) {
+        do_tb_flush(cpu);
+        return;
+    }
+
+    tb_ctx->regions[tb_ctx->cur_region].code_ptr = tcg_ctx.code_gen_ptr;
+    i = (tb_ctx->cur_region + 1) % tb_ctx->nb_regions;
+    r = &tb_ctx->regions[i];
+    for (tb = &tb_ctx->tbs[r->tb_start];
+         tb < &tb_ctx->tbs[r->tb_start + r->nb_tbs]; tb++) {
+        /* skip the TBs already invalidated and the aborted translations */
+        if (tb->page_addr[0] != -1) {
+            tb_phys_invalidate(tb, -1);
+        }
+    }
+    tb_ctx->nb_tbs -= r->nb_tbs;
+    tb_region_start(i);
+    tb_ctx->tb_region_evict_count++;
+}
+
+#if !defined(CONFIG_USER_ONLY)
+static void tb_evict_region_safe_work(void *data)
+{
+    tb_lock();
+    if (tb_code_generation() == GPOINTER_TO_UINT(data)) {
+        tb_evict_region(first_cpu);
+    }
+    tb_unlock();
+}
+#endif
+
 static void build_page_bitmap(PageDesc *p)
 {
     int n, tb_start, tb_end;
@@ -1067,12 +1336,25 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     if (use_icount && !(cflags & CF_IGNORE_ICOUNT)) {
         cflags |= CF_USE_ICOUNT;
     }
+    if (cpu_quantum_counted()) {
+        cflags |= CF_QUANTUM;
+    }
 
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
  buffer_overflow:
-        /* flush must be done */
-        tb_flush(cpu);
+#if !defined(CONFIG_USER_ONLY)
+        if (tb_code_in_use()) {
+            /* the other vCPUs may be running code of the oldest region,
+               it is evicted once they stopped and the TB translated
+               again after that */
+            async_safe_run(tb_evict_region_safe_work,
+                           GUINT_TO_POINTER(tb_code_generation()));
+            cpu_loop_exit(cpu);
+        }
+#endif
+        /* eviction must be done */
+        tb_evict_region(cpu);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         assert(tb != NULL);
@@ -1123,10 +1405,12 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
        re-initialize it per above, and re-do the actual code generation.  */
     gen_code_size = tcg_gen_code(&tcg_ctx, tb);
     if (unlikely(gen_code_size < 0)) {
+        tb_free(tb);
         goto buffer_overflow;
     }
     search_size = encode_search(tb, (void *)gen_code_buf + gen_code_size);
     if (unlikely(search_size < 0)) {
+        tb_free(tb);
         goto buffer_overflow;
     }
 
@@ -1172,11 +1456,16 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
  */
 void tb_invalidate_phys_range(tb_page_addr_t start, tb_page_addr_t end)
 {
+    bool locked = tb_lock_entry();
+
     while (start < end) {
         tb_invalidate_phys_page_range(start, end, 0);
         start &= TARGET_PAGE_MASK;
         start += TARGET_PAGE_SIZE;
     }
+    if (locked) {
+        tb_unlock();
+    }
 }
 
 /*
@@ -1300,6 +1589,7 @@ void tb_invalidate_phys_page_range(tb_page_addr_t start, tb_page_addr_t end,
 void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
 {
     PageDesc *p;
+    bool locked;
 
 #if 0
     if (1) {
@@ -1314,6 +1604,7 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
     if (!p) {
         return;
     }
+    locked = tb_lock_entry();
     if (!p->code_bitmap &&
         ++p->code_write_count >= SMC_BITMAP_USE_THRESHOLD) {
         /* build code bitmap */
@@ -1332,6 +1623,9 @@ void tb_invalidate_phys_page_fast(tb_page_addr_t start, int len)
     do_invalidate:
         tb_invalidate_phys_page_range(start, start + len, 1);
     }
+    if (locked) {
+        tb_unlock();
+    }
 }
 
 #if !defined(CONFIG_SOFTMMU)
@@ -1460,6 +1754,9 @@ static inline void tb_alloc_page(TranslationBlock *tb,
     if (!page_already_protected) {
         tlb_protect_code(page_addr);
     }
+    if (tb_code_hashing) {
+        p->code_hash = tb_code_page_hash(page_addr);
+    }
 #endif
 }
 
@@ -1471,14 +1768,7 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
-    unsigned int h;
-    TranslationBlock **ptb;
-
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
+    uint32_t h;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1500,6 +1790,10 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
         tb_reset_jump(tb, 1);
     }
 
+    /* add in the hash table last, the lookups do not take tb_lock */
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags, tb->cs_base);
+    qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
@@ -1509,20 +1803,28 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
-    int m_min, m_max, m;
+    int m_min, m_max, m, i;
     uintptr_t v;
     TranslationBlock *tb;
+    TBRegion *r = NULL;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        r = &tcg_ctx.tb_ctx.regions[i];
+        if (tc_ptr >= (uintptr_t)r->code_start &&
+            tc_ptr < (uintptr_t)r->code_end) {
+            break;
+        }
+    }
+    if (i == tcg_ctx.tb_ctx.nb_regions || r->nb_tbs <= 0) {
         return NULL;
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    if (tc_ptr >= (uintptr_t)(i == tcg_ctx.tb_ctx.cur_region
+                              ? tcg_ctx.code_gen_ptr : r->code_ptr)) {
         return NULL;
     }
     /* binary search (cf Knuth) */
-    m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_min = r->tb_start;
+    m_max = r->tb_start + r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
         tb = &tcg_ctx.tb_ctx.tbs[m];
@@ -1554,15 +1856,18 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
     }
     ram_addr = (memory_region_get_ram_addr(mr) & TARGET_PAGE_MASK)
         + addr;
-    tb_invalidate_phys_page_range(ram_addr, ram_addr + 1, 0);
+    tb_invalidate_phys_range(ram_addr, ram_addr + 1);
     rcu_read_unlock();
 }
 #endif /* !defined(CONFIG_USER_ONLY) */
 
+/* Returns with tb_lock held, the caller translates again and leaves the
+   execution loop, which releases it.  */
 void tb_check_watchpoint(CPUState *cpu)
 {
     TranslationBlock *tb;
 
+    tb_lock_entry();
     tb = tb_find_pc(cpu->mem_io_pc);
     if (tb) {
         /* We can use retranslation to find the PC.  */
@@ -1595,6 +1900,8 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     target_ulong pc, cs_base;
     uint64_t flags;
 
+    /* released when leaving the execution loop */
+    tb_lock_entry();
     tb = tb_find_pc(retaddr);
     if (!tb) {
         cpu_abort(cpu, "cpu_io_recompile: could not find TB for pc=%p",
@@ -1671,52 +1978,70 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
 
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    size_t host_code_size, host_code_max;
+    struct qht_stats hst;
     TranslationBlock *tb;
+    TBRegion *r;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    host_code_size = 0;
+    host_code_max = 0;
+    for (j = 0; j < tcg_ctx.tb_ctx.nb_regions; j++) {
+        r = &tcg_ctx.tb_ctx.regions[j];
+        host_code_size += (j == tcg_ctx.tb_ctx.cur_region
+                           ? tcg_ctx.code_gen_ptr : r->code_ptr)
+                          - r->code_start;
+        host_code_max += r->code_end - r->code_start;
+        for (i = r->tb_start; i < r->tb_start + r->nb_tbs; i++) {
+            tb = &tcg_ctx.tb_ctx.tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_highwater - tcg_ctx.code_gen_buffer);
+    cpu_fprintf(f, "gen code size       %zd/%zd\n",
+                host_code_size, host_code_max);
     cpu_fprintf(f, "TB count            %d/%d\n",
             tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
+    cpu_fprintf(f, "code regions        %d (current %d)\n",
+            tcg_ctx.tb_ctx.nb_regions, tcg_ctx.tb_ctx.cur_region);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
             tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zd bytes (expansion ratio: %0.1f)\n",
+            tcg_ctx.tb_ctx.nb_tbs ? host_code_size /
+                                    tcg_ctx.tb_ctx.nb_tbs : 0,
+                target_code_size ? (double) host_code_size /
+                                            target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
+    qht_statistics(&tcg_ctx.tb_ctx.htable, &hst);
+    cpu_fprintf(f, "TB hash buckets     %zu/%zu (%0.2f%% head buckets used)\n",
+                hst.used_head_buckets, hst.head_buckets,
+                hst.head_buckets ?
+                (double)hst.used_head_buckets / hst.head_buckets * 100 : 0);
+    cpu_fprintf(f, "TB hash chains      avg %0.2f max %zu buckets\n",
+                hst.avg_chain, hst.max_chain);
     cpu_fprintf(f, "direct jump count   %d (%d%%) (2 jumps=%d %d%%)\n",
                 direct_jmp_count,
                 tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp_count * 100) /
@@ -1726,6 +2051,8 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                         tcg_ctx.tb_ctx.nb_tbs : 0);
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d\n",
+            tcg_ctx.tb_ctx.tb_region_evict_count);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
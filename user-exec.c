@@ -23,6 +23,7 @@
 #include "qemu/bitops.h"
 #include "exec/cpu_ldst.h"
 #include "translate-all.h"
+#include "exec/helper-proto.h"
 
 #undef EAX
 #undef ECX
@@ -675,3 +676,77 @@ int cpu_signal_handler(int host_signum, void *pinfo,
 #error host CPU specific signal handler needed
 
 #endif
+
+/* Host address of an atomic operation of the guest, or NULL if it must
+   take the slow path because it is unaligned.  The guest threads run
+   concurrently, so the fault of an unmapped address is raised here rather
+   than from the signal handler, which could not tell where the helper
+   was called from.  */
+void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                        TCGMemOpIdx oi, int size, uintptr_t retaddr)
+{
+    if (page_check_range(addr, size, PAGE_READ | PAGE_WRITE) < 0) {
+        CPUState *cpu = ENV_GET_CPU(env);
+        CPUClass *cc = CPU_GET_CLASS(cpu);
+
+        cpu_restore_state(cpu, retaddr - GETPC_ADJ);
+        cc->handle_mmu_fault(cpu, addr, 1, get_mmuidx(oi));
+        exception_action(cpu);
+    }
+    if (addr & (size - 1)) {
+        return NULL;
+    }
+    return g2h(addr);
+}
+
+uint64_t atomic_slow_ld(CPUArchState *env, target_ulong addr,
+                        TCGMemOpIdx oi, int size, bool be, uintptr_t retaddr)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = 0; i < size; i++) {
+        uint64_t b = ldub_p(g2h(addr + i));
+
+        val |= b << (8 * (be ? size - 1 - i : i));
+    }
+    return val;
+}
+
+void atomic_slow_st(CPUArchState *env, target_ulong addr, uint64_t val,
+                    TCGMemOpIdx oi, int size, bool be, uintptr_t retaddr)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        stb_p(g2h(addr + i), val >> (8 * (be ? size - 1 - i : i)));
+    }
+}
+
+#define SHIFT 0
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 1
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 1
+#define ATOMIC_BE 1
+#include "atomic_template.h"
+
+#define SHIFT 2
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 2
+#define ATOMIC_BE 1
+#include "atomic_template.h"
+
+#define SHIFT 3
+#define ATOMIC_BE 0
+#include "atomic_template.h"
+
+#define SHIFT 3
+#define ATOMIC_BE 1
+#include "atomic_template.h"
@@ -0,0 +1,272 @@
+/*
+ * Resizable hash table with RCU-safe lookups
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <glib.h>
+#include "qemu/qht.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+#include "qemu/rcu.h"
+
+/* The table is an array of head buckets, each holding a few entries and
+ * a chain of overflow buckets.  A bucket fills one cache line, so that a
+ * lookup usually touches a single line: the hashes are compared first and
+ * the entry is only dereferenced when they match.
+ *
+ * Readers run concurrently with a single writer.  An entry is published
+ * by writing its hash and then its pointer, and removed by clearing the
+ * pointer; a reader can thus see a stale hash next to a valid pointer, but
+ * the lookup function always checks the entry itself.  Overflow buckets
+ * and replaced maps are freed after an RCU grace period.
+ */
+#define QHT_BUCKET_ALIGN 64
+
+#if HOST_LONG_BITS == 32
+#define QHT_BUCKET_ENTRIES 6
+#else
+#define QHT_BUCKET_ENTRIES 4
+#endif
+
+/* the table doubles when it is more than half full */
+#define QHT_MAX_LOAD_NUM 1
+#define QHT_MAX_LOAD_DEN 2
+
+struct qht_bucket {
+    uint32_t hashes[QHT_BUCKET_ENTRIES];
+    void *pointers[QHT_BUCKET_ENTRIES];
+    struct qht_bucket *next;
+} __attribute__((aligned(QHT_BUCKET_ALIGN)));
+
+struct qht_map {
+    struct rcu_head rcu;
+    struct qht_bucket *buckets;
+    size_t n_buckets;
+};
+
+static struct qht_bucket *qht_bucket_new(size_t n)
+{
+    struct qht_bucket *b;
+
+    b = qemu_memalign(QHT_BUCKET_ALIGN, n * sizeof(struct qht_bucket));
+    memset(b, 0, n * sizeof(struct qht_bucket));
+    return b;
+}
+
+static struct qht_map *qht_map_new(size_t n_elems)
+{
+    struct qht_map *map = g_new(struct qht_map, 1);
+
+    map->n_buckets = pow2ceil(MAX(n_elems / QHT_BUCKET_ENTRIES, 1));
+    map->buckets = qht_bucket_new(map->n_buckets);
+    return map;
+}
+
+static void qht_map_destroy(struct qht_map *map)
+{
+    struct qht_bucket *b, *next;
+    size_t i;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        for (b = map->buckets[i].next; b; b = next) {
+            next = b->next;
+            qemu_vfree(b);
+        }
+    }
+    qemu_vfree(map->buckets);
+    g_free(map);
+}
+
+/* Replace the map of the table, the readers may still be walking the old
+ * one until the end of the grace period.  */
+static void qht_map_publish(struct qht *ht, struct qht_map *map)
+{
+    struct qht_map *old = ht->map;
+
+    atomic_rcu_set(&ht->map, map);
+    call_rcu(old, qht_map_destroy, rcu);
+}
+
+static inline struct qht_bucket *qht_map_head(struct qht_map *map,
+                                              uint32_t hash)
+{
+    return &map->buckets[hash & (map->n_buckets - 1)];
+}
+
+static bool qht_map_insert(struct qht_map *map, void *p, uint32_t hash)
+{
+    struct qht_bucket *b, *prev = NULL, *free_b = NULL;
+    int i, free_i = 0;
+
+    for (b = qht_map_head(map, hash); b; b = b->next) {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i] == p) {
+                return false;
+            }
+            if (b->pointers[i] == NULL && free_b == NULL) {
+                free_b = b;
+                free_i = i;
+            }
+        }
+        prev = b;
+    }
+
+    if (free_b == NULL) {
+        b = qht_bucket_new(1);
+        b->hashes[0] = hash;
+        b->pointers[0] = p;
+        atomic_rcu_set(&prev->next, b);
+        return true;
+    }
+    atomic_set(&free_b->hashes[free_i], hash);
+    atomic_rcu_set(&free_b->pointers[free_i], p);
+    return true;
+}
+
+void qht_init(struct qht *ht, size_t n_elems)
+{
+    ht->map = qht_map_new(n_elems);
+    ht->n_entries = 0;
+}
+
+void qht_destroy(struct qht *ht)
+{
+    qht_map_destroy(ht->map);
+    ht->map = NULL;
+}
+
+void qht_resize(struct qht *ht, size_t n_elems)
+{
+    struct qht_map *old = ht->map;
+    struct qht_map *map = qht_map_new(n_elems);
+    struct qht_bucket *b;
+    size_t i;
+    int j;
+
+    for (i = 0; i < old->n_buckets; i++) {
+        for (b = &old->buckets[i]; b; b = b->next) {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (b->pointers[j]) {
+                    qht_map_insert(map, b->pointers[j], b->hashes[j]);
+                }
+            }
+        }
+    }
+    qht_map_publish(ht, map);
+}
+
+bool qht_insert(struct qht *ht, void *p, uint32_t hash)
+{
+    struct qht_map *map = ht->map;
+
+    if (!qht_map_insert(map, p, hash)) {
+        return false;
+    }
+    ht->n_entries++;
+    if (ht->n_entries * QHT_MAX_LOAD_DEN >
+        map->n_buckets * QHT_BUCKET_ENTRIES * QHT_MAX_LOAD_NUM) {
+        qht_resize(ht, map->n_buckets * QHT_BUCKET_ENTRIES * 2);
+    }
+    return true;
+}
+
+void *qht_lookup(struct qht *ht, qht_lookup_func_t func, const void *userp,
+                 uint32_t hash)
+{
+    struct qht_map *map = atomic_rcu_read(&ht->map);
+    struct qht_bucket *b = qht_map_head(map, hash);
+    void *p;
+    int i;
+
+    do {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (atomic_read(&b->hashes[i]) == hash) {
+                p = atomic_rcu_read(&b->pointers[i]);
+                if (p && func(p, userp)) {
+                    return p;
+                }
+            }
+        }
+        b = atomic_rcu_read(&b->next);
+    } while (b);
+    return NULL;
+}
+
+bool qht_remove(struct qht *ht, const void *p, uint32_t hash)
+{
+    struct qht_bucket *b;
+    int i;
+
+    for (b = qht_map_head(ht->map, hash); b; b = b->next) {
+        for (i = 0; i < QHT_BUCKET_ENTRIES; i++) {
+            if (b->pointers[i] == p) {
+                atomic_set(&b->pointers[i], NULL);
+                ht->n_entries--;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void qht_reset(struct qht *ht)
+{
+    if (ht->n_entries == 0) {
+        return;
+    }
+    qht_map_publish(ht, qht_map_new(ht->map->n_buckets * QHT_BUCKET_ENTRIES));
+    ht->n_entries = 0;
+}
+
+void qht_iter(struct qht *ht, qht_iter_func_t func, void *userp)
+{
+    struct qht_map *map = ht->map;
+    struct qht_bucket *b;
+    size_t i;
+    int j;
+
+    for (i = 0; i < map->n_buckets; i++) {
+        for (b = &map->buckets[i]; b; b = b->next) {
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (b->pointers[j]) {
+                    func(ht, b->pointers[j], b->hashes[j], userp);
+                }
+            }
+        }
+    }
+}
+
+void qht_statistics(struct qht *ht, struct qht_stats *stats)
+{
+    struct qht_map *map = ht->map;
+    struct qht_bucket *b;
+    size_t i, chain, chains = 0;
+    bool used;
+    int j;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->head_buckets = map->n_buckets;
+    for (i = 0; i < map->n_buckets; i++) {
+        used = false;
+        chain = 0;
+        for (b = &map->buckets[i]; b; b = b->next) {
+            chain++;
+            for (j = 0; j < QHT_BUCKET_ENTRIES; j++) {
+                if (b->pointers[j]) {
+                    used = true;
+                    stats->entries++;
+                }
+            }
+        }
+        if (used) {
+            stats->used_head_buckets++;
+            chains += chain;
+            stats->max_chain = MAX(stats->max_chain, chain);
+        }
+    }
+    stats->avg_chain = stats->used_head_buckets
+                       ? (double)chains / stats->used_head_buckets : 0;
+}
@@ -27,6 +27,7 @@
 
 #ifdef CONFIG_FLEXUS
 #include "libqemuflex/flexus_proxy.h"
+#include "libqemuflex/trace_record.h"
 
 char* sim_path = NULL;
 int timing_mode = 0;
@@ -43,8 +44,6 @@ extern int64_t flexus_simulation_length;
 #include <libvdeplug.h>
 #endif
 
-sig_atomic_t quantum_value;
-
 #ifdef CONFIG_SDL
 #if defined(__APPLE__) || defined(main)
 #include <SDL.h>
@@ -131,6 +130,8 @@ int main(int argc, char **argv)
 #include "crypto/init.h"
 #include "sysemu/replay.h"
 #include "qapi/qmp/qerror.h"
+#include "migration/checkpoint.h"
+#include "qapi/util.h"
 
 #define MAX_VIRTIO_CONSOLES 1
 #define MAX_SCLP_CONSOLES 1
@@ -539,6 +540,64 @@ static QemuOptsList qemu_fw_cfg_opts = {
     },
 };
 
+#ifdef CONFIG_FLEXUS
+static QemuOptsList qemu_flexus_bench_opts = {
+    .name = "flexus-bench",
+    .head = QTAILQ_HEAD_INITIALIZER(qemu_flexus_bench_opts.head),
+    .desc = {
+        {
+            .name = "instructions",
+            .type = QEMU_OPT_NUMBER,
+        }, {
+            .name = "file",
+            .type = QEMU_OPT_STRING,
+        }, {
+            .name = "modes",
+            .type = QEMU_OPT_STRING,
+        },
+        { /* end of list */ }
+    },
+};
+
+/* Start the benchmark of -flexus-bench, the modes are separated by ':' */
+static void flexus_bench_start(QemuOpts *opts)
+{
+    const char *modes_str = qemu_opt_get(opts, "modes");
+    FlexusBenchModeList *modes = NULL, **tail = &modes;
+    Error *err = NULL;
+
+    if (modes_str) {
+        char **names = g_strsplit(modes_str, ":", 0);
+        int i;
+
+        for (i = 0; names[i] && !err; i++) {
+            int mode = qapi_enum_parse(FlexusBenchMode_lookup, names[i],
+                                       FLEXUS_BENCH_MODE__MAX, -1, &err);
+            if (mode >= 0) {
+                *tail = g_new0(FlexusBenchModeList, 1);
+                (*tail)->value = mode;
+                tail = &(*tail)->next;
+            }
+        }
+        g_strfreev(names);
+    }
+    if (!err) {
+        if (!qemu_opt_get(opts, "file")) {
+            error_setg(&err, "-flexus-bench needs a file");
+        } else {
+            qmp_flexus_bench(qemu_opt_get_number(opts, "instructions", 0),
+                             qemu_opt_get(opts, "file"), modes != NULL, modes,
+                             &err);
+        }
+    }
+    qapi_free_FlexusBenchModeList(modes);
+    if (err) {
+        error_report_err(err);
+        exit(1);
+    }
+}
+#endif /* CONFIG_FLEXUS */
+
 /**
  * Get machine options
  *
@@ -3003,10 +3062,15 @@ int main(int argc, char **argv, char **envp)
     DisplayState *ds;
     int cyls, heads, secs, translation;
     QemuOpts *hda_opts = NULL, *opts, *machine_opts, *icount_opts = NULL;
+#ifdef CONFIG_FLEXUS
+    QemuOpts *flexus_bench_opts = NULL;
+    const char *flexus_trace_record_file = NULL;
+#endif
     QemuOptsList *olist;
     int optind;
     const char *optarg;
     const char *loadvm = NULL;
+    const char *loadcpt = NULL;
     const char *quantum_opt = NULL;
     MachineClass *machine_class;
     const char *cpu_model;
@@ -3066,6 +3130,9 @@ int main(int argc, char **argv, char **envp)
     qemu_add_opts(&qemu_icount_opts);
     qemu_add_opts(&qemu_semihosting_config_opts);
     qemu_add_opts(&qemu_fw_cfg_opts);
+#ifdef CONFIG_FLEXUS
+    qemu_add_opts(&qemu_flexus_bench_opts);
+#endif
     module_call_init(MODULE_INIT_OPTS);
 
     runstate_init();
@@ -3630,6 +3697,15 @@ int main(int argc, char **argv, char **envp)
 	      }
 	      flexus_simulation_length = atol(optarg);
 	      break;
+	    case QEMU_OPTION_flexus_bench:
+	      flexus_bench_opts = qemu_opts_parse_noisily(qemu_find_opts("flexus-bench"),
+	                                                  optarg, false);
+	      if( !flexus_bench_opts )
+		exit(1);
+	      break;
+	    case QEMU_OPTION_flexus_trace_record:
+	      flexus_trace_record_file = optarg;
+	      break;
 #endif /* CONFIG_FLEXUS */
 
             case QEMU_OPTION_watchdog:
@@ -3670,6 +3746,9 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_loadvm:
                 loadvm = optarg;
                 break;
+            case QEMU_OPTION_loadcpt:
+                loadcpt = optarg;
+                break;
             case QEMU_OPTION_full_screen:
                 full_screen = 1;
                 break;
@@ -3925,6 +4004,9 @@ int main(int argc, char **argv, char **envp)
                 }
                 configure_rtc(opts);
                 break;
+            case QEMU_OPTION_tcg_threads:
+                qemu_tcg_configure(optarg, &error_fatal);
+                break;
             case QEMU_OPTION_tb_size:
                 tcg_tb_size = strtol(optarg, NULL, 0);
                 if (tcg_tb_size < 0) {
@@ -4467,6 +4549,27 @@ int main(int argc, char **argv, char **envp)
         qemu_opts_del(icount_opts);
     }
 
+    if (qemu_tcg_mttcg_enabled()) {
+        if (!tcg_enabled()) {
+            error_report("-tcg-threads multi requires TCG");
+            exit(1);
+        }
+        if (use_icount || replay_mode != REPLAY_MODE_NONE) {
+            error_report("-tcg-threads multi is not allowed with -icount "
+                         "or record/replay");
+            exit(1);
+        }
+#ifdef CONFIG_FLEXUS
+        /* the instrumentation expects the vCPUs to run in turn */
+        if (sim_path != NULL || timing_mode || flexus_is_simulating ||
+            flexus_bench_opts != NULL || flexus_trace_record_file != NULL) {
+            error_report("-tcg-threads multi is not allowed with the "
+                         "Flexus simulation, timing or tracing options");
+            exit(1);
+        }
+#endif
+    }
+
     /* clean up network at qemu process termination */
     atexit(&net_cleanup);
 
@@ -4700,13 +4803,26 @@ int main(int argc, char **argv, char **envp)
             exit(1);
 	}	
     }
+    if (loadcpt) {
+        char *dir = g_strdup(loadcpt);
+        char *index = strrchr(dir, ':');
+
+        if (!index) {
+            error_report("-loadcpt expects dir:index");
+            exit(1);
+        }
+        *index++ = 0;
+        if (checkpoint_load(dir, atoi(index), &err) < 0) {
+            error_report_err(err);
+            exit(1);
+        }
+        g_free(dir);
+    }
     if (quantum_opt) {
-        quantum_value = atoi(quantum_opt);
-        if (quantum_value < 0)
-            quantum_value = 0;
+        qemu_set_quantum(atoi(quantum_opt));
     }
     else
-        quantum_value = 0;
+        qemu_set_quantum(0);
 
     qdev_prop_check_globals();
     if (vmstate_dump_file) {
@@ -4743,6 +4859,12 @@ int main(int argc, char **argv, char **envp)
 
     free(hooks);
 
+    if( flexus_bench_opts != NULL )
+      flexus_bench_start(flexus_bench_opts);
+
+    if( flexus_trace_record_file != NULL )
+      qmp_flexus_trace_record_start(flexus_trace_record_file, &error_fatal);
+
     // trigger the periodic event
     QEMU_execute_callbacks(-1, 0, 0);
 #endif
@@ -4752,6 +4874,9 @@ int main(int argc, char **argv, char **envp)
 
     bdrv_close_all();
     pause_all_vcpus();
+#ifdef CONFIG_FLEXUS
+    QEMU_trace_record_exit();
+#endif
     res_free();
 #ifdef CONFIG_TPM
     tpm_cleanup();